@@ -3,10 +3,12 @@
 
 #include <algorithm>
 #include <boost/numeric/conversion/cast.hpp>
+#include <dcgp/expression.hpp>
 #include <pagmo/types.hpp>
 #include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
+#include <string>
 #include <vector>
 
 #include "python_includes.hpp"
@@ -23,6 +25,36 @@ namespace dcgpy
     throw py::error_already_set();
 }
 
+// Converts the name of the floating point rules of an expression (see dcgp::expression::set_fp_rules()) to the
+// rules.
+template <typename T>
+inline typename dcgp::expression<T>::fp_rules str_to_fp_rules(const std::string &rules)
+{
+    if (rules == "exact") {
+        return dcgp::expression<T>::fp_rules::exact;
+    } else if (rules == "fast") {
+        return dcgp::expression<T>::fp_rules::fast;
+    } else if (rules != "none") {
+        py_throw(PyExc_ValueError,
+                 ("The floating point rules were: " + rules + " while only exact, fast and none are allowed").c_str());
+    }
+    return dcgp::expression<T>::fp_rules::none;
+}
+
+// Converts the floating point rules of an expression to their name.
+template <typename T>
+inline std::string fp_rules_to_str(typename dcgp::expression<T>::fp_rules rules)
+{
+    switch (rules) {
+        case dcgp::expression<T>::fp_rules::exact:
+            return "exact";
+        case dcgp::expression<T>::fp_rules::fast:
+            return "fast";
+        default:
+            return "none";
+    }
+}
+
 // Perform a deep copy of input object o.
 inline py::object deepcopy(const py::object &o)
 {
@@ -177,6 +177,35 @@ Unsets the phenotype correction.
 )";
 }
 
+std::string expression_set_fp_rules_doc()
+{
+    return R"(set_fp_rules(rules)
+
+Sets the floating point rules of the simplified evaluation of a double expression.
+
+The expression is evaluated over a simplified active graph: the nodes of the built-in kernels reading only
+ephemeral constants are folded to their value and some algebraic identities reduce a node to one of its operands,
+to a constant or to fewer operands. With "exact" (the default) only the identities holding for all floats are used,
+so that the results are unchanged. "fast" also uses x+0, x*0, x-x and x/x, assuming finite values and ignoring the
+sign of zero, and evaluates sig, tanh, exp and gaussian over many points with vector instructions, whose
+results may differ in the last bits. "none" evaluates every active node. The rules only affect the evaluation of double expressions.
+
+Args:
+    rules (``str``): the floating point rules, one of "exact", "fast" or "none".
+
+Raises:
+    ValueError: if *rules* is not one of "exact", "fast" or "none".
+
+Examples:
+
+>>> import dcgpy
+>>> ex = dcgpy.expression_double(1,1,1,10,11,2,dcgpy.kernel_set_double(["sum","diff","mul","div"])(), 0, 33)
+>>> ex.set_fp_rules("fast")
+>>> ex.get_fp_rules()
+'fast'
+)";
+}
+
 std::string expression_loss_doc()
 {
     return R"(loss(points, labels, loss_type)
@@ -428,7 +457,7 @@ Args:
     lr (``float``): the learning generate
     batch_size (``int``): the batch size
     loss_type (``str``): the loss, one of "MSE" for Mean Square Error and "CE" for Cross-Entropy.
-    parallel (``int``): sets the grain for parallelism. 0 -> no parallelism n -> divides the data into n parts and processes them in parallel threads 
+    parallel (``int``): sets the grain for parallelism. 0 -> no parallelism n -> divides the data into n (roughly equal) parts and processes them in parallel threads 
     shuffle (``bool``): when True it shuffles the points and labels before performing one epoch of training.
 
 
@@ -1142,12 +1171,17 @@ the model computational graph). The instantiated object can be used as UDP (User
 The symbolic regression problem can be instantiated both as a single and as a two-objectives problem. In the second
 case, aside the chosen loss on the data, the model complexity will be considered as an objective.
 
+.. note::
+    When evaluating mutants, as in :class:`dcgpy.es4cgp`, each thread keeps the outputs over the data of the active
+    nodes of the parents last used, up to 2^23 floats (64 MB) per thread. The mutants of a parent whose outputs exceed
+    this budget are evaluated from scratch.
+
     )";
 }
 
 std::string symbolic_regression_init_doc()
 {
-    return R"(symbolic_regression(points, labels, rows = 1, columns=16, levels_back=17, arity=2, kernels, n_eph=0, multi_objective=False, parallel_batches=0, loss="MSE")
+    return R"(symbolic_regression(points, labels, rows = 1, columns=16, levels_back=17, arity=2, kernels, n_eph=0, multi_objective=False, parallel_batches=0, loss="MSE", gradient="forward")
 
 Constructs a symbolic_regression optimization problem compatible with the pagmo UDP interface.
 
@@ -1163,6 +1197,8 @@ Args:
     multi_objective (``bool``): when True the problem will be considered as multiobjective (loss and model complexity).
     parallel_batches (``int``): allows to split the data into batches for parallel evaluation.
     loss (``str``): loss type used, one of "MSE" (for mean squared error) or "CE" (for cross entropy).
+    gradient (``str``): differentiation mode of the gradient, one of "forward" (generalized duals) or "reverse"
+      (one backward sweep, whatever the number of ephemeral constants, available for built-in kernels only).
 
 Raises:
     unspecified: any exception thrown by failures at the intersection between C++ and Python (e.g.,
@@ -1233,6 +1269,23 @@ Raises:
 )";
 }
 
+std::string symbolic_regression_set_fp_rules_doc()
+{
+    return R"(set_fp_rules(rules)
+
+Sets the floating point rules (see :func:`dcgpy.expression_double.set_fp_rules()`) of the double expression used
+to compute the loss. With "fast" the loss is always computed evaluating the whole simplified expression, so that the
+evaluations reusing the outputs of the nodes of a parent or the subtrees shared among a batch are not used. The
+gradient and the hessians are not affected.
+
+Args:
+    rules (``str``): the floating point rules, one of "exact", "fast" or "none".
+
+Raises:
+    ValueError: if *rules* is not one of "exact", "fast" or "none".
+)";
+}
+
 std::string generic_set_bfe_doc()
 {
     return R"(set_bfe(b)
@@ -1319,13 +1372,15 @@ constructed with a :class:`~dcgpy.es4cgp`. A verbosity of ``N`` implies a log
 line each ``N`` generations.
 
 Returns:
-    ``list`` of ``tuples``: at each logged epoch, the values ``Gen``, ``Fevals``, ``Current best``, ``Best``, where:
+    ``list`` of ``tuples``: at each logged epoch, the values ``Gen``, ``Fevals``, ``Best``, ``Constants``, ``Model``,
+    ``Skipped``, where:
 
     * ``Gen`` (``int``), generation number.
     * ``Fevals`` (``int``), number of functions evaluation made.
     * ``Best`` (``float``), the best fitness found.
     * ``Constants`` (``list``), the current values for the ephemeral constants.
-    * ``Model`` (``string``), the string representation of the current best model
+    * ``Model`` (``string``), the string representation of the current best model.
+    * ``Skipped`` (``int``), number of evaluations skipped as the mutant expressed the same model as its parent
 Examples:
     >>> import dcgpy
     >>> from pygmo import *
@@ -1336,22 +1391,13 @@ Examples:
     >>> pop = population(udp, 4)
     >>> algo.set_verbosity(200)
     >>> pop = algo.evolve(pop) # doctest: +SKIP
-    Gen:        Fevals:          Best:   Constants:   Model:
-       0              0        7398.14   [-1.22497]   [x0*c1**2 + c1**2] ...
-     200            800        233.979   [-1.34118]   [x0*(x0 - x0**2 + x0**3 + (x0 - x0**2)** ...
-     400           1600        4.26131   [-1.15376]   [x0*(x0 + x0*(c1 + x0**2) - x0**2 + (x0  ...
-     600           2400        4.26126   [-1.15198]   [x0*(x0 + x0*(c1 + x0**2) - x0**2 + (x0  ...
-     800           3200        4.26126   [-1.15198]   [x0*(x0 + x0*(c1 + x0**2) - x0**2 + (x0  ...
-    1000           4000        4.26126   [-1.15198]   [x0*(x0 + x0*(c1 + x0**2) - x0**2 + (x0  ...
-    1200           4800        4.26126   [-1.15198]   [x0*(x0 + x0*(c1 + x0**2) - x0**2 + (x0  ...
-    1400           5600        4.26126   [-1.15198]   [x0*(x0 + x0*(c1 + x0**2) - x0**2 + (x0  ...
-    1600           6400       0.664691   [-1.12614]   [x0*(x0 + x0*(c1 + x0**2) - (c1 + x0**2) ...
-    1800           7200       0.664691   [-1.12614]   [x0*(x0 + x0*(c1 + x0**2) - (c1 + x0**2) ...
-    2000           8000       0.664689   [-1.12548]   [x0*(x0 + x0*(c1 + x0**2) - (c1 + x0**2) ...
+    Gen:        Fevals:       Skipped:          Best:   Constants:   Model:
+       0              0              0        7398.14   [-1.22497]   [x0*c1**2 + c1**2] ...
+    ...
     Exit condition -- generations = 2000
     >>> uda = algo.extract(dcgpy.es4cgp)
     >>> uda.get_log() # doctest: +SKIP
-    [(0, 0, 7398.139620548432, array([-1.22496858]), '[x0*c1**2 + c1**2]'), ...
+    [(0, 0, 7398.139620548432, array([-1.22496858]), '[x0*c1**2 + c1**2]', 0), ...
 
 See also the docs of the relevant C++ method :cpp:func:`dcgp::es4cgp::get_log()`.
 )";
@@ -1406,13 +1452,15 @@ constructed with a :class:`~dcgpy.moes4cgp`. A verbosity of ``N`` implies a log
 line each ``N`` generations.
 
 Returns:
-    ``list`` of ``tuples``: at each logged epoch, the values ``Gen``, ``Fevals``, ``Current best``, ``Best``, where:
+    ``list`` of ``tuples``: at each logged epoch, the values ``Gen``, ``Fevals``, ``Best loss``, ``Ndf size``,
+    ``Compl.``, ``Skipped``, where:
 
     * ``Gen`` (``int``), generation number.
     * ``Fevals`` (``int``), number of functions evaluation made.
     * ``Best loss`` (``float``), the best fitness found.
     * ``Ndf size`` (``int``), number of models in the non dominated front.
-    * ``Compl.`` (``in``), minimum complexity across the models in the non dominated front.
+    * ``Compl.`` (``int``), the largest complexity in the population.
+    * ``Skipped`` (``int``), number of evaluations skipped as the mutant expressed the same model as its parent.
 Examples:
     >>> import dcgpy
     >>> from pygmo import *
@@ -1423,26 +1471,13 @@ Examples:
     >>> pop = population(udp, 100)
     >>> algo.set_verbosity(10)
     >>> pop = algo.evolve(pop) # doctest: +SKIP
-    Gen:        Fevals:     Best loss: Ndf size:   Compl.:
-       0              0        6.07319         3        92
-      10           1000        2.15419         5        10
-      20           2000        1.92403         8        33
-      30           3000       0.373663        12        72
-      40           4000        0.36954        13        72
-      50           5000       0.235749        16        73
-      60           6000       0.235749        12        73
-      70           7000       0.235749        13        73
-      80           8000       0.217968        12        75
-      90           9000       0.217968        12        75
-     100          10000       0.217968        12        75
-     110          11000       0.217968        14        75
-     120          12000       0.217968        14        75
-     130          13000       0.217968        13        75
-     140          14000       0.162293        12        52
+    Gen:        Fevals:       Skipped:     Best loss: Ndf size:   Compl.:
+       0              0              0        6.07319         3        92
+    ...
     Exit condition -- generations = 140
     >>> uda = algo.extract(dcgpy.moes4cgp)
     >>> uda.get_log() # doctest: +SKIP
-    [(0, 0, 6.0731942123423, 3, 92), ...
+    [(0, 0, 6.0731942123423, 3, 92, 0), ...
 
 See also the docs of the relevant C++ method :cpp:func:`dcgp::moes4cgp::get_log()`.
 )";
@@ -1553,6 +1588,10 @@ outlined by the following pseudo-algorithm:
 .. note::
     MES4CGP is tailored to solve :class:`dcgpy.symbolic_regression` problems and will not work on different types.
 
+.. note::
+    The gradient and the hessians used by the Newton step are computed together with the loss by the UDP, bypassing
+    the problem: they are not counted by :func:`~pygmo.problem.get_gevals()` and :func:`~pygmo.problem.get_hevals()`.
+
 Args:
     gen (``int``): number of generations.
     max_mut (``int``): number of active genes to be mutated.
@@ -1640,6 +1679,10 @@ outlined by the following pseudo-algorithm:
 .. note::
     MOMES4CGP is tailored to solve :class:`dcgpy.symbolic_regression` problems and will not work on different types.
 
+.. note::
+    As in :class:`dcgpy.mes4cgp`, the gradient and the hessians used by the Newton step are not counted by
+    :func:`~pygmo.problem.get_gevals()` and :func:`~pygmo.problem.get_hevals()`.
+
 Args:
     gen (``int``): number of generations.
     max_mut (``int``): maximum number of active genes to be mutated.
@@ -23,6 +23,7 @@ std::string expression_mutate_doc();
 std::string expression_loss_doc();
 std::string expression_set_phenotype_correction_doc();
 std::string expression_unset_phenotype_correction_doc();
+std::string expression_set_fp_rules_doc();
 
 
 // expression_weighted
@@ -46,6 +47,7 @@ std::string expression_ann_sgd_doc();
 std::string symbolic_regression_doc();
 std::string symbolic_regression_init_doc();
 std::string symbolic_regression_predict_doc();
+std::string symbolic_regression_set_fp_rules_doc();
 
 // UDAs
 std::string generic_set_bfe_doc();
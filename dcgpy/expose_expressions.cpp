@@ -59,7 +59,8 @@ void expose_expression(const py::module &m, std::string type)
         .def(
             "__call__", [](const expression<T> &instance, const std::vector<std::string> &v) { return instance(v); },
             "Call operator from strings")
-        .def("set", &expression<T>::set, expression_set_doc().c_str(), py::arg("chromosome"))
+        .def("set", static_cast<void (expression<T>::*)(const std::vector<unsigned> &)>(&expression<T>::set),
+             expression_set_doc().c_str(), py::arg("chromosome"))
         .def("set_f_gene", &expression<T>::set_f_gene, expression_set_f_gene_doc().c_str(), py::arg("node_id"),
              py::arg("f_id"))
         .def("get", &expression<T>::get, "Gets the expression chromosome")
@@ -112,6 +113,13 @@ void expose_expression(const py::module &m, std::string type)
             expression_set_phenotype_correction_doc().c_str(), py::arg("pc"))
         .def("unset_phenotype_correction", &expression<T>::unset_phenotype_correction,
              expression_unset_phenotype_correction_doc().c_str())
+        .def(
+            "set_fp_rules",
+            [](expression<T> &instance, const std::string &rules) { instance.set_fp_rules(str_to_fp_rules<T>(rules)); },
+            expression_set_fp_rules_doc().c_str(), py::arg("rules"))
+        .def(
+            "get_fp_rules", [](const expression<T> &instance) { return fp_rules_to_str<T>(instance.get_fp_rules()); },
+            "get_fp_rules()\nGets the floating point rules of the simplified evaluation")
         // The parallelism for the loss computation is switched off in python as pythonic kernels would
         // produce a crash if evaluated in multiple threads.
         .def(
@@ -72,26 +72,35 @@ void expose_symbolic_regression(py::module &m)
     py::class_<dcgp::symbolic_regression> sr_(m, "symbolic_regression", symbolic_regression_doc().c_str());
     sr_.def(py::init<>())
         // Constructor from list of lists
-        .def(py::init<const std::vector<std::vector<double>> &, const std::vector<std::vector<double>> &, unsigned,
-                      unsigned, unsigned, unsigned, const std::vector<kernel<double>> &, unsigned, bool, unsigned,
-                      std::string>(),
+        .def(py::init([](const std::vector<std::vector<double>> &points,
+                         const std::vector<std::vector<double>> &labels, unsigned rows, unsigned cols,
+                         unsigned levels_back, unsigned arity, const std::vector<kernel<double>> &kernels,
+                         unsigned n_eph, bool multi_objective, unsigned parallel_batches, std::string loss,
+                         std::string gradient) {
+                 return ::new dcgp::symbolic_regression(points, labels, rows, cols, levels_back, arity, kernels, n_eph,
+                                                        multi_objective, parallel_batches, loss,
+                                                        dcgp::random_device::next(), gradient);
+             }),
              py::arg("points"), py::arg("labels"), py::arg("rows") = 1, py::arg("cols") = 16,
              py::arg("levels_back") = 17, py::arg("arity") = 2, py::arg("kernels"), py::arg("n_eph") = 0u,
-             py::arg("multi_objective") = false, py::arg("parallel_batches") = 0u, py::arg("loss") = "MSE")
+             py::arg("multi_objective") = false, py::arg("parallel_batches") = 0u, py::arg("loss") = "MSE",
+             py::arg("gradient") = "forward")
         // Constructor from Numpy Arrays
         .def(
             py::init([](const py::array_t<double> &points, const py::array_t<double> &labels, unsigned rows,
                         unsigned cols, unsigned levels_back, unsigned arity, const std::vector<kernel<double>> &kernels,
-                        unsigned n_eph, bool multi_objective, unsigned parallel_batches, std::string loss) {
+                        unsigned n_eph, bool multi_objective, unsigned parallel_batches, std::string loss,
+                        std::string gradient) {
                 auto vvd_points = ndarr_to_vvector(points);
                 auto vvd_labels = ndarr_to_vvector(labels);
                 return ::new dcgp::symbolic_regression(vvd_points, vvd_labels, rows, cols, levels_back, arity, kernels,
-                                                       n_eph, multi_objective, parallel_batches, loss);
+                                                       n_eph, multi_objective, parallel_batches, loss,
+                                                       dcgp::random_device::next(), gradient);
             }),
             symbolic_regression_init_doc().c_str(), py::arg("points"), py::arg("labels"), py::arg("rows") = 1,
             py::arg("cols") = 16, py::arg("levels_back") = 17, py::arg("arity") = 2, py::arg("kernels"),
             py::arg("n_eph") = 0u, py::arg("multi_objective") = false, py::arg("parallel_batches") = 0u,
-            py::arg("loss") = "MSE")
+            py::arg("loss") = "MSE", py::arg("gradient") = "forward")
         .def("get_nobj", &dcgp::symbolic_regression::get_nobj)
         .def("get_cgp", &dcgp::symbolic_regression::get_cgp)
         .def("fitness", &dcgp::symbolic_regression::fitness)
@@ -131,6 +140,16 @@ void expose_symbolic_regression(py::module &m)
                  instance.set_phenotype_correction(pc,pc);
              })
         .def("unset_phenotype_correction", &symbolic_regression::unset_phenotype_correction)
+        .def(
+            "set_fp_rules",
+            [](dcgp::symbolic_regression &instance, const std::string &rules) {
+                instance.set_fp_rules(str_to_fp_rules<double>(rules));
+            },
+            symbolic_regression_set_fp_rules_doc().c_str(), py::arg("rules"))
+        .def(
+            "get_fp_rules",
+            [](const dcgp::symbolic_regression &instance) { return fp_rules_to_str<double>(instance.get_fp_rules()); },
+            "get_fp_rules()\nGets the floating point rules of the loss evaluation")
 
         .def(py::pickle(&udx_pickle_getstate<dcgp::symbolic_regression>,
                         &udx_pickle_setstate<dcgp::symbolic_regression>))
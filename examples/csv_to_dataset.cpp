@@ -0,0 +1,20 @@
+#include <iostream>
+
+#include <dcgp/dataset.hpp>
+
+using namespace dcgp;
+
+// Converts a dataset from the CSV layout read by dataset::from_csv into the binary format that can be
+// memory mapped with dataset::from_file.
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " input.csv output.bin" << std::endl;
+        return 1;
+    }
+    auto data = dataset::from_csv(argv[1]);
+    data.to_file(argv[2]);
+    std::cout << "Written " << data.size() << " points (n = " << data.get_n() << ", m = " << data.get_m()
+              << ") to " << argv[2] << std::endl;
+    return 0;
+}
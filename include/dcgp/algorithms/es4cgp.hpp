@@ -56,12 +56,17 @@ namespace dcgp
  * In this class we provide an evolutionary strategy tailored to solve :class:`dcgp::symbolic_regression` problems
  * leveraging the kowledge on the genetic structure of Cartesian Genetic Programs (i.e. able to mutate only active
  * genes).
+ *
+ * When no bfe is set, the mutants are evaluated with dcgp::symbolic_regression::race_fitness(), so that the
+ * evaluation of a mutant stops as soon as it is known to be worse than its parent, and only its nodes affected by
+ * the mutation are evaluated, the others being read from the node outputs of its parent.
  */
 class es4cgp
 {
 public:
-    /// Single entry of the log (gen, fevals, best, constants, formula)
-    typedef std::tuple<unsigned, unsigned long long, double, pagmo::vector_double, std::string> log_line_type;
+    /// Single entry of the log (gen, fevals, best, constants, formula, skipped)
+    typedef std::tuple<unsigned, unsigned long long, double, pagmo::vector_double, std::string, unsigned long long>
+        log_line_type;
     /// The log
     typedef std::vector<log_line_type> log_type;
 
@@ -110,6 +115,7 @@ public:
         auto NP = pop.size();
         auto fevals0 = prob.get_fevals(); // fevals already made
         auto count = 1u;                  // regulates the screen output
+        unsigned long long skipped = 0u;  // evaluations of neutral mutants skipped
         // We do not use directly the pagmo::problem::extract as otherwise we could not override it in the python
         // bindings. Using this global function, instead, allows its implementation to be overridden in the bindings.
         auto udp_ptr = details::extract_sr_cpp_py(prob);
@@ -148,11 +154,15 @@ public:
         auto mutated_eph_val = std::vector<double>(n_eph, 0.);
         // Normal distribution (to perturb the constants)
         std::normal_distribution<> normal{0., 1.};
-        // Uniform distribution (to pick the number of active mutations)
-        std::uniform_int_distribution<unsigned> dis(1u, m_max_mut);
         // A contiguous vector of chromosomes/fitness vectors is allocated here
         pagmo::vector_double dvs(NP * dim);
         pagmo::vector_double fs(NP * n_obj);
+        // Flags the mutants expressing the same phenotype as best_x (their fitness is not computed)
+        std::vector<bool> neutral(NP);
+        // Flags the mutants whose fitness is only a lower bound, as their evaluation was stopped early
+        std::vector<bool> raced(NP);
+        // The chromosomes of the non neutral mutants (contiguous, for pagmo::bfe)
+        pagmo::vector_double dvs_eval;
 
         // Main loop
         for (decltype(m_gen) gen = 1u; gen <= m_gen; ++gen) {
@@ -163,22 +173,18 @@ public:
                     // Every 50 lines print the column names
                     if (count % 50u == 1u) {
                         pagmo::print("\n", std::setw(7), "Gen:", std::setw(15), "Fevals:", std::setw(15),
-                                     "Best:", "\tConstants:", "\tModel:\n");
+                                     "Skipped:", std::setw(15), "Best:", "\tConstants:", "\tModel:\n");
                     }
                     auto formula = udp_ptr->prettier(best_x);
-                    log_single_line(gen - 1, prob.get_fevals() - fevals0, best_f, best_x, formula, n_eph);
+                    log_single_line(gen - 1, prob.get_fevals() - fevals0, skipped, best_f, best_x, formula, n_eph);
                     ++count;
                 }
             }
             // 1 - We generate new NP individuals mutating the best and we write on the dvs for pagmo::bfe to evaluate
             // their fitnesses.
+            cgp.set_from_range(best_x.begin() + static_cast<long>(n_eph), best_x.end());
+            neutral = cgp.random_offspring(dvs.data() + n_eph, dim, NP, m_max_mut, m_e);
             for (decltype(NP) i = 0u; i < NP; ++i) {
-                cgp.set_from_range(best_x.begin() + static_cast<long>(n_eph), best_x.end());
-                cgp.mutate_random(dis(m_e));
-                std::vector<unsigned> mutated_x = cgp.get();
-                std::transform(mutated_x.begin(), mutated_x.end(), dvs.data() + i * dim + n_eph,
-                               [](unsigned a) { return boost::numeric_cast<double>(a); });
-
                 // We then mutate the continuous part if requested
                 if (m_learn_constants) {
                     for (auto j = 0u; j < n_eph; ++j) {
@@ -186,17 +192,44 @@ public:
                     }
                     std::copy(mutated_eph_val.begin(), mutated_eph_val.end(), dvs.data() + i * dim);
                 }
+                // 2 - Mutants expressing the same phenotype as best_x inherit its fitness
+                neutral[i] = neutral[i] && cgp.same_eph_phenotype(best_x.data(), dvs.data() + i * dim);
+                if (neutral[i]) {
+                    fs[i] = best_f;
+                    ++skipped;
+                }
             }
 
             // 3 - We compute the mutants fitnesses
             if (m_bfe) {
-                fs = (*m_bfe)(prob, dvs);
+                dvs_eval.clear();
+                for (decltype(NP) i = 0u; i < NP; ++i) {
+                    if (!neutral[i]) {
+                        dvs_eval.insert(dvs_eval.end(), dvs.data() + i * dim, dvs.data() + (i + 1) * dim);
+                    }
+                }
+                if (!dvs_eval.empty()) {
+                    auto fs_eval = (*m_bfe)(prob, dvs_eval);
+                    for (decltype(NP) i = 0u, j = 0u; i < NP; ++i) {
+                        if (!neutral[i]) {
+                            fs[i] = fs_eval[j++];
+                        }
+                    }
+                }
             } else {
+                // The mutants worse than best_x are not selected, hence their evaluation can stop as soon as this
+                // is known
+                const double threshold = best_f;
                 for (decltype(NP) i = 0u; i < NP; ++i) {
-                    pagmo::vector_double tmp_x(dim);
-                    std::copy(dvs.data() + i * dim, dvs.data() + (i + 1) * dim, tmp_x.begin());
-                    pagmo::vector_double tmp_f = prob.fitness(tmp_x);
-                    fs[i] = tmp_f[0];
+                    raced[i] = false;
+                    if (!neutral[i]) {
+                        pagmo::vector_double tmp_x(dim);
+                        std::copy(dvs.data() + i * dim, dvs.data() + (i + 1) * dim, tmp_x.begin());
+                        pagmo::vector_double tmp_f = udp_ptr->race_fitness(tmp_x, threshold, best_x);
+                        prob.increment_fevals(1u);
+                        fs[i] = tmp_f[0];
+                        raced[i] = pagmo::detail::greater_than_f(fs[i], threshold);
+                    }
                 }
             }
             // 4 - We insert the mutated individuals in the population if their fitness is not worse than 
@@ -212,21 +245,21 @@ public:
             if (pagmo::detail::greater_than_f(m_ftol, best_f)) {
                 if (m_verbosity > 0u) {
                     auto formula = udp_ptr->prettier(best_x);
-                    log_single_line(gen, prob.get_fevals() - fevals0, best_f, best_x, formula, n_eph);
+                    log_single_line(gen, prob.get_fevals() - fevals0, skipped, best_f, best_x, formula, n_eph);
                     ++count;
                     pagmo::print("Exit condition -- ftol < ", m_ftol, "\n");
                 }
-                update_pop(pop, dvs, fs, best_f, best_x, NP, dim);
+                update_pop(pop, dvs, fs, raced, best_f, best_x, NP, dim);
                 return pop;
             }
         }
         // Evolution has terminated and we now update into the pagmo::pop.
-        update_pop(pop, dvs, fs, best_f, best_x, NP, dim);
+        update_pop(pop, dvs, fs, raced, best_f, best_x, NP, dim);
         // At the end, the pagmo::population will contain the best individual together with its best NP-1 mutants.
         // We log the last iteration
         if (m_verbosity > 0u) {
             auto formula = udp_ptr->prettier(best_x);
-            log_single_line(m_gen, prob.get_fevals() - fevals0, best_f, best_x, formula, n_eph);
+            log_single_line(m_gen, prob.get_fevals() - fevals0, skipped, best_f, best_x, formula, n_eph);
             pagmo::print("Exit condition -- generations = ", m_gen, '\n');
         }
         return pop;
@@ -269,25 +302,15 @@ public:
      *
      * Example (verbosity 100):
      * @code{.unparsed}
-     *  Gen:        Fevals:          Best:    Constants:    Model:
-     *      0              0        4087.68    [3.52114]    [0] ...
-     *    100            400        324.845    [3.61414]    [2*x0**4] ...
-     *    200            800        324.845    [3.61414]    [2*x0**4] ...
-     *    300           1200        165.212    [3.56702]    [x0**2*(-x0 + 2*x0**2)] ...
-     *    400           1600         28.814    [3.45813]    [x0*(-x0 + x0**2*(-x0 + x0**2) - (-x0 +  ...
-     *    500           2000        10.5589    [3.59501]    [x0*(-4*x0 + x0**2*(-x0 + x0**2) + x0**2 ...
-     *    600           2400         2.2459    [3.44443]    [x0*(-x0*c1 + x0**2*(-x0 + x0**2) + x0** ...
-     *    700           2800        2.24378    [3.43364]    [x0*(-x0*c1 + x0**2*(-x0 + x0**2) + x0** ...
-     *    800           3200        2.24378    [3.43364]    [x0*(-x0*c1 + x0**2*(-x0 + x0**2) + x0** ...
-     *    900           3600        2.24378    [3.43364]    [x0*(-x0*c1 + x0**2*(-x0 + x0**2) + x0** ...
-     *   1000           4000        2.24374    [3.43618]    [x0*(-x0*c1 + x0**2*(-x0 + x0**2) + x0** ...
-     *   1100           4400        2.24372    [3.43479]    [x0*(-x0*c1 + x0**2*(-x0 + x0**2) + x0** ...
-     *   1200           4800      0.0697188    [3.35616]    [x0*(x0 + x0**2*(-c1 + x0**2))] ...
-     *   1300           5200      0.0254527    [3.37625]    [x0*(x0 + x0**2*(-c1 + x0**2))] ...
+     *  Gen:        Fevals:       Skipped:          Best:    Constants:    Model:
+     *      0              0              0        4087.68    [3.52114]    [0] ...
+     *    ...
      * @endcode
-     * Gen is the generation number, Fevals the number of function evaluation used, Best is the best fitness found,
-     * Constants contains the value of the ephemeral constants and Formula peeks into the prettier expression of the
-     * underlying CGP.
+     * Gen is the generation number, Fevals the number of function evaluation used, Skipped the number of evaluations
+     * avoided as the mutant expressed the same phenotype as its parent (and thus inherited its fitness), Best is the
+     * best fitness found, Constants contains the value of the ephemeral constants and Formula peeks into the prettier
+     * expression of the underlying CGP. How the mutants split between Fevals and Skipped depends on the run, as the
+     * neutral mutants are random.
      * @param level verbosity level
      */
     void set_verbosity(unsigned level)
@@ -344,26 +367,31 @@ public:
 
 private:
     // This prints to screen and logs one single line.
-    void log_single_line(unsigned gen, unsigned long long fevals, double best_f, pagmo::vector_double &best_x,
-                         const std::string &formula, pagmo::vector_double::size_type n_eph) const
+    void log_single_line(unsigned gen, unsigned long long fevals, unsigned long long skipped, double best_f,
+                         pagmo::vector_double &best_x, const std::string &formula,
+                         pagmo::vector_double::size_type n_eph) const
     {
         std::vector<double> eph_val(best_x.data(), best_x.data() + n_eph);
-        std::cout << std::setw(7) << gen << std::setw(15) << fevals << std::setw(15) << best_f << "\t" << eph_val
-                  << "\t" << formula.substr(0, 40) << " ..." << std::endl;
-        m_log.emplace_back(gen, fevals, best_f, eph_val, formula);
+        std::cout << std::setw(7) << gen << std::setw(15) << fevals << std::setw(15) << skipped << std::setw(15)
+                  << best_f << "\t" << eph_val << "\t" << formula.substr(0, 40) << " ..." << std::endl;
+        m_log.emplace_back(gen, fevals, best_f, eph_val, formula, skipped);
     }
 
     // Used to update the population from the dvs, fs used via the bfe. Typically done at the end of the evolve when an
     // exit condition is met.
     void update_pop(pagmo::population &pop, const pagmo::vector_double &dvs, const pagmo::vector_double &fs,
-                    double best_f, const pagmo::vector_double &best_x, pagmo::vector_double::size_type NP,
-                    pagmo::vector_double::size_type dim) const
+                    const std::vector<bool> &raced, double best_f, const pagmo::vector_double &best_x,
+                    pagmo::vector_double::size_type NP, pagmo::vector_double::size_type dim) const
     {
         // First, the latest generation of mutants (if better)
         for (decltype(NP) i = 0u; i < NP; ++i) {
             if (pagmo::detail::less_than_f(fs[i], pop.get_f()[i][0])) {
-                pop.set_xf(i, pagmo::vector_double(dvs.data() + i * dim, dvs.data() + (i + 1) * dim),
-                           pagmo::vector_double(1, fs[i]));
+                pagmo::vector_double x(dvs.data() + i * dim, dvs.data() + (i + 1) * dim);
+                // A lower bound of the fitness is not inserted, the mutant is evaluated fully and checked again
+                auto f = raced[i] ? pop.get_problem().fitness(x) : pagmo::vector_double(1, fs[i]);
+                if (pagmo::detail::less_than_f(f[0], pop.get_f()[i][0])) {
+                    pop.set_xf(i, x, f);
+                }
             }
         }
         auto worst_idx = pop.worst_idx();
@@ -50,6 +50,14 @@ namespace dcgp
  * > > Reinsertion: set pop to contain the best N individuals taken from pop and pop2
  * @endcode
  *
+ * The individuals of pop2 are evaluated with dcgp::symbolic_regression::race_fitness(), so that the evaluation
+ * stops as soon as they are known not to improve on the best individual, and only their nodes affected by the
+ * mutation (or by the Newton step) are evaluated.
+ *
+ * The gradient and the hessians used by the Newton step are computed together with the loss, in a single pass over
+ * the data, calling dcgp::symbolic_regression::loss_gradient_hessian() directly on the UDP. As pagmo::problem only
+ * exposes a counter increment for the fitness evaluations, these calls are not counted in the gradient and hessians
+ * evaluations of the problem (pagmo::problem::get_gevals() and pagmo::problem::get_hevals()).
  */
 class mes4cgp
 {
@@ -152,8 +160,6 @@ public:
         // Full pivoting LU decomposition to check that H is invertible, find the inverse
         // and see if H is positive definite
         Eigen::FullPivLU<Eigen::MatrixXd> fullpivlu;
-        // Uniform distribution (to pick the number of active mutations)
-        std::uniform_int_distribution<unsigned> dis(1u, m_max_mut);
         // Main loop
         for (decltype(m_gen) gen = 1u; gen <= m_gen; ++gen) {
             // Logs and prints (verbosity modes > 1: a line is added every m_verbosity generations)
@@ -171,15 +177,12 @@ public:
                 }
             }
             // 1 - We generate new NP individuals mutating the integer part of the chromosome and leaving the continuous
-            // part untouched
+            // part untouched (the expression is set to the parent once, each child is written in place)
             std::vector<pagmo::vector_double> mutated_x(NP, best_x);
             std::vector<pagmo::vector_double> mutated_f(NP, best_f);
+            cgp.set(best_xu);
             for (decltype(NP) i = 0u; i < NP; ++i) {
-                cgp.set(best_xu);
-                cgp.mutate_random(dis(m_e));
-                std::vector<unsigned> mutated_xu = cgp.get();
-                std::transform(mutated_xu.begin(), mutated_xu.end(), mutated_x[i].data() + n_eph,
-                               [](unsigned a) { return boost::numeric_cast<double>(a); });
+                cgp.random_offspring(mutated_x[i].data() + n_eph, best_xu.size(), 1u, m_max_mut, m_e);
             }
 
             // 2 - Life long learning is here obtained performing a single Newton iteration (thus favouring constants
@@ -188,16 +191,20 @@ public:
             // deal with the fact that ephemeral constants are often not appearing in the expression, thus the hessian
             // has zero cols and rows but it still should be used to modify the meaningful constants.
             for (decltype(NP) i = 0u; i < NP; ++i) {
-                // Defining the gradient and hessian returned by the UDP.
-                auto hess = prob.hessians(mutated_x[i]);
-                auto grad = prob.gradient(mutated_x[i]);
+                // Loss, gradient and hessian are computed by the UDP in a single pass over the data. The loss is
+                // cached in the UDP, so that the fitness evaluation below does not need another pass when the
+                // constants are left unchanged.
+                auto lgh = udp_ptr->loss_gradient_hessian(mutated_x[i]);
+                const auto &grad = std::get<1>(lgh);
+                const auto &hess = std::get<2>(lgh);
                 // For a single ephemeral constant we avoid to call the Eigen machinery. This
                 // makes the code more readable and results in a few lines rather than tens of.
                 if (n_eph == 1u) {
-                    if (hess[0][0] != 0. && std::isfinite(grad[0]) && std::isfinite(hess[0][0])) {
-                        mutated_x[i][0] = mutated_x[i][0] - grad[0] / hess[0][0];
+                    if (hess[0] != 0. && std::isfinite(grad[0]) && std::isfinite(hess[0])) {
+                        mutated_x[i][0] = mutated_x[i][0] - grad[0] / hess[0];
                     }
-                    mutated_f[i] = prob.fitness(mutated_x[i]);
+                    mutated_f[i] = udp_ptr->race_fitness(mutated_x[i], best_f[0], best_x);
+                    prob.increment_fevals(1u);
                 } else { // We have at least two ephemeral constants defined and thus need to deal with matrices.
                     // We find out how many epheremal constants are actually in expression
                     // collecting the indices of non-zero gradients
@@ -214,10 +221,10 @@ public:
                     if (n_non_zero == 1u) {
                         // Only one ephemeral constant is in the expression, as above, we avoid to call the
                         // Eigen machinery. This makes the code more readable.
-                        if (hess[0][non_zero[0]] != 0. && std::isfinite(grad[non_zero[0]])
-                            && std::isfinite(hess[0][non_zero[0]])) {
+                        if (hess[non_zero[0]] != 0. && std::isfinite(grad[non_zero[0]])
+                            && std::isfinite(hess[non_zero[0]])) {
                             mutated_x[i][non_zero[0]]
-                                = mutated_x[i][non_zero[0]] - grad[non_zero[0]] / hess[0][non_zero[0]];
+                                = mutated_x[i][non_zero[0]] - grad[non_zero[0]] / hess[non_zero[0]];
                         }
                     } else if (n_non_zero > 1u) {
                         // The full Hessian
@@ -229,9 +236,9 @@ public:
                         // (active) Constants stored in a column vector
                         C = Eigen::MatrixXd::Zero(_(n_non_zero), 1u);
                         // We construct the hessian including all the zero elements
-                        for (decltype(hess[0].size()) j = 0u; j < hess[0].size(); ++j) {
-                            fullH(_(hs[0][j].first), _(hs[0][j].second)) = hess[0][j];
-                            fullH(_(hs[0][j].second), _(hs[0][j].first)) = hess[0][j];
+                        for (decltype(hess.size()) j = 0u; j < hess.size(); ++j) {
+                            fullH(_(hs[0][j].first), _(hs[0][j].second)) = hess[j];
+                            fullH(_(hs[0][j].second), _(hs[0][j].first)) = hess[j];
                         }
                         // The following nested fors loops copy into the active hessian all cols and rows tht are non
                         // zero, i.e. corresponding to eph constants that actually are in the expression Probably this
@@ -276,7 +283,8 @@ public:
                             }
                         }
                     }
-                    mutated_f[i] = prob.fitness(mutated_x[i]);
+                    mutated_f[i] = udp_ptr->race_fitness(mutated_x[i], best_f[0], best_x);
+                    prob.increment_fevals(1u);
                 }
             }
             // 3 - We check if we found anything better.
@@ -1,6 +1,8 @@
 #ifndef DCGP_MOES4CGP_H
 #define DCGP_MOES4CGP_H
 
+#include <algorithm>
+#include <limits>
 #include <random>
 #include <sstream>
 #include <string>
@@ -51,12 +53,17 @@ namespace dcgp
  * > > Reinsertion: set pop to contain the best N individuals taken from pop and pop2 according to non dominated
  * sorting.
  * @endcode
+ *
+ * When no bfe is set, the mutants are evaluated with dcgp::symbolic_regression::race_fitness(). A mutant having
+ * a complexity not lower than any individual in pop and a loss higher than all of them is dominated by N
+ * individuals, and thus not selected: its evaluation stops as soon as its loss is known to be that high.
  */
 class moes4cgp
 {
 public:
-    /// Single entry of the log (gen, fevals, best loss, ndf size, max. complexity)
-    typedef std::tuple<unsigned, unsigned long long, double, unsigned long long, double> log_line_type;
+    /// Single entry of the log (gen, fevals, best loss, ndf size, max. complexity, skipped)
+    typedef std::tuple<unsigned, unsigned long long, double, unsigned long long, double, unsigned long long>
+        log_line_type;
     /// The log
     typedef std::vector<log_line_type> log_type;
 
@@ -106,6 +113,7 @@ public:
         auto NP = pop.size();
         auto fevals0 = prob.get_fevals(); // fevals already made
         auto count = 1u;                  // regulates the screen output
+        unsigned long long skipped = 0u;  // evaluations of neutral mutants skipped
         // We do not use directly the pagmo::problem::extract as otherwise we could not override it in the python
         // bindings. Using this global function, instead, allows its implementation to be overridden in the bindings.
         auto udp_ptr = details::extract_sr_cpp_py(prob);
@@ -139,8 +147,6 @@ public:
         auto n_eph = prob.get_ncx();
         // Normal distribution (to perturb the constants)
         std::normal_distribution<> normal{0., 1.};
-        // Uniform distribution (to pick the number of active mutations)
-        std::uniform_int_distribution<unsigned> dis(1u, m_max_mut);
         // A contiguous vector of chromosomes/fitness vectors for pagmo::bfe input\output is allocated here.
         pagmo::vector_double dvs(NP * dim);
         pagmo::vector_double fs(NP * n_obj);
@@ -148,6 +154,10 @@ public:
         std::vector<pagmo::vector_double> dvs_v(2 * NP, pagmo::vector_double(dim, 0.));
         std::vector<pagmo::vector_double> fs_v(2 * NP,
                                                pagmo::vector_double(n_obj, std::numeric_limits<double>::infinity()));
+        // Flags the mutants expressing the same phenotype as their parent (their fitness is not computed)
+        std::vector<bool> neutral(NP);
+        // The chromosomes of the non neutral mutants (contiguous, for pagmo::bfe)
+        pagmo::vector_double dvs_eval;
         // This will store the idx of the best individuals to select for the next generation.
         std::vector<pagmo::vector_double::size_type> best_idx(NP);
 
@@ -159,10 +169,11 @@ public:
                 if (gen % m_verbosity == 1u || m_verbosity == 1u) {
                     // Every 50 lines print the column names
                     if (count % 50u == 1u) {
-                        pagmo::print("\n", std::setw(7), "Gen:", std::setw(15), "Fevals:", std::setw(15),
-                                     "Best loss:", std::setw(10), "Ndf size:", std::setw(10), "Compl.:\n");
+                        pagmo::print("\n", std::setw(7), "Gen:", std::setw(15), "Fevals:", std::setw(15), "Skipped:",
+                                     std::setw(15), "Best loss:", std::setw(10), "Ndf size:", std::setw(10),
+                                     "Compl.:\n");
                     }
-                    log_single_line(gen - 1, prob.get_fevals() - fevals0, pop);
+                    log_single_line(gen - 1, prob.get_fevals() - fevals0, skipped, pop);
                     ++count;
                     // Check for ftol stopping condition
                     if (pagmo::detail::greater_than_f(m_ftol, pagmo::ideal(pop.get_f())[0])) {
@@ -173,13 +184,19 @@ public:
                     }
                 }
             }
+            // The worst loss and complexity in the population: a mutant at least as complex and with a higher loss
+            // is dominated by all the NP individuals
+            double max_loss = -std::numeric_limits<double>::infinity();
+            double max_complexity = -std::numeric_limits<double>::infinity();
+            for (const auto &f : pop.get_f()) {
+                max_loss = std::max(max_loss, f[0]);
+                max_complexity = std::max(max_complexity, f[1]);
+            }
             // 1 - We generate new NP individuals mutating the best and we write on the dvs for pagmo::bfe to evaluate
             // their fitnesses.
             for (decltype(NP) i = 0u; i < NP; ++i) {
                 cgp.set_from_range(pop.get_x()[i].begin() + static_cast<long>(n_eph), pop.get_x()[i].end());
-                cgp.mutate_random(dis(m_e));
-                std::transform(cgp.get().begin(), cgp.get().end(), dvs.data() + i * dim + n_eph,
-                               [](unsigned a) { return boost::numeric_cast<double>(a); });
+                neutral[i] = cgp.random_offspring(dvs.data() + i * dim + n_eph, dim, 1u, m_max_mut, m_e)[0];
 
                 // We then mutate the continuous part if requested
                 if (m_learn_constants) {
@@ -187,6 +204,12 @@ public:
                         dvs[i * dim + j] = pop.get_x()[i][j] + 10. * normal(m_e);
                     }
                 }
+                // Mutants expressing the same phenotype as their parent inherit its fitness
+                neutral[i] = neutral[i] && cgp.same_eph_phenotype(pop.get_x()[i].data(), dvs.data() + i * dim);
+                if (neutral[i]) {
+                    fs_v[i] = pop.get_f()[i];
+                    ++skipped;
+                }
             }
 
             // 2 - We compute the mutants fitnesses
@@ -195,13 +218,32 @@ public:
                 std::copy(dvs.data() + i * dim, dvs.data() + (i + 1) * dim, dvs_v[i].begin());
             }
             if (m_bfe) { // bfe evaluation
-                fs = (*m_bfe)(prob, dvs);
+                dvs_eval.clear();
                 for (decltype(NP) i = 0u; i < NP; ++i) {
-                    std::copy(fs.data() + i * n_obj, fs.data() + (i + 1) * n_obj, fs_v[i].begin());
+                    if (!neutral[i]) {
+                        dvs_eval.insert(dvs_eval.end(), dvs.data() + i * dim, dvs.data() + (i + 1) * dim);
+                    }
+                }
+                if (!dvs_eval.empty()) {
+                    fs = (*m_bfe)(prob, dvs_eval);
+                    for (decltype(NP) i = 0u, j = 0u; i < NP; ++i) {
+                        if (!neutral[i]) {
+                            std::copy(fs.data() + j * n_obj, fs.data() + (j + 1) * n_obj, fs_v[i].begin());
+                            ++j;
+                        }
+                    }
                 }
-            } else { // normal evaluation
+            } else { // normal evaluation, racing the mutants
                 for (decltype(NP) i = 0u; i < NP; ++i) {
-                    fs_v[i] = prob.fitness(dvs_v[i]);
+                    if (!neutral[i]) {
+                        // The complexity of the mutant is needed for its threshold
+                        cgp.set_from_range(dvs_v[i].begin() + static_cast<long>(n_eph), dvs_v[i].end());
+                        const auto threshold = static_cast<double>(cgp.get_active_genes().size()) >= max_complexity
+                                                   ? max_loss
+                                                   : std::numeric_limits<double>::infinity();
+                        fs_v[i] = udp_ptr->race_fitness(dvs_v[i], threshold);
+                        prob.increment_fevals(1u);
+                    }
                 }
             }
             for (decltype(NP) i = 0u; i < NP; ++i) {
@@ -217,7 +259,7 @@ public:
             }
         }
         if (m_verbosity > 0u) {
-            log_single_line(m_gen, prob.get_fevals() - fevals0, pop);
+            log_single_line(m_gen, prob.get_fevals() - fevals0, skipped, pop);
             pagmo::print("Exit condition -- max generations = ", m_gen, '\n');
         }
         return pop;
@@ -260,29 +302,15 @@ public:
      *
      * Example (verbosity 10):
      * @code{.unparsed}
-     *  Gen:        Fevals:     Best loss: Ndf size:   Compl.:
-     *     0              0        6.07319         3        92
-     *    10           1000        2.15419         5        10
-     *    20           2000        1.92403         8        33
-     *    30           3000       0.373663        12        72
-     *    40           4000        0.36954        13        72
-     *    50           5000       0.235749        16        73
-     *    60           6000       0.235749        12        73
-     *    70           7000       0.235749        13        73
-     *    80           8000       0.217968        12        75
-     *    90           9000       0.217968        12        75
-     *   100          10000       0.217968        12        75
-     *   110          11000       0.217968        14        75
-     *   120          12000       0.217968        14        75
-     *   130          13000       0.217968        13        75
-     *   140          14000       0.162293        12        52
-
-
+     *  Gen:        Fevals:       Skipped:     Best loss: Ndf size:   Compl.:
+     *     0              0              0        6.07319         3        92
+     *   ...
      * @endcode
-     * Gen is the generation number, Fevals the number of function evaluation used, Best loss is the best loss in
-     the
+     * Gen is the generation number, Fevals the number of function evaluation used, Skipped the number of evaluations
+     * avoided as the mutant expressed the same phenotype as its parent, Best loss is the best loss in the
      * population, Ndf size is the size of the non dominated front (i.e. the number of models that are optimal) and
-     * compl. is the complexity of the lowest loss model.
+     * Compl. is the largest complexity in the population (the second component of its nadir point). How the mutants
+     * split between Fevals and Skipped depends on the run, as the neutral mutants are random.
      *
      * @param level verbosity level
      */
@@ -329,11 +357,11 @@ public:
     /// Get log
     /**
      * A log containing relevant quantities monitoring the last call to evolve. Each element of the returned
-     * <tt>std::vector</tt> is a moes4cgp::log_line_type containing: Gen, Fevals, Best loss, Ndf size and Complexity
-     * described in moes4cgp::set_verbosity().
+     * <tt>std::vector</tt> is a moes4cgp::log_line_type containing: Gen, Fevals, Best loss, Ndf size, Complexity and
+     * Skipped described in moes4cgp::set_verbosity().
      *
      * @return an <tt> std::vector</tt> of moes4cgp::log_line_type containing the logged values Gen, Fevals, Best
-     * loss, Ndf size and Complexity
+     * loss, Ndf size, Complexity and Skipped
      */
     const log_type &get_log() const
     {
@@ -342,14 +370,15 @@ public:
 
 private:
     // This prints to screen and logs one single line.
-    void log_single_line(unsigned gen, unsigned long long fevals, const pagmo::population &pop) const
+    void log_single_line(unsigned gen, unsigned long long fevals, unsigned long long skipped,
+                         const pagmo::population &pop) const
     {
         pagmo::vector_double ideal_point = pagmo::ideal(pop.get_f());
         pagmo::vector_double nadir_point = pagmo::nadir(pop.get_f());
         auto ndf_size = pagmo::non_dominated_front_2d(pop.get_f()).size();
-        pagmo::print(std::setw(7), gen, std::setw(15), fevals, std::setw(15), ideal_point[0], std::setw(10), ndf_size,
-                     std::setw(10), nadir_point[1], '\n');
-        m_log.emplace_back(gen, fevals, ideal_point[0], ndf_size, nadir_point[1]);
+        pagmo::print(std::setw(7), gen, std::setw(15), fevals, std::setw(15), skipped, std::setw(15), ideal_point[0],
+                     std::setw(10), ndf_size, std::setw(10), nadir_point[1], '\n');
+        m_log.emplace_back(gen, fevals, ideal_point[0], ndf_size, nadir_point[1], skipped);
     }
 
 public:
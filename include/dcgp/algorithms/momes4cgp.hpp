@@ -43,6 +43,10 @@ namespace dcgp
  * > > Reinsertion: set pop to contain the best N individuals taken from pop and pop2 according to non dominated
  * sorting.
  * @endcode
+ *
+ * As in dcgp::mes4cgp, the Newton step calls dcgp::symbolic_regression::loss_gradient_hessian() directly on the UDP,
+ * hence its gradient and hessians are not counted by pagmo::problem::get_gevals() and
+ * pagmo::problem::get_hevals().
  */
 class momes4cgp
 {
@@ -178,13 +182,17 @@ public:
             std::vector<pagmo::vector_double> mutated_x(NP);
             for (decltype(NP) i = 0u; i < NP; ++i) {
                 mutated_x[i] = pop.get_x()[i];
+                // Individuals drawing no mutations are copied as they are (without setting the CGP)
+                if (n_active_mutations[i] == 0u) {
+                    continue;
+                }
                 // We extract the integer part of the individual
                 std::vector<unsigned> mutated_xu(mutated_x[i].size() - n_eph);
                 std::transform(mutated_x[i].data() + n_eph, mutated_x[i].data() + mutated_x[i].size(),
                                mutated_xu.begin(), [](double a) { return boost::numeric_cast<unsigned>(a); });
                 // Use it to set the CGP
                 cgp.set(mutated_xu);
-                // Mutate the expression
+                // Mutate the expression (the active graph is updated gene by gene, see expression::mutate_random())
                 cgp.mutate_random(n_active_mutations[i]);
                 mutated_xu = cgp.get();
                 // Put it back
@@ -195,14 +203,17 @@ public:
             // 2 - Life long learning (i.e. touching the continuous part) is obtained performing a single Newton
             // iteration (thus favouring constants appearing linearly)
             for (decltype(NP) i = 0u; i < NP; ++i) {
-                // Defining the gradient and hessian returned by the UDP.
-                auto hess = prob.hessians(mutated_x[i]);
-                auto grad = prob.gradient(mutated_x[i]);
+                // Loss, gradient and hessian are computed by the UDP in a single pass over the data. The loss is
+                // cached in the UDP, so that the fitness evaluation below does not need another pass when the
+                // constants are left unchanged.
+                auto lgh = udp_ptr->loss_gradient_hessian(mutated_x[i]);
+                const auto &grad = std::get<1>(lgh);
+                const auto &hess = std::get<2>(lgh);
                 // For a single ephemeral constant we avoid to call the Eigen machinery. This
                 // makes the code more readable and results in a few lines rather than tens of.
                 if (n_eph == 1u) {
-                    if (hess[0][0] != 0. && std::isfinite(grad[0]) && std::isfinite(hess[0][0])) {
-                        mutated_x[i][0] = mutated_x[i][0] - grad[0] / hess[0][0];
+                    if (hess[0] != 0. && std::isfinite(grad[0]) && std::isfinite(hess[0])) {
+                        mutated_x[i][0] = mutated_x[i][0] - grad[0] / hess[0];
                     }
                 } else { // We have at least two ephemeral constants defined and thus need to deal with matrices.
                     // We find out how many epheremal constants are actually in expression
@@ -220,10 +231,10 @@ public:
                     if (n_non_zero == 1u) {
                         // Only one ephemeral constant is in the expression, as above, we avoid to call the
                         // Eigen machinery. This makes the code more readable.
-                        if (hess[0][non_zero[0]] != 0. && std::isfinite(grad[non_zero[0]])
-                            && std::isfinite(hess[0][non_zero[0]])) {
+                        if (hess[non_zero[0]] != 0. && std::isfinite(grad[non_zero[0]])
+                            && std::isfinite(hess[non_zero[0]])) {
                             mutated_x[i][non_zero[0]]
-                                = mutated_x[i][non_zero[0]] - grad[non_zero[0]] / hess[0][non_zero[0]];
+                                = mutated_x[i][non_zero[0]] - grad[non_zero[0]] / hess[non_zero[0]];
                         }
                     } else if (n_non_zero > 1u) {
                         // The full Hessian
@@ -235,9 +246,9 @@ public:
                         // (active) Constants stored in a column vector
                         C = Eigen::MatrixXd::Zero(_(n_non_zero), 1u);
                         // We construct the hessian including all the zero elements
-                        for (decltype(hess[0].size()) j = 0u; j < hess[0].size(); ++j) {
-                            fullH(_(hs[0][j].first), _(hs[0][j].second)) = hess[0][j];
-                            fullH(_(hs[0][j].second), _(hs[0][j].first)) = hess[0][j];
+                        for (decltype(hess.size()) j = 0u; j < hess.size(); ++j) {
+                            fullH(_(hs[0][j].first), _(hs[0][j].second)) = hess[j];
+                            fullH(_(hs[0][j].second), _(hs[0][j].first)) = hess[j];
                         }
                         // The following nested fors loops copy into the active hessian all cols and rows tht are non
                         // zero, i.e. corresponding to eph constants that actually are in the expression Probably this
@@ -0,0 +1,945 @@
+#ifndef DCGP_DATASET_H
+#define DCGP_DATASET_H
+
+#include <cerrno>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <boost/functional/hash.hpp>
+#include <boost/interprocess/exceptions.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/serialization/array_wrapper.hpp>
+#include <boost/serialization/split_member.hpp>
+#include <boost/serialization/string.hpp>
+
+#include <dcgp/config.hpp>
+#include <dcgp/s11n.hpp>
+
+namespace dcgp
+{
+namespace detail
+{
+// Minimal allocator returning memory aligned to Align bytes.
+template <typename T, std::size_t Align>
+struct aligned_allocator {
+    using value_type = T;
+    template <typename U>
+    struct rebind {
+        using other = aligned_allocator<U, Align>;
+    };
+    aligned_allocator() = default;
+    template <typename U>
+    aligned_allocator(const aligned_allocator<U, Align> &)
+    {
+    }
+    T *allocate(std::size_t n)
+    {
+        return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(Align)));
+    }
+    void deallocate(T *p, std::size_t)
+    {
+        ::operator delete(p, std::align_val_t(Align));
+    }
+    friend bool operator==(const aligned_allocator &, const aligned_allocator &)
+    {
+        return true;
+    }
+    friend bool operator!=(const aligned_allocator &, const aligned_allocator &)
+    {
+        return false;
+    }
+};
+
+// Header of the binary dataset files (see dataset::to_file()). All offsets are in bytes from the beginning
+// of the file.
+struct dataset_file_header {
+    char magic[8];
+    std::uint64_t version;
+    // Type of the values (0: float64)
+    std::uint64_t dtype;
+    std::uint64_t n;
+    std::uint64_t m;
+    std::uint64_t N;
+    // Distance (in values) between the starts of two consecutive columns
+    std::uint64_t stride;
+    std::uint64_t hash;
+    // Points and labels stored row by row
+    std::uint64_t points_offset;
+    std::uint64_t labels_offset;
+    // Points and labels stored column by column
+    std::uint64_t pointsT_offset;
+    std::uint64_t labelsT_offset;
+};
+static_assert(sizeof(dataset_file_header) == 96u, "Unexpected padding in the dataset file header.");
+constexpr char dataset_file_magic[8] = {'D', 'C', 'G', 'P', 'D', 'A', 'T', 'A'};
+constexpr std::uint64_t dataset_file_version = 1u;
+} // namespace detail
+
+/// A shared, immutable dataset
+/**
+ * Holds N points (of dimension n) and their labels (of dimension m) as contiguous float64 buffers, stored both row by
+ * row and column by column. All buffers, and each column, start at addresses aligned to dataset::alignment bytes.
+ *
+ * The data cannot be modified after construction and copies of a dataset share it: copying an object holding a
+ * dataset (e.g. a pagmo UDP copied into islands, threads and populations) only increments a reference count.
+ *
+ * Datasets can also be explicitly added to a process-local registry (see add_to_registry()), where they are identified
+ * by a hash of their content and kept alive until removed. Objects holding a registered dataset can then be serialized
+ * storing only a reference to it (its hash, dimensions and checksum), which is checked against the registry of the
+ * loading process (see e.g. symbolic_regression::set_data_by_reference()).
+ *
+ * A dataset can be saved to a binary file (see to_file()) and later memory mapped from it (see from_file()): the
+ * mapped dataset is a zero-copy view on the file, and several processes mapping the same file share a single
+ * page-cached copy of the data. Datasets in the CSV layout used by the examples can be read with from_csv().
+ * Similarly, a dataset can be placed in shared memory (see to_shared_memory()), in which case it is serialized as
+ * the name of the shared memory object.
+ */
+class dataset
+{
+public:
+    /// Alignment (in bytes) of the buffers and of each column
+    static constexpr std::size_t alignment = 64u;
+    /// Type of the (aligned) buffers
+    using buffer_type = std::vector<double, detail::aligned_allocator<double, alignment>>;
+
+    /// A view on a point or a label
+    class row_view
+    {
+    public:
+        row_view(const double *data, unsigned size) : m_data(data), m_size(size) {}
+        const double &operator[](unsigned i) const
+        {
+            return m_data[i];
+        }
+        unsigned size() const
+        {
+            return m_size;
+        }
+        const double *data() const
+        {
+            return m_data;
+        }
+        const double *begin() const
+        {
+            return m_data;
+        }
+        const double *end() const
+        {
+            return m_data + m_size;
+        }
+
+    private:
+        const double *m_data;
+        unsigned m_size;
+    };
+
+    /// Random access iterator over the points or the labels (optionally in a permuted order)
+    class row_iterator
+    {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = row_view;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = row_view;
+
+        row_iterator(const double *base, unsigned dim, const std::size_t *perm, std::size_t pos)
+            : m_base(base), m_dim(dim), m_perm(perm), m_pos(pos)
+        {
+        }
+        row_view operator*() const
+        {
+            auto i = m_perm ? m_perm[m_pos] : m_pos;
+            return row_view(m_base + i * m_dim, m_dim);
+        }
+        row_view operator[](difference_type k) const
+        {
+            return *(*this + k);
+        }
+        row_iterator &operator++()
+        {
+            ++m_pos;
+            return *this;
+        }
+        row_iterator &operator+=(difference_type k)
+        {
+            m_pos = static_cast<std::size_t>(static_cast<difference_type>(m_pos) + k);
+            return *this;
+        }
+        row_iterator operator+(difference_type k) const
+        {
+            auto retval(*this);
+            retval += k;
+            return retval;
+        }
+        difference_type operator-(const row_iterator &other) const
+        {
+            return static_cast<difference_type>(m_pos) - static_cast<difference_type>(other.m_pos);
+        }
+        bool operator==(const row_iterator &other) const
+        {
+            return m_pos == other.m_pos && m_base == other.m_base && m_perm == other.m_perm;
+        }
+        bool operator!=(const row_iterator &other) const
+        {
+            return !(*this == other);
+        }
+
+    private:
+        const double *m_base;
+        unsigned m_dim;
+        const std::size_t *m_perm;
+        std::size_t m_pos;
+    };
+
+    /// Default constructor
+    /**
+     * Constructs an empty dataset.
+     */
+    dataset() : m_ptr(std::make_shared<const impl>()) {}
+
+    /// Constructor
+    /**
+     * Constructs a dataset copying the points and the labels.
+     *
+     * @param[in] points input data.
+     * @param[in] labels output data.
+     *
+     * @throws std::invalid_argument if points and labels are empty or not consistent.
+     */
+    dataset(const std::vector<std::vector<double>> &points, const std::vector<std::vector<double>> &labels)
+    {
+        // 1 - We check that points is not an empty vector.
+        if (points.size() == 0) {
+            throw std::invalid_argument("The size of the input data (points) is zero.");
+        }
+        // 2 - We check labels and points have the same (non-empty) size
+        if (points.size() != labels.size()) {
+            throw std::invalid_argument("The number of input data (points) is " + std::to_string(points.size())
+                                        + " while the number of labels is " + std::to_string(labels.size())
+                                        + ". They should be equal.");
+        }
+        auto tmp = std::make_shared<impl>();
+        tmp->n = static_cast<unsigned>(points[0].size());
+        tmp->m = static_cast<unsigned>(labels[0].size());
+        tmp->N = points.size();
+        tmp->points_buffer.reserve(tmp->N * tmp->n);
+        tmp->labels_buffer.reserve(tmp->N * tmp->m);
+        for (decltype(points.size()) i = 0u; i < points.size(); ++i) {
+            // 3 - We check that all p in points have the same size
+            if (points[i].size() != tmp->n) {
+                throw std::invalid_argument("The input data (points) is inconsistent: all points must have the same "
+                                            "dimension, while I detect differences.");
+            }
+            // 4 - We check that all l in labels have the same size
+            if (labels[i].size() != tmp->m) {
+                throw std::invalid_argument("The labels are inconsistent: all labels must have the same "
+                                            "dimension, while I detect differences.");
+            }
+            tmp->points_buffer.insert(tmp->points_buffer.end(), points[i].begin(), points[i].end());
+            tmp->labels_buffer.insert(tmp->labels_buffer.end(), labels[i].begin(), labels[i].end());
+        }
+        tmp->init();
+        m_ptr = std::move(tmp);
+    }
+
+    /// Number of points
+    std::size_t size() const
+    {
+        return m_ptr->N;
+    }
+
+    /// Dimension of the points
+    unsigned get_n() const
+    {
+        return m_ptr->n;
+    }
+
+    /// Dimension of the labels
+    unsigned get_m() const
+    {
+        return m_ptr->m;
+    }
+
+    /// The i-th point
+    row_view point(std::size_t i) const
+    {
+        return row_view(m_ptr->points + i * m_ptr->n, m_ptr->n);
+    }
+
+    /// The i-th label
+    row_view label(std::size_t i) const
+    {
+        return row_view(m_ptr->labels + i * m_ptr->m, m_ptr->m);
+    }
+
+    /// The j-th component of all points (size() contiguous values)
+    const double *point_column(unsigned j) const
+    {
+        return m_ptr->pointsT + j * m_ptr->stride;
+    }
+
+    /// The j-th component of all labels (size() contiguous values)
+    const double *label_column(unsigned j) const
+    {
+        return m_ptr->labelsT + j * m_ptr->stride;
+    }
+
+    /// Iterators over the points
+    /**
+     * @param[in] perm if not null, the iterators will visit the points perm[0], perm[1], ..., perm[size() - 1].
+     */
+    row_iterator points_begin(const std::size_t *perm = nullptr) const
+    {
+        return row_iterator(m_ptr->points, m_ptr->n, perm, 0u);
+    }
+    row_iterator points_end(const std::size_t *perm = nullptr) const
+    {
+        return row_iterator(m_ptr->points, m_ptr->n, perm, m_ptr->N);
+    }
+
+    /// Iterators over the labels
+    /**
+     * @param[in] perm if not null, the iterators will visit the labels perm[0], perm[1], ..., perm[size() - 1].
+     */
+    row_iterator labels_begin(const std::size_t *perm = nullptr) const
+    {
+        return row_iterator(m_ptr->labels, m_ptr->m, perm, 0u);
+    }
+    row_iterator labels_end(const std::size_t *perm = nullptr) const
+    {
+        return row_iterator(m_ptr->labels, m_ptr->m, perm, m_ptr->N);
+    }
+
+    /// Content hash
+    /**
+     * @return a hash of the dimensions and of the values of the points and labels.
+     */
+    std::size_t get_hash() const
+    {
+        return m_ptr->hash;
+    }
+
+    /// Content checksum
+    /**
+     * A 64 bit FNV-1a checksum of the dimensions and of the bytes of the points and labels, computed independently
+     * from get_hash() and used, together with it, to identify registered datasets (see from_registry()). It is
+     * computed (reading all the data) on the first call and cached.
+     *
+     * @return the checksum of the dataset.
+     */
+    std::uint64_t get_checksum() const
+    {
+        return m_ptr->get_checksum();
+    }
+
+    /// A reference to a registered dataset
+    /**
+     * What is stored in place of the data when an object holding a dataset is serialized by reference: the hash,
+     * the dimensions and the checksum of the dataset, all checked by from_registry() on load.
+     */
+    struct reference {
+        std::size_t hash = 0u;
+        unsigned n = 0u;
+        unsigned m = 0u;
+        std::size_t N = 0u;
+        std::uint64_t checksum = 0u;
+        template <typename Archive>
+        void serialize(Archive &ar, unsigned)
+        {
+            ar &hash;
+            ar &n;
+            ar &m;
+            ar &N;
+            ar &checksum;
+        }
+    };
+
+    /// Gets a reference to the dataset
+    /**
+     * @return the reference identifying the dataset in the registry (see from_registry()).
+     */
+    reference get_reference() const
+    {
+        return reference{get_hash(), get_n(), get_m(), size(), get_checksum()};
+    }
+
+    /// Adds a dataset to the registry
+    /**
+     * Adds *data* to the process-local registry, where it is kept alive (and retrievable by its reference, see
+     * from_registry()) until removed with remove_from_registry(). Registering the same data again has no effect.
+     *
+     * The registry is not shared across processes: a forked process (e.g. the one of a pagmo::fork_island) sees the
+     * datasets registered before the fork, while datasets registered by the child are not visible to the parent.
+     *
+     * @param[in] data the dataset.
+     *
+     * @throws std::invalid_argument if a dataset with a different content but the same hash is already registered.
+     */
+    static void add_to_registry(const dataset &data)
+    {
+        auto &reg = get_registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        auto it = reg.entries.find(data.get_hash());
+        if (it == reg.entries.end()) {
+            reg.entries.emplace(data.get_hash(), data.m_ptr);
+        } else if (!same_content(*it->second, data.get_reference())) {
+            throw std::invalid_argument("A different dataset with the same hash (" + std::to_string(data.get_hash())
+                                        + ") is already registered in this process.");
+        }
+    }
+
+    /// Removes a dataset from the registry
+    /**
+     * @param[in] hash the hash of the dataset to be removed. Nothing happens if no such dataset is registered.
+     */
+    static void remove_from_registry(std::size_t hash)
+    {
+        auto &reg = get_registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.entries.erase(hash);
+    }
+
+    /// Checks if a dataset is registered
+    /**
+     * @param[in] data the dataset.
+     *
+     * @return true if a dataset with the same content as *data* is registered in this process.
+     */
+    static bool is_registered(const dataset &data)
+    {
+        auto &reg = get_registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        auto it = reg.entries.find(data.get_hash());
+        return it != reg.entries.end() && same_content(*it->second, data.get_reference());
+    }
+
+    /// Retrieves a dataset from the registry
+    /**
+     * @param[in] hash the hash of the dataset.
+     *
+     * @return the registered dataset (sharing its data).
+     *
+     * @throws std::invalid_argument if no dataset with such a hash is registered.
+     */
+    static dataset from_registry(std::size_t hash)
+    {
+        auto &reg = get_registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        auto it = reg.entries.find(hash);
+        if (it == reg.entries.end()) {
+            throw std::invalid_argument("No dataset with hash " + std::to_string(hash)
+                                        + " is registered in this process (datasets must be registered with "
+                                          "dataset::add_to_registry() by each process resolving them).");
+        }
+        dataset retval;
+        retval.m_ptr = it->second;
+        return retval;
+    }
+
+    /// Retrieves a dataset from the registry, checking its content
+    /**
+     * @param[in] ref the reference to the dataset (see get_reference()).
+     *
+     * @return the registered dataset (sharing its data).
+     *
+     * @throws std::invalid_argument if no dataset with the hash of *ref* is registered, or if the registered one
+     * has different dimensions or checksum (i.e. its hash collides with the one of the referenced dataset).
+     */
+    static dataset from_registry(const reference &ref)
+    {
+        auto retval = from_registry(ref.hash);
+        if (!same_content(*retval.m_ptr, ref)) {
+            throw std::invalid_argument("The dataset registered with hash " + std::to_string(ref.hash)
+                                        + " is not the referenced one (their dimensions or checksums differ).");
+        }
+        return retval;
+    }
+
+    /// Saves the dataset to a binary file
+    /**
+     * Writes the dataset to \p filename in the binary format read by from_file(): a header (holding n, m, N, the
+     * type of the values, the hash and the offsets of the data) followed by the points and labels stored both row
+     * by row and column by column. Each block, and each column, is aligned to dataset::alignment bytes. Values are
+     * stored as float64 in the byte order of the machine.
+     *
+     * @param[in] filename the file to be written.
+     *
+     * @throws std::invalid_argument if the file cannot be written.
+     */
+    void to_file(const std::string &filename) const
+    {
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            throw std::invalid_argument("Could not open the file " + filename + " for writing.");
+        }
+        std::uint64_t pos = 0u;
+        write_image([&file, &pos](std::uint64_t offset, const void *data, std::uint64_t size) {
+            const char zeros[alignment] = {};
+            file.write(zeros, static_cast<std::streamsize>(offset - pos));
+            file.write(static_cast<const char *>(data), static_cast<std::streamsize>(size));
+            pos = offset + size;
+        });
+        if (!file) {
+            throw std::invalid_argument("Error while writing the file " + filename + ".");
+        }
+    }
+
+    /// Memory maps a dataset from a binary file
+    /**
+     * Maps (read only) a file written by to_file(). The data is not copied nor parsed: the returned dataset (and its
+     * copies) reads directly from the mapped file, which stays mapped as long as any of them exists.
+     *
+     * @param[in] filename the file to be mapped.
+     *
+     * @return the mapped dataset.
+     *
+     * @throws std::invalid_argument if the file cannot be mapped or is not a valid dataset file.
+     */
+    static dataset from_file(const std::string &filename)
+    {
+        auto tmp = std::make_shared<impl>();
+        try {
+            boost::interprocess::file_mapping file(filename.c_str(), boost::interprocess::read_only);
+            tmp->region = boost::interprocess::mapped_region(file, boost::interprocess::read_only);
+        } catch (const boost::interprocess::interprocess_exception &e) {
+            throw std::invalid_argument("Could not map the file " + filename + ": " + e.what());
+        }
+        tmp->read_image("the file " + filename);
+        dataset retval;
+        retval.m_ptr = std::move(tmp);
+        return retval;
+    }
+
+    /// Copies the dataset in shared memory
+    /**
+     * Creates the shared memory object \p name (in the binary format of to_file()) and copies the data in it. The
+     * returned dataset reads from the shared memory object and, when serialized, only stores its name: loading it
+     * (e.g. in the worker processes of pagmo's fork_island) attaches to the same shared memory object (see
+     * from_shared_memory()), so that all processes share a single copy of the data.
+     *
+     * The shared memory object outlives the processes using it, and must be removed with remove_shared_memory()
+     * when no longer needed.
+     *
+     * @param[in] name the name of the shared memory object.
+     *
+     * @return the dataset in shared memory.
+     *
+     * @throws std::invalid_argument if the shared memory object cannot be created (e.g. because it already exists).
+     * If it is created, but filling or attaching to it fails, it is removed before the exception is propagated.
+     */
+    dataset to_shared_memory(const std::string &name) const
+    {
+        // Set once the shared memory object is created, so that a failure afterwards removes it (while an
+        // already existing object with the same name is left alone)
+        bool created = false;
+        try {
+            boost::interprocess::shared_memory_object shm(boost::interprocess::create_only, name.c_str(),
+                                                          boost::interprocess::read_write);
+            created = true;
+            std::uint64_t size = 0u;
+            write_image([&size](std::uint64_t offset, const void *, std::uint64_t n_bytes) { size = offset + n_bytes; });
+            shm.truncate(static_cast<boost::interprocess::offset_t>(size));
+            boost::interprocess::mapped_region region(shm, boost::interprocess::read_write);
+            auto base = static_cast<char *>(region.get_address());
+            write_image([base](std::uint64_t offset, const void *data, std::uint64_t n_bytes) {
+                if (n_bytes != 0u) {
+                    std::memcpy(base + offset, data, n_bytes);
+                }
+            });
+            return from_shared_memory(name);
+        } catch (const boost::interprocess::interprocess_exception &e) {
+            if (created) {
+                remove_shared_memory(name);
+            }
+            throw std::invalid_argument("Could not create the shared memory object " + name + ": " + e.what());
+        } catch (...) {
+            if (created) {
+                remove_shared_memory(name);
+            }
+            throw;
+        }
+    }
+
+    /// Attaches to a dataset in shared memory
+    /**
+     * Maps (read only) the shared memory object \p name created by to_shared_memory(). The data is not copied.
+     *
+     * @param[in] name the name of the shared memory object.
+     *
+     * @return the dataset in shared memory.
+     *
+     * @throws std::invalid_argument if the shared memory object cannot be mapped or does not hold a dataset.
+     */
+    static dataset from_shared_memory(const std::string &name)
+    {
+        auto tmp = std::make_shared<impl>();
+        try {
+            boost::interprocess::shared_memory_object shm(boost::interprocess::open_only, name.c_str(),
+                                                          boost::interprocess::read_only);
+            tmp->region = boost::interprocess::mapped_region(shm, boost::interprocess::read_only);
+        } catch (const boost::interprocess::interprocess_exception &e) {
+            throw std::invalid_argument("Could not map the shared memory object " + name + ": " + e.what());
+        }
+        tmp->read_image("the shared memory object " + name);
+        tmp->shm_name = name;
+        dataset retval;
+        retval.m_ptr = std::move(tmp);
+        return retval;
+    }
+
+    /// Removes a shared memory object
+    /**
+     * Removes the shared memory object \p name. Datasets already attached to it stay valid, while new attachments
+     * will fail.
+     *
+     * @param[in] name the name of the shared memory object.
+     *
+     * @return true if the shared memory object was removed.
+     */
+    static bool remove_shared_memory(const std::string &name)
+    {
+        return boost::interprocess::shared_memory_object::remove(name.c_str());
+    }
+
+    /// Name of the shared memory object
+    /**
+     * @return the name of the shared memory object holding the data, or an empty string if the data is not in
+     * shared memory.
+     */
+    const std::string &get_shared_memory_name() const
+    {
+        return m_ptr->shm_name;
+    }
+
+    /// Reads a dataset from a CSV file
+    /**
+     * Reads a file in the CSV layout used by Andrew James in his CGP-Library-V2.2 (and by the dcgp examples):
+     * the values n, m, N followed by the N rows, each made of the n components of a point followed by the m
+     * components of its label, all separated by commas and/or whitespace.
+     *
+     * Use to_file() to convert the result in the binary format, which can then be mapped with from_file().
+     *
+     * @param[in] filename the file to be read.
+     *
+     * @return the dataset.
+     *
+     * @throws std::invalid_argument if the file cannot be read or is malformed.
+     */
+    static dataset from_csv(const std::string &filename)
+    {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file) {
+            throw std::invalid_argument("Could not open the file " + filename + ".");
+        }
+        std::ostringstream oss;
+        oss << file.rdbuf();
+        const auto text = oss.str();
+        const char *cur = text.c_str();
+        auto next = [&cur, &text, &filename]() {
+            while (*cur == ',' || *cur == ' ' || *cur == '\t' || *cur == '\r' || *cur == '\n') {
+                ++cur;
+            }
+            char *end;
+            errno = 0;
+            auto retval = std::strtod(cur, &end);
+            if (end == cur || errno == ERANGE) {
+                throw std::invalid_argument("Malformed value in the file " + filename + " at position "
+                                            + std::to_string(cur - text.c_str()) + ".");
+            }
+            cur = end;
+            return retval;
+        };
+        const auto n = next(), m = next(), N = next();
+        // The dimensions must be non negative integers representable as unsigned (n, m) and std::size_t (N)
+        auto dim_ok = [](double d, int digits) { return d >= 0. && std::floor(d) == d && d < std::ldexp(1., digits); };
+        if (!dim_ok(n, std::numeric_limits<unsigned>::digits) || !dim_ok(m, std::numeric_limits<unsigned>::digits)
+            || !dim_ok(N, std::numeric_limits<std::size_t>::digits)) {
+            throw std::invalid_argument("Invalid dimensions in the file " + filename
+                                        + ": n, m and N must be non negative integers.");
+        }
+        auto tmp = std::make_shared<impl>();
+        tmp->n = static_cast<unsigned>(n);
+        tmp->m = static_cast<unsigned>(m);
+        tmp->N = static_cast<std::size_t>(N);
+        // Each value takes at least one character, which bounds the size of the buffers below (and rules out
+        // overflows in their computation)
+        const std::size_t row_size = std::size_t(tmp->n) + tmp->m;
+        if (row_size != 0u && tmp->N > text.size() / row_size) {
+            throw std::invalid_argument("The file " + filename + " declares " + std::to_string(tmp->N) + " rows of "
+                                        + std::to_string(row_size) + " values, more than it can contain.");
+        }
+        tmp->points_buffer.resize(tmp->N * tmp->n);
+        tmp->labels_buffer.resize(tmp->N * tmp->m);
+        for (std::size_t i = 0u; i < tmp->N; ++i) {
+            for (unsigned j = 0u; j < tmp->n; ++j) {
+                tmp->points_buffer[i * tmp->n + j] = next();
+            }
+            for (unsigned j = 0u; j < tmp->m; ++j) {
+                tmp->labels_buffer[i * tmp->m + j] = next();
+            }
+        }
+        tmp->init();
+        dataset retval;
+        retval.m_ptr = std::move(tmp);
+        return retval;
+    }
+
+    /// A copy of the points
+    std::vector<std::vector<double>> get_points() const
+    {
+        std::vector<std::vector<double>> retval;
+        for (std::size_t i = 0u; i < size(); ++i) {
+            retval.emplace_back(point(i).begin(), point(i).end());
+        }
+        return retval;
+    }
+
+    /// A copy of the labels
+    std::vector<std::vector<double>> get_labels() const
+    {
+        std::vector<std::vector<double>> retval;
+        for (std::size_t i = 0u; i < size(); ++i) {
+            retval.emplace_back(label(i).begin(), label(i).end());
+        }
+        return retval;
+    }
+
+    /// Object serialization
+    /**
+     * This method will save/load \p this into the archive \p ar. A dataset in shared memory only saves the name
+     * of the shared memory object, and is loaded attaching to it. Otherwise, only the data stored row by row is
+     * saved, and the loaded dataset owns its data (also when the saved one was memory mapped from a file).
+     *
+     * @param ar target archive.
+     *
+     * @throws std::invalid_argument if the shared memory object cannot be attached.
+     * @throws unspecified any exception thrown by the serialization of primitive types.
+     */
+    template <typename Archive>
+    void save(Archive &ar, unsigned) const
+    {
+        ar << m_ptr->shm_name;
+        if (!m_ptr->shm_name.empty()) {
+            return;
+        }
+        ar << m_ptr->n;
+        ar << m_ptr->m;
+        ar << m_ptr->N;
+        ar << boost::serialization::make_array(m_ptr->points, m_ptr->N * m_ptr->n);
+        ar << boost::serialization::make_array(m_ptr->labels, m_ptr->N * m_ptr->m);
+    }
+    template <typename Archive>
+    void load(Archive &ar, unsigned)
+    {
+        std::string shm_name;
+        ar >> shm_name;
+        if (!shm_name.empty()) {
+            *this = from_shared_memory(shm_name);
+            return;
+        }
+        auto tmp = std::make_shared<impl>();
+        ar >> tmp->n;
+        ar >> tmp->m;
+        ar >> tmp->N;
+        tmp->points_buffer.resize(tmp->N * tmp->n);
+        tmp->labels_buffer.resize(tmp->N * tmp->m);
+        ar >> boost::serialization::make_array(tmp->points_buffer.data(), tmp->points_buffer.size());
+        ar >> boost::serialization::make_array(tmp->labels_buffer.data(), tmp->labels_buffer.size());
+        tmp->init();
+        m_ptr = std::move(tmp);
+    }
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+
+private:
+    struct impl {
+        // Fills in the data stored column by column, the hash and the pointers from the buffers of the data stored
+        // row by row
+        void init()
+        {
+            points = points_buffer.data();
+            labels = labels_buffer.data();
+            hash = 0u;
+            boost::hash_combine(hash, n);
+            boost::hash_combine(hash, m);
+            boost::hash_combine(hash, N);
+            boost::hash_range(hash, points_buffer.begin(), points_buffer.end());
+            boost::hash_range(hash, labels_buffer.begin(), labels_buffer.end());
+            // Columns are padded so that they all start at aligned addresses
+            constexpr std::size_t pad = alignment / sizeof(double);
+            stride = (N + pad - 1u) / pad * pad;
+            pointsT_buffer.assign(n * stride, 0.);
+            labelsT_buffer.assign(m * stride, 0.);
+            for (std::size_t i = 0u; i < N; ++i) {
+                for (unsigned j = 0u; j < n; ++j) {
+                    pointsT_buffer[j * stride + i] = points[i * n + j];
+                }
+                for (unsigned j = 0u; j < m; ++j) {
+                    labelsT_buffer[j * stride + i] = labels[i * m + j];
+                }
+            }
+            pointsT = pointsT_buffer.data();
+            labelsT = labelsT_buffer.data();
+        }
+        // FNV-1a checksum of the dimensions and of the row by row data, computed on the first call
+        std::uint64_t get_checksum() const
+        {
+            std::call_once(checksum_flag, [this]() {
+                std::uint64_t c = 14695981039346656037ull;
+                auto add = [&c](const void *data, std::size_t size) {
+                    const auto bytes = static_cast<const unsigned char *>(data);
+                    for (std::size_t i = 0u; i < size; ++i) {
+                        c = (c ^ bytes[i]) * 1099511628211ull;
+                    }
+                };
+                const std::uint64_t dims[3] = {n, m, N};
+                add(dims, sizeof(dims));
+                add(points, N * n * sizeof(double));
+                add(labels, N * m * sizeof(double));
+                checksum = c;
+            });
+            return checksum;
+        }
+        // Sets all members from the binary image (see dataset::to_file()) held in the mapped region. The
+        // description of the source is used in the error messages.
+        void read_image(const std::string &source)
+        {
+            const auto base = static_cast<const char *>(region.get_address());
+            const std::uint64_t size = region.get_size();
+            detail::dataset_file_header h;
+            if (size < sizeof(h)) {
+                throw std::invalid_argument("The content of " + source + " is too short to be a dataset.");
+            }
+            std::memcpy(&h, base, sizeof(h));
+            if (std::memcmp(h.magic, detail::dataset_file_magic, sizeof(h.magic)) != 0
+                || h.version != detail::dataset_file_version) {
+                throw std::invalid_argument("The content of " + source
+                                            + " is not a dataset (or has an unknown version).");
+            }
+            if (h.dtype != 0u) {
+                throw std::invalid_argument("The content of " + source + " has values of type "
+                                            + std::to_string(h.dtype) + ", while only float64 (0) is supported.");
+            }
+            constexpr std::size_t pad = alignment / sizeof(double);
+            // Checks that the block of rows * cols values starting at offset lies in the region, testing the
+            // product by division so that it cannot overflow
+            auto block_ok = [size](std::uint64_t offset, std::uint64_t rows, std::uint64_t cols) {
+                if (offset % alignment != 0u || offset > size) {
+                    return false;
+                }
+                const std::uint64_t max_values = (size - offset) / sizeof(double);
+                return rows == 0u || cols <= max_values / rows;
+            };
+            if (h.n > std::numeric_limits<unsigned>::max() || h.m > std::numeric_limits<unsigned>::max()
+                || static_cast<std::size_t>(h.N) != h.N || static_cast<std::size_t>(h.stride) != h.stride) {
+                throw std::invalid_argument("The header of " + source + " has out of range dimensions.");
+            }
+            if (h.stride < h.N || h.stride % pad != 0u || !block_ok(h.points_offset, h.N, h.n)
+                || !block_ok(h.labels_offset, h.N, h.m) || !block_ok(h.pointsT_offset, h.n, h.stride)
+                || !block_ok(h.labelsT_offset, h.m, h.stride)) {
+                throw std::invalid_argument("The header of " + source + " is inconsistent.");
+            }
+            n = static_cast<unsigned>(h.n);
+            m = static_cast<unsigned>(h.m);
+            N = static_cast<std::size_t>(h.N);
+            stride = static_cast<std::size_t>(h.stride);
+            hash = static_cast<std::size_t>(h.hash);
+            points = reinterpret_cast<const double *>(base + h.points_offset);
+            labels = reinterpret_cast<const double *>(base + h.labels_offset);
+            pointsT = reinterpret_cast<const double *>(base + h.pointsT_offset);
+            labelsT = reinterpret_cast<const double *>(base + h.labelsT_offset);
+        }
+        unsigned n = 0u;
+        unsigned m = 0u;
+        std::size_t N = 0u;
+        std::size_t hash = 0u;
+        // Checksum of the content, computed on demand (see dataset::get_checksum())
+        mutable std::once_flag checksum_flag;
+        mutable std::uint64_t checksum = 0u;
+        // Distance between the starts of two consecutive columns
+        std::size_t stride = 0u;
+        // Data stored row by row
+        const double *points = nullptr;
+        const double *labels = nullptr;
+        // Data stored column by column
+        const double *pointsT = nullptr;
+        const double *labelsT = nullptr;
+        // Storage of the data, when owned
+        buffer_type points_buffer;
+        buffer_type labels_buffer;
+        buffer_type pointsT_buffer;
+        buffer_type labelsT_buffer;
+        // Storage of the data, when memory mapped from a file or from shared memory
+        boost::interprocess::mapped_region region;
+        // Name of the shared memory object holding the data (empty if not in shared memory)
+        std::string shm_name;
+    };
+
+    // Builds the binary image of the dataset (see to_file()), passing its header and data blocks, in order, to
+    // w(offset, data, size)
+    template <typename Writer>
+    void write_image(Writer &&w) const
+    {
+        const auto &d = *m_ptr;
+        auto align = [](std::uint64_t offset) { return (offset + alignment - 1u) / alignment * alignment; };
+        detail::dataset_file_header h;
+        std::memcpy(h.magic, detail::dataset_file_magic, sizeof(h.magic));
+        h.version = detail::dataset_file_version;
+        h.dtype = 0u;
+        h.n = d.n;
+        h.m = d.m;
+        h.N = d.N;
+        h.stride = d.stride;
+        h.hash = d.hash;
+        h.points_offset = align(sizeof(h));
+        h.labels_offset = align(h.points_offset + d.N * d.n * sizeof(double));
+        h.pointsT_offset = align(h.labels_offset + d.N * d.m * sizeof(double));
+        h.labelsT_offset = align(h.pointsT_offset + d.n * d.stride * sizeof(double));
+        w(0u, &h, sizeof(h));
+        w(h.points_offset, d.points, d.N * d.n * sizeof(double));
+        w(h.labels_offset, d.labels, d.N * d.m * sizeof(double));
+        w(h.pointsT_offset, d.pointsT, d.n * d.stride * sizeof(double));
+        w(h.labelsT_offset, d.labelsT, d.m * d.stride * sizeof(double));
+    }
+    // Compares the content of a registered dataset with a reference to it
+    static bool same_content(const impl &d, const reference &ref)
+    {
+        if (d.n != ref.n || d.m != ref.m || d.N != ref.N) {
+            return false;
+        }
+        return d.get_checksum() == ref.checksum;
+    }
+    // The process-local registry
+    struct registry {
+        std::mutex mutex;
+        std::unordered_map<std::size_t, std::shared_ptr<const impl>> entries;
+    };
+    static registry &get_registry()
+    {
+        static registry reg;
+        return reg;
+    }
+
+    std::shared_ptr<const impl> m_ptr;
+};
+
+} // end of namespace dcgp
+
+#endif // DCGP_DATASET_H
@@ -2,6 +2,7 @@
 #define DCGP_H
 
 #include <dcgp/config.hpp>
+#include <dcgp/dataset.hpp>
 #include <dcgp/expression.hpp>
 #include <dcgp/expression_ann.hpp>
 #include <dcgp/expression_weighted.hpp>
@@ -2,9 +2,15 @@
 #define DCGP_EXPRESSION_H
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
 #include <functional>
 #include <initializer_list>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <mutex>
 #include <random>
 #include <sstream>
 #include <stdexcept>
@@ -13,8 +19,8 @@
 
 #include <audi/audi.hpp>
 
-#include <tbb/parallel_for.h>
-#include <tbb/spin_mutex.h>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_reduce.h>
 
 #include <boost/optional.hpp>
 /* This <boost/serialization/version.hpp> include guards against an issue
@@ -28,6 +34,7 @@
 #include <boost/serialization/version.hpp>
 
 #include <dcgp/config.hpp>
+#include <dcgp/dataset.hpp>
 #include <dcgp/kernel.hpp>
 #include <dcgp/kernel_set.hpp>
 #include <dcgp/rng.hpp>
@@ -57,6 +64,8 @@ private:
     template <typename U>
     using functor_enabler = typename std::enable_if<
         std::is_same<U, double>::value || is_gdual<T>::value || std::is_same<U, std::string>::value, int>::type;
+    template <typename U>
+    using double_enabler = typename std::enable_if<std::is_same<U, double>::value, int>::type;
 
 public:
     // Phenotype Correction function type. This is a dcgp function, but in the arguments it makes use of a std function
@@ -70,6 +79,16 @@ public:
         // Cross-Entropy
         CE
     };
+    /// Floating point rules of the simplified evaluation (see set_fp_rules())
+    enum class fp_rules {
+        /// No simplification: every active node is evaluated
+        none,
+        /// Constant folding and the identities holding for all doubles: the results are unchanged, bit by bit
+        exact,
+        /// Also the identities holding for finite values only, ignoring the sign of zero (as -ffast-math), and the
+        /// vectorized exponential in evaluate_batch()
+        fast
+    };
 
     /// Constructor
     /** Constructs a dCGP expression with variable arity
@@ -226,31 +245,20 @@ public:
      */
     virtual std::vector<std::string> operator()(const std::vector<std::string> &in) const
     {
-        std::vector<std::string> point(in);
-        point.insert(point.end(), m_eph_symb.begin(), m_eph_symb.end());
-        if (point.size() != m_n) {
+        if (in.size() + m_eph_symb.size() != m_n) {
             throw std::invalid_argument("Input size is incompatible");
         }
+        ensure_tapes();
         std::vector<std::string> retval(m_m);
-        std::vector<std::string> node(m_n + m_r * m_c);
-        std::vector<std::string> function_in;
-
-        for (auto node_id : m_active_nodes) {
-            if (node_id < m_n) {
-                node[node_id] = point[node_id];
-            } else {
-                unsigned arity = _get_arity(node_id);
-                function_in.resize(arity);
-                unsigned idx = m_gene_idx[node_id]; // position in the chromosome of the current node
-                for (auto j = 0u; j < arity; ++j) {
-                    function_in[j] = node[m_x[idx + j + 1u]];
-                }
-                node[node_id] = m_f[m_x[idx]](function_in);
+        with_tape_workspace<std::string>([&](tape_workspace<std::string> &ws) {
+            ws.slots.resize(m_tapes.tape_size);
+            std::copy(in.begin(), in.end(), ws.slots.begin());
+            std::copy(m_eph_symb.begin(), m_eph_symb.end(), ws.slots.begin() + static_cast<std::ptrdiff_t>(in.size()));
+            run_tape(ws.slots, ws.function_in);
+            for (auto i = 0u; i < m_m; ++i) {
+                retval[i] = ws.slots[m_tapes.tape_out[i]];
             }
-        }
-        for (auto i = 0u; i < m_m; ++i) {
-            retval[i] = node[m_x[m_x.size() - m_m + i]];
-        }
+        });
         return retval;
     }
 
@@ -269,6 +277,580 @@ public:
         return (*this)(dummy);
     }
 
+    /// Evaluates the dCGP expression over a batch of points (columnar)
+    /**
+     * Evaluates the dCGP expression over \p N points stored column by column: \p in[i] points to the \p N values of
+     * the i-th input and \p out[j] to a caller-provided buffer that will receive the \p N values of the j-th output.
+     * The points are processed in blocks and, within each block, every active node is computed over all points
+     * before moving to the next one, using the batch version of its kernel when available (see kernel::batch()).
+     * No memory is allocated per point. If a phenotype correction is set, the points are instead evaluated one at a
+     * time via operator().
+     *
+     * @param[in] in pointers to the input columns (ephemeral constants excluded).
+     * @param[out] out pointers to the output columns.
+     * @param[in] N number of points.
+     *
+     * @throw std::invalid_argument if the number of input or output columns is incompatible.
+     */
+    template <typename U = T, typename std::enable_if<std::is_same<U, double>::value, int>::type = 0>
+    void evaluate_batch(const std::vector<const double *> &in, const std::vector<double *> &out, std::size_t N) const
+    {
+        const auto n_in = static_cast<unsigned>(m_n - m_eph_val.size());
+        if (in.size() != n_in) {
+            throw std::invalid_argument("Input size is incompatible, number of input columns is: "
+                                        + std::to_string(in.size()) + " while I expected: " + std::to_string(n_in));
+        }
+        if (out.size() != m_m) {
+            throw std::invalid_argument("Output size is incompatible, number of output columns is: "
+                                        + std::to_string(out.size()) + " while I expected: " + std::to_string(m_m));
+        }
+        if (m_phenotype_correction) {
+            std::vector<double> point(n_in);
+            for (decltype(N) k = 0u; k < N; ++k) {
+                for (auto i = 0u; i < n_in; ++i) {
+                    point[i] = in[i][k];
+                }
+                auto res = (*this)(point);
+                for (auto j = 0u; j < m_m; ++j) {
+                    out[j][k] = res[j];
+                }
+            }
+            return;
+        }
+        ensure_tapes();
+        run_tape_batch(m_tapes.simple_tape, m_tapes.simple_tape_size, m_tapes.simple_tape_out, in, {}, out, N,
+                       m_tapes.simple_constants, m_fp_rules == fp_rules::fast);
+    }
+
+    /// Evaluates the dCGP expression over a batch of points (columnar)
+    /**
+     * Evaluates the dCGP expression over a dataset stored column by column. The output buffers are resized
+     * (only when needed) to contain one column of the same size as the input ones per each output.
+     *
+     * @param[in] in the input columns (ephemeral constants excluded), all of the same size.
+     * @param[out] out the output columns.
+     *
+     * @throw std::invalid_argument if the number of input columns is incompatible, or if their sizes differ.
+     */
+    template <typename U = T, typename std::enable_if<std::is_same<U, double>::value, int>::type = 0>
+    void evaluate_batch(const std::vector<std::vector<double>> &in, std::vector<std::vector<double>> &out) const
+    {
+        const auto N = in.size() ? in[0].size() : 0u;
+        if (!std::all_of(in.begin(), in.end(), [N](const std::vector<double> &col) { return col.size() == N; })) {
+            throw std::invalid_argument("All input columns must have the same size, while I detect differences.");
+        }
+        out.resize(m_m);
+        std::vector<const double *> in_ptrs(in.size());
+        std::vector<double *> out_ptrs(m_m);
+        for (decltype(in.size()) i = 0u; i < in.size(); ++i) {
+            in_ptrs[i] = in[i].data();
+        }
+        for (auto j = 0u; j < m_m; ++j) {
+            out[j].resize(N);
+            out_ptrs[j] = out[j].data();
+        }
+        evaluate_batch(in_ptrs, out_ptrs, N);
+    }
+
+    /// Gradient of a loss w.r.t. the ephemeral constants (reverse mode)
+    /**
+     * Evaluates the dCGP expression over \p N points stored column by column (as in evaluate_batch()) and computes,
+     * by reverse mode differentiation, the gradient of the total loss with respect to all the ephemeral constants.
+     * Points are processed in blocks: a forward sweep stores the value of every active node, then \p loss is called
+     * with the output columns of the block and a backward sweep propagates its derivatives down to the constants.
+     * The cost is thus independent of the number of ephemeral constants.
+     *
+     * \p loss must be callable as <tt>double loss(const double *const *y, double *const *dy, std::size_t offset,
+     * std::size_t b)</tt>: \p y[j] points to the \p b values of the j-th output for the points [\p offset,
+     * \p offset + \p b), and the function must write in \p dy[j] the derivatives of the loss with respect to them
+     * and return the loss summed over the block.
+     *
+     * Only built-in kernels (see kernel::get_id()) are supported, since their derivatives are known. Where a kernel
+     * is not differentiable the derivative of one of its branches is used, and the protected division is considered
+     * constant where the protection kicks in.
+     *
+     * @param[in] in pointers to the input columns (ephemeral constants excluded).
+     * @param[in] N number of points.
+     * @param[in] loss the loss of a block of points (see above).
+     * @param[out] grad the gradient of the total loss with respect to the ephemeral constants.
+     *
+     * @return the loss summed over all the points.
+     *
+     * @throw std::invalid_argument if the number of input columns is incompatible, if an active node has a
+     * user-defined kernel or if a phenotype correction is set.
+     */
+    template <typename F, typename U = T, typename std::enable_if<std::is_same<U, double>::value, int>::type = 0>
+    double eph_gradient_batch(const std::vector<const double *> &in, std::size_t N, F &&loss,
+                              std::vector<double> &grad) const
+    {
+        const auto n_in = static_cast<unsigned>(m_n - m_eph_val.size());
+        if (in.size() != n_in) {
+            throw std::invalid_argument("Input size is incompatible, number of input columns is: "
+                                        + std::to_string(in.size()) + " while I expected: " + std::to_string(n_in));
+        }
+        if (m_phenotype_correction) {
+            throw std::invalid_argument("Reverse mode differentiation is not available with a phenotype correction");
+        }
+        // Position of each active node in the workspace (inputs excluded, as they are read from in)
+        std::vector<unsigned> pos(m_n + m_r * m_c, 0u);
+        std::vector<kernel_id> ids;
+        unsigned n_nodes = 0u;
+        for (auto node_id : m_active_nodes) {
+            if (node_id < n_in) {
+                continue;
+            }
+            pos[node_id] = n_nodes++;
+            if (node_id >= m_n) {
+                ids.push_back(m_f[m_x[m_gene_idx[node_id]]].get_id());
+                if (ids.back() == kernel_id::user) {
+                    throw std::invalid_argument("Reverse mode differentiation is not available for the kernel: "
+                                                + m_f[m_x[m_gene_idx[node_id]]].get_name());
+                }
+            }
+        }
+        grad.assign(m_eph_val.size(), 0.);
+        double retval = 0.;
+        constexpr std::size_t block = 256u;
+        with_tape_workspace<double>([&](tape_workspace<double> &ws) {
+            // Each active node (inputs excluded) has a column of values and one of adjoints of block size
+            ws.slots.resize(n_nodes * block);
+            ws.adjoints.resize(n_nodes * block);
+            std::vector<const double *> y(m_m);
+            std::vector<double *> dy(m_m);
+            for (auto i = n_in; i < m_n; ++i) {
+                if (is_active_node(i)) {
+                    std::fill(ws.slots.begin() + static_cast<std::ptrdiff_t>(pos[i] * block),
+                              ws.slots.begin() + static_cast<std::ptrdiff_t>((pos[i] + 1u) * block),
+                              m_eph_val[i - n_in]);
+                }
+            }
+            for (decltype(N) start = 0u; start < N; start += block) {
+                const auto b = std::min(block, N - start);
+                auto value = [&](unsigned node_id) -> const double * {
+                    return node_id < n_in ? in[node_id] + start : ws.slots.data() + pos[node_id] * block;
+                };
+                // Forward sweep
+                auto id_it = ids.begin();
+                for (auto node_id : m_active_nodes) {
+                    if (node_id < m_n) {
+                        continue;
+                    }
+                    const auto idx = m_gene_idx[node_id];
+                    const auto arity = _get_arity(node_id);
+                    ws.columns.resize(arity);
+                    ws.function_in.resize(arity);
+                    for (auto j = 0u; j < arity; ++j) {
+                        ws.columns[j] = value(m_x[idx + 1u + j]);
+                    }
+                    const auto &f = m_f[m_x[idx]];
+                    double *o = ws.slots.data() + pos[node_id] * block;
+                    if (f.has_batch()) {
+                        f.batch(ws.columns.data(), arity, o, b);
+                    } else {
+                        for (decltype(N) k = 0u; k < b; ++k) {
+                            for (auto j = 0u; j < arity; ++j) {
+                                ws.function_in[j] = ws.columns[j][k];
+                            }
+                            o[k] = f(ws.function_in);
+                        }
+                    }
+                    ++id_it;
+                }
+                // Seeding of the adjoints with the derivatives of the loss (an output may be an input of the
+                // expression, or be repeated, hence the separate buffer)
+                std::fill(ws.adjoints.begin(), ws.adjoints.end(), 0.);
+                ws.output_adjoints.resize(m_m * block);
+                for (auto j = 0u; j < m_m; ++j) {
+                    y[j] = value(m_x[m_x.size() - m_m + j]);
+                    dy[j] = ws.output_adjoints.data() + j * block;
+                }
+                retval += loss(y.data(), dy.data(), start, b);
+                for (auto j = 0u; j < m_m; ++j) {
+                    const auto node_id = m_x[m_x.size() - m_m + j];
+                    if (node_id >= n_in) {
+                        auto adj = ws.adjoints.data() + pos[node_id] * block;
+                        for (decltype(N) k = 0u; k < b; ++k) {
+                            adj[k] += dy[j][k];
+                        }
+                    }
+                }
+                // Backward sweep
+                for (auto it = m_active_nodes.rbegin(); it != m_active_nodes.rend(); ++it) {
+                    const auto node_id = *it;
+                    if (node_id < m_n) {
+                        break;
+                    }
+                    --id_it;
+                    const auto idx = m_gene_idx[node_id];
+                    const auto arity = _get_arity(node_id);
+                    const double *v = ws.slots.data() + pos[node_id] * block;
+                    const double *adj = ws.adjoints.data() + pos[node_id] * block;
+                    ws.columns.resize(arity);
+                    ws.function_in.resize(arity);
+                    ws.partials.resize(arity);
+                    for (auto j = 0u; j < arity; ++j) {
+                        ws.columns[j] = value(m_x[idx + 1u + j]);
+                    }
+                    for (decltype(N) k = 0u; k < b; ++k) {
+                        for (auto j = 0u; j < arity; ++j) {
+                            ws.function_in[j] = ws.columns[j][k];
+                        }
+                        kernel_partials(*id_it, ws.function_in.data(), arity, v[k], ws.partials.data());
+                        for (auto j = 0u; j < arity; ++j) {
+                            const auto in_node = m_x[idx + 1u + j];
+                            if (in_node >= n_in) {
+                                ws.adjoints[pos[in_node] * block + k] += adj[k] * ws.partials[j];
+                            }
+                        }
+                    }
+                }
+                // The adjoints of the ephemeral constants are accumulated in the gradient
+                for (auto i = n_in; i < m_n; ++i) {
+                    if (is_active_node(i)) {
+                        const double *adj = ws.adjoints.data() + pos[i] * block;
+                        for (decltype(N) k = 0u; k < b; ++k) {
+                            grad[i - n_in] += adj[k];
+                        }
+                    }
+                }
+            }
+        });
+        return retval;
+    }
+
+    /// Gets the eph frontier
+    /**
+     * The eph frontier is made of the active function nodes whose value does not depend on the ephemeral constants,
+     * and that are read by nodes depending on them or by the outputs. Their values can be computed once for a
+     * given chromosome and point (see eph_frontier()) and reused while only the ephemeral constants change (see
+     * operator()(const std::vector<T> &, const std::vector<T> &)), so that only the nodes depending on the
+     * ephemeral constants are evaluated.
+     *
+     * @return the ids of the nodes in the eph frontier (sorted).
+     */
+    const std::vector<unsigned> &get_eph_frontier() const
+    {
+        ensure_tapes();
+        return m_tapes.eph_frontier;
+    }
+
+    /// Evaluates the eph frontier
+    /**
+     * Evaluates the nodes of the eph frontier (see get_eph_frontier()) in \p point. The phenotype correction, if
+     * any, is ignored.
+     *
+     * @param[in] point the input values (ephemeral constants excluded).
+     *
+     * @return the values of the nodes in the eph frontier.
+     *
+     * @throw std::invalid_argument if the size of \p point is incompatible.
+     */
+    std::vector<T> eph_frontier(const std::vector<T> &point) const
+    {
+        if (point.size() + m_eph_val.size() != m_n) {
+            throw std::invalid_argument("Input size is incompatible");
+        }
+        ensure_tapes();
+        std::vector<T> retval(m_tapes.eph_frontier.size());
+        with_tape_workspace<T>([&](tape_workspace<T> &ws) {
+            ws.slots.resize(m_tapes.frontier_tape_size);
+            std::copy(point.begin(), point.end(), ws.slots.begin());
+            run_tape(m_tapes.frontier_tape, ws.slots, ws.function_in);
+            for (decltype(retval.size()) i = 0u; i < retval.size(); ++i) {
+                retval[i] = ws.slots[m_tapes.frontier_tape_out[i]];
+            }
+        });
+        return retval;
+    }
+
+    /// Evaluates the dCGP expression given its eph frontier
+    /**
+     * Evaluates the dCGP expression in \p point reading the values of the nodes in the eph frontier (see
+     * get_eph_frontier()) from \p frontier, as returned by eph_frontier() for the same point and chromosome, so
+     * that only the nodes depending on the ephemeral constants are evaluated.
+     *
+     * @param[in] point the input values (ephemeral constants excluded).
+     * @param[in] frontier the values of the nodes in the eph frontier.
+     *
+     * @return the value of the expression.
+     *
+     * @throw std::invalid_argument if the size of \p point or of \p frontier are incompatible, or if a phenotype
+     * correction is set.
+     */
+    std::vector<T> operator()(const std::vector<T> &point, const std::vector<T> &frontier) const
+    {
+        if (point.size() + m_eph_val.size() != m_n) {
+            throw std::invalid_argument("Input size is incompatible");
+        }
+        ensure_tapes();
+        if (frontier.size() != m_tapes.eph_frontier.size()) {
+            throw std::invalid_argument("The eph frontier size is incompatible, it is: " + std::to_string(frontier.size())
+                                        + " while I expected: " + std::to_string(m_tapes.eph_frontier.size()));
+        }
+        if (m_phenotype_correction) {
+            throw std::invalid_argument("The eph frontier cannot be used with a phenotype correction");
+        }
+        std::vector<T> retval(m_m);
+        with_tape_workspace<T>([&](tape_workspace<T> &ws) {
+            ws.slots.resize(m_tapes.dep_tape_size);
+            auto it = std::copy(point.begin(), point.end(), ws.slots.begin());
+            it = std::copy(m_eph_val.begin(), m_eph_val.end(), it);
+            std::copy(frontier.begin(), frontier.end(), it);
+            run_tape(m_tapes.dep_tape, ws.slots, ws.function_in);
+            for (auto i = 0u; i < m_m; ++i) {
+                retval[i] = ws.slots[m_tapes.dep_tape_out[i]];
+            }
+        });
+        return retval;
+    }
+
+    /// Evaluates the eph frontier over a batch of points (columnar)
+    /**
+     * Evaluates the nodes of the eph frontier (see get_eph_frontier()) over \p N points stored column by column,
+     * as evaluate_batch() does for the outputs. The phenotype correction, if any, is ignored.
+     *
+     * @param[in] in pointers to the input columns (ephemeral constants excluded).
+     * @param[out] out pointers to the columns of the nodes in the eph frontier.
+     * @param[in] N number of points.
+     *
+     * @throw std::invalid_argument if the number of input or output columns is incompatible.
+     */
+    template <typename U = T, typename std::enable_if<std::is_same<U, double>::value, int>::type = 0>
+    void eph_frontier_batch(const std::vector<const double *> &in, const std::vector<double *> &out,
+                            std::size_t N) const
+    {
+        const auto n_in = static_cast<unsigned>(m_n - m_eph_val.size());
+        if (in.size() != n_in) {
+            throw std::invalid_argument("Input size is incompatible, number of input columns is: "
+                                        + std::to_string(in.size()) + " while I expected: " + std::to_string(n_in));
+        }
+        ensure_tapes();
+        if (out.size() != m_tapes.eph_frontier.size()) {
+            throw std::invalid_argument("Output size is incompatible, number of output columns is: "
+                                        + std::to_string(out.size())
+                                        + " while I expected: " + std::to_string(m_tapes.eph_frontier.size()));
+        }
+        run_tape_batch(m_tapes.frontier_tape, m_tapes.frontier_tape_size, m_tapes.frontier_tape_out, in, {}, out, N);
+    }
+
+    /// Evaluates the dCGP expression over a batch of points (columnar) given its eph frontier
+    /**
+     * As evaluate_batch(), but reading the columns of the nodes in the eph frontier from \p frontier, as computed
+     * by eph_frontier_batch() for the same points and chromosome, so that only the nodes depending on the ephemeral
+     * constants are evaluated.
+     *
+     * @param[in] in pointers to the input columns (ephemeral constants excluded).
+     * @param[in] frontier pointers to the columns of the nodes in the eph frontier.
+     * @param[out] out pointers to the output columns.
+     * @param[in] N number of points.
+     *
+     * @throw std::invalid_argument if the number of input, eph frontier or output columns is incompatible, or if a
+     * phenotype correction is set.
+     */
+    template <typename U = T, typename std::enable_if<std::is_same<U, double>::value, int>::type = 0>
+    void evaluate_batch(const std::vector<const double *> &in, const std::vector<const double *> &frontier,
+                        const std::vector<double *> &out, std::size_t N) const
+    {
+        const auto n_in = static_cast<unsigned>(m_n - m_eph_val.size());
+        if (in.size() != n_in) {
+            throw std::invalid_argument("Input size is incompatible, number of input columns is: "
+                                        + std::to_string(in.size()) + " while I expected: " + std::to_string(n_in));
+        }
+        ensure_tapes();
+        if (frontier.size() != m_tapes.eph_frontier.size()) {
+            throw std::invalid_argument("The eph frontier size is incompatible, it is: " + std::to_string(frontier.size())
+                                        + " while I expected: " + std::to_string(m_tapes.eph_frontier.size()));
+        }
+        if (out.size() != m_m) {
+            throw std::invalid_argument("Output size is incompatible, number of output columns is: "
+                                        + std::to_string(out.size()) + " while I expected: " + std::to_string(m_m));
+        }
+        if (m_phenotype_correction) {
+            throw std::invalid_argument("The eph frontier cannot be used with a phenotype correction");
+        }
+        run_tape_batch(m_tapes.dep_tape, m_tapes.dep_tape_size, m_tapes.dep_tape_out, in, frontier, out, N);
+    }
+
+    /// Flags the nodes unchanged with respect to another chromosome
+    /**
+     * A node is unchanged when it has the same value in this expression and in the one (having the same kernels)
+     * encoded by \p x with ephemeral constants \p eph_val. These are the inputs, the ephemeral constants having the
+     * same value (bit by bit, for doubles) and the active function nodes having the same function and connection
+     * genes, all pointing to unchanged nodes. Everything downstream of a mutated gene is thus flagged as changed.
+     * Only the active nodes are visited.
+     *
+     * @param[in] x the other chromosome.
+     * @param[in] eph_val the ephemeral constants of the other chromosome.
+     *
+     * @return one flag per node (false for the inactive function nodes).
+     *
+     * @throw std::invalid_argument if the size of \p x or of \p eph_val is incompatible.
+     */
+    std::vector<bool> unchanged_nodes(const std::vector<unsigned> &x, const std::vector<T> &eph_val) const
+    {
+        if (x.size() != m_x.size()) {
+            throw std::invalid_argument("The chromosome size is incompatible, it is: " + std::to_string(x.size())
+                                        + " while I expected: " + std::to_string(m_x.size()));
+        }
+        if (eph_val.size() != m_eph_val.size()) {
+            throw std::invalid_argument("The number of ephemeral constants is incompatible, it is: "
+                                        + std::to_string(eph_val.size())
+                                        + " while I expected: " + std::to_string(m_eph_val.size()));
+        }
+        const auto n_in = static_cast<unsigned>(m_n - m_eph_val.size());
+        std::vector<bool> retval(m_n + m_r * m_c, false);
+        for (auto node_id : m_active_nodes) {
+            if (node_id < m_n) {
+                if (node_id < n_in) {
+                    retval[node_id] = true;
+                } else if constexpr (std::is_same<T, double>::value) {
+                    // (bit by bit, as -0. and 0. may give different values downstream)
+                    retval[node_id]
+                        = std::memcmp(&m_eph_val[node_id - n_in], &eph_val[node_id - n_in], sizeof(double)) == 0;
+                } else {
+                    retval[node_id] = m_eph_val[node_id - n_in] == eph_val[node_id - n_in];
+                }
+                continue;
+            }
+            const auto idx = m_gene_idx[node_id];
+            bool unchanged = m_x[idx] == x[idx];
+            for (auto j = 1u; unchanged && j <= _get_arity(node_id); ++j) {
+                unchanged = m_x[idx + j] == x[idx + j] && retval[m_x[idx + j]];
+            }
+            retval[node_id] = unchanged;
+        }
+        return retval;
+    }
+
+    /// The compiled evaluation of some function nodes (see compile_nodes())
+    struct nodes_tape {
+        std::vector<unsigned> tape;
+        std::vector<unsigned> tape_out;
+        unsigned size = 0u;
+        std::size_t n_known = 0u;
+    };
+
+    /// Compiles the evaluation of some function nodes
+    /**
+     * Checks and compiles the evaluation of the function nodes in \p nodes, reading the columns of the function
+     * nodes in \p known and writing the ones in \p outs (see nodes_batch()). The nodes in \p nodes must be sorted
+     * and may only read the inputs, the ephemeral constants, the nodes in \p known and the ones preceding them in
+     * \p nodes.
+     *
+     * The result can be run over any number of batches, as long as the chromosome is not changed (the ephemeral
+     * constants are read when running it). The nodes are compiled as they are in the active graph, whatever the
+     * floating point rules (see set_fp_rules()).
+     *
+     * @param[in] known the ids of the nodes whose columns are known.
+     * @param[in] nodes the ids of the nodes to evaluate.
+     * @param[in] outs the ids of the nodes, among \p nodes, whose columns are written.
+     *
+     * @return the compiled evaluation.
+     *
+     * @throw std::invalid_argument if a node in \p nodes is not a function node or reads a node it cannot, if a node
+     * in \p outs is not in \p nodes, or if a phenotype correction is set.
+     */
+    nodes_tape compile_nodes(const std::vector<unsigned> &known, const std::vector<unsigned> &nodes,
+                             const std::vector<unsigned> &outs) const
+    {
+        if (m_phenotype_correction) {
+            throw std::invalid_argument("The nodes cannot be evaluated separately with a phenotype correction");
+        }
+        std::vector<bool> available(m_n + m_r * m_c, false);
+        std::fill(available.begin(), available.begin() + m_n, true);
+        for (auto node_id : known) {
+            if (node_id < m_n || node_id >= available.size()) {
+                throw std::invalid_argument("The node " + std::to_string(node_id) + " is not a function node");
+            }
+            available[node_id] = true;
+        }
+        for (auto node_id : nodes) {
+            if (node_id < m_n || node_id >= available.size()) {
+                throw std::invalid_argument("The node " + std::to_string(node_id) + " is not a function node");
+            }
+            for (auto j = 1u; j <= _get_arity(node_id); ++j) {
+                if (!available[m_x[m_gene_idx[node_id] + j]]) {
+                    throw std::invalid_argument("The node " + std::to_string(node_id) + " reads the node "
+                                                + std::to_string(m_x[m_gene_idx[node_id] + j])
+                                                + ", which is neither known nor evaluated before it");
+                }
+            }
+            available[node_id] = true;
+        }
+        for (auto node_id : outs) {
+            if (!std::binary_search(nodes.begin(), nodes.end(), node_id)) {
+                throw std::invalid_argument("The output node " + std::to_string(node_id) + " is not evaluated");
+            }
+        }
+        nodes_tape retval;
+        tape_buffers buffers;
+        buffers.resize(m_n + m_r * m_c);
+        retval.size = compile_tape(nodes, known, outs, retval.tape, retval.tape_out, buffers);
+        retval.n_known = known.size();
+        return retval;
+    }
+
+    /// Evaluates some function nodes over a batch of points (columnar)
+    /**
+     * Computes the function nodes in \p nodes over \p N points stored column by column, reading the columns of the
+     * function nodes in \p known from \p known_columns, and writes the columns of the ones in \p outs. The nodes in
+     * \p nodes must be sorted and may only read the inputs, the ephemeral constants, the nodes in \p known and the
+     * ones preceding them in \p nodes. The nodes not in \p outs are only kept for the current block of points.
+     *
+     * Together with unchanged_nodes(), this allows to evaluate a mutated chromosome recomputing only the active
+     * nodes downstream of the mutated genes and reading the others from the columns computed for the original one.
+     * When the same nodes are evaluated over several batches, compile them once with compile_nodes() and use
+     * nodes_batch(const nodes_tape &, const std::vector<const double *> &, const std::vector<const double *> &,
+     * const std::vector<double *> &, std::size_t) const.
+     *
+     * @param[in] in pointers to the input columns (ephemeral constants excluded).
+     * @param[in] known the ids of the nodes whose columns are known.
+     * @param[in] known_columns pointers to the columns of the nodes in \p known.
+     * @param[in] nodes the ids of the nodes to evaluate.
+     * @param[in] outs the ids of the nodes, among \p nodes, whose columns are written.
+     * @param[out] out pointers to the columns of the nodes in \p outs.
+     * @param[in] N number of points.
+     *
+     * @throw std::invalid_argument if the number of columns is incompatible, if a node in \p nodes is not a
+     * function node or reads a node it cannot, if a node in \p outs is not in \p nodes, or if a phenotype
+     * correction is set.
+     */
+    template <typename U = T, typename std::enable_if<std::is_same<U, double>::value, int>::type = 0>
+    void nodes_batch(const std::vector<const double *> &in, const std::vector<unsigned> &known,
+                     const std::vector<const double *> &known_columns, const std::vector<unsigned> &nodes,
+                     const std::vector<unsigned> &outs, const std::vector<double *> &out, std::size_t N) const
+    {
+        nodes_batch(compile_nodes(known, nodes, outs), in, known_columns, out, N);
+    }
+
+    /// Evaluates compiled function nodes over a batch of points (columnar)
+    /**
+     * As the other overload, running the evaluation compiled by compile_nodes().
+     *
+     * @param[in] tape the compiled evaluation.
+     * @param[in] in pointers to the input columns (ephemeral constants excluded).
+     * @param[in] known_columns pointers to the columns of the known nodes.
+     * @param[out] out pointers to the columns of the output nodes.
+     * @param[in] N number of points.
+     *
+     * @throw std::invalid_argument if the number of columns is incompatible.
+     */
+    template <typename U = T, typename std::enable_if<std::is_same<U, double>::value, int>::type = 0>
+    void nodes_batch(const nodes_tape &tape, const std::vector<const double *> &in,
+                     const std::vector<const double *> &known_columns, const std::vector<double *> &out,
+                     std::size_t N) const
+    {
+        const auto n_in = static_cast<unsigned>(m_n - m_eph_val.size());
+        if (in.size() != n_in) {
+            throw std::invalid_argument("Input size is incompatible, number of input columns is: "
+                                        + std::to_string(in.size()) + " while I expected: " + std::to_string(n_in));
+        }
+        if (known_columns.size() != tape.n_known || out.size() != tape.tape_out.size()) {
+            throw std::invalid_argument("The number of node columns is incompatible with the number of nodes");
+        }
+        run_tape_batch(tape.tape, tape.size, tape.tape_out, in, known_columns, out, N);
+    }
+
     /// Evaluates the model loss (single data point)
     /**
      * Returns the model loss over a single point of data of the dCGP output.
@@ -291,36 +873,29 @@ public:
                 "When computing the loss the prediction dimension (output) seemed wrong, it was: "
                 + std::to_string(prediction.size()) + " while I expected: " + std::to_string(this->get_m()));
         }
-        T retval(0.);
+        return loss_of(this->operator()(point), prediction, loss_e);
+    }
 
-        auto outputs = this->operator()(point);
-        switch (loss_e) {
-            // Mean Square Error
-            case loss_type::MSE: {
-                for (decltype(outputs.size()) i = 0u; i < outputs.size(); ++i) {
-                    retval += (outputs[i] - prediction[i]) * (outputs[i] - prediction[i]);
-                }
-                retval /= static_cast<double>(outputs.size());
-                break; // and exits the switch
-            }
-            // Cross Entropy
-            case loss_type::CE: {
-                // We guard from numerical instabilities subtracting the max element
-                auto max = *std::max_element(outputs.begin(), outputs.end());
-                // exp(a_i - max)
-                std::transform(outputs.begin(), outputs.end(), outputs.begin(),
-                               [max](T a) { return audi::exp(a - max); });
-                // sum exp(a_i - max)
-                T cumsum = std::accumulate(outputs.begin(), outputs.end(), T(0.));
-                // log(p_i) * y_i
-                std::transform(outputs.begin(), outputs.end(), prediction.begin(), outputs.begin(),
-                               [cumsum](T a, T y) { return audi::log(a / cumsum) * y; });
-                // - sum log(p_i) y_i
-                retval = -std::accumulate(outputs.begin(), outputs.end(), T(0.));
-                break;
-            }
+    /// Evaluates the model loss (single data point) given the eph frontier
+    /**
+     * Returns the model loss over a single point of data of the dCGP output, evaluated given the values of its eph
+     * frontier (see get_eph_frontier() and operator()(const std::vector<T> &, const std::vector<T> &)).
+     *
+     * @param[point] The input data (single point)
+     * @param[prediction] The predicted output (single point)
+     * @param[frontier] The values of the nodes in the eph frontier in point
+     * @param[loss_e] The loss type.
+     * @return the computed loss
+     */
+    T loss(const std::vector<T> &point, const std::vector<T> &prediction, const std::vector<T> &frontier,
+           loss_type loss_e) const
+    {
+        if (prediction.size() != this->get_m()) {
+            throw std::invalid_argument(
+                "When computing the loss the prediction dimension (output) seemed wrong, it was: "
+                + std::to_string(prediction.size()) + " while I expected: " + std::to_string(this->get_m()));
         }
-        return retval;
+        return loss_of(this->operator()(point, frontier), prediction, loss_e);
     }
 
     /// Evaluates the model loss (on a batch)
@@ -331,8 +906,8 @@ public:
      * @param[labels] The predicted outputs (a batch).
      * @param[loss_s] The loss type. Can be "MSE" for Mean Square Error (regression) or "CE" for Cross Entropy
      * (classification)
-     * @param[parallel] sets the grain for parallelism. 0 -> no parallelism n -> divides the data into n parts and
-     * evaluates them in parallel threads.
+     * @param[parallel] sets the grain for parallelism. 0 -> no parallelism n -> divides the data into n (roughly
+     * equal) parts and evaluates them in parallel threads.
      * @return the loss
      */
     T loss(const std::vector<std::vector<T>> &points, const std::vector<std::vector<T>> &labels,
@@ -347,15 +922,28 @@ public:
         if (points.size() == 0) {
             throw std::invalid_argument("Data size cannot be zero");
         }
-        loss_type loss_e;
-        if (loss_s == "MSE") { // Mean Squared Error
-            loss_e = loss_type::MSE;
-        } else if (loss_s == "CE") {
-            loss_e = loss_type::CE; // Cross Entropy
-        } else {
-            throw std::invalid_argument("The requested loss was: " + loss_s + " while only MSE and CE are allowed");
+        return loss(points.begin(), points.end(), labels.begin(), string_to_loss(loss_s), parallel);
+    }
+
+    /// Evaluates the model loss (on a dataset)
+    /**
+     * Evaluates the model loss over all the points of a dataset.
+     *
+     * @param[data] The dataset.
+     * @param[loss_s] The loss type. Can be "MSE" for Mean Square Error (regression) or "CE" for Cross Entropy
+     * (classification)
+     * @param[parallel] sets the grain for parallelism. 0 -> no parallelism n -> divides the data into n (roughly
+     * equal) parts and evaluates them in parallel threads.
+     * @return the loss
+     */
+    template <typename U = T, double_enabler<U> = 0>
+    T loss(const dataset &data, const std::string &loss_s, unsigned parallel = 0u) const
+    {
+        if (data.size() == 0) {
+            throw std::invalid_argument("Data size cannot be zero");
         }
-        return loss(points.begin(), points.end(), labels.begin(), loss_e, parallel);
+        return loss_impl(data.points_begin(), data.labels_begin(), static_cast<unsigned>(data.size()),
+                         string_to_loss(loss_s), parallel);
     }
 
     /// Sets the chromosome
@@ -374,6 +962,26 @@ public:
         update_data_structures();
     }
 
+    /// Sets the chromosome and the values of the ephemeral constants
+    /**
+     * Equivalent to set(const std::vector<unsigned> &) followed by set_eph_val(), but updating the data structures
+     * only once.
+     *
+     * @param[in] xu the new cromosome
+     * @param[in] eph_val the values of the ephemeral constants.
+     *
+     * @throw std::invalid_argument if the chromosome is out of bounds or has the wrong size, or if the size of
+     * *eph_val* is not equal to the number of ephemeral constants.
+     */
+    void set(const std::vector<unsigned> &xu, const std::vector<T> &eph_val)
+    {
+        check_cgp_encoding(xu);
+        check_eph_val_size(eph_val);
+        m_x = xu;
+        m_eph_val = eph_val;
+        update_data_structures();
+    }
+
     /// Sets the chromosome from range
     /**
      * Sets a given chromosome as genotype for the expression and updates
@@ -414,6 +1022,10 @@ public:
         }
         auto gene_idx = m_gene_idx[node_id];
         m_x[gene_idx] = f_id;
+        // The active graph is unchanged, but the tapes cache the kernel ids
+        if (is_active_node(node_id)) {
+            invalidate_tapes();
+        }
     }
 
     /// Sets the values of ephemeral constants
@@ -425,12 +1037,52 @@ public:
      */
     void set_eph_val(const std::vector<T> &eph_val)
     {
-        if (eph_val.size() != m_eph_val.size()) {
-            throw std::invalid_argument(
-                "The number of ephemeral constants in this dCGP expression is " + std::to_string(m_eph_val.size())
-                + ", while you are trying to set their values with a vector of size " + std::to_string(eph_val.size()));
+        check_eph_val_size(eph_val);
+        // Values identical bit by bit (e.g. not -0. for 0., while the same NaN is) leave the simplified tape as is
+        if constexpr (std::is_same<T, double>::value) {
+            if (eph_val.empty()
+                || std::memcmp(eph_val.data(), m_eph_val.data(), eph_val.size() * sizeof(double)) == 0) {
+                return;
+            }
         }
         m_eph_val = eph_val;
+        // The simplified tape folds the ephemeral constants
+        invalidate_tapes(tape_cache::simple_stale);
+    }
+
+    /// Sets the floating point rules of the simplified evaluation
+    /**
+     * The double expression is evaluated (by operator() and evaluate_batch()) over a simplified active graph: the
+     * function nodes of built-in kernels (see kernel::get_id()) reading only ephemeral constants (or such nodes) are
+     * folded to their value and, according to \p rules, some algebraic identities of the built-in kernels reduce a
+     * node to one of its operands, to a constant or to fewer operands. With fp_rules::exact (the default) these are
+     * x*1, x/1, x-0, x+(-0) and pdiv(x,x), which hold for all doubles, so that the results are unchanged.
+     * fp_rules::fast also uses x+0, x*0, x-x and x/x, assuming finite values and ignoring the sign of zero, and
+     * evaluate_batch() then calls the fast batch versions of the kernels (see get_fast_batch_function()), so that
+     * its results may also differ in the last bits from those of operator().
+     * fp_rules::none evaluates every active node. User kernels are never called while simplifying.
+     *
+     * Only operator() and evaluate_batch() use the simplified graph: eph_frontier_batch(), evaluate_batch() given
+     * the eph frontier and the nodes compiled by compile_nodes() evaluate the active graph as is, which gives the
+     * same results with fp_rules::exact and fp_rules::none, but not necessarily with fp_rules::fast.
+     *
+     * The chromosome, the active nodes and genes and the symbolic and gdual evaluations are not affected.
+     *
+     * @param[in] rules the floating point rules.
+     */
+    void set_fp_rules(fp_rules rules)
+    {
+        m_fp_rules = rules;
+        invalidate_tapes(tape_cache::simple_stale);
+    }
+
+    /// Gets the floating point rules of the simplified evaluation
+    /**
+     * @return the floating point rules set by set_fp_rules().
+     */
+    fp_rules get_fp_rules() const
+    {
+        return m_fp_rules;
     }
 
     /// Sets the values of ephemeral constants
@@ -662,8 +1314,7 @@ public:
             do {
                 new_value = std::uniform_int_distribution<unsigned>(m_lb[idx], m_ub[idx])(m_e);
             } while (new_value == m_x[idx]);
-            m_x[idx] = new_value;
-            update_data_structures(); // TODO: unecessary if the gene is a function gene
+            set_gene(idx, new_value);
         }
     }
 
@@ -677,7 +1328,6 @@ public:
      */
     void mutate(std::vector<unsigned> idxs)
     {
-        bool flag = false;
         for (auto i = 0u; i < idxs.size(); ++i) {
             if (idxs[i] >= m_x.size()) {
                 throw std::invalid_argument("idx of gene to be mutated is out of bounds");
@@ -689,11 +1339,9 @@ public:
                 do {
                     new_value = std::uniform_int_distribution<unsigned>(m_lb[idxs[i]], m_ub[idxs[i]])(m_e);
                 } while (new_value == m_x[idxs[i]]);
-                m_x[idxs[i]] = new_value;
-                flag = true;
+                set_gene(idxs[i], new_value);
             }
         }
-        if (flag) update_data_structures();
     }
 
     /// Mutates N random genes
@@ -705,7 +1353,6 @@ public:
      */
     void mutate_random(unsigned N)
     {
-        bool flag = false;
         for (auto i = 0u; i < N; ++i) {
             // If only one value is allowed for the gene, (lb==ub),
             // then we will not do anything as mutation does not apply
@@ -715,14 +1362,101 @@ public:
                 do {
                     new_value = std::uniform_int_distribution<unsigned>(m_lb[idx], m_ub[idx])(m_e);
                 } while (new_value == m_x[idx]);
-                m_x[idx] = new_value;
-                flag = true;
+                set_gene(static_cast<unsigned>(idx), new_value);
             }
         }
-        if (flag) update_data_structures();
     }
 
-    /// Mutates inactive genes randomly up to \p N
+    /// Writes mutated copies of the chromosome in a buffer
+    /**
+     * Writes \p k children of the current chromosome, as doubles, starting at \p out and each \p stride elements
+     * after the previous one (so that, for example, the children can be written in the chromosome part of the
+     * contiguous decision vectors evaluated by a pagmo::bfe). Each child has a number of random genes, drawn
+     * uniformly in [1, \p max_mut], mutated as by mutate_random(). The random numbers are drawn from \p e and
+     * the expression is not modified: past the copy of the chromosome, the cost of a child is thus proportional to
+     * its mutations rather than to the size of the expression.
+     *
+     * A child is phenotypically neutral if all the genes it does not share with the chromosome are inactive, as
+     * then its active graph is the same.
+     *
+     * @param[out] out the position of the first gene of the first child.
+     * @param[in] stride the distance between the first genes of two consecutive children.
+     * @param[in] k the number of children.
+     * @param[in] max_mut the maximum number of genes mutated in a child.
+     * @param[in] e the random engine.
+     *
+     * @return a vector of \p k flags, true for the phenotypically neutral children.
+     *
+     * @throw std::invalid_argument if \p max_mut is zero or \p stride is smaller than the size of the chromosome.
+     */
+    std::vector<bool> random_offspring(double *out, std::size_t stride, std::size_t k, unsigned max_mut,
+                                       detail::random_engine_type &e) const
+    {
+        if (max_mut == 0u) {
+            throw std::invalid_argument("The maximum number of mutations must be at least 1");
+        }
+        if (stride < m_x.size()) {
+            throw std::invalid_argument("The stride between the children is " + std::to_string(stride)
+                                        + ", while the size of the chromosome is " + std::to_string(m_x.size()));
+        }
+        std::vector<bool> retval(k, true);
+        std::vector<double> parent(m_x.begin(), m_x.end());
+        std::vector<unsigned> mutated;
+        for (decltype(k) i = 0u; i < k; ++i) {
+            double *child = out + i * stride;
+            std::copy(parent.begin(), parent.end(), child);
+            mutated.clear();
+            const auto n_mut = std::uniform_int_distribution<unsigned>(1u, max_mut)(e);
+            for (auto j = 0u; j < n_mut; ++j) {
+                auto idx = std::uniform_int_distribution<std::vector<unsigned>::size_type>(0, m_lb.size() - 1)(e);
+                // If only one value is allowed for the gene, (lb==ub), mutation does not apply
+                if (m_lb[idx] < m_ub[idx]) {
+                    unsigned new_value;
+                    do {
+                        new_value = std::uniform_int_distribution<unsigned>(m_lb[idx], m_ub[idx])(e);
+                    } while (new_value == child[idx]);
+                    child[idx] = new_value;
+                    mutated.push_back(static_cast<unsigned>(idx));
+                }
+            }
+            // (a gene mutated twice may be back to its original value)
+            for (auto idx : mutated) {
+                if (child[idx] != parent[idx] && is_active_gene(idx)) {
+                    retval[i] = false;
+                    break;
+                }
+            }
+        }
+        return retval;
+    }
+
+    /// Checks that two sets of ephemeral constants express the same phenotype
+    /**
+     * Compares two sets of values of the ephemeral constants, given as contiguous doubles (as in the decision
+     * vectors of a pagmo::problem). They express the same phenotype of the current chromosome if none of the
+     * constants differing between them is active. The values are compared bit by bit, so that for example -0. and 0.
+     * differ.
+     *
+     * @param[in] eph_val the position of the first value of the first set.
+     * @param[in] other_eph_val the position of the first value of the second set.
+     *
+     * @return true if the constants differing between the two sets are all inactive.
+     */
+    template <typename U = T, typename std::enable_if<std::is_same<U, double>::value, int>::type = 0>
+    bool same_eph_phenotype(const double *eph_val, const double *other_eph_val) const
+    {
+        // The ephemeral constants are the last inputs
+        const auto n_in = static_cast<unsigned>(m_n - m_eph_val.size());
+        for (decltype(m_eph_val.size()) j = 0u; j < m_eph_val.size(); ++j) {
+            if (std::memcmp(eph_val + j, other_eph_val + j, sizeof(double)) != 0
+                && is_active_node(n_in + static_cast<unsigned>(j))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// Mutates inactive genes randomly up to \p N
     /**
      * Mutates inactive random genes within their bounds up to \p N.
      * The guarantee to actually mutate N would cost and is deemed unnecessary.
@@ -855,7 +1589,7 @@ public:
      */
     bool is_active_node(const unsigned node_id) const
     {
-        return (std::find(m_active_nodes.begin(), m_active_nodes.end(), node_id) != m_active_nodes.end());
+        return node_id < m_is_active_node.size() && m_is_active_node[node_id];
     }
 
     /// Checks if a given gene is active
@@ -867,7 +1601,7 @@ public:
      */
     bool is_active_gene(const unsigned idx) const
     {
-        return (std::find(m_active_genes.begin(), m_active_genes.end(), idx) != m_active_genes.end());
+        return idx < m_is_active_gene.size() && m_is_active_gene[idx];
     }
 
     /// Sets the phenotype correction
@@ -890,6 +1624,15 @@ public:
         m_phenotype_correction = boost::none;
     }
 
+    /// Gets the phenotype correction
+    /**
+     * @return the phenotype correction (empty if not set).
+     */
+    const boost::optional<pc_fun_type> &get_phenotype_correction() const
+    {
+        return m_phenotype_correction;
+    }
+
     /// Overloaded stream operator
     /**
      * Will return a formatted string containing a human readable representation
@@ -942,62 +1685,65 @@ protected:
      * changed. A call to this method takes care of this. In derived classes (such as for example expression_ann), one
      * can add more of these chromosome dependant data, and will thus need to override this method, making sure to still
      * have it called by the new method and adding there the new data book-keeping. Hence the method must be marked
-     * as virtual.
+     * as virtual. The tapes used to evaluate the expression are also marked here to be recompiled at the next
+     * evaluation (see ensure_tapes()).
      */
 
     virtual void update_data_structures()
     {
         assert(m_x.size() == m_lb.size());
 
-        // First we update the active nodes
-        std::vector<unsigned> current(m_m), next;
-        m_active_nodes.clear();
-
-        // At the beginning, current contains only the node connected to the output nodes
+        // First we mark the active nodes counting, for each node, the active genes connected to it. Since
+        // connections always point to nodes with a lower id, a single backward sweep is enough.
+        m_is_active_node.assign(m_n + m_r * m_c, false);
+        m_active_refs.assign(m_n + m_r * m_c, 0u);
         for (auto i = 0u; i < m_m; ++i) {
-            current[i] = m_x[m_x.size() - m_m + i];
-        }
-        do {
-            m_active_nodes.insert(m_active_nodes.end(), current.begin(), current.end());
-
-            for (auto node_id : current) {
-                if (node_id >= m_n) // we skip the input nodes as they do
-                                    // not have any connection
-                {
-                    auto node_arity = _get_arity(node_id);
-                    for (auto i = 1u; i <= node_arity; ++i) {
-                        next.push_back(m_x[m_gene_idx[node_id] + i]);
-                    }
-                } else {
-                    m_active_nodes.push_back(node_id);
-                }
-            }
-            // We remove duplicates to avoid processing them and thus having a 2^N
-            // complexity
-            std::sort(next.begin(), next.end());
-            next.erase(std::unique(next.begin(), next.end()), next.end());
-            current = next;
-            next.clear();
-        } while (current.size() > 0);
-
-        // We remove duplicates and keep m_active_nodes sorted
-        std::sort(m_active_nodes.begin(), m_active_nodes.end());
-        m_active_nodes.erase(std::unique(m_active_nodes.begin(), m_active_nodes.end()), m_active_nodes.end());
-
-        // Then the active genes
-        m_active_genes.clear();
-        for (auto i = 0u; i < m_active_nodes.size(); ++i) {
-            auto node_id = m_active_nodes[i];
-            if (node_id >= m_n) {
-                for (auto j = 0u; j <= _get_arity(node_id); ++j) {
-                    m_active_genes.push_back(m_gene_idx[node_id] + j);
+            auto node_id = m_x[m_x.size() - m_m + i];
+            m_is_active_node[node_id] = true;
+            ++m_active_refs[node_id];
+        }
+        for (auto node_id = m_n + m_r * m_c; node_id-- > m_n;) {
+            if (m_is_active_node[node_id]) {
+                for (auto i = 1u; i <= _get_arity(node_id); ++i) {
+                    auto in_node = m_x[m_gene_idx[node_id] + i];
+                    m_is_active_node[in_node] = true;
+                    ++m_active_refs[in_node];
                 }
             }
         }
-        // Output genes are always active
-        for (auto i = 0u; i < m_m; ++i) {
-            m_active_genes.push_back(static_cast<unsigned>(m_x.size()) - m_m + i);
+        // Then the active nodes and genes
+        update_active_lists();
+
+        // And last the tapes
+        invalidate_tapes();
+    }
+
+    /// Updates the class data after the mutation of one active gene
+    /**
+     * Called by mutate() when an active connection or output gene has changed. Rather than rebuilding the active
+     * nodes and genes from scratch, the nodes reached (or no longer reached) through the mutated gene are
+     * activated (or deactivated) following the count of active genes pointing to each node, and only they are
+     * inserted in (or removed from) the active nodes and genes. The cost of this part is thus proportional to the
+     * number of nodes changing state, plus a merge of the (sorted) active lists, linear in the number of active
+     * nodes. The tapes are only marked as stale: they are recompiled from the active nodes at the next evaluation
+     * (see ensure_tapes()), so that an expression mutated several times, or never evaluated, does not pay for
+     * them. Derived classes overriding update_data_structures() must also override this method, calling the base
+     * class implementation.
+     *
+     * @param[in] idx the index of the mutated gene.
+     * @param[in] old_value the value of the gene before the mutation.
+     */
+    virtual void update_data_structures(unsigned idx, unsigned old_value)
+    {
+        assert(is_active_gene(idx) && !is_function_gene(idx));
+        // The new connection is added first, so that the nodes it shares with the old one are never deactivated
+        std::vector<unsigned> activated, deactivated;
+        add_active_ref(m_x[idx], activated);
+        remove_active_ref(old_value, deactivated);
+        if (!activated.empty() || !deactivated.empty()) {
+            patch_active_lists(activated, deactivated);
         }
+        invalidate_tapes();
     }
 
     /// Evaluates the model loss (on a batch)
@@ -1008,78 +1754,828 @@ protected:
      * @param[dlast] End of data.
      * @param[lfirst] Begin of labels.
      * @param[loss_e] The loss type.
-     * @param[parallel] sets the grain for parallelism. 0 -> no parallelism n -> divides the data into n parts and
-     * evaluates them in parallel threads.
+     * @param[parallel] sets the grain for parallelism. 0 -> no parallelism n -> divides the data into n (roughly
+     * equal) parts and evaluates them in parallel threads.
      * @return the loss
      */
     T loss(typename std::vector<std::vector<T>>::const_iterator dfirst,
            typename std::vector<std::vector<T>>::const_iterator dlast,
            typename std::vector<std::vector<T>>::const_iterator lfirst, loss_type loss_e, unsigned parallel = 0u) const
+    {
+        return loss_impl(dfirst, lfirst, static_cast<unsigned>(dlast - dfirst), loss_e, parallel);
+    }
+
+private:
+    // The loss of the outputs of the expression in a single point
+    static T loss_of(std::vector<T> outputs, const std::vector<T> &prediction, loss_type loss_e)
     {
         T retval(0.);
-        unsigned batch_size = static_cast<unsigned>(dlast - dfirst);
-        if (parallel > 0u) {
-            if (batch_size % parallel != 0) {
-                throw std::invalid_argument("The batch size is: " + std::to_string(batch_size)
-                                            + " and cannot be divided into " + std::to_string(parallel) + " parts.");
-            }
-            unsigned inner_batch_size = batch_size / parallel;
-            // The mutex that will protect read/write access to retval
-            tbb::spin_mutex mutex_weights_updates;
-            // This loops over all points, predictions in the mini-batch
-            tbb::parallel_for(0u, batch_size, inner_batch_size, [&](unsigned i) {
-                T err(0.);
-                // The loss gets computed
-                for (auto j = 0u; j < inner_batch_size; ++j) {
-                    err += loss(*(dfirst + i + j), *(lfirst + i + j), loss_e);
+        switch (loss_e) {
+            // Mean Square Error
+            case loss_type::MSE: {
+                for (decltype(outputs.size()) i = 0u; i < outputs.size(); ++i) {
+                    retval += (outputs[i] - prediction[i]) * (outputs[i] - prediction[i]);
                 }
-                // We acquire the lock on the mutex
-                tbb::spin_mutex::scoped_lock lock(mutex_weights_updates);
-                // We update the cumulative loss and gradient
-                retval += err;
-            });
-        } else {
-            for (decltype(batch_size) i = 0; i < batch_size; ++i) {
-                // The loss gets computed
-                retval += loss(*(dfirst + i), *(lfirst + i), loss_e);
+                retval /= static_cast<double>(outputs.size());
+                break; // and exits the switch
+            }
+            // Cross Entropy
+            case loss_type::CE: {
+                // We guard from numerical instabilities subtracting the max element
+                auto max = *std::max_element(outputs.begin(), outputs.end());
+                // exp(a_i - max)
+                std::transform(outputs.begin(), outputs.end(), outputs.begin(),
+                               [max](T a) { return audi::exp(a - max); });
+                // sum exp(a_i - max)
+                T cumsum = std::accumulate(outputs.begin(), outputs.end(), T(0.));
+                // log(p_i) * y_i
+                std::transform(outputs.begin(), outputs.end(), prediction.begin(), outputs.begin(),
+                               [cumsum](T a, T y) { return audi::log(a / cumsum) * y; });
+                // - sum log(p_i) y_i
+                retval = -std::accumulate(outputs.begin(), outputs.end(), T(0.));
+                break;
+            }
+        }
+        return retval;
+    }
+
+    // Decodes the loss type
+    static loss_type string_to_loss(const std::string &loss_s)
+    {
+        if (loss_s == "MSE") { // Mean Squared Error
+            return loss_type::MSE;
+        } else if (loss_s == "CE") {
+            return loss_type::CE; // Cross Entropy
+        }
+        throw std::invalid_argument("The requested loss was: " + loss_s + " while only MSE and CE are allowed");
+    }
+
+    // Returns the row, copying it in buffer if it is not already a std::vector<T>
+    static const std::vector<T> &as_vector(const std::vector<T> &row, std::vector<T> &)
+    {
+        return row;
+    }
+    template <typename Row>
+    static const std::vector<T> &as_vector(const Row &row, std::vector<T> &buffer)
+    {
+        buffer.assign(row.begin(), row.end());
+        return buffer;
+    }
+
+    // Evaluates the model loss over the batch_size points (and labels) starting at dfirst (and lfirst). The
+    // iterators can run over std::vector<std::vector<T>> or over a dcgp::dataset.
+    template <typename DIt, typename LIt>
+    T loss_impl(DIt dfirst, LIt lfirst, unsigned batch_size, loss_type loss_e, unsigned parallel) const
+    {
+        T retval(0.);
+        // Loss over the points [begin, end)
+        auto partial_loss = [&](unsigned begin, unsigned end, T err) {
+            std::vector<T> point, label;
+            for (auto i = begin; i != end; ++i) {
+                err += loss(as_vector(*(dfirst + i), point), as_vector(*(lfirst + i), label), loss_e);
             }
+            return err;
+        };
+        if (parallel > 0u) {
+            // The data is split into (roughly) parallel parts, each reduced into its own partial loss
+            const unsigned grain = std::max(1u, (batch_size + parallel - 1u) / parallel);
+            retval = tbb::parallel_reduce(
+                tbb::blocked_range<unsigned>(0u, batch_size, grain), T(0.),
+                [&](const tbb::blocked_range<unsigned> &range, T err) {
+                    return partial_loss(range.begin(), range.end(), err);
+                },
+                [](const T &a, const T &b) { return a + b; });
+        } else {
+            retval = partial_loss(0u, batch_size, retval);
         }
         retval /= batch_size;
 
         return retval;
     }
 
-private:
+    // Runs tape (see update_tape()) over N points stored column by column, processing them in blocks. The columns
+    // of the preloaded nodes (if any) are read from preloaded, the ones of the slots in tape_out are written in out.
+    // The slots following the preloaded ones hold the constants (see update_simplified_tape()). If fast, the fast
+    // batch versions of the kernels are called (see kernel::fast_batch()).
+    template <typename U = T, typename std::enable_if<std::is_same<U, double>::value, int>::type = 0>
+    void run_tape_batch(const std::vector<unsigned> &tape, unsigned tape_size, const std::vector<unsigned> &tape_out,
+                        const std::vector<const double *> &in, const std::vector<const double *> &preloaded,
+                        const std::vector<double *> &out, std::size_t N,
+                        const std::vector<double> &constants = {}, bool fast = false) const
+    {
+        const auto n_in = static_cast<unsigned>(m_n - m_eph_val.size());
+        constexpr std::size_t block = 256u;
+        with_tape_workspace<double>([&](tape_workspace<double> &ws) {
+            // Each slot other than the inputs has a column of block size in the workspace
+            ws.slots.resize(tape_size * block);
+            for (auto i = n_in; i < m_n; ++i) {
+                std::fill(ws.slots.begin() + static_cast<std::ptrdiff_t>(i * block),
+                          ws.slots.begin() + static_cast<std::ptrdiff_t>((i + 1u) * block), m_eph_val[i - n_in]);
+            }
+            for (decltype(constants.size()) i = 0u; i < constants.size(); ++i) {
+                const auto slot = m_n + preloaded.size() + i;
+                std::fill(ws.slots.begin() + static_cast<std::ptrdiff_t>(slot * block),
+                          ws.slots.begin() + static_cast<std::ptrdiff_t>((slot + 1u) * block), constants[i]);
+            }
+            for (decltype(N) start = 0u; start < N; start += block) {
+                const auto b = std::min(block, N - start);
+                auto column = [&](unsigned slot) -> const double * {
+                    if (slot < n_in) {
+                        return in[slot] + start;
+                    }
+                    if (slot >= m_n && slot < m_n + preloaded.size()) {
+                        return preloaded[slot - m_n] + start;
+                    }
+                    return ws.slots.data() + slot * block;
+                };
+                auto it = tape.data();
+                const auto end = it + tape.size();
+                while (it != end) {
+                    const unsigned arity = it[1];
+                    ws.columns.resize(arity);
+                    ws.function_in.resize(arity);
+                    for (auto j = 0u; j < arity; ++j) {
+                        ws.columns[j] = column(it[3u + j]);
+                    }
+                    const auto &f = m_f[it[0]];
+                    double *o = ws.slots.data() + it[2] * block;
+                    if (f.has_batch()) {
+                        if (fast) {
+                            f.fast_batch(ws.columns.data(), arity, o, b);
+                        } else {
+                            f.batch(ws.columns.data(), arity, o, b);
+                        }
+                    } else {
+                        for (decltype(N) k = 0u; k < b; ++k) {
+                            for (auto j = 0u; j < arity; ++j) {
+                                ws.function_in[j] = ws.columns[j][k];
+                            }
+                            o[k] = f(ws.function_in);
+                        }
+                    }
+                    it += 3u + arity;
+                }
+                for (decltype(tape_out.size()) j = 0u; j < tape_out.size(); ++j) {
+                    auto src = column(tape_out[j]);
+                    std::copy(src, src + b, out[j] + start);
+                }
+            }
+        });
+    }
+
     // implemented as a fake static member as to allow its use as a phenotype correction.
     static std::vector<T> call_operator_impl(const expression<T> &ex, const std::vector<T> &point)
     {
-        std::vector<T> point_expanded(point);
-        point_expanded.insert(point_expanded.end(), ex.m_eph_val.begin(), ex.m_eph_val.end());
-
-        if (point_expanded.size() != ex.m_n) {
+        if (point.size() + ex.m_eph_val.size() != ex.m_n) {
             throw std::invalid_argument("Input size is incompatible");
         }
+        ex.ensure_tapes();
         std::vector<T> retval(ex.m_m);
-        std::vector<T> node(ex.m_n + ex.m_r * ex.m_c);
-        std::vector<T> function_in;
+        with_tape_workspace<T>([&](tape_workspace<T> &ws) {
+            if constexpr (std::is_same<T, double>::value) {
+                // The simplified tape, with the constants following the ephemeral ones
+                ws.slots.resize(ex.m_tapes.simple_tape_size);
+                auto it = std::copy(point.begin(), point.end(), ws.slots.begin());
+                it = std::copy(ex.m_eph_val.begin(), ex.m_eph_val.end(), it);
+                std::copy(ex.m_tapes.simple_constants.begin(), ex.m_tapes.simple_constants.end(), it);
+                ex.run_tape(ex.m_tapes.simple_tape, ws.slots, ws.function_in);
+                for (auto i = 0u; i < ex.m_m; ++i) {
+                    retval[i] = ws.slots[ex.m_tapes.simple_tape_out[i]];
+                }
+            } else {
+                ws.slots.resize(ex.m_tapes.tape_size);
+                std::copy(point.begin(), point.end(), ws.slots.begin());
+                std::copy(ex.m_eph_val.begin(), ex.m_eph_val.end(),
+                          ws.slots.begin() + static_cast<std::ptrdiff_t>(point.size()));
+                ex.run_tape(ws.slots, ws.function_in);
+                for (auto i = 0u; i < ex.m_m; ++i) {
+                    retval[i] = ws.slots[ex.m_tapes.tape_out[i]];
+                }
+            }
+        });
+        return retval;
+    }
+
+    // Buffers reused across tape runs. The flag marks the thread local instance as busy, so that
+    // a re-entrant evaluation (e.g. from within a kernel) does not overwrite it.
+    template <typename U>
+    struct tape_workspace {
+        std::vector<U> slots;
+        std::vector<U> function_in;
+        // the operand columns (used only in batch evaluations)
+        std::vector<const U *> columns;
+        // the adjoints and the partial derivatives (used only in reverse mode differentiation)
+        std::vector<U> adjoints;
+        std::vector<U> output_adjoints;
+        std::vector<U> partials;
+        bool busy = false;
+    };
+
+    // Calls f with the thread local workspace, or with a fresh one if that is already in use.
+    template <typename U, typename F>
+    static void with_tape_workspace(F &&f)
+    {
+        thread_local tape_workspace<U> ws;
+        if (ws.busy) {
+            tape_workspace<U> tmp;
+            f(tmp);
+            return;
+        }
+        struct busy_guard {
+            ~busy_guard()
+            {
+                m_flag = false;
+            }
+            bool &m_flag;
+        } guard{ws.busy};
+        ws.busy = true;
+        f(ws);
+    }
+
+    // Work buffers of the tape compilation, indexed by node id. They are sized to the whole graph once, and each
+    // compilation only writes (before reading them) the entries of the nodes it visits, so that its cost is linear
+    // in the number of active nodes.
+    struct tape_buffers {
+        void resize(unsigned n_nodes)
+        {
+            if (last_use.size() < n_nodes) {
+                is_dependent.resize(n_nodes);
+                is_frontier.resize(n_nodes);
+                alias.resize(n_nodes);
+                is_constant.resize(n_nodes);
+                value.resize(n_nodes);
+                operands.resize(n_nodes);
+                needed.resize(n_nodes);
+                last_use.resize(n_nodes);
+                slot.resize(n_nodes);
+            }
+        }
+        // used by update_tape()
+        std::vector<bool> is_dependent;
+        std::vector<bool> is_frontier;
+        // used by update_simplified_tape()
+        std::vector<unsigned> alias;
+        std::vector<bool> is_constant;
+        std::vector<double> value;
+        std::vector<std::vector<unsigned>> operands;
+        std::vector<bool> needed;
+        // used by compile_tape()
+        std::vector<unsigned> last_use;
+        std::vector<unsigned> slot;
+    };
+
+    // The tapes of the active graph (see update_tape()) and their state. Since a const expression can be evaluated
+    // by several threads at once, they are compiled (and copied) under a lock. The work buffers are not copied.
+    struct tape_cache {
+        enum status_type : unsigned char { stale, simple_stale, ready };
+
+        tape_cache() = default;
+        tape_cache(const tape_cache &other)
+        {
+            *this = other;
+        }
+        tape_cache &operator=(const tape_cache &other)
+        {
+            if (this != &other) {
+                std::lock_guard<std::mutex> lock(other.mutex);
+                tape = other.tape;
+                tape_out = other.tape_out;
+                tape_size = other.tape_size;
+                eph_frontier = other.eph_frontier;
+                frontier_tape = other.frontier_tape;
+                frontier_tape_out = other.frontier_tape_out;
+                frontier_tape_size = other.frontier_tape_size;
+                dep_tape = other.dep_tape;
+                dep_tape_out = other.dep_tape_out;
+                dep_tape_size = other.dep_tape_size;
+                simple_tape = other.simple_tape;
+                simple_tape_out = other.simple_tape_out;
+                simple_tape_size = other.simple_tape_size;
+                simple_constants = other.simple_constants;
+                status.store(other.status.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            }
+            return *this;
+        }
+
+        // The tape of the active graph, the slots holding the outputs after a run and the number of slots
+        // (inputs, ephemeral constants and registers) needed
+        std::vector<unsigned> tape;
+        std::vector<unsigned> tape_out;
+        unsigned tape_size = 0u;
+        // The active function nodes not depending on the ephemeral constants read by the ones depending on them or
+        // by the outputs, and the tapes of the two parts of the active graph
+        std::vector<unsigned> eph_frontier;
+        std::vector<unsigned> frontier_tape;
+        std::vector<unsigned> frontier_tape_out;
+        unsigned frontier_tape_size = 0u;
+        std::vector<unsigned> dep_tape;
+        std::vector<unsigned> dep_tape_out;
+        unsigned dep_tape_size = 0u;
+        // The tape of the simplified active graph, with the values of the folded nodes it reads (see
+        // update_simplified_tape())
+        std::vector<unsigned> simple_tape;
+        std::vector<unsigned> simple_tape_out;
+        unsigned simple_tape_size = 0u;
+        std::vector<T> simple_constants;
+        // stale: all the tapes must be compiled, simple_stale: only the simplified one
+        std::atomic<unsigned char> status{stale};
+        mutable std::mutex mutex;
+        tape_buffers buffers;
+    };
 
-        for (auto node_id : ex.m_active_nodes) {
-            if (node_id < ex.m_n) {
-                node[node_id] = point_expanded[node_id];
+    // Marks the tapes to be recompiled (all of them, or only the simplified one) at the next evaluation
+    void invalidate_tapes(typename tape_cache::status_type status = tape_cache::stale)
+    {
+        if (status < m_tapes.status.load(std::memory_order_relaxed)) {
+            m_tapes.status.store(status, std::memory_order_relaxed);
+        }
+    }
+
+    // Sets a gene to a new value, updating the active graph incrementally. Inactive genes do not affect it, active
+    // function genes only change the kernels in the tapes.
+    void set_gene(unsigned idx, unsigned new_value)
+    {
+        auto old_value = m_x[idx];
+        m_x[idx] = new_value;
+        if (is_active_gene(idx)) {
+            if (is_function_gene(idx)) {
+                invalidate_tapes();
             } else {
-                unsigned arity = ex._get_arity(node_id);
-                function_in.resize(arity);
-                unsigned idx = ex.m_gene_idx[node_id]; // position in the chromosome of the current node
-                for (auto j = 0u; j < arity; ++j) {
-                    function_in[j] = node[ex.m_x[idx + j + 1u]];
+                update_data_structures(idx, old_value);
+            }
+        }
+    }
+
+    // Compiles the tapes, if stale. Called before any use of the tapes, so that an expression changed several
+    // times (e.g. mutated) compiles them only when (and if) it is evaluated.
+    void ensure_tapes() const
+    {
+        if (m_tapes.status.load(std::memory_order_acquire) == tape_cache::ready) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(m_tapes.mutex);
+        const auto status = m_tapes.status.load(std::memory_order_relaxed);
+        if (status == tape_cache::ready) {
+            return;
+        }
+        m_tapes.buffers.resize(m_n + m_r * m_c);
+        if (status == tape_cache::stale) {
+            update_tape();
+        } else {
+            update_simplified_tape();
+        }
+        m_tapes.status.store(tape_cache::ready, std::memory_order_release);
+    }
+
+    // Returns true if the gene idx is the function gene of a node
+    bool is_function_gene(unsigned idx) const
+    {
+        if (idx >= m_x.size() - m_m) {
+            return false;
+        }
+        // m_gene_idx is increasing over the non-input nodes
+        auto it = std::upper_bound(m_gene_idx.begin() + m_n, m_gene_idx.end(), idx);
+        return *(it - 1) == idx;
+    }
+
+    // Adds an active gene pointing to node_id, activating the nodes that become reachable. These are appended to
+    // activated.
+    void add_active_ref(unsigned node_id, std::vector<unsigned> &activated)
+    {
+        if (m_active_refs[node_id]++ > 0u) {
+            return;
+        }
+        std::vector<unsigned> stack{node_id};
+        while (!stack.empty()) {
+            auto current = stack.back();
+            stack.pop_back();
+            m_is_active_node[current] = true;
+            activated.push_back(current);
+            if (current >= m_n) {
+                for (auto i = 1u; i <= _get_arity(current); ++i) {
+                    auto in_node = m_x[m_gene_idx[current] + i];
+                    if (m_active_refs[in_node]++ == 0u) {
+                        stack.push_back(in_node);
+                    }
                 }
-                node[node_id] = ex.m_f[ex.m_x[idx]](function_in);
             }
         }
-        for (auto i = 0u; i < ex.m_m; ++i) {
-            retval[i] = node[ex.m_x[ex.m_x.size() - ex.m_m + i]];
+    }
+
+    // Removes an active gene pointing to node_id, deactivating the nodes that are no longer reachable. These are
+    // appended to deactivated.
+    void remove_active_ref(unsigned node_id, std::vector<unsigned> &deactivated)
+    {
+        assert(m_active_refs[node_id] > 0u);
+        if (--m_active_refs[node_id] > 0u) {
+            return;
+        }
+        std::vector<unsigned> stack{node_id};
+        while (!stack.empty()) {
+            auto current = stack.back();
+            stack.pop_back();
+            m_is_active_node[current] = false;
+            deactivated.push_back(current);
+            if (current >= m_n) {
+                for (auto i = 1u; i <= _get_arity(current); ++i) {
+                    auto in_node = m_x[m_gene_idx[current] + i];
+                    if (--m_active_refs[in_node] == 0u) {
+                        stack.push_back(in_node);
+                    }
+                }
+            }
+        }
+    }
+
+    // Inserts the activated nodes in m_active_nodes and removes the deactivated ones, doing the same for their genes
+    // in m_active_genes and m_is_active_gene. Both lists are sorted, the output genes being the last ones.
+    void patch_active_lists(std::vector<unsigned> &activated, std::vector<unsigned> &deactivated)
+    {
+        std::sort(activated.begin(), activated.end());
+        std::sort(deactivated.begin(), deactivated.end());
+        std::vector<unsigned> genes_on, genes_off;
+        for (auto node_id : activated) {
+            if (node_id >= m_n) {
+                for (auto j = 0u; j <= _get_arity(node_id); ++j) {
+                    genes_on.push_back(m_gene_idx[node_id] + j);
+                    m_is_active_gene[m_gene_idx[node_id] + j] = true;
+                }
+            }
+        }
+        for (auto node_id : deactivated) {
+            if (node_id >= m_n) {
+                for (auto j = 0u; j <= _get_arity(node_id); ++j) {
+                    genes_off.push_back(m_gene_idx[node_id] + j);
+                    m_is_active_gene[m_gene_idx[node_id] + j] = false;
+                }
+            }
+        }
+        auto patch = [](std::vector<unsigned> &list, const std::vector<unsigned> &on,
+                        const std::vector<unsigned> &off) {
+            std::vector<unsigned> kept;
+            kept.reserve(list.size() + on.size());
+            std::set_difference(list.begin(), list.end(), off.begin(), off.end(), std::back_inserter(kept));
+            list.clear();
+            std::merge(kept.begin(), kept.end(), on.begin(), on.end(), std::back_inserter(list));
+        };
+        patch(m_active_nodes, activated, deactivated);
+        patch(m_active_genes, genes_on, genes_off);
+    }
+
+    // Rebuilds m_active_nodes, m_active_genes and m_is_active_gene from m_is_active_node
+    void update_active_lists()
+    {
+        m_active_nodes.clear();
+        m_active_genes.clear();
+        m_is_active_gene.assign(m_x.size(), false);
+        for (auto node_id = 0u; node_id < m_is_active_node.size(); ++node_id) {
+            if (m_is_active_node[node_id]) {
+                m_active_nodes.push_back(node_id);
+                if (node_id >= m_n) {
+                    for (auto j = 0u; j <= _get_arity(node_id); ++j) {
+                        m_active_genes.push_back(m_gene_idx[node_id] + j);
+                        m_is_active_gene[m_gene_idx[node_id] + j] = true;
+                    }
+                }
+            }
+        }
+        // Output genes are always active
+        for (auto i = 0u; i < m_m; ++i) {
+            m_active_genes.push_back(static_cast<unsigned>(m_x.size()) - m_m + i);
+            m_is_active_gene[m_x.size() - m_m + i] = true;
+        }
+    }
+
+    /// Compiles the active graph into a tape
+    /**
+     * The tape is a flat sequence of instructions, one per active function node in topological order, each
+     * encoded as: kernel id, arity, output slot, operand slots. Slots [0, m_n) hold the inputs and the ephemeral
+     * constants, the remaining ones are registers: a register is recycled as soon as the node it holds has
+     * been read for the last time, so that the number of slots needed is typically much smaller than the
+     * number of active nodes. The output slot of an instruction never coincides with one of its operands, so that
+     * batch kernels can write their output while reading the inputs.
+     *
+     * Two more tapes split the active graph in the part not depending on the ephemeral constants and the rest:
+     * the first computes the eph frontier (see get_eph_frontier()), the second computes the outputs reading the
+     * eph frontier from the slots following the ephemeral constants.
+     *
+     * The tapes are compiled by ensure_tapes(), under its lock.
+     */
+    void update_tape() const
+    {
+        std::vector<unsigned> outputs(m_x.end() - m_m, m_x.end());
+        std::vector<unsigned> all, independent, dependent;
+        // A node depends on the ephemeral constants if any of its inputs does
+        auto &is_dependent = m_tapes.buffers.is_dependent;
+        for (auto node_id : m_active_nodes) {
+            if (node_id < m_n) {
+                is_dependent[node_id] = node_id >= m_n - m_eph_val.size();
+                continue;
+            }
+            is_dependent[node_id] = false;
+            for (auto j = 1u; j <= _get_arity(node_id); ++j) {
+                if (is_dependent[m_x[m_gene_idx[node_id] + j]]) {
+                    is_dependent[node_id] = true;
+                    break;
+                }
+            }
+            all.push_back(node_id);
+            (is_dependent[node_id] ? dependent : independent).push_back(node_id);
+        }
+        // The eph frontier: function nodes not depending on the ephemeral constants read by the dependent ones or
+        // by the outputs
+        auto &is_frontier = m_tapes.buffers.is_frontier;
+        for (auto node_id : independent) {
+            is_frontier[node_id] = false;
+        }
+        for (auto node_id : dependent) {
+            for (auto j = 1u; j <= _get_arity(node_id); ++j) {
+                auto in_node = m_x[m_gene_idx[node_id] + j];
+                if (in_node >= m_n && !is_dependent[in_node]) {
+                    is_frontier[in_node] = true;
+                }
+            }
+        }
+        for (auto node_id : outputs) {
+            if (node_id >= m_n && !is_dependent[node_id]) {
+                is_frontier[node_id] = true;
+            }
+        }
+        m_tapes.eph_frontier.clear();
+        for (auto node_id : independent) {
+            if (is_frontier[node_id]) {
+                m_tapes.eph_frontier.push_back(node_id);
+            }
+        }
+        auto &tapes = m_tapes;
+        tapes.tape_size = compile_tape(all, {}, outputs, tapes.tape, tapes.tape_out, tapes.buffers);
+        tapes.frontier_tape_size = compile_tape(independent, {}, tapes.eph_frontier, tapes.frontier_tape,
+                                                tapes.frontier_tape_out, tapes.buffers);
+        tapes.dep_tape_size = compile_tape(dependent, tapes.eph_frontier, outputs, tapes.dep_tape, tapes.dep_tape_out,
+                                           tapes.buffers);
+        update_simplified_tape();
+    }
+
+    // Simplifies the active graph of a double expression according to m_fp_rules (see set_fp_rules()) and compiles
+    // it into m_tapes.simple_tape. The folded nodes read by the simplified graph are preloaded with the values in
+    // m_tapes.simple_constants. Called by ensure_tapes(), under its lock.
+    void update_simplified_tape() const
+    {
+        if constexpr (std::is_same<T, double>::value) {
+            std::vector<unsigned> outputs(m_x.end() - m_m, m_x.end());
+            if (m_fp_rules == fp_rules::none) {
+                std::vector<unsigned> all;
+                std::copy_if(m_active_nodes.begin(), m_active_nodes.end(), std::back_inserter(all),
+                             [this](unsigned node_id) { return node_id >= m_n; });
+                m_tapes.simple_constants.clear();
+                m_tapes.simple_tape_size
+                    = compile_tape(all, {}, outputs, m_tapes.simple_tape, m_tapes.simple_tape_out, m_tapes.buffers);
+                return;
+            }
+            const auto n_in = m_n - static_cast<unsigned>(m_eph_val.size());
+            const bool fast = m_fp_rules == fp_rules::fast;
+            // Each node is either a constant (with its value), or the alias of another node, or itself (a node
+            // evaluated on its operands, possibly fewer than in the chromosome)
+            auto &alias = m_tapes.buffers.alias;
+            auto &is_constant = m_tapes.buffers.is_constant;
+            auto &value = m_tapes.buffers.value;
+            auto &operands = m_tapes.buffers.operands;
+            auto make_constant = [&](unsigned node_id, double v) {
+                is_constant[node_id] = true;
+                value[node_id] = v;
+            };
+            for (auto node_id : m_active_nodes) {
+                alias[node_id] = node_id;
+                is_constant[node_id] = false;
+                if (node_id < m_n) {
+                    if (node_id >= n_in) {
+                        make_constant(node_id, m_eph_val[node_id - n_in]);
+                    }
+                    continue;
+                }
+                const auto &f = m_f[m_x[m_gene_idx[node_id]]];
+                auto &ops = operands[node_id];
+                ops.clear();
+                bool all_constant = true;
+                for (auto j = 1u; j <= _get_arity(node_id); ++j) {
+                    ops.push_back(alias[m_x[m_gene_idx[node_id] + j]]);
+                    all_constant = all_constant && is_constant[ops.back()];
+                }
+                // Constant folding (of the built-in kernels only, so that no user kernel, possibly implemented in
+                // Python, is called here)
+                if (all_constant && f.get_id() != kernel_id::user) {
+                    std::vector<double> in(ops.size());
+                    for (decltype(ops.size()) j = 0u; j < ops.size(); ++j) {
+                        in[j] = value[ops[j]];
+                    }
+                    make_constant(node_id, f(in));
+                    continue;
+                }
+                // The operands from position first on equal to the neutral element are dropped
+                auto drop = [&](std::vector<unsigned>::size_type first, auto is_neutral) {
+                    std::vector<unsigned> kept(ops.begin(), ops.begin() + static_cast<std::ptrdiff_t>(first));
+                    for (auto j = first; j < ops.size(); ++j) {
+                        if (!is_constant[ops[j]] || !is_neutral(value[ops[j]])) {
+                            kept.push_back(ops[j]);
+                        }
+                    }
+                    ops = std::move(kept);
+                };
+                auto is_zero = [](double v) { return v == 0.; };
+                auto is_one = [](double v) { return v == 1.; };
+                const bool twins = ops.size() == 2u && ops[0] == ops[1];
+                switch (f.get_id()) {
+                    case kernel_id::sum:
+                        // x + (-0) == x for all x, while x + 0 is -0 + 0 = +0 for x = -0
+                        drop(0u, fast ? +is_zero : +[](double v) { return v == 0. && std::signbit(v); });
+                        break;
+                    case kernel_id::diff:
+                        if (fast && twins) {
+                            make_constant(node_id, 0.);
+                            continue;
+                        }
+                        drop(1u, fast ? +is_zero : +[](double v) { return v == 0. && !std::signbit(v); });
+                        break;
+                    case kernel_id::mul:
+                        if (fast
+                            && std::any_of(ops.begin(), ops.end(),
+                                           [&](unsigned o) { return is_constant[o] && value[o] == 0.; })) {
+                            make_constant(node_id, 0.);
+                            continue;
+                        }
+                        drop(0u, is_one);
+                        break;
+                    case kernel_id::div:
+                        if (fast && twins) {
+                            make_constant(node_id, 1.);
+                            continue;
+                        }
+                        drop(1u, is_one);
+                        break;
+                    case kernel_id::pdiv:
+                        // x / x is either 1 or not finite, hence 1
+                        if (twins) {
+                            make_constant(node_id, 1.);
+                            continue;
+                        }
+                        if (fast && ops.size() == 2u && is_constant[ops[1]] && value[ops[1]] == 1.) {
+                            ops.pop_back();
+                        }
+                        break;
+                    default:
+                        break;
+                }
+                // A node left with a single operand of the n-ary kernels is the operand itself
+                if (ops.size() == 1u && ops.size() != _get_arity(node_id)) {
+                    alias[node_id] = ops[0];
+                }
+            }
+            // The nodes needed by the outputs in the simplified graph
+            auto &needed = m_tapes.buffers.needed;
+            for (auto node_id : m_active_nodes) {
+                needed[node_id] = false;
+            }
+            for (auto &node_id : outputs) {
+                node_id = alias[node_id];
+                needed[node_id] = true;
+            }
+            for (auto it = m_active_nodes.rbegin(); it != m_active_nodes.rend() && *it >= m_n; ++it) {
+                if (needed[*it] && !is_constant[*it]) {
+                    for (auto in_node : operands[*it]) {
+                        needed[in_node] = true;
+                    }
+                }
+            }
+            std::vector<unsigned> kept, folded;
+            m_tapes.simple_constants.clear();
+            for (auto node_id : m_active_nodes) {
+                if (node_id < m_n || !needed[node_id]) {
+                    continue;
+                }
+                if (is_constant[node_id]) {
+                    folded.push_back(node_id);
+                    m_tapes.simple_constants.push_back(value[node_id]);
+                } else if (alias[node_id] == node_id) {
+                    kept.push_back(node_id);
+                }
+            }
+            m_tapes.simple_tape_size = compile_tape(kept, folded, outputs, m_tapes.simple_tape, m_tapes.simple_tape_out,
+                                                    m_tapes.buffers, &operands);
+        } else {
+            m_tapes.simple_tape.clear();
+            m_tapes.simple_tape_out.clear();
+            m_tapes.simple_tape_size = 0u;
+            m_tapes.simple_constants.clear();
+        }
+    }
+
+    // Compiles the function nodes (in topological order) into tape, see update_tape(). The preloaded nodes are read
+    // from the slots following the ephemeral constants, in order. The slots of the nodes in outs are written in
+    // tape_out and the number of slots needed is returned. The operands of a node are read from the chromosome
+    // unless given in operands (indexed by node id). The work buffers must be sized to the whole graph.
+    unsigned compile_tape(const std::vector<unsigned> &nodes, const std::vector<unsigned> &preloaded,
+                          const std::vector<unsigned> &outs, std::vector<unsigned> &tape,
+                          std::vector<unsigned> &tape_out, tape_buffers &buffers,
+                          const std::vector<std::vector<unsigned>> *operands = nullptr) const
+    {
+        auto arity_of = [&](unsigned node_id) {
+            return operands ? static_cast<unsigned>((*operands)[node_id].size()) : _get_arity(node_id);
+        };
+        auto operand = [&](unsigned node_id, unsigned j) {
+            return operands ? (*operands)[node_id][j - 1u] : m_x[m_gene_idx[node_id] + j];
+        };
+        // We mark the nodes that must never be released (the ones feeding the outputs)
+        const unsigned never = std::numeric_limits<unsigned>::max();
+        // Position in the tape of the last instruction reading each node (written for all the nodes read)
+        auto &last_use = buffers.last_use;
+        unsigned pos = 0u;
+        for (auto node_id : nodes) {
+            for (auto j = 1u; j <= arity_of(node_id); ++j) {
+                last_use[operand(node_id, j)] = pos;
+            }
+            ++pos;
+        }
+        for (auto node_id : outs) {
+            last_use[node_id] = never;
+        }
+
+        // Slot of each node (written for the inputs, the preloaded nodes and the nodes before they are read)
+        auto &slot = buffers.slot;
+        std::vector<unsigned> free_slots;
+        for (auto i = 0u; i < m_n; ++i) {
+            slot[i] = i;
+        }
+        unsigned n_slots = m_n;
+        for (auto node_id : preloaded) {
+            slot[node_id] = n_slots++;
+            last_use[node_id] = never;
+        }
+        tape.clear();
+        pos = 0u;
+        for (auto node_id : nodes) {
+            unsigned idx = m_gene_idx[node_id]; // position in the chromosome of the current node
+            unsigned arity = arity_of(node_id);
+            tape.push_back(m_x[idx]);
+            tape.push_back(arity);
+            auto out_pos = tape.size();
+            tape.push_back(0u);
+            for (auto j = 1u; j <= arity; ++j) {
+                tape.push_back(slot[operand(node_id, j)]);
+            }
+            if (free_slots.empty()) {
+                slot[node_id] = n_slots++;
+            } else {
+                slot[node_id] = free_slots.back();
+                free_slots.pop_back();
+            }
+            tape[out_pos] = slot[node_id];
+            // Registers read here for the last time are released
+            for (auto j = 1u; j <= arity; ++j) {
+                auto in_node = operand(node_id, j);
+                if (in_node >= m_n && last_use[in_node] == pos) {
+                    free_slots.push_back(slot[in_node]);
+                    last_use[in_node] = never; // avoids releasing twice repeated operands
+                }
+            }
+            ++pos;
+        }
+        tape_out.resize(outs.size());
+        for (decltype(outs.size()) i = 0u; i < outs.size(); ++i) {
+            tape_out[i] = slot[outs[i]];
+        }
+        return n_slots;
+    }
+
+    // Runs the tape. The first m_n slots must contain the inputs and the ephemeral constants (followed, for the
+    // tape of the dependent part, by the eph frontier).
+    template <typename U>
+    void run_tape(std::vector<U> &slots, std::vector<U> &function_in) const
+    {
+        run_tape(m_tapes.tape, slots, function_in);
+    }
+    template <typename U>
+    void run_tape(const std::vector<unsigned> &tape, std::vector<U> &slots, std::vector<U> &function_in) const
+    {
+        auto it = tape.data();
+        const auto end = it + tape.size();
+        while (it != end) {
+            const unsigned arity = it[1];
+            function_in.resize(arity);
+            for (auto j = 0u; j < arity; ++j) {
+                function_in[j] = slots[it[3u + j]];
+            }
+            slots[it[2]] = m_f[it[0]](function_in);
+            it += 3u + arity;
+        }
+    }
+
+    void check_eph_val_size(const std::vector<T> &eph_val) const
+    {
+        if (eph_val.size() != m_eph_val.size()) {
+            throw std::invalid_argument(
+                "The number of ephemeral constants in this dCGP expression is " + std::to_string(m_eph_val.size())
+                + ", while you are trying to set their values with a vector of size " + std::to_string(eph_val.size()));
         }
-        return retval;
     }
 
     /// Validity of the CGP encoding
@@ -1189,33 +2685,65 @@ private:
 public:
     /// Object serialization
     /**
-     * This method will save/load \p this into the archive \p ar.
+     * This method will save/load \p this into the archive \p ar. Only the structure of the expression, its
+     * kernels, chromosome and constants are stored: the active graph and the tapes are rebuilt on load.
      *
      * @param ar target archive.
      *
      * @throws unspecified any exception thrown by the serialization of the expression and of primitive types.
      */
     template <typename Archive>
-    void serialize(Archive &ar, unsigned)
-    {
-        ar &m_n;
-        ar &m_m;
-        ar &m_r;
-        ar &m_c;
-        ar &m_l;
-        ar &m_arity;
-        ar &m_f;
-        ar &m_eph_val;
-        ar &m_eph_symb;
-        ar &m_lb;
-        ar &m_ub;
-        ar &m_active_nodes;
-        ar &m_active_genes;
-        ar &m_x;
-        ar &m_gene_idx;
-        ar &m_phenotype_correction;
-        ar &m_e;
+    void save(Archive &ar, unsigned) const
+    {
+        ar << m_n;
+        ar << m_m;
+        ar << m_r;
+        ar << m_c;
+        ar << m_l;
+        ar << m_arity;
+        ar << m_f;
+        ar << m_eph_val;
+        ar << m_eph_symb;
+        ar << m_lb;
+        ar << m_ub;
+        ar << m_x;
+        ar << m_gene_idx;
+        ar << m_fp_rules;
+        ar << m_phenotype_correction;
+        ar << m_e;
     }
+    template <typename Archive>
+    void load(Archive &ar, unsigned version)
+    {
+        ar >> m_n;
+        ar >> m_m;
+        ar >> m_r;
+        ar >> m_c;
+        ar >> m_l;
+        ar >> m_arity;
+        ar >> m_f;
+        ar >> m_eph_val;
+        ar >> m_eph_symb;
+        ar >> m_lb;
+        ar >> m_ub;
+        if (version == 0u) {
+            // Archives of version 0 also store the active nodes and genes
+            ar >> m_active_nodes;
+            ar >> m_active_genes;
+            ar >> m_x;
+            ar >> m_gene_idx;
+            m_fp_rules = fp_rules::exact;
+        } else {
+            ar >> m_x;
+            ar >> m_gene_idx;
+            ar >> m_fp_rules;
+        }
+        ar >> m_phenotype_correction;
+        ar >> m_e;
+        // The data of derived classes are loaded by them, hence the base class method
+        expression::update_data_structures();
+    }
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
 
 private:
     // number of inputs
@@ -1244,10 +2772,19 @@ private:
     std::vector<unsigned> m_active_nodes;
     // active genes idx
     std::vector<unsigned> m_active_genes;
+    // flags marking the active nodes and genes (for constant time lookups)
+    std::vector<bool> m_is_active_node;
+    std::vector<bool> m_is_active_gene;
+    // number of active genes (connection or output) pointing to each node
+    std::vector<unsigned> m_active_refs;
     // the encoded chromosome
     std::vector<unsigned> m_x;
     // The starting index in the chromosome of the genes expressing a node
     std::vector<unsigned> m_gene_idx;
+    // The floating point rules of the simplified evaluation (see set_fp_rules())
+    fp_rules m_fp_rules = fp_rules::exact;
+    // The tapes, compiled at the first evaluation needing them (see ensure_tapes())
+    mutable tape_cache m_tapes;
     // The optional phenotype correction
     boost::optional<pc_fun_type> m_phenotype_correction;
     // the random engine for the class
@@ -1258,4 +2795,18 @@ private:
 
 } // end of namespace dcgp
 
+namespace boost
+{
+namespace serialization
+{
+// Version 1 no longer stores the active nodes and genes, rebuilt on load with the tapes.
+template <typename T>
+struct version<dcgp::expression<T>> {
+    typedef mpl::int_<1> type;
+    typedef mpl::integral_c_tag tag;
+    BOOST_STATIC_CONSTANT(int, value = version::type::value);
+};
+} // namespace serialization
+} // namespace boost
+
 #endif // DCGP_EXPRESSION_H
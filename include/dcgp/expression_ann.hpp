@@ -2,6 +2,8 @@
 #define DCGP_EXPRESSION_ANN_H
 
 #include <algorithm>
+#include <cmath>
+#include <cstddef>
 #include <functional>
 #include <initializer_list>
 #include <iostream>
@@ -11,14 +13,17 @@
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <tuple>
 #include <vector>
 
+#include <tbb/blocked_range.h>
+#include <tbb/combinable.h>
 #include <tbb/parallel_for.h>
-#include <tbb/spin_mutex.h>
 
 #include <audi/io.hpp>
 
 #include <dcgp/config.hpp>
+#include <dcgp/dataset.hpp>
 #include <dcgp/expression.hpp>
 #include <dcgp/kernel.hpp>
 #include <dcgp/s11n.hpp>
@@ -309,16 +314,6 @@ public:
                 const std::vector<double> &point, const std::vector<double> &prediction,
                 const expression<double>::loss_type loss_e) const
     {
-        if (point.size() != this->get_n()) {
-            throw std::invalid_argument("When computing the loss the point dimension (input) seemed wrong, it was: "
-                                        + std::to_string(point.size())
-                                        + " while I expected: " + std::to_string(this->get_n()));
-        }
-        if (prediction.size() != this->get_m()) {
-            throw std::invalid_argument(
-                "When computing the loss the prediction dimension (output) seemed wrong, it was: "
-                + std::to_string(prediction.size()) + " while I expected: " + std::to_string(this->get_m()));
-        }
         if (gweights.size() != m_weights.size()) {
             throw std::invalid_argument("The size of the return value gweights is: " + std::to_string(gweights.size())
                                         + " while I expected: " + std::to_string(m_weights.size()));
@@ -329,88 +324,8 @@ public:
                                         + " while I expected: " + std::to_string(m_biases.size()));
         }
 
-        // ------------------------------------------ Forward pass (takes roughly half of the time) --------------------
-        // All active nodes outputs get computed as well as
-        // the activation function derivatives
-        auto n_nodes = this->get_n() + this->get_r() * this->get_c();
-        std::vector<double> node(n_nodes, 0.), d_node(n_nodes, 0.);
-        fill_nodes(point, node, d_node); // here is where the computatinal graph is computed.
-
-        // We add to node_d some virtual nodes containing the derivative of the loss with respect to the outputs
-        // (dL/do_i)
-        switch (loss_e) {
-            // Mean Square Error
-            case expression<double>::loss_type::MSE: {
-                auto sample_dim = static_cast<double>(prediction.size());
-                for (decltype(this->get_m()) i = 0u; i < this->get_m(); ++i) {
-                    auto node_idx = this->get()[this->get().size() - this->get_m() + i];
-                    auto dummy = (node[node_idx] - prediction[i]);
-                    d_node.push_back(2. * dummy / sample_dim);
-                    value += dummy * dummy / sample_dim;
-                }
-                break; // and exits the switch
-            }
-            // Cross Entropy
-            case expression<double>::loss_type::CE: {
-                std::vector<double> ps(this->get_m(), 0.);
-                // We store output values in ps
-                for (decltype(this->get_m()) i = 0u; i < this->get_m(); ++i) {
-                    auto node_idx = this->get()[this->get().size() - this->get_m() + i];
-                    ps[i] = node[node_idx];
-                }
-                // We guard from numerical instabilities subtracting the max
-                auto max = *std::max_element(ps.begin(), ps.end());
-                std::transform(ps.begin(), ps.end(), ps.begin(), [max](double a) { return std::exp(a - max); });
-                // We compute the sum of exp(o_i - max)
-                double cumsum = std::accumulate(ps.begin(), ps.end(), 0.);
-                // We transform to probabilities p_i
-                std::transform(ps.begin(), ps.end(), ps.begin(), [cumsum](double a) { return a / cumsum; });
-                // We add the derivatives of the loss w.r.t. to outputs
-                for (decltype(ps.size()) i = 0u; i < ps.size(); ++i) {
-                    d_node.push_back(ps[i] - prediction[i]);
-                }
-                // We compute the cross-entropy
-                std::transform(ps.begin(), ps.end(), prediction.begin(), ps.begin(),
-                               [](double p, double y) { return std::log(p) * y; });
-                // - sum log(p_i) y_i
-                value += -std::accumulate(ps.begin(), ps.end(), 0.);
-                break;
-            }
-        }
-
-        // ------------------------------------------ Backward pass (takes roughly the remaining half)
-        // ----------------- We iterate backward on all the active nodes (except the input nodes) filling up the
-        // gradient information at each node for the incoming weights and relative bias
-        for (auto it = this->get_active_nodes().rbegin(); it != this->get_active_nodes().rend(); ++it) {
-            if (*it < this->get_n()) continue;
-            // index in the node/d_node vectors
-            auto node_id = *it;
-            // index of the node in the bias vector
-            auto b_idx = node_id - this->get_n();
-            // index of the node in the chromosome
-            auto c_idx = this->get_gene_idx()[node_id];
-            // index of the node in the weight vector
-            auto w_idx = c_idx - (node_id - this->get_n());
-
-            // We update the d_node information
-            double cum = 0.;
-            for (auto i = 0u; i < m_connected[node_id].size(); ++i) {
-                // If the node is not "virtual", that is not one of the m virtual nodes we added computing (x-x_i)^2
-                if (m_connected[node_id][i].first < this->get_n() + this->get_r() * this->get_c()) {
-                    cum += m_weights[m_connected[node_id][i].second] * d_node[m_connected[node_id][i].first];
-                } else {
-                    auto n_out = m_connected[node_id][i].first - (this->get_n() + this->get_r() * this->get_c());
-                    cum += d_node[d_node.size() - this->get_m() + n_out];
-                }
-            }
-            d_node[node_id] *= cum;
-
-            // fill gradients for weights and biases info
-            for (auto i = 0u; i < this->_get_arity(node_id); ++i) {
-                gweights[w_idx + i] += d_node[node_id] * node[this->get()[c_idx + 1 + i]];
-            }
-            gbiases[b_idx] += d_node[node_id];
-        }
+        with_backprop_workspace(
+            [&](backprop_workspace &ws) { d_loss(value, gweights, gbiases, point, prediction, loss_e, ws); });
     }
 
     /// Evaluates the loss and its gradient  (on a batch)
@@ -421,8 +336,8 @@ public:
      * @param[labels] The predicted outputs (a batch).
      * @param[loss_e] The loss type. Must be loss_type::MSE for Mean Square Error (regression) or loss_type::CE for
      * Cross Entropy (classification)
-     * @param[parallel] sets the grain for parallelism. 0 -> no parallelism n -> divides the data into n parts and
-     * processes them in parallel threads.
+     * @param[parallel] sets the grain for parallelism. 0 -> no parallelism n -> divides the data into n (roughly
+     * equal) parts and processes them in parallel threads.
      * @return the loss, the gradient of the loss w.r.t. all weights (also inactive) and the gradient of the loss w.r.t
      * all biases.
      */
@@ -450,8 +365,8 @@ public:
      * @param[lr] The learning rate.
      * @param[batch_size] The batch size.
      * @param[loss_s] A string defining the loss type. Can be one of "MSE" (mean squared error) or "CE" (cross-entropy)
-     * @param[parallel] sets the grain for parallelism. 0 -> no parallelism n -> divides the data into n parts and
-     * processes them in parallel threads.
+     * @param[parallel] sets the grain for parallelism. 0 -> no parallelism n -> divides the data into n (roughly
+     * equal) parts and processes them in parallel threads.
      * @param[shuffle] when true it shuffles the points and labels before performing one epoch of training.
      *
      * @return The average error across the batches. Note: this will not be equal to the error on the whole data set
@@ -517,6 +432,88 @@ public:
         return retval / counter;
     }
 
+    /// Evaluates the loss and its gradient  (on a dataset)
+    /**
+     * Returns the loss and its gradient with respect to weights and biases over all the points of a dataset.
+     *
+     * @param[data] The dataset.
+     * @param[loss_e] The loss type. Must be loss_type::MSE for Mean Square Error (regression) or loss_type::CE for
+     * Cross Entropy (classification)
+     * @param[parallel] sets the grain for parallelism. 0 -> no parallelism n -> divides the data into n (roughly
+     * equal) parts and processes them in parallel threads.
+     * @return the loss, the gradient of the loss w.r.t. all weights (also inactive) and the gradient of the loss w.r.t
+     * all biases.
+     */
+    std::tuple<double, std::vector<double>, std::vector<double>>
+    d_loss(const dataset &data, expression<double>::loss_type loss_e, unsigned parallel = 0u) const
+    {
+        if (data.size() == 0) {
+            throw std::invalid_argument("Data size cannot be zero");
+        }
+        return d_loss_impl(data.points_begin(), data.labels_begin(), static_cast<unsigned>(data.size()), loss_e,
+                           parallel);
+    }
+
+    /// Stochastic gradient descent (on a dataset)
+    /**
+     * Performs one "epoch" of stochastic gradient descent. The dataset is not modified: when shuffling, the points are
+     * visited in a random order.
+     *
+     * @param[data] The dataset.
+     * @param[lr] The learning rate.
+     * @param[batch_size] The batch size.
+     * @param[loss_s] A string defining the loss type. Can be one of "MSE" (mean squared error) or "CE" (cross-entropy)
+     * @param[parallel] sets the grain for parallelism. 0 -> no parallelism n -> divides the data into n (roughly
+     * equal) parts and processes them in parallel threads.
+     * @param[shuffle] when true the points are visited in a random order.
+     *
+     * @return The average error across the batches.
+     *
+     * @throws std::invalid_argument if the *data* size is zero, or if *lr* is not positive.
+     */
+    double sgd(const dataset &data, double lr, unsigned batch_size, const std::string &loss_s, unsigned parallel = 0u,
+               bool shuffle = true)
+    {
+        // Sanity checks for the inputs
+        if (data.size() == 0) {
+            throw std::invalid_argument("Data size cannot be zero");
+        }
+        if (lr <= 0) {
+            throw std::invalid_argument("The learning rate must be a positive number, while: " + std::to_string(lr)
+                                        + " was detected.");
+        }
+
+        // Decoding the loss from string to the enum type (loss_s -> loss_e)
+        expression<double>::loss_type loss_e;
+        if (loss_s == "MSE") {
+            loss_e = expression<double>::loss_type::MSE;
+        } else if (loss_s == "CE") {
+            loss_e = expression<double>::loss_type::CE;
+        } else {
+            throw std::invalid_argument("The requested loss was: " + loss_s + " while only MSE and CE are allowed");
+        }
+
+        // The order in which the points are visited
+        std::vector<std::size_t> perm(data.size());
+        std::iota(perm.begin(), perm.end(), std::size_t(0u));
+        if (shuffle) {
+            std::mt19937 eng(std::random_device{}());
+            std::shuffle(perm.begin(), perm.end(), eng);
+        }
+
+        // Starting the iteration
+        const unsigned N = static_cast<unsigned>(data.size());
+        double retval = 0.;
+        double counter = 0.;
+        for (unsigned start = 0u; start < N; start += batch_size) {
+            retval += update_weights_impl(data.points_begin(perm.data()) + start,
+                                          data.labels_begin(perm.data()) + start, std::min(batch_size, N - start), lr,
+                                          loss_e, parallel);
+            counter++;
+        }
+        return retval / counter;
+    }
+
     /// Sets the output nonlinearities
     /**
      * Sets the nonlinearities of all nodes connected to the output nodes.
@@ -883,6 +880,389 @@ private:
         return this->get_f()[this->get()[idx]](function_in);
     }
 
+    // Applies the nonlinearity of a dCGPANN kernel of type t to the weighted inputs z[0], ..., z[T-1] of a node,
+    // writing the node values in o and their derivatives with respect to z in d. It is shared by the single point
+    // (T = 1) and the batched backpropagation so that the math of each kernel is written only once.
+    static void activation(kernel_type t, const double *z, double *o, double *d, unsigned T)
+    {
+        switch (t) {
+            case kernel_type::SIG:
+                for (auto k = 0u; k < T; ++k) {
+                    o[k] = 1. / (1. + std::exp(-z[k]));
+                    d[k] = o[k] * (1. - o[k]);
+                }
+                break;
+            case kernel_type::TANH:
+                for (auto k = 0u; k < T; ++k) {
+                    o[k] = std::tanh(z[k]);
+                    d[k] = 1. - o[k] * o[k];
+                }
+                break;
+            case kernel_type::SUM:
+                for (auto k = 0u; k < T; ++k) {
+                    o[k] = z[k];
+                    d[k] = 1.;
+                }
+                break;
+            case kernel_type::RELU:
+                for (auto k = 0u; k < T; ++k) {
+                    o[k] = (z[k] < 0.) ? 0. : z[k];
+                    d[k] = (o[k] > 0.) ? 1. : 0.;
+                }
+                break;
+            case kernel_type::ELU:
+                for (auto k = 0u; k < T; ++k) {
+                    o[k] = (z[k] < 0.) ? std::exp(z[k]) - 1. : z[k];
+                    d[k] = (o[k] > 0.) ? 1. : o[k] + 1.;
+                }
+                break;
+            case kernel_type::ISRU:
+                for (auto k = 0u; k < T; ++k) {
+                    o[k] = z[k] / std::sqrt(1. + z[k] * z[k]);
+                    d[k] = o[k] * o[k] * o[k] / z[k] / z[k] / z[k];
+                }
+                break;
+            case kernel_type::SIN_NU:
+                for (auto k = 0u; k < T; ++k) {
+                    o[k] = std::sin(z[k]);
+                    d[k] = std::cos(z[k]);
+                }
+                break;
+            case kernel_type::COS_NU:
+                for (auto k = 0u; k < T; ++k) {
+                    o[k] = std::cos(z[k]);
+                    d[k] = -std::sin(z[k]);
+                }
+                break;
+            case kernel_type::GAUSSIAN_NU:
+                for (auto k = 0u; k < T; ++k) {
+                    o[k] = std::exp(-z[k] * z[k]);
+                    d[k] = -2 * z[k] * o[k];
+                }
+                break;
+            case kernel_type::INV_SUM:
+                for (auto k = 0u; k < T; ++k) {
+                    o[k] = -z[k];
+                    d[k] = -1.;
+                }
+                break;
+            case kernel_type::ABS:
+                for (auto k = 0u; k < T; ++k) {
+                    o[k] = std::abs(z[k]);
+                    d[k] = z[k] < 0. ? -1 : 1;
+                }
+                break;
+            case kernel_type::STEP:
+                for (auto k = 0u; k < T; ++k) {
+                    o[k] = z[k] < 0. ? 0. : 1.;
+                    d[k] = 0.;
+                }
+                break;
+        }
+    }
+
+    // Buffers reused across the backpropagation of many points. The flag marks the thread local instance as busy, so
+    // that a re-entrant call (e.g. from within a kernel) does not overwrite it.
+    struct backprop_workspace {
+        std::vector<double> node;
+        // the node derivatives followed by the derivatives of the loss w.r.t. the outputs
+        std::vector<double> d_node;
+        std::vector<double> function_in;
+        // the output probabilities (cross entropy)
+        std::vector<double> ps;
+        bool busy = false;
+    };
+
+    // Calls f with the thread local workspace, or with a fresh one if that is already in use.
+    template <typename F>
+    static void with_backprop_workspace(F &&f)
+    {
+        thread_local backprop_workspace ws;
+        if (ws.busy) {
+            backprop_workspace tmp;
+            f(tmp);
+            return;
+        }
+        struct busy_guard {
+            ~busy_guard()
+            {
+                m_flag = false;
+            }
+            bool &m_flag;
+        } guard{ws.busy};
+        ws.busy = true;
+        f(ws);
+    }
+
+    // Cumulates the loss and its gradient (of a single point) using the buffers in ws
+    void d_loss(double &value, std::vector<double> &gweights, std::vector<double> &gbiases,
+                const std::vector<double> &point, const std::vector<double> &prediction,
+                const expression<double>::loss_type loss_e, backprop_workspace &ws) const
+    {
+        if (point.size() != this->get_n()) {
+            throw std::invalid_argument("When computing the loss the point dimension (input) seemed wrong, it was: "
+                                        + std::to_string(point.size())
+                                        + " while I expected: " + std::to_string(this->get_n()));
+        }
+        if (prediction.size() != this->get_m()) {
+            throw std::invalid_argument(
+                "When computing the loss the prediction dimension (output) seemed wrong, it was: "
+                + std::to_string(prediction.size()) + " while I expected: " + std::to_string(this->get_m()));
+        }
+        // ------------------------------------------ Forward pass (takes roughly half of the time) --------------------
+        // All active nodes outputs get computed as well as
+        // the activation function derivatives
+        auto n_nodes = this->get_n() + this->get_r() * this->get_c();
+        auto &node = ws.node;
+        auto &d_node = ws.d_node;
+        node.resize(n_nodes);
+        d_node.resize(n_nodes + this->get_m());
+        fill_nodes(point, node, d_node); // here is where the computatinal graph is computed.
+
+        // The last m entries of d_node are virtual nodes containing the derivative of the loss with respect to the
+        // outputs (dL/do_i)
+        switch (loss_e) {
+            // Mean Square Error
+            case expression<double>::loss_type::MSE: {
+                auto sample_dim = static_cast<double>(prediction.size());
+                for (decltype(this->get_m()) i = 0u; i < this->get_m(); ++i) {
+                    auto node_idx = this->get()[this->get().size() - this->get_m() + i];
+                    auto dummy = (node[node_idx] - prediction[i]);
+                    d_node[n_nodes + i] = 2. * dummy / sample_dim;
+                    value += dummy * dummy / sample_dim;
+                }
+                break; // and exits the switch
+            }
+            // Cross Entropy
+            case expression<double>::loss_type::CE: {
+                auto &ps = ws.ps;
+                ps.resize(this->get_m());
+                // We store output values in ps
+                for (decltype(this->get_m()) i = 0u; i < this->get_m(); ++i) {
+                    auto node_idx = this->get()[this->get().size() - this->get_m() + i];
+                    ps[i] = node[node_idx];
+                }
+                // We guard from numerical instabilities subtracting the max
+                auto max = *std::max_element(ps.begin(), ps.end());
+                std::transform(ps.begin(), ps.end(), ps.begin(), [max](double a) { return std::exp(a - max); });
+                // We compute the sum of exp(o_i - max)
+                double cumsum = std::accumulate(ps.begin(), ps.end(), 0.);
+                // We transform to probabilities p_i
+                std::transform(ps.begin(), ps.end(), ps.begin(), [cumsum](double a) { return a / cumsum; });
+                // We add the derivatives of the loss w.r.t. to outputs
+                for (decltype(ps.size()) i = 0u; i < ps.size(); ++i) {
+                    d_node[n_nodes + i] = ps[i] - prediction[i];
+                }
+                // We compute the cross-entropy
+                std::transform(ps.begin(), ps.end(), prediction.begin(), ps.begin(),
+                               [](double p, double y) { return std::log(p) * y; });
+                // - sum log(p_i) y_i
+                value += -std::accumulate(ps.begin(), ps.end(), 0.);
+                break;
+            }
+        }
+
+        // ------------------------------------------ Backward pass (takes roughly the remaining half)
+        // ----------------- We iterate backward on all the active nodes (except the input nodes) filling up the
+        // gradient information at each node for the incoming weights and relative bias
+        for (auto it = this->get_active_nodes().rbegin(); it != this->get_active_nodes().rend(); ++it) {
+            if (*it < this->get_n()) continue;
+            // index in the node/d_node vectors
+            auto node_id = *it;
+            // index of the node in the bias vector
+            auto b_idx = node_id - this->get_n();
+            // index of the node in the chromosome
+            auto c_idx = this->get_gene_idx()[node_id];
+            // index of the node in the weight vector
+            auto w_idx = c_idx - (node_id - this->get_n());
+
+            // We update the d_node information
+            double cum = 0.;
+            for (auto i = 0u; i < m_connected[node_id].size(); ++i) {
+                // If the node is not "virtual", that is not one of the m virtual nodes we added computing (x-x_i)^2
+                if (m_connected[node_id][i].first < n_nodes) {
+                    cum += m_weights[m_connected[node_id][i].second] * d_node[m_connected[node_id][i].first];
+                } else {
+                    cum += d_node[m_connected[node_id][i].first];
+                }
+            }
+            d_node[node_id] *= cum;
+
+            // fill gradients for weights and biases info
+            for (auto i = 0u; i < this->_get_arity(node_id); ++i) {
+                gweights[w_idx + i] += d_node[node_id] * node[this->get()[c_idx + 1 + i]];
+            }
+            gbiases[b_idx] += d_node[node_id];
+        }
+    }
+
+    // Number of points processed together by the batched forward and backward passes
+    static constexpr unsigned backprop_tile = 256u;
+
+    // Cumulates the loss and its gradient over the N points (and labels) starting at dfirst (and lfirst). Each
+    // active node processes a whole tile of points at once, so that weights and kernel type are looked up once per
+    // node and the inner loops run over contiguous columns. The result is the same of the single point version.
+    template <typename DIt, typename LIt>
+    void batch_d_loss(double &value, std::vector<double> &gweights, std::vector<double> &gbiases, DIt dfirst,
+                      LIt lfirst, unsigned N, const expression<double>::loss_type loss_e,
+                      backprop_workspace &ws) const
+    {
+        for (unsigned start = 0u; start < N; start += backprop_tile) {
+            batch_d_loss_tile(value, gweights, gbiases, dfirst + start, lfirst + start,
+                              std::min(backprop_tile, N - start), loss_e, ws);
+        }
+    }
+
+    // Cumulates the loss and its gradient over T points. Node values and derivatives are stored node major, the
+    // column of the node node_id starting at node_id * T.
+    template <typename DIt, typename LIt>
+    void batch_d_loss_tile(double &value, std::vector<double> &gweights, std::vector<double> &gbiases, DIt dfirst,
+                           LIt lfirst, unsigned T, const expression<double>::loss_type loss_e,
+                           backprop_workspace &ws) const
+    {
+        const auto n = this->get_n();
+        const auto m = this->get_m();
+        const auto n_nodes = n + this->get_r() * this->get_c();
+        for (auto k = 0u; k < T; ++k) {
+            if ((*(dfirst + k)).size() != n) {
+                throw std::invalid_argument("When computing the loss the point dimension (input) seemed wrong, it was: "
+                                            + std::to_string((*(dfirst + k)).size())
+                                            + " while I expected: " + std::to_string(n));
+            }
+            if ((*(lfirst + k)).size() != m) {
+                throw std::invalid_argument(
+                    "When computing the loss the prediction dimension (output) seemed wrong, it was: "
+                    + std::to_string((*(lfirst + k)).size()) + " while I expected: " + std::to_string(m));
+            }
+        }
+        auto &node = ws.node;
+        auto &d_node = ws.d_node;
+        // the weighted sum of the node inputs (forward pass) and the cumulated d_node of the children (backward pass)
+        auto &z = ws.function_in;
+        node.resize(n_nodes * T);
+        d_node.resize((n_nodes + m) * T);
+        z.resize(T);
+
+        // ------------------------------------------ Forward pass ----------------------------------------------------
+        for (auto node_id : this->get_active_nodes()) {
+            double *o = node.data() + node_id * T;
+            if (node_id < n) {
+                for (auto k = 0u; k < T; ++k) {
+                    o[k] = (*(dfirst + k))[node_id];
+                }
+                continue;
+            }
+            unsigned arity = this->_get_arity(node_id);
+            // position in the chromosome of the current node
+            unsigned g_idx = this->get_gene_idx()[node_id];
+            // starting position in m_weights of the weights relative to the node
+            unsigned w_idx = g_idx - (node_id - n);
+            // position in m_biases of the node bias
+            unsigned b_idx = node_id - n;
+            // w_1 a + bias + w_2 b + w_3 c + ... (in the same order as kernel_call)
+            const double *x = node.data() + this->get()[g_idx + 1] * T;
+            const double w = m_weights[w_idx];
+            const double b = m_biases[b_idx];
+            for (auto k = 0u; k < T; ++k) {
+                z[k] = x[k] * w + b;
+            }
+            for (auto j = 1u; j < arity; ++j) {
+                const double *xj = node.data() + this->get()[g_idx + j + 1] * T;
+                const double wj = m_weights[w_idx + j];
+                for (auto k = 0u; k < T; ++k) {
+                    z[k] += xj[k] * wj;
+                }
+            }
+            // nonlinearity and its derivative
+            activation(m_kernel_map[this->get()[g_idx]], z.data(), o, d_node.data() + node_id * T, T);
+        }
+
+        // ------------------------------------------ Loss and its derivatives w.r.t. the outputs --------------------
+        // These are stored in the m virtual node columns following the n + r * c real ones
+        switch (loss_e) {
+            // Mean Square Error
+            case expression<double>::loss_type::MSE: {
+                auto sample_dim = static_cast<double>(m);
+                for (auto k = 0u; k < T; ++k) {
+                    const auto &prediction = *(lfirst + k);
+                    for (decltype(this->get_m()) i = 0u; i < m; ++i) {
+                        auto node_idx = this->get()[this->get().size() - m + i];
+                        auto dummy = (node[node_idx * T + k] - prediction[i]);
+                        d_node[(n_nodes + i) * T + k] = 2. * dummy / sample_dim;
+                        value += dummy * dummy / sample_dim;
+                    }
+                }
+                break;
+            }
+            // Cross Entropy
+            case expression<double>::loss_type::CE: {
+                auto &ps = ws.ps;
+                ps.resize(m);
+                for (auto k = 0u; k < T; ++k) {
+                    const auto &prediction = *(lfirst + k);
+                    for (decltype(this->get_m()) i = 0u; i < m; ++i) {
+                        auto node_idx = this->get()[this->get().size() - m + i];
+                        ps[i] = node[node_idx * T + k];
+                    }
+                    auto max = *std::max_element(ps.begin(), ps.end());
+                    std::transform(ps.begin(), ps.end(), ps.begin(), [max](double a) { return std::exp(a - max); });
+                    double cumsum = std::accumulate(ps.begin(), ps.end(), 0.);
+                    std::transform(ps.begin(), ps.end(), ps.begin(), [cumsum](double a) { return a / cumsum; });
+                    for (decltype(ps.size()) i = 0u; i < ps.size(); ++i) {
+                        d_node[(n_nodes + i) * T + k] = ps[i] - prediction[i];
+                    }
+                    std::transform(ps.begin(), ps.end(), prediction.begin(), ps.begin(),
+                                   [](double p, double y) { return std::log(p) * y; });
+                    value += -std::accumulate(ps.begin(), ps.end(), 0.);
+                }
+                break;
+            }
+        }
+
+        // ------------------------------------------ Backward pass ---------------------------------------------------
+        auto &cum = z;
+        for (auto it = this->get_active_nodes().rbegin(); it != this->get_active_nodes().rend(); ++it) {
+            if (*it < n) continue;
+            auto node_id = *it;
+            auto b_idx = node_id - n;
+            auto c_idx = this->get_gene_idx()[node_id];
+            auto w_idx = c_idx - (node_id - n);
+
+            std::fill(cum.begin(), cum.end(), 0.);
+            for (const auto &conn : m_connected[node_id]) {
+                const double *dc = d_node.data() + conn.first * T;
+                // virtual (output) nodes have no weight
+                if (conn.first < n_nodes) {
+                    const double w = m_weights[conn.second];
+                    for (auto k = 0u; k < T; ++k) {
+                        cum[k] += w * dc[k];
+                    }
+                } else {
+                    for (auto k = 0u; k < T; ++k) {
+                        cum[k] += dc[k];
+                    }
+                }
+            }
+            double *d = d_node.data() + node_id * T;
+            for (auto k = 0u; k < T; ++k) {
+                d[k] *= cum[k];
+            }
+
+            // fill gradients for weights and biases info
+            for (auto i = 0u; i < this->_get_arity(node_id); ++i) {
+                const double *x = node.data() + this->get()[c_idx + 1 + i] * T;
+                double &g = gweights[w_idx + i];
+                for (auto k = 0u; k < T; ++k) {
+                    g += d[k] * x[k];
+                }
+            }
+            double &g = gbiases[b_idx];
+            for (auto k = 0u; k < T; ++k) {
+                g += d[k];
+            }
+        }
+    }
+
     // computes node to evaluate the expression
     template <typename U, enable_double_string<U> = 0>
     std::vector<U> fill_nodes(const std::vector<U> &in) const
@@ -919,8 +1299,6 @@ private:
         if (in.size() != this->get_n()) {
             throw std::invalid_argument("Input size is incompatible");
         }
-        // Start
-        std::vector<double> function_in;
         for (auto node_id : this->get_active_nodes()) {
             if (node_id < this->get_n()) {
                 node[node_id] = in[node_id];
@@ -930,69 +1308,18 @@ private:
                 d_node[node_id] = 0.;
             } else {
                 unsigned arity = this->_get_arity(node_id);
-                function_in.resize(arity);
                 // position in the chromosome of the current node
                 unsigned g_idx = this->get_gene_idx()[node_id];
                 // starting position in m_weights of the weights relative to the node
                 unsigned w_idx = g_idx - (node_id - this->get_n());
                 // starting position in m_biases of the node bias
                 unsigned b_idx = node_id - this->get_n();
-                for (auto j = 0u; j < arity; ++j) {
-                    function_in[j] = node[this->get()[g_idx + j + 1]];
-                }
-                node[node_id] = kernel_call(function_in, g_idx, arity, w_idx, b_idx);
-                // take cares of d_node
-                // sigmoid derivative is sig(1-sig)
-                switch (m_kernel_map[this->get()[g_idx]]) {
-                    case kernel_type::SIG:
-                        d_node[node_id] = node[node_id] * (1. - node[node_id]);
-                        break;
-                    case kernel_type::TANH:
-                        d_node[node_id] = 1. - node[node_id] * node[node_id];
-                        break;
-                    case kernel_type::SUM:
-                        d_node[node_id] = 1.;
-                        break;
-                    case kernel_type::RELU:
-                        d_node[node_id] = (node[node_id] > 0.) ? 1. : 0.;
-                        break;
-                    case kernel_type::ELU:
-                        d_node[node_id] = (node[node_id] > 0.) ? 1. : node[node_id] + 1.;
-                        break;
-                    case kernel_type::ISRU: {
-                        auto cumin = std::accumulate(function_in.begin(), function_in.end(), 0.);
-                        d_node[node_id] = node[node_id] * node[node_id] * node[node_id] / cumin / cumin / cumin;
-                        break;
-                    }
-                    case kernel_type::SIN_NU: {
-                        auto cumin = std::accumulate(function_in.begin(), function_in.end(), 0.);
-                        d_node[node_id] = std::cos(cumin);
-                        break;
-                    }
-                    case kernel_type::COS_NU: {
-                        auto cumin = std::accumulate(function_in.begin(), function_in.end(), 0.);
-                        d_node[node_id] = -std::sin(cumin);
-                        break;
-                    }
-                    case kernel_type::GAUSSIAN_NU: {
-                        auto cumin = std::accumulate(function_in.begin(), function_in.end(), 0.);
-                        d_node[node_id] = -2 * cumin * node[node_id];
-                        break;
-                    }
-                    case kernel_type::INV_SUM: {
-                        d_node[node_id] = -1.;
-                        break;
-                    }
-                    case kernel_type::ABS: {
-                        auto cumin = std::accumulate(function_in.begin(), function_in.end(), 0.);
-                        d_node[node_id] = cumin < 0. ? -1 : 1;
-                        break;
-                    }
-                    case kernel_type::STEP: {
-                        d_node[node_id] = 0.;
-                        break;
-                    }
+                // w_1 a + bias + w_2 b + w_3 c + ... (in the same order as kernel_call)
+                double z = node[this->get()[g_idx + 1]] * m_weights[w_idx] + m_biases[b_idx];
+                for (auto j = 1u; j < arity; ++j) {
+                    z += node[this->get()[g_idx + j + 1]] * m_weights[w_idx + j];
                 }
+                activation(m_kernel_map[this->get()[g_idx]], &z, &node[node_id], &d_node[node_id], 1u);
             }
         }
     }
@@ -1002,6 +1329,19 @@ private:
     void update_data_structures() override
     {
         expression<double>::update_data_structures();
+        update_connected();
+    }
+
+    // This overrides the base class incremental update_data_structures after a single gene mutation
+    void update_data_structures(unsigned idx, unsigned old_value) override
+    {
+        expression<double>::update_data_structures(idx, old_value);
+        update_connected();
+    }
+
+    // Rebuilds m_connected from the active nodes
+    void update_connected()
+    {
         m_connected.clear();
         m_connected.resize(this->get_n() + this->get_m() + this->get_r() * this->get_c());
         for (auto node_id : this->get_active_nodes()) {
@@ -1036,8 +1376,8 @@ private:
      * @param[lfirst] Start range for the labels
      * @param[lr] The learning rate
      * @param[loss_e] The loss type
-     * @param[parallel] sets the grain for parallelism. 0 -> no parallelism n -> divides the data into n parts and
-     * processes them in parallel threads.
+     * @param[parallel] sets the grain for parallelism. 0 -> no parallelism n -> divides the data into n (roughly
+     * equal) parts and processes them in parallel threads.
      *
      * @return the loss before the weight update
      *
@@ -1047,7 +1387,25 @@ private:
                           typename std::vector<std::vector<double>>::const_iterator lfirst, double lr,
                           expression<double>::loss_type loss_e, unsigned parallel = 0u)
     {
-        auto err = d_loss(dfirst, dlast, lfirst, loss_e, parallel);
+        return update_weights_impl(dfirst, lfirst, static_cast<unsigned>(dlast - dfirst), lr, loss_e, parallel);
+    }
+
+    std::tuple<double, std::vector<double>, std::vector<double>>
+    d_loss(typename std::vector<std::vector<double>>::const_iterator dfirst,
+           typename std::vector<std::vector<double>>::const_iterator dlast,
+           typename std::vector<std::vector<double>>::const_iterator lfirst, expression<double>::loss_type loss_e,
+           unsigned parallel = 0u) const
+    {
+        return d_loss_impl(dfirst, lfirst, static_cast<unsigned>(dlast - dfirst), loss_e, parallel);
+    }
+
+    // Performs one weight/bias update using the batch_size points (and labels) starting at dfirst (and lfirst). The
+    // iterators can run over std::vector<std::vector<double>> or over a dcgp::dataset.
+    template <typename DIt, typename LIt>
+    double update_weights_impl(DIt dfirst, LIt lfirst, unsigned batch_size, double lr,
+                               expression<double>::loss_type loss_e, unsigned parallel)
+    {
+        auto err = d_loss_impl(dfirst, lfirst, batch_size, loss_e, parallel);
 
         // We now update the weights with the stochastic gradient descent update rule
         std::transform(m_weights.begin(), m_weights.end(), std::get<1>(err).begin(), m_weights.begin(),
@@ -1057,50 +1415,47 @@ private:
         return std::get<0>(err);
     }
 
+    // Evaluates the loss and its gradient over the batch_size points (and labels) starting at dfirst (and lfirst).
+    template <typename DIt, typename LIt>
     std::tuple<double, std::vector<double>, std::vector<double>>
-    d_loss(typename std::vector<std::vector<double>>::const_iterator dfirst,
-           typename std::vector<std::vector<double>>::const_iterator dlast,
-           typename std::vector<std::vector<double>>::const_iterator lfirst, expression<double>::loss_type loss_e,
-           unsigned parallel = 0u) const
+    d_loss_impl(DIt dfirst, LIt lfirst, unsigned batch_size, expression<double>::loss_type loss_e,
+                unsigned parallel) const
     {
-        // Batch dimension
-        const unsigned batch_size = static_cast<unsigned>(dlast - dfirst);
         // These variables need to be read/written by all tasks.
         double value = 0.;
         std::vector<double> gweights(m_weights.size(), 0.);
         std::vector<double> gbiases(m_biases.size(), 0.);
 
         if (parallel > 0u) {
-            if (batch_size % parallel != 0) {
-                throw std::invalid_argument("The batch size is: " + std::to_string(batch_size)
-                                            + " and cannot be divided into " + std::to_string(parallel) + " parts.");
-            }
-            unsigned inner_batch_size = batch_size / parallel;
-            // The mutex that will protect read write access to value, gweights, gbiases.
-            tbb::spin_mutex mutex_weights_updates;
+            // The data is split into (roughly) parallel parts
+            const unsigned grain = std::max(1u, (batch_size + parallel - 1u) / parallel);
+            // Each thread cumulates the loss and its gradient in its own accumulator, these are summed at the end.
+            tbb::combinable<std::tuple<double, std::vector<double>, std::vector<double>>> partials([this]() {
+                return std::make_tuple(0., std::vector<double>(m_weights.size(), 0.),
+                                       std::vector<double>(m_biases.size(), 0.));
+            });
             // This loops over all points, predictions in the mini-batch
-            tbb::parallel_for(0u, batch_size, inner_batch_size, [&](unsigned i) {
-                double value2 = 0.;
-                std::vector<double> gweights2(m_weights.size(), 0.);
-                std::vector<double> gbiases2(m_biases.size(), 0.);
-                // The loss and its gradient get computed
-                for (auto j = 0u; j < inner_batch_size; ++j) {
-                    d_loss(value2, gweights2, gbiases2, *(dfirst + i + j), *(lfirst + i + j), loss_e);
-                }
-                // We acquire the lock on the mutex
-                tbb::spin_mutex::scoped_lock lock(mutex_weights_updates);
-                // We update the cumulative loss and gradient
-                value += value2;
-                std::transform(gweights.begin(), gweights.end(), gweights2.begin(), gweights.begin(),
+            tbb::parallel_for(tbb::blocked_range<unsigned>(0u, batch_size, grain),
+                              [&](const tbb::blocked_range<unsigned> &range) {
+                                  auto &acc = partials.local();
+                                  with_backprop_workspace([&](backprop_workspace &ws) {
+                                      batch_d_loss(std::get<0>(acc), std::get<1>(acc), std::get<2>(acc),
+                                                   dfirst + range.begin(), lfirst + range.begin(), range.size(),
+                                                   loss_e, ws);
+                                  });
+                              });
+            partials.combine_each([&](const std::tuple<double, std::vector<double>, std::vector<double>> &acc) {
+                value += std::get<0>(acc);
+                std::transform(gweights.begin(), gweights.end(), std::get<1>(acc).begin(), gweights.begin(),
                                [](double a, double b) { return a + b; });
-                std::transform(gbiases.begin(), gbiases.end(), gbiases2.begin(), gbiases.begin(),
+                std::transform(gbiases.begin(), gbiases.end(), std::get<2>(acc).begin(), gbiases.begin(),
                                [](double a, double b) { return a + b; });
             });
         } else {
-            for (unsigned i = 0u; i < batch_size; ++i) {
+            with_backprop_workspace([&](backprop_workspace &ws) {
                 // The loss and its gradient get computed and cumulated in value, gweights, gbiases
-                d_loss(value, gweights, gbiases, *(dfirst + i), *(lfirst + i), loss_e);
-            }
+                batch_d_loss(value, gweights, gbiases, dfirst, lfirst, batch_size, loss_e, ws);
+            });
         }
         std::transform(gweights.begin(), gweights.end(), gweights.begin(),
                        [&batch_size](double a) { return a / batch_size; });
@@ -2,7 +2,10 @@
 #define DCGP_KERNEL_H
 
 #include <algorithm>
+#include <cstddef>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
 #include <string>
 #include <utility> // std::forward
 #include <vector>
@@ -10,6 +13,7 @@
 #include <dcgp/config.hpp>
 #include <dcgp/function.hpp>
 #include <dcgp/s11n.hpp>
+#include <dcgp/wrapped_functions.hpp>
 
 namespace dcgp
 {
@@ -44,6 +48,12 @@ namespace dcgp
  * kernel<double> f(my_sum<double>, print_my_sum, "my_sum");
  * @endcode
  *
+ * When the two functions are one of those provided in dcgp/wrapped_functions.hpp and its matching symbolic
+ * representation (as is the case for all kernels built by a dcgp::kernel_set), the kernel is a built-in kernel: it
+ * is identified by a dcgp::kernel_id, evaluated through a switch on it and copied without allocations. When ``T`` is
+ * ``double`` a built-in kernel also carries a batch version of the function that evaluates it over many points at
+ * once (see kernel::batch()). Any other pair of callables is stored type erased in a dcgp::function.
+ *
  * @tparam T The type of the function output (and inputs)
  */
 template <typename T>
@@ -55,8 +65,10 @@ public:
     using my_fun_type = function<T(const std::vector<T> &)>;
     /// Basic prototype of a kernel function returning its symbolic representation
     using my_print_fun_type = function<std::string(const std::vector<std::string> &)>;
+    /// Prototype of the batch version of a kernel function
+    using my_batch_fun_type = batch_fun_ptr<T>;
 #endif
-    kernel() = default;
+    kernel() : m_user(std::make_unique<user_functions>()), m_thread_safety(pagmo::thread_safety::basic) {}
 
     /// Constructor
     /**
@@ -68,9 +80,71 @@ public:
      *
      */
     template <typename U, typename V>
-    kernel(U &&f, V &&pf, std::string name) : m_f(std::forward<U>(f)), m_pf(std::forward<V>(pf)), m_name(name)
+    kernel(U &&f, V &&pf, std::string name) : m_name(name)
+    {
+        my_fun_type fun(std::forward<U>(f));
+        my_print_fun_type pfun(std::forward<V>(pf));
+        m_id = get_kernel_id(fun, pfun);
+        if (m_id == kernel_id::user) {
+            m_thread_safety = std::min(fun.get_thread_safety(), pfun.get_thread_safety());
+            m_user = std::make_unique<user_functions>(user_functions{std::move(fun), std::move(pfun)});
+        } else {
+            // Built-in kernels are pure functions
+            m_thread_safety = pagmo::thread_safety::constant;
+        }
+        m_bf = get_batch_function<T>(m_id);
+        m_fast_bf = get_fast_batch_function<T>(m_id);
+    }
+
+    /// Copy constructor
+    /**
+     * Built-in kernels are copied without allocations, user defined ones deep copy their functions.
+     *
+     * @param[in] other the kernel to be copied.
+     */
+    kernel(const kernel &other)
+        : m_user(other.m_user ? std::make_unique<user_functions>(*other.m_user) : nullptr), m_name(other.m_name),
+          m_thread_safety(other.m_thread_safety), m_id(other.m_id), m_bf(other.m_bf),
+          m_fast_bf(other.m_fast_bf)
+    {
+    }
+    /// Move constructor
+    /**
+     * The moved-from kernel can only be destroyed or assigned to: calling it throws.
+     *
+     * @param[in] other the kernel to be moved.
+     */
+    kernel(kernel &&other) noexcept
+        : m_user(std::move(other.m_user)), m_name(std::move(other.m_name)), m_thread_safety(other.m_thread_safety),
+          m_id(other.m_id), m_bf(other.m_bf), m_fast_bf(other.m_fast_bf)
+    {
+        other.m_id = kernel_id::user;
+        other.m_bf = nullptr;
+        other.m_fast_bf = nullptr;
+    }
+    /// Copy assignment
+    kernel &operator=(const kernel &other)
+    {
+        if (this != &other) {
+            *this = kernel(other);
+        }
+        return *this;
+    }
+    /// Move assignment
+    kernel &operator=(kernel &&other) noexcept
     {
-        m_thread_safety = std::min(m_f.get_thread_safety(), m_pf.get_thread_safety());
+        if (this != &other) {
+            m_user = std::move(other.m_user);
+            m_name = std::move(other.m_name);
+            m_thread_safety = other.m_thread_safety;
+            m_id = other.m_id;
+            m_bf = other.m_bf;
+            m_fast_bf = other.m_fast_bf;
+            other.m_id = kernel_id::user;
+            other.m_bf = nullptr;
+            other.m_fast_bf = nullptr;
+        }
+        return *this;
     }
 
     /// Parenthesis operator
@@ -83,7 +157,10 @@ public:
      */
     T operator()(const std::vector<T> &in) const
     {
-        return m_f(in);
+        if (m_id == kernel_id::user) {
+            return user().m_f(in);
+        }
+        return call_kernel(m_id, in);
     }
     /// Parenthesis operator
     /**
@@ -95,7 +172,7 @@ public:
      */
     T operator()(const std::initializer_list<T> &in) const
     {
-        return m_f(in);
+        return operator()(std::vector<T>(in));
     }
     /// Parenthesis operator
     /**
@@ -107,7 +184,58 @@ public:
      */
     std::string operator()(const std::vector<std::string> &in) const
     {
-        return m_pf(in);
+        if (m_id == kernel_id::user) {
+            return user().m_pf(in);
+        }
+        return print_kernel(m_id, in);
+    }
+
+    /// Batch evaluation
+    /**
+     * Evaluates the kernel over \p n points at once.
+     *
+     * @param[in] in pointers to the input columns, \p in[j] pointing to the \p n values of the j-th input.
+     * @param[in] arity number of inputs.
+     * @param[out] out pointer to the \p n results. It must not overlap any of the inputs.
+     * @param[in] n number of points.
+     *
+     * @throw std::invalid_argument if the kernel has no batch version (see kernel::has_batch()).
+     */
+    void batch(const T *const *in, unsigned arity, T *out, std::size_t n) const
+    {
+        if (m_bf == nullptr) {
+            throw std::invalid_argument("The kernel " + m_name + " does not have a batch version");
+        }
+        m_bf(in, arity, out, n);
+    }
+
+    /// Fast batch evaluation
+    /**
+     * As kernel::batch(), but calling the fast batch version of the kernel (see get_fast_batch_function()), whose
+     * results may differ in the last bits from those of the scalar function.
+     *
+     * @param[in] in pointers to the input columns, \p in[j] pointing to the \p n values of the j-th input.
+     * @param[in] arity number of inputs.
+     * @param[out] out pointer to the \p n results. It must not overlap any of the inputs.
+     * @param[in] n number of points.
+     *
+     * @throw std::invalid_argument if the kernel has no batch version (see kernel::has_batch()).
+     */
+    void fast_batch(const T *const *in, unsigned arity, T *out, std::size_t n) const
+    {
+        if (m_fast_bf == nullptr) {
+            throw std::invalid_argument("The kernel " + m_name + " does not have a batch version");
+        }
+        m_fast_bf(in, arity, out, n);
+    }
+
+    /// Availability of a batch version
+    /**
+     * @return true if the kernel can be evaluated via kernel::batch().
+     */
+    bool has_batch() const
+    {
+        return m_bf != nullptr;
     }
 
     /// Kernel name
@@ -121,6 +249,17 @@ public:
         return m_name;
     }
 
+    /// Kernel id
+    /**
+     * Returns the kernel id
+     *
+     * @return the dcgp::kernel_id of a built-in kernel, kernel_id::user otherwise.
+     */
+    kernel_id get_id() const
+    {
+        return m_id;
+    }
+
     // Thread safety level.
     pagmo::thread_safety get_thread_safety() const
     {
@@ -152,24 +291,90 @@ public:
      * @throws unspecified any exception thrown by the serialization of the expression and of primitive types.
      */
     template <typename Archive>
-    void serialize(Archive &ar, unsigned)
+    void save(Archive &ar, unsigned) const
+    {
+        ar << m_id;
+        // Only user defined kernels need their functions to be stored
+        if (m_id == kernel_id::user) {
+            ar << user().m_f;
+            ar << user().m_pf;
+        }
+        ar << m_name;
+    }
+    template <typename Archive>
+    void load(Archive &ar, unsigned version)
     {
-        ar &m_f;
-        ar &m_pf;
-        ar &m_name;
+        // Deserialize in a separate object and move it in later, for exception safety.
+        kernel tmp;
+        if (version == 0u) {
+            // Archives older than the kernel ids store the functions of all kernels
+            ar >> tmp.m_user->m_f;
+            ar >> tmp.m_user->m_pf;
+            tmp.m_id = get_kernel_id(tmp.m_user->m_f, tmp.m_user->m_pf);
+        } else {
+            ar >> tmp.m_id;
+            if (tmp.m_id == kernel_id::user) {
+                ar >> tmp.m_user->m_f;
+                ar >> tmp.m_user->m_pf;
+            }
+        }
+        if (tmp.m_id == kernel_id::user) {
+            tmp.m_thread_safety = std::min(tmp.m_user->m_f.get_thread_safety(), tmp.m_user->m_pf.get_thread_safety());
+        } else {
+            tmp.m_user.reset();
+            tmp.m_thread_safety = pagmo::thread_safety::constant;
+        }
+        ar >> tmp.m_name;
+        // The batch versions are not serialized, but recovered from the id
+        tmp.m_bf = get_batch_function<T>(tmp.m_id);
+        tmp.m_fast_bf = get_fast_batch_function<T>(tmp.m_id);
+        *this = std::move(tmp);
     }
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
 
 private:
-    /// The function
-    my_fun_type m_f;
-    /// Its symbolic representation
-    my_print_fun_type m_pf;
+    // The functions of a user defined kernel
+    struct user_functions {
+        /// The function
+        my_fun_type m_f;
+        /// Its symbolic representation
+        my_print_fun_type m_pf;
+    };
+    const user_functions &user() const
+    {
+        if (!m_user) {
+            throw std::invalid_argument("A moved-from kernel cannot be used");
+        }
+        return *m_user;
+    }
+    // The user defined functions (nullptr for built-in kernels)
+    std::unique_ptr<user_functions> m_user;
     /// Its name
     std::string m_name;
     // Thread safety.
     pagmo::thread_safety m_thread_safety;
+    // The built-in kernel id (kernel_id::user for user defined kernels)
+    kernel_id m_id = kernel_id::user;
+    // The batch version of the function (if available)
+    my_batch_fun_type m_bf = nullptr;
+    // Its fast version, for the fast floating point rules
+    my_batch_fun_type m_fast_bf = nullptr;
 };
 
 } // end of namespace dcgp
 
+namespace boost
+{
+namespace serialization
+{
+// Version 1 stores the kernel id and, only for user defined kernels, the functions.
+template <typename T>
+struct version<dcgp::kernel<T>> {
+    typedef mpl::int_<1> type;
+    typedef mpl::integral_c_tag tag;
+    BOOST_STATIC_CONSTANT(int, value = version::type::value);
+};
+} // namespace serialization
+} // namespace boost
+
 #endif // DCGP_KERNEL_H
@@ -1,18 +1,36 @@
 #ifndef DCGP_SYMBOLIC_REGRESSION_H
 #define DCGP_SYMBOLIC_REGRESSION_H
 #include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
 #include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <numeric> // std::accumulate
+#include <tuple>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <audi/gdual.hpp>
+#include <boost/functional/hash.hpp>
 #include <boost/numeric/conversion/cast.hpp>
 #include <boost/range/algorithm/transform.hpp>
 #include <pagmo/io.hpp>
 #include <pagmo/population.hpp>
 #include <pagmo/problem.hpp>
 #include <pagmo/types.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/blocked_range2d.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
 
+#include <dcgp/dataset.hpp>
 #include <dcgp/expression.hpp>
 #include <dcgp/kernel_set.hpp>
 #include <dcgp/rng.hpp>
@@ -21,6 +39,149 @@
 
 namespace dcgp
 {
+namespace detail
+{
+// The bit pattern of a double, so that values comparing equal but not identical (as -0. and 0.) are told apart
+inline std::uint64_t double_bits(double value)
+{
+    std::uint64_t retval;
+    std::memcpy(&retval, &value, sizeof(double));
+    return retval;
+}
+
+// Compares two decision vectors bit by bit
+inline bool same_bits(const std::vector<double> &a, const std::vector<double> &b)
+{
+    return a.size() == b.size() && (a.empty() || std::memcmp(a.data(), b.data(), a.size() * sizeof(double)) == 0);
+}
+
+// A bounded, thread safe map from phenotype keys to fitness values. When full, the oldest entries are evicted.
+// Entries are stored by the hash of their key, the full key being kept to detect collisions.
+class fitness_cache
+{
+public:
+    using key_type = std::vector<std::uint64_t>;
+
+    explicit fitness_cache(std::size_t capacity = 4096u) : m_capacity(capacity) {}
+    fitness_cache(const fitness_cache &other)
+    {
+        std::lock_guard<std::mutex> lock(other.m_mutex);
+        m_capacity = other.m_capacity;
+        m_entries = other.m_entries;
+        m_order = other.m_order;
+        m_hits = other.m_hits;
+        m_misses = other.m_misses;
+    }
+    fitness_cache &operator=(const fitness_cache &other)
+    {
+        if (this != &other) {
+            fitness_cache tmp(other);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_capacity = tmp.m_capacity;
+            m_entries = std::move(tmp.m_entries);
+            m_order = std::move(tmp.m_order);
+            m_hits = tmp.m_hits;
+            m_misses = tmp.m_misses;
+        }
+        return *this;
+    }
+
+    // Looks for key, writing its fitness in value. Returns false if the key is not in the cache.
+    bool find(const key_type &key, double &value) const
+    {
+        const auto h = boost::hash_range(key.begin(), key.end());
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_entries.find(h);
+        if (it == m_entries.end() || it->second.first != key) {
+            ++m_misses;
+            return false;
+        }
+        ++m_hits;
+        value = it->second.second;
+        return true;
+    }
+    void insert(key_type key, double value)
+    {
+        if (m_capacity == 0u) {
+            return;
+        }
+        const auto h = boost::hash_range(key.begin(), key.end());
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_entries.find(h);
+        if (it != m_entries.end()) {
+            // A collision (or a concurrent insertion): the entry is overwritten
+            it->second = {std::move(key), value};
+            return;
+        }
+        if (m_entries.size() >= m_capacity) {
+            m_entries.erase(m_order.front());
+            m_order.pop_front();
+        }
+        m_entries.emplace(h, std::make_pair(std::move(key), value));
+        m_order.push_back(h);
+    }
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_entries.clear();
+        m_order.clear();
+        m_hits = 0u;
+        m_misses = 0u;
+    }
+    unsigned long long get_hits() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_hits;
+    }
+    unsigned long long get_misses() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_misses;
+    }
+
+private:
+    mutable std::mutex m_mutex;
+    std::size_t m_capacity;
+    std::unordered_map<std::size_t, std::pair<key_type, double>> m_entries;
+    // The hashes of the entries, in insertion order
+    std::deque<std::size_t> m_order;
+    mutable unsigned long long m_hits = 0u;
+    mutable unsigned long long m_misses = 0u;
+};
+
+// Thread specific objects of type T, each created on its first use in a thread. Copies start empty.
+template <typename T>
+class thread_scratch
+{
+public:
+    thread_scratch() = default;
+    thread_scratch(const thread_scratch &) {}
+    thread_scratch &operator=(const thread_scratch &)
+    {
+        clear();
+        return *this;
+    }
+
+    // The object of the calling thread, created with make() if not there yet
+    template <typename F>
+    T &local(F &&make)
+    {
+        auto &ptr = m_ets.local();
+        if (!ptr) {
+            ptr = std::make_unique<T>(make());
+        }
+        return *ptr;
+    }
+    void clear()
+    {
+        m_ets.clear();
+    }
+
+private:
+    tbb::enumerable_thread_specific<std::unique_ptr<T>> m_ets;
+};
+} // namespace detail
+
 /// A Symbolic Regression problem
 /**
  *
@@ -39,6 +200,10 @@ namespace dcgp
  * The symbolic regression problem can be instantiated both as a single and a two-objectives problem. In the second
  * case, aside the Mean Squared Error, the formula complexity will be considered as an objective.
  *
+ * The data is shared by all the copies of the problem, while each thread evaluating it keeps some working state.
+ * Most notably, race_fitness(const pagmo::vector_double &, double, const pagmo::vector_double &) const (used by
+ * es4cgp) keeps the outputs over the data of the active nodes of the parents last used, up to 2^23 doubles (64 MB)
+ * per thread. The mutants of a parent whose outputs exceed this budget are evaluated from scratch.
  */
 class symbolic_regression
 {
@@ -46,12 +211,12 @@ public:
     /// Default constructor
     /**
      * A default constructor is needed by the pagmo UDP interface, but it should not be used.
-     * It constructs a list of 1 empty points/labels vector and a dummy cgp member.
-     * It is guaranteed that m_points[0] and m_labels[0] can be accessed.
+     * It constructs an empty dataset and a dummy cgp member.
      */
     symbolic_regression()
-        : m_points(1), m_labels(1), m_r(1), m_c(1), m_l(1), m_arity(2), m_f(kernel_set<double>({"sum"})()), m_n_eph(0),
-          m_multi_objective(true), m_parallel_batches(0u), m_loss_s("MSE")
+        : m_dchunks(std::make_shared<const std::vector<dual_chunk>>()), m_r(1), m_c(1), m_l(1), m_arity(2),
+          m_f(kernel_set<double>({"sum"})()), m_n_eph(0), m_multi_objective(true), m_parallel_batches(0u),
+          m_loss_s("MSE"), m_gradient_s("forward")
     {
     }
 
@@ -68,12 +233,14 @@ public:
      * @param[in] f function set. An std::vector of dcgp::kernel<expression::type>.
      * @param[in] n_eph number of ephemeral constants.
      * @param[in] multi_objective when true, it will consider the model complexity as a second objective.
-     * @param[in] parallel_batches number of parallel batches.
+     * @param[in] parallel_batches number of parallel batches (of the loss, of its gradient and of its hessian).
      * @param[in] loss_s loss type as string, either "MSE" or "CE".
      * @param[in] seed seed used for the random engine.
+     * @param[in] gradient_s differentiation mode used by gradient(), either "forward" or "reverse".
      *
      * @throws std::invalid_argument if points and labels are not consistent.
      * @throws std::invalid_argument if the CGP related parameters (i.e. *r*, *c*, etc...) are malformed.
+     * @throws std::invalid_argument if *gradient_s* is "reverse" and *f* contains user-defined kernels.
      */
     symbolic_regression(const std::vector<std::vector<double>> &points, const std::vector<std::vector<double>> &labels,
                         unsigned r = 1u,     // n. rows
@@ -86,10 +253,53 @@ public:
                         bool multi_objective = false,   // when true the fitness also returns the formula complexity
                         unsigned parallel_batches = 0u, // number of parallel batches
                         std::string loss_s = "MSE",     // loss type
-                        unsigned seed = random_device::next() // seed used to generate mutations by the cgp
+                        unsigned seed = random_device::next(), // seed used to generate mutations by the cgp
+                        std::string gradient_s = "forward"     // differentiation mode of the gradient
                         )
-        : m_points(points), m_labels(labels), m_r(r), m_c(c), m_l(l), m_arity(arity), m_f(f), m_n_eph(n_eph),
-          m_multi_objective(multi_objective), m_parallel_batches(parallel_batches), m_loss_s(loss_s)
+        : symbolic_regression(dataset(points, labels), r, c, l, arity, f, n_eph, multi_objective, parallel_batches,
+                              loss_s, seed, gradient_s)
+    {
+    }
+
+    /// Constructor
+    /**
+     * Constructs a symbolic_regression optimization problem compatible with the pagmo UDP interface. The data is
+     * shared with *data* (and with all copies of the problem), not copied.
+     *
+     * @param[in] data the dataset (points and labels).
+     * @param[in] r number of rows of the dCGP.
+     * @param[in] c number of columns of the dCGP.
+     * @param[in] l number of levels-back allowed in the dCGP.
+     * @param[in] arity arity of the basis functions.
+     * @param[in] f function set. An std::vector of dcgp::kernel<expression::type>.
+     * @param[in] n_eph number of ephemeral constants.
+     * @param[in] multi_objective when true, it will consider the model complexity as a second objective.
+     * @param[in] parallel_batches number of parallel batches (of the loss, of its gradient and of its hessian).
+     * @param[in] loss_s loss type as string, either "MSE" or "CE".
+     * @param[in] seed seed used for the random engine.
+     * @param[in] gradient_s differentiation mode used by gradient(), either "forward" or "reverse".
+     *
+     * @throws std::invalid_argument if the dataset is empty.
+     * @throws std::invalid_argument if the CGP related parameters (i.e. *r*, *c*, etc...) are malformed.
+     * @throws std::invalid_argument if *gradient_s* is "reverse" and *f* contains user-defined kernels.
+     */
+    symbolic_regression(const dataset &data,
+                        unsigned r = 1u,     // n. rows
+                        unsigned c = 10u,    // n. columns
+                        unsigned l = 11u,    // n. levels-back
+                        unsigned arity = 2u, // basis functions' arity
+                        std::vector<kernel<double>> f
+                        = kernel_set<double>({"sum", "diff", "mul", "pdiv"})(), // functions
+                        unsigned n_eph = 0u,                                    // number of ephemeral constants
+                        bool multi_objective = false,   // when true the fitness also returns the formula complexity
+                        unsigned parallel_batches = 0u, // number of parallel batches
+                        std::string loss_s = "MSE",     // loss type
+                        unsigned seed = random_device::next(), // seed used to generate mutations by the cgp
+                        std::string gradient_s = "forward"     // differentiation mode of the gradient
+                        )
+        : m_data(data), m_r(r), m_c(c), m_l(l), m_arity(arity), m_f(f), m_n_eph(n_eph),
+          m_multi_objective(multi_objective), m_parallel_batches(parallel_batches), m_loss_s(loss_s),
+          m_gradient_s(gradient_s)
     {
         unsigned n;
         unsigned m;
@@ -111,16 +321,13 @@ public:
             }
         }
         m_dcgp = expression<audi::gdual_v>(n, m, m_r, m_c, m_l, m_arity, f_g(), m_n_eph, seed);
-        // We initialize the dpoints/dduals
-        m_dpoints = points_to_gdual_v(points);
-        m_dlabels = points_to_gdual_v(labels);
         // We create the symbol set of the differentials here for efficiency.
         // They are used in the gradient computation.
         for (const auto &symb : m_dcgp.get_eph_symb()) {
             m_deph_symb.push_back("d" + symb);
         }
         // We create the symbols of the input variables here
-        for (decltype(m_points[0].size()) i = 0u; i < m_points[0].size(); ++i) {
+        for (decltype(m_data.get_n()) i = 0u; i < m_data.get_n(); ++i) {
             m_symbols.push_back("x" + std::to_string(i));
         }
         if (m_loss_s == "MSE") {
@@ -130,6 +337,21 @@ public:
         } else {
             throw std::invalid_argument("The requested loss was: " + m_loss_s + " while only MSE and CE are allowed");
         }
+        // We initialize the dpoints/dduals
+        update_ddata();
+        if (m_gradient_s == "reverse") {
+            // The reverse mode needs the derivatives of the kernels, known only for the built-in ones
+            for (const auto &ker : m_f) {
+                if (ker.get_id() == kernel_id::user) {
+                    throw std::invalid_argument("The reverse mode gradient is not available for the kernel: "
+                                                + ker.get_name());
+                }
+            }
+            m_reverse_mode = true;
+        } else if (m_gradient_s != "forward") {
+            throw std::invalid_argument("The requested gradient mode was: " + m_gradient_s
+                                        + " while only forward and reverse are allowed");
+        }
     }
 
     /// Number of objectives
@@ -153,19 +375,235 @@ public:
      */
     pagmo::vector_double fitness(const pagmo::vector_double &x) const
     {
-        std::vector<double> retval(1u + m_multi_objective, 0);
-        // Here we set the CGP member from the chromosome
-        set_cgp(x);
-        if (x == m_cache_fitness.first) {
-            retval[0] = m_cache_fitness.second[0];
+        return fitness_impl(x, nullptr, nullptr);
+    }
+
+    /// Fitness computation with early rejection
+    /**
+     * Computes the fitness as fitness(), but only as far as needed to tell whether the loss is larger than
+     * \p threshold. The data is processed in blocks of race_block_size points (per parallel batch) and, the loss
+     * terms of the single points being non-negative, the evaluation stops as soon as their partial sum proves the
+     * loss to be larger than \p threshold. It also stops as soon as the partial sum is NaN.
+     *
+     * When stopped early, the loss returned is the partial one, a lower bound of the loss larger than
+     * \p threshold (or NaN), and it is not cached. Otherwise it is the loss returned by fitness(). For the cross
+     * entropy loss the bound only holds for non-negative labels, hence with negative labels only NaN partial sums
+     * stop the evaluation.
+     *
+     * @param x the decision vector.
+     * @param threshold the loss above which \p x is rejected.
+     *
+     * @return the fitness of \p x, or a lower bound of its loss larger than \p threshold.
+     */
+    pagmo::vector_double race_fitness(const pagmo::vector_double &x, double threshold) const
+    {
+        return fitness_impl(x, &threshold, nullptr);
+    }
+
+    /// Fitness computation with early rejection, reusing the node outputs of a parent
+    /**
+     * As race_fitness(const pagmo::vector_double &, double) const, but evaluating \p x as a mutant of \p parent:
+     * the outputs of the active nodes of \p parent over the data are computed (if not already) and kept, so that
+     * only the active nodes of \p x downstream of the genes (or of the ephemeral constants) differing from
+     * \p parent are evaluated, the others being read from the outputs of \p parent. The outputs of the nodes of
+     * \p x are not kept: this pays off when several mutants of the same parent are evaluated, as in es4cgp.
+     *
+     * The node outputs are kept per thread, up to a total of 2^23 values. When those of \p x alone do not fit, when
+     * a phenotype correction is set or with the fast floating point rules (see set_fp_rules()), \p x is evaluated
+     * from scratch. The loss is the same as computed by
+     * race_fitness(const pagmo::vector_double &, double) const.
+     *
+     * @param x the decision vector.
+     * @param threshold the loss above which \p x is rejected.
+     * @param parent the decision vector \p x was mutated from.
+     *
+     * @return the fitness of \p x, or a lower bound of its loss larger than \p threshold.
+     *
+     * @throws std::invalid_argument if \p parent and \p x have different sizes.
+     */
+    pagmo::vector_double race_fitness(const pagmo::vector_double &x, double threshold,
+                                      const pagmo::vector_double &parent) const
+    {
+        if (parent.size() != x.size()) {
+            throw std::invalid_argument("The parent chromosome has size " + std::to_string(parent.size())
+                                        + " while the mutant has size " + std::to_string(x.size()));
+        }
+        return fitness_impl(x, &threshold, &parent);
+    }
+
+    /// Batch fitness computation
+    /**
+     * Computes the fitness of the decision vectors stored contiguously in \p dvs, as pagmo::problem::batch_fitness().
+     * This makes pagmo::member_bfe (the one pagmo::default_bfe selects for this problem) use it, so that the
+     * algorithms evaluating their offspring through a bfe (e.g. es4cgp) do so tile by tile.
+     *
+     * The data is walked in tiles of points fitting a typical L2 cache (256KB of inputs, labels and predictions)
+     * and each tile is used to evaluate all the decision vectors of the batch before moving on to the next one.
+     * With datasets larger than the cache, the data is thus read from memory once per batch, rather than once per
+     * decision vector. Tiles and decision vectors are evaluated in parallel (unless the kernels or the phenotype
+     * correction are not thread safe). The tiles are made of whole blocks of race_block_size points, whose loss
+     * terms are summed block by block and then in order, as in fitness(): the losses are thus the same as the ones
+     * of fitness(), whatever the tiles. Phenotypes found in the cache, or repeated in the batch, are not evaluated
+     * again.
+     *
+     * The offspring of a generation share many active subtrees (e.g. the ones of their parent). These are found
+     * structurally (same kernels, inputs and ephemeral constants) and each one is evaluated once per tile, its
+     * output column being read by all the other phenotypes having it, so that this pays off even when all of them
+     * are different. Since a phenotype reads the subtrees evaluated by the preceding ones, only the tiles are then
+     * evaluated in parallel: the subtrees are thus shared only when there are at least as many tiles as threads (or
+     * the evaluation is serial), and never with a phenotype correction or with the fast floating point rules.
+     *
+     * @param dvs the decision vectors.
+     *
+     * @return the fitness vectors, stored contiguously.
+     *
+     * @throws std::invalid_argument if the size of \p dvs is not a multiple of the dimension of the problem.
+     */
+    pagmo::vector_double batch_fitness(const pagmo::vector_double &dvs) const
+    {
+        const auto dim = m_n_eph + m_cgp.get().size();
+        if (dvs.size() % dim != 0u) {
+            throw std::invalid_argument("The size of the decision vectors (" + std::to_string(dvs.size())
+                                        + ") is not a multiple of the problem dimension (" + std::to_string(dim)
+                                        + ")");
+        }
+        const auto n_dvs = dvs.size() / dim;
+        const auto n_obj = get_nobj();
+        pagmo::vector_double retval(n_dvs * n_obj, 0.);
+        // 1 - The distinct phenotypes to be evaluated and, for each decision vector, the position of its own
+        // (n_dvs when its loss is cached)
+        std::vector<expression<double>> cgps;
+        std::vector<detail::fitness_cache::key_type> keys;
+        std::vector<std::size_t> pos(n_dvs, n_dvs);
+        with_scratch([&](scratch &s) {
+            std::unordered_map<detail::fitness_cache::key_type, std::size_t,
+                               boost::hash<detail::fitness_cache::key_type>>
+                positions;
+            for (decltype(pos.size()) i = 0u; i < n_dvs; ++i) {
+                set_cgp(s.cgp, pagmo::vector_double(dvs.data() + i * dim, dvs.data() + (i + 1u) * dim));
+                if (m_multi_objective) {
+                    retval[i * n_obj + 1u] = static_cast<double>(s.cgp.get_active_genes().size());
+                }
+                auto key = phenotype_key(s.cgp);
+                auto it = positions.find(key);
+                if (it != positions.end()) {
+                    pos[i] = it->second;
+                } else if (!m_phenotype_cache.find(key, retval[i * n_obj])) {
+                    pos[i] = cgps.size();
+                    positions.emplace(key, cgps.size());
+                    cgps.push_back(s.cgp);
+                    keys.push_back(std::move(key));
+                }
+            }
+        });
+        // 2 - The subtrees shared among the phenotypes, evaluated once per tile (not with a phenotype correction,
+        // which is applied to the outputs only). A phenotype may then read the subtrees evaluated by any of the
+        // preceding ones, so that only the tiles can be evaluated in parallel: the subtrees are thus not shared
+        // when none is, or when there are fewer tiles than threads (and phenotypes and tiles are split instead).
+        const auto N = m_data.size();
+        const auto n_in = m_data.get_n();
+        const auto m = m_data.get_m();
+        const bool parallel = get_thread_safety() >= pagmo::thread_safety::constant;
+        // (a multiple of race_block_size, so that the blocks of the loss sums do not straddle two tiles)
+        auto tile_size = [&](std::size_t n_shared) {
+            const auto points = tile_bytes / (sizeof(double) * (n_in + 2u * m + n_shared));
+            return std::max<std::size_t>(1u, points / race_block_size) * race_block_size;
+        };
+        std::size_t n_shared = 0u;
+        auto plans = partial_graphs() ? subtree_plans(cgps, n_shared) : std::vector<subtree_plan>{};
+        if (n_shared == 0u
+            || (parallel
+                && (N + tile_size(n_shared) - 1u) / tile_size(n_shared)
+                       < static_cast<std::size_t>(tbb::this_task_arena::max_concurrency()))) {
+            plans.clear();
+            n_shared = 0u;
+        }
+        // 3 - The loss sums of the blocks of each phenotype, computed tile by tile (tile-major for each range of
+        // phenotypes)
+        const auto tile = tile_size(n_shared);
+        const auto n_tiles = (N + tile - 1u) / tile;
+        const auto n_blocks = (N + race_block_size - 1u) / race_block_size;
+        std::vector<double> partial(cgps.size() * n_blocks, 0.);
+        auto eval = [&](std::size_t t_begin, std::size_t t_end, std::size_t c_begin, std::size_t c_end) {
+            // The shared columns, followed by one prediction column per output
+            std::vector<double> columns((n_shared + m) * tile);
+            auto column = [&columns, tile](std::size_t k) { return columns.data() + k * tile; };
+            std::vector<const double *> in(n_in), predictions(m), known_columns;
+            std::vector<double *> out;
+            for (auto t = t_begin; t < t_end; ++t) {
+                const auto begin = t * tile;
+                const auto end = std::min(N, begin + tile);
+                for (decltype(in.size()) i = 0u; i < in.size(); ++i) {
+                    in[i] = m_data.point_column(i) + begin;
+                }
+                for (auto c = c_begin; c < c_end; ++c) {
+                    const auto &cgp = cgps[c];
+                    if (plans.empty()) {
+                        out.resize(m);
+                        for (decltype(out.size()) j = 0u; j < m; ++j) {
+                            out[j] = column(j);
+                            predictions[j] = out[j];
+                        }
+                        cgp.evaluate_batch(in, out, end - begin);
+                    } else {
+                        const auto &plan = plans[c];
+                        if (!plan.nodes.empty()) {
+                            known_columns.resize(plan.known.size());
+                            for (decltype(known_columns.size()) k = 0u; k < known_columns.size(); ++k) {
+                                known_columns[k] = column(plan.known_columns[k]);
+                            }
+                            out.resize(plan.outs.size());
+                            for (decltype(out.size()) k = 0u; k < out.size(); ++k) {
+                                out[k] = column(plan.out_columns[k]);
+                            }
+                            cgp.nodes_batch(plan.tape, in, known_columns, out, end - begin);
+                        }
+                        const auto &xu = cgp.get();
+                        for (decltype(predictions.size()) j = 0u; j < m; ++j) {
+                            const auto node_id = xu[xu.size() - m + j];
+                            if (node_id < n_in) {
+                                predictions[j] = in[node_id];
+                            } else if (node_id < cgp.get_n()) {
+                                std::fill(column(n_shared + j), column(n_shared + j) + (end - begin),
+                                          cgp.get_eph_val()[node_id - n_in]);
+                                predictions[j] = column(n_shared + j);
+                            } else {
+                                predictions[j] = column(plan.output_columns[j]);
+                            }
+                        }
+                    }
+                    block_loss_sums(predictions, begin, end, partial.data() + c * n_blocks + begin / race_block_size);
+                }
+            }
+        };
+        if (!parallel) {
+            eval(0u, n_tiles, 0u, cgps.size());
+        } else if (plans.empty()) {
+            tbb::parallel_for(tbb::blocked_range2d<std::size_t>(0u, n_tiles, 0u, cgps.size()),
+                              [&eval](const tbb::blocked_range2d<std::size_t> &range) {
+                                  eval(range.rows().begin(), range.rows().end(), range.cols().begin(),
+                                       range.cols().end());
+                              });
         } else {
-            // And we compute the MSE loss splitting the data in n batches.
-            // TODO: make this work also when m_parallel_batches does not divide exactly the data size.
-            retval[0] = m_cgp.loss(m_points, m_labels, m_loss_s, m_parallel_batches);
+            // A phenotype may read the subtrees evaluated by any of the preceding ones, so only the tiles are split
+            tbb::parallel_for(tbb::blocked_range<std::size_t>(0u, n_tiles),
+                              [&eval, &cgps](const tbb::blocked_range<std::size_t> &range) {
+                                  eval(range.begin(), range.end(), 0u, cgps.size());
+                              });
         }
-        // In the multiobjective case we compute the formula complexity
-        if (m_multi_objective) {
-            retval[1] = static_cast<double>(m_cgp.get_active_genes().size());
+        // 4 - The losses, summing the blocks in order (as sum_loss() does), and cached
+        std::vector<double> losses(cgps.size(), 0.);
+        for (decltype(losses.size()) c = 0u; c < losses.size(); ++c) {
+            for (decltype(partial.size()) b = 0u; b < n_blocks; ++b) {
+                losses[c] += partial[c * n_blocks + b];
+            }
+            losses[c] /= static_cast<double>(N);
+            m_phenotype_cache.insert(std::move(keys[c]), losses[c]);
+        }
+        for (decltype(pos.size()) i = 0u; i < n_dvs; ++i) {
+            if (pos[i] < n_dvs) {
+                retval[i * n_obj] = losses[pos[i]];
+            }
         }
         return retval;
     }
@@ -175,44 +613,41 @@ public:
      * Computes the gradient of the loss with respect to the ephemeral constants (i.e. the continuous part of the
      * chromosome).
      *
+     * In the "forward" mode (the default) the expression is evaluated over gduals having one symbol per ephemeral
+     * constant, so that the cost grows with their number. In the "reverse" mode (see the constructor) a forward and
+     * a backward sweep of the double expression over the data are used instead, whatever the number of constants.
+     * The two modes return the same values, except where the protected division kicks in: there the reverse mode
+     * sees a constant, while the forward mode (using the unprotected division) does not. When a phenotype
+     * correction is set the forward mode is always used.
+     *
      * @param x the decision vector.
      *
      * @return the gradient in \p x.
      */
     pagmo::vector_double gradient(const pagmo::vector_double &x) const
     {
-        std::vector<double> retval(m_n_eph, 0);
-        // The chromosome has a floating point part (the ephemeral constants) and an integer part (the encoded CGP).
-        // 1 - We extract the integer part and represent it as an unsigned vector to set the CGP expression.
-        std::vector<unsigned> xu(x.size() - m_n_eph);
-        std::transform(x.data() + m_n_eph, x.data() + x.size(), xu.begin(),
-                       [](double a) { return boost::numeric_cast<unsigned>(a); });
-        m_dcgp.set(xu);
-        // 2 - We use the floating point part of the chromosome to set ephemeral constants.
-        std::vector<audi::gdual_v> eph_val;
-        for (decltype(m_n_eph) i = 0u; i < m_n_eph; ++i) {
-            eph_val.emplace_back(x[i], m_dcgp.get_eph_symb()[i], 1u); // Only first derivative is needed
-        }
-        m_dcgp.set_eph_val(eph_val);
-        // 3 - We compute the loss splitting the data in n batches.
-        // TODO: make this work also when m_parallel_batches does not divide exactly the data size.
-        auto loss = m_dcgp.loss(m_dpoints, m_dlabels, m_loss_e);
-        // Now we extract fitness and gradient and store the values in the caches or in the return value
-        m_cache_fitness.first = x;
-        m_cache_fitness.second.resize(get_nobj());
-        m_cache_fitness.second[0] = collapse(loss.constant_cf());
-
-        loss.extend_symbol_set(m_deph_symb);
-        if (!(loss.get_order() == 0u)) { // this happens when input terminals of the eph constants are inactive
-                                         // (gradient is then zero)
-            for (decltype(m_n_eph) i = 0u; i < m_n_eph; ++i) {
-                std::vector<unsigned> coeff(m_n_eph, 0.);
-                coeff[i] = 1.;
-                auto dvec = loss.get_derivative(coeff);
-                retval[i] = collapse(dvec);
+        return with_scratch([this, &x](scratch &s) {
+            // The gradient may have been computed already by hessians() or loss_gradient_hessian()
+            if (detail::same_bits(x, s.cache_gradient.first)) {
+                return s.cache_gradient.second;
             }
-        }
-        return retval;
+            std::vector<double> retval(m_n_eph, 0);
+            if (m_reverse_mode && !m_has_pc) {
+                set_cgp(s.cgp, x);
+                s.cache_fitness.first = x;
+                s.cache_fitness.second = reverse_gradient(s, retval);
+                return retval;
+            }
+            // 1 - We set the dCGP expression from the chromosome (only first derivatives are needed).
+            set_dcgp(s.dcgp, x, 1u);
+            // 2 - We compute the loss and its gradient.
+            auto res = dual_loss(s, 1u);
+            // Now we store the fitness in the cache and the gradient in the return value
+            s.cache_fitness.first = x;
+            s.cache_fitness.second = res[0];
+            std::copy(res.begin() + 1, res.end(), retval.begin());
+            return retval;
+        });
     }
 
     /// Sparsity pattern (gradient)
@@ -243,64 +678,46 @@ public:
      */
     std::vector<pagmo::vector_double> hessians(const pagmo::vector_double &x) const
     {
-        // The hessian sparsity and dimension
-        auto hs = hessians_sparsity();
-        auto hd = hs[0].size();
         // Initializing the return value (hessian) to zeros.
         std::vector<pagmo::vector_double> retval;
-        for (const auto &item : hs) {
+        for (const auto &item : hessians_sparsity()) {
             retval.emplace_back(item.size(), 0.);
         }
-        // Initializing the gradient to zeros.
-        m_cache_gradient.first = x;
-        m_cache_gradient.second.clear();
-        m_cache_gradient.second.resize(m_n_eph, 0.);
-
-        // The chromosome has a floating point part (the ephemeral constants) and an integer part (the encoded CGP).
-        // 1 - We extract the integer part and represent it as an unsigned vector to set the CGP expression.
-        std::vector<unsigned> xu(x.size() - m_n_eph);
-        std::transform(x.data() + m_n_eph, x.data() + x.size(), xu.begin(),
-                       [](double a) { return boost::numeric_cast<unsigned>(a); });
-        m_dcgp.set(xu);
-        // 2 - We use the floating point part of the chromosome to set the ephemeral constants values of the dcgp
-        // member.
-        std::vector<audi::gdual_v> eph_val;
-        for (decltype(m_n_eph) i = 0u; i < m_n_eph; ++i) {
-            eph_val.emplace_back(x[i], m_dcgp.get_eph_symb()[i], 2u); // First and second order derivative are needed
-        }
-        m_dcgp.set_eph_val(eph_val);
-        // 3 - We compute the MSE loss and its differentials.
-        auto loss = m_dcgp.loss(m_dpoints, m_dlabels, m_loss_e);
-        // We make sure all symbols are in so that we get zeros when querying for a variable not in the gdual
-        loss.extend_symbol_set(m_deph_symb);
-
-        // Now we extract fitness, gradient and hessians from the gdual and store the values (retval or cache)
-        m_cache_fitness.first = x;
-        m_cache_fitness.second.resize(get_nobj());
-        m_cache_fitness.second[0] = collapse(loss.constant_cf());
-        // We compute the gradient and the hessian only if
-        // the loss depends on at least one ephemeral constant.
-        // Otherwise the initialization values will be returned, that is zeros.
-        if (!(loss.get_order() == 0u)) {
-            // gradient (we cache it)
-            for (decltype(m_n_eph) i = 0u; i < m_n_eph; ++i) {
-                std::vector<unsigned> coeff(m_n_eph, 0.);
-                coeff[i] = 1.;
-                auto deriv = loss.get_derivative(coeff);
-                m_cache_gradient.second[i] = collapse(deriv);
-            }
-            // hessian (we return it)
-            for (decltype(hd) i = 0u; i < hd; ++i) {
-                std::vector<unsigned> coeff(m_n_eph, 0.);
-                coeff[hs[0][i].first] = 1;
-                coeff[hs[0][i].second] += 1;
-                auto deriv = loss.get_derivative(coeff);
-                retval[0][i] = collapse(deriv);
-            }
-        }
+        retval[0] = std::get<2>(loss_gradient_hessian(x));
         return retval;
     }
 
+    /// Loss, gradient and hessian computation
+    /**
+     * Computes the loss together with its gradient and hessian with respect to the ephemeral constants (i.e. the
+     * continuous part of the chromosome), in a single pass over the data. The values are the same returned by
+     * fitness(), gradient() and hessians(), and are cached (per thread) so that a following call to fitness() or
+     * gradient() with the same \p x does not evaluate the expression again.
+     *
+     * @param x the decision vector.
+     *
+     * @return the loss, the gradient and the hessian (in the order of hessians_sparsity()) in \p x.
+     */
+    std::tuple<double, pagmo::vector_double, pagmo::vector_double>
+    loss_gradient_hessian(const pagmo::vector_double &x) const
+    {
+        return with_scratch([&](scratch &s) {
+            // 1 - We set the dCGP expression from the chromosome (first and second order derivatives are needed).
+            set_dcgp(s.dcgp, x, 2u);
+            // 2 - We compute the loss and its differentials.
+            auto res = dual_loss(s, 2u);
+            auto value = res[0];
+            pagmo::vector_double grad(res.begin() + 1, res.begin() + 1 + m_n_eph);
+            pagmo::vector_double hess(res.begin() + 1 + m_n_eph, res.end());
+            // Now we store fitness and gradient in the caches
+            s.cache_fitness.first = x;
+            s.cache_fitness.second = value;
+            s.cache_gradient.first = x;
+            s.cache_gradient.second = grad;
+            return std::make_tuple(value, std::move(grad), std::move(hess));
+        });
+    }
+
     /// Sparsity pattern (hessian)
     /**
      * Returns the sparsity pattern of the hessian. The sparsity patter is dense in the continuous part of the
@@ -365,6 +782,43 @@ public:
         return "a CGP symbolic regression problem";
     }
 
+    /// Gets the dataset
+    /**
+     * @return the data (points and labels) of the problem.
+     */
+    const dataset &get_data() const
+    {
+        return m_data;
+    }
+
+    /// Sets the serialization mode of the dataset
+    /**
+     * By default the dataset is serialized together with the problem. When serializing by reference, only a
+     * reference to the dataset (its hash, dimensions and checksum, see dataset::get_reference()) is stored, and on
+     * load the dataset is retrieved from the process-local registry (see dataset::from_registry()). This avoids
+     * copying large datasets through the archives used, for example, by pagmo to move problems across islands.
+     *
+     * The dataset must be registered explicitly with dataset::add_to_registry(), both in the saving and in the
+     * loading process, and stays alive until removed with dataset::remove_from_registry(). As the registry is
+     * process-local, with a pagmo::fork_island the dataset must be registered in the parent before the evolution
+     * starts: the forked child then inherits it, and the archive it sends back resolves in the parent.
+     *
+     * @param[in] flag when true, the dataset is serialized by reference.
+     */
+    void set_data_by_reference(bool flag)
+    {
+        m_data_by_reference = flag;
+    }
+
+    /// Gets the serialization mode of the dataset
+    /**
+     * @return true if the dataset is serialized by reference (see set_data_by_reference()).
+     */
+    bool get_data_by_reference() const
+    {
+        return m_data_by_reference;
+    }
+
     /// Extra info
     /**
      * @return a string containing extra problem information.
@@ -372,11 +826,14 @@ public:
     std::string get_extra_info() const
     {
         std::ostringstream ss;
-        pagmo::stream(ss, "\tData dimension (points): ", m_points[0].size(), "\n");
-        pagmo::stream(ss, "\tData dimension (labels): ", m_labels[0].size(), "\n");
-        pagmo::stream(ss, "\tData size: ", m_points.size(), "\n");
+        pagmo::stream(ss, "\tData dimension (points): ", m_data.get_n(), "\n");
+        pagmo::stream(ss, "\tData dimension (labels): ", m_data.get_m(), "\n");
+        pagmo::stream(ss, "\tData size: ", m_data.size(), "\n");
         pagmo::stream(ss, "\tKernels: ", m_cgp.get_f(), "\n");
         pagmo::stream(ss, "\tLoss: ", m_loss_s, "\n");
+        pagmo::stream(ss, "\tGradient: ", m_gradient_s, " mode\n");
+        pagmo::stream(ss, "\tFitness cache hits: ", m_phenotype_cache.get_hits(), "\n");
+        pagmo::stream(ss, "\tFitness cache misses: ", m_phenotype_cache.get_misses(), "\n");
         return ss.str();
     }
 
@@ -392,16 +849,14 @@ public:
      */
     std::string pretty(const pagmo::vector_double &x) const
     {
-        // Here we set the CGP data member from the chromosome
-        set_cgp(x);
+        return with_scratch([this, &x](scratch &s) {
+            // Here we set the CGP from the chromosome
+            set_cgp(s.cgp, x);
 
-        std::ostringstream ss;
-        std::vector<std::string> symbols;
-        for (decltype(m_points[0].size()) i = 0u; i < m_points[0].size(); ++i) {
-            symbols.push_back("x" + std::to_string(i));
-        }
-        pagmo::stream(ss, m_cgp(symbols));
-        return ss.str();
+            std::ostringstream ss;
+            pagmo::stream(ss, s.cgp(m_symbols));
+            return ss.str();
+        });
     }
 
     /// Human-readable representation of a decision vector.
@@ -416,15 +871,12 @@ public:
      */
     std::string prettier(const pagmo::vector_double &x) const
     {
-        // Here we set the CGP data member from the chromosome
-        set_cgp(x);
-
+        auto raws = with_scratch([this, &x](scratch &s) {
+            // Here we set the CGP from the chromosome
+            set_cgp(s.cgp, x);
+            return s.cgp(m_symbols);
+        });
         std::ostringstream ss;
-        std::vector<std::string> symbols;
-        for (decltype(m_points[0].size()) i = 0u; i < m_points[0].size(); ++i) {
-            symbols.push_back("x" + std::to_string(i));
-        }
-        auto raws = m_cgp(symbols);
         std::vector<SymEngine::Expression> exs;
         for (auto const &raw : raws) {
             exs.emplace_back(raw);
@@ -448,18 +900,12 @@ public:
     /// Sets the inner CGP
     /**
      * The access to the inner CGP is offered in the public interface to allow evolve methods in UDAs
-     * to reuse the same object and perform mutations via it.
+     * to reuse the same object and perform mutations via it. Unlike the rest of the const interface, this method is
+     * not thread safe (the evaluation methods do not use the inner CGP, but per-thread copies).
      */
     void set_cgp(const pagmo::vector_double &x) const
     {
-        // We need to make a copy of the chromosome as to represents its genes as unsigned
-        std::vector<unsigned> xu(x.size() - m_n_eph);
-        std::transform(x.data() + m_n_eph, x.data() + x.size(), xu.data(),
-                       [](double a) { return boost::numeric_cast<unsigned>(a); });
-        m_cgp.set(xu);
-        // 2 - We set the floating point part as ephemeral constants.
-        std::vector<double> eph_val(x.data(), x.data() + m_n_eph);
-        m_cgp.set_eph_val(eph_val);
+        set_cgp(m_cgp, x);
     }
 
     /// Model predictions
@@ -473,9 +919,11 @@ public:
      */
     std::vector<double> predict(const std::vector<double> &point, pagmo::vector_double x) const
     {
-        // Here we set the CGP member from the chromosome
-        set_cgp(x);
-        return m_cgp(point);
+        return with_scratch([&](scratch &s) {
+            // Here we set the CGP from the chromosome
+            set_cgp(s.cgp, x);
+            return s.cgp(point);
+        });
     }
 
     /// Model predictions
@@ -490,27 +938,35 @@ public:
     std::vector<std::vector<double>> predict(const std::vector<std::vector<double>> &points,
                                              pagmo::vector_double x) const
     {
-        // This will hold the return value
-        std::vector<std::vector<double>> retval;
-        // Here we set the CGP member from the chromosome
-        set_cgp(x);
-        // We loop over the input points
-        for (decltype(points.size()) i = 0u; i < points.size(); ++i) {
-            retval.push_back(m_cgp(points[i]));
-        }
-        return retval;
+        return with_scratch([&](scratch &s) {
+            // This will hold the return value
+            std::vector<std::vector<double>> retval;
+            // Here we set the CGP from the chromosome
+            set_cgp(s.cgp, x);
+            // We loop over the input points
+            for (decltype(points.size()) i = 0u; i < points.size(); ++i) {
+                retval.push_back(s.cgp(points[i]));
+            }
+            return retval;
+        });
     }
 
     /// Thread safety for this udp
     /**
-     * This is set to none as pitonic kernels could be in the inner expression
+     * The evaluation methods (fitness(), gradient(), hessians(), predict(), ...) keep all their working state
+     * (the expressions and their buffers) in per-thread scratch objects, so that the thread safety is that of the
+     * least safe among the kernels and the phenotype correction. With built-in kernels this is
+     * pagmo::thread_safety::constant, and a single problem can be used concurrently (e.g. by pagmo::thread_bfe).
+     * Python kernels make it pagmo::thread_safety::none.
      */
     pagmo::thread_safety get_thread_safety() const
     {
-        return (*std::min_element(
-                    m_f.begin(), m_f.end(),
-                    [](const auto &a, const auto &b) { return a.get_thread_safety() < b.get_thread_safety(); }))
-            .get_thread_safety();
+        auto retval = (*std::min_element(m_f.begin(), m_f.end(),
+                                         [](const auto &a, const auto &b) {
+                                             return a.get_thread_safety() < b.get_thread_safety();
+                                         }))
+                          .get_thread_safety();
+        return std::min(retval, m_pc_thread_safety);
     }
 
     /// Sets the phenotype correction
@@ -525,71 +981,851 @@ public:
     void set_phenotype_correction(typename expression<double>::pc_fun_type pc,
                                   typename expression<audi::gdual_v>::pc_fun_type dpc)
     {
+        m_pc_thread_safety = std::min(pc.get_thread_safety(), dpc.get_thread_safety());
+        m_has_pc = true;
         m_cgp.set_phenotype_correction(pc);
         m_dcgp.set_phenotype_correction(dpc);
+        // The cached fitness values and the per-thread expressions refer to the uncorrected expressions
+        m_phenotype_cache.clear();
+        m_scratch.clear();
+    }
+
+    /// Sets the floating point rules of the loss evaluation
+    /**
+     * Sets the floating point rules (see expression::set_fp_rules()) of the double expression used to compute the
+     * loss by fitness(), race_fitness() and batch_fitness(). With expression::fp_rules::fast, whose simplified graph
+     * and vectorized kernels may give different results than the active graph as is, the loss is always computed by
+     * expression::evaluate_batch(): the eph frontier, the node outputs of a parent (see race_fitness()) and the
+     * shared subtrees (see batch_fitness()) are then not used. The gradient and the hessians are not affected.
+     *
+     * @param rules the floating point rules.
+     */
+    void set_fp_rules(expression<double>::fp_rules rules)
+    {
+        m_cgp.set_fp_rules(rules);
+        // The cached fitness values and the per-thread expressions refer to the previous rules
+        m_phenotype_cache.clear();
+        m_scratch.clear();
+    }
+
+    /// Gets the floating point rules of the loss evaluation
+    /**
+     * @return the floating point rules set by set_fp_rules().
+     */
+    expression<double>::fp_rules get_fp_rules() const
+    {
+        return m_cgp.get_fp_rules();
     }
 
     /// Unsets the phenotype correction
     void unset_phenotype_correction()
     {
+        m_pc_thread_safety = pagmo::thread_safety::constant;
+        m_has_pc = false;
         m_cgp.unset_phenotype_correction();
         m_dcgp.unset_phenotype_correction();
+        m_phenotype_cache.clear();
+        m_scratch.clear();
     }
 
 private:
+    // The columns of the active function nodes of a chromosome over the data, indexed by node id (null for the
+    // other nodes), read by the evaluation of its mutants (see delta_loss())
+    struct node_columns {
+        pagmo::vector_double x;
+        std::vector<std::shared_ptr<const double[]>> columns;
+        // the number of columns
+        std::size_t n_columns;
+    };
+
+    // The evaluation of a phenotype in batch_fitness(): its active function nodes read from the columns of the
+    // subtrees evaluated by the preceding phenotypes (known) and the ones evaluated (nodes), writing the columns of
+    // the subtrees read by the following phenotypes and of the outputs (outs). Columns are numbered as the shared
+    // ones followed by one prediction column per output.
+    struct subtree_plan {
+        std::vector<unsigned> known;
+        std::vector<std::size_t> known_columns;
+        std::vector<unsigned> nodes;
+        std::vector<unsigned> outs;
+        std::vector<std::size_t> out_columns;
+        // the column of each output (for the outputs reading a function node)
+        std::vector<std::size_t> output_columns;
+        // the evaluation of nodes, compiled once for all the tiles
+        expression<double>::nodes_tape tape;
+    };
+
+    // Per-thread working state of the evaluations: copies of the expressions, the fitness and the gradient computed
+    // as a by-product of the last gdual evaluations and the buffer of the cgp predictions (column by column). The
+    // flag marks an instance as busy, so that a re-entrant evaluation (e.g. a task stolen by this thread while
+    // waiting in a parallel loop) does not overwrite it.
+    struct scratch {
+        expression<double> cgp;
+        expression<audi::gdual_v> dcgp;
+        std::pair<pagmo::vector_double, double> cache_fitness;
+        std::pair<pagmo::vector_double, pagmo::vector_double> cache_gradient;
+        std::vector<std::vector<double>> predictionsT;
+        // The integer part of the chromosome last evaluated and the values of its eph frontier (see
+        // expression::get_eph_frontier()) over the data, as double columns (when frontier_ready) and as vectorized
+        // gduals, one vector per chunk (when not empty). Reused as long as only the ephemeral constants change.
+        std::vector<unsigned> frontier_key;
+        std::vector<std::vector<double>> frontier;
+        bool frontier_ready = false;
+        std::vector<std::vector<audi::gdual_v>> dfrontier;
+        // The node columns of the chromosomes last used by delta_loss() (least recently used first) and their number
+        std::deque<node_columns> columns;
+        std::size_t columns_size = 0u;
+        bool busy = false;
+    };
+
+    // Calls f with the scratch of the calling thread, or with a fresh one if that is already in use.
+    template <typename F>
+    auto with_scratch(F &&f) const -> decltype(f(std::declval<scratch &>()))
+    {
+        auto make = [this]() { return scratch{m_cgp, m_dcgp, {}, {}, {}}; };
+        auto &s = m_scratch.local(make);
+        if (s.busy) {
+            auto tmp = make();
+            return f(tmp);
+        }
+        struct busy_guard {
+            ~busy_guard()
+            {
+                m_flag = false;
+            }
+            bool &m_flag;
+        } guard{s.busy};
+        s.busy = true;
+        return f(s);
+    }
+
+    // Sets cgp from the chromosome x
+    void set_cgp(expression<double> &cgp, const pagmo::vector_double &x) const
+    {
+        // We need to make a copy of the chromosome as to represents its genes as unsigned
+        std::vector<unsigned> xu(x.size() - m_n_eph);
+        std::transform(x.data() + m_n_eph, x.data() + x.size(), xu.data(),
+                       [](double a) { return boost::numeric_cast<unsigned>(a); });
+        // The floating point part is set as ephemeral constants together with the genes, so that the expression is
+        // updated only once.
+        cgp.set(xu, std::vector<double>(x.data(), x.data() + m_n_eph));
+    }
+
+    // Sets dcgp from the chromosome x, with the ephemeral constants as gduals of the given order
+    void set_dcgp(expression<audi::gdual_v> &dcgp, const pagmo::vector_double &x, unsigned order) const
+    {
+        // The chromosome has a floating point part (the ephemeral constants) and an integer part (the encoded CGP).
+        // 1 - We extract the integer part and represent it as an unsigned vector to set the CGP expression.
+        std::vector<unsigned> xu(x.size() - m_n_eph);
+        std::transform(x.data() + m_n_eph, x.data() + x.size(), xu.begin(),
+                       [](double a) { return boost::numeric_cast<unsigned>(a); });
+        dcgp.set(xu);
+        // 2 - We use the floating point part of the chromosome to set ephemeral constants.
+        std::vector<audi::gdual_v> eph_val;
+        for (decltype(m_n_eph) i = 0u; i < m_n_eph; ++i) {
+            eph_val.emplace_back(x[i], dcgp.get_eph_symb()[i], order);
+        }
+        dcgp.set_eph_val(eph_val);
+    }
+
+    // Implements fitness() and, when threshold is not null, race_fitness() (given the parent, if not null)
+    pagmo::vector_double fitness_impl(const pagmo::vector_double &x, const double *threshold,
+                                      const pagmo::vector_double *parent) const
+    {
+        return with_scratch([this, &x, threshold, parent](scratch &s) {
+            std::vector<double> retval(1u + m_multi_objective, 0);
+            // Here we set the CGP from the chromosome
+            set_cgp(s.cgp, x);
+            if (detail::same_bits(x, s.cache_fitness.first)) {
+                retval[0] = s.cache_fitness.second;
+            } else {
+                // Chromosomes differing only in inactive genes share the same phenotype, hence the same loss
+                auto key = phenotype_key(s.cgp);
+                if (!m_phenotype_cache.find(key, retval[0])) {
+                    // And we compute the loss splitting the data in n batches (a partial loss is not cached).
+                    bool aborted = false;
+                    if (!parent || !partial_graphs() || !delta_loss(s, x, *parent, threshold, aborted, retval[0])) {
+                        retval[0] = batch_loss(s, threshold, &aborted);
+                    }
+                    if (!aborted) {
+                        m_phenotype_cache.insert(std::move(key), retval[0]);
+                    }
+                }
+            }
+            // In the multiobjective case we compute the formula complexity
+            if (m_multi_objective) {
+                retval[1] = static_cast<double>(s.cgp.get_active_genes().size());
+            }
+            return retval;
+        });
+    }
+
     // Collapses a vectorized cf into one (taking the mean)
     static inline double collapse(const audi::vectorized<double> &vec)
     {
         return std::accumulate(vec.begin(), vec.end(), 0.) / static_cast<double>(vec.size());
     }
 
-    // Transpose of a vector vector
-    static inline std::vector<std::vector<double>> transpose(const std::vector<std::vector<double>> &points)
+    // True when the loss can be computed evaluating parts of the active graph as is (the eph frontier, the node
+    // columns of a parent or the shared subtrees), i.e. without a phenotype correction (which is applied to the
+    // outputs only) and unless the fast floating point rules make the simplified graph differ from it
+    bool partial_graphs() const
+    {
+        return !m_has_pc && m_cgp.get_fp_rules() != expression<double>::fp_rules::fast;
+    }
+
+    // Checks whether xu is the integer part of the chromosome of the eph frontier cached in s. If not, the cache
+    // is cleared and its key set to xu.
+    static bool frontier_hit(scratch &s, const std::vector<unsigned> &xu)
+    {
+        if (s.frontier_key == xu) {
+            return true;
+        }
+        s.frontier_key = xu;
+        s.frontier.clear();
+        s.frontier_ready = false;
+        s.dfrontier.clear();
+        return false;
+    }
+
+    // Computes the loss of s.dcgp (whose ephemeral constants are gduals of the given order) over the data and returns
+    // its value followed by the gradient and, if order is 2, by the hessian (in the order of hessians_sparsity()).
+    // The data chunks are evaluated in parallel and their contributions summed, in a fixed order. The values of the
+    // eph frontier are computed once per chromosome, so that later calls changing only the ephemeral constants (as
+    // in the memetic algorithms and in gd4cgp) propagate the gduals only through the nodes depending on them.
+    std::vector<double> dual_loss(scratch &s, unsigned order) const
+    {
+        const auto &dcgp = s.dcgp;
+        // The derivatives to be extracted
+        std::vector<std::vector<unsigned>> coeffs;
+        for (decltype(m_n_eph) i = 0u; i < m_n_eph; ++i) {
+            coeffs.emplace_back(m_n_eph, 0u);
+            coeffs.back()[i] = 1u;
+        }
+        if (order == 2u) {
+            const auto hs = hessians_sparsity();
+            for (const auto &item : hs[0]) {
+                coeffs.emplace_back(m_n_eph, 0u);
+                coeffs.back()[item.first] = 1u;
+                coeffs.back()[item.second] += 1u;
+            }
+        }
+        const auto &chunks = *m_dchunks;
+        // A default constructed problem has no data, hence no contribution to the loss and its derivatives
+        if (chunks.empty()) {
+            return std::vector<double>(1u + coeffs.size(), 0.);
+        }
+        const auto N = static_cast<double>(m_data.size());
+        std::vector<std::vector<double>> partial(chunks.size(), std::vector<double>(1u + coeffs.size(), 0.));
+        // Without ephemeral constants the frontier would be the whole expression, which is evaluated once anyway
+        const bool use_frontier = m_n_eph > 0u && !m_has_pc;
+        bool fill_frontier = false;
+        if (use_frontier && (!frontier_hit(s, dcgp.get()) || s.dfrontier.empty())) {
+            s.dfrontier.resize(chunks.size());
+            fill_frontier = true;
+        }
+        auto eval = [&](std::size_t c) {
+            audi::gdual_v loss;
+            if (use_frontier) {
+                if (fill_frontier) {
+                    s.dfrontier[c] = dcgp.eph_frontier(chunks[c].points);
+                }
+                loss = dcgp.loss(chunks[c].points, chunks[c].labels, s.dfrontier[c], m_loss_e);
+            } else {
+                loss = dcgp.loss(chunks[c].points, chunks[c].labels, m_loss_e);
+            }
+            // The mean over the chunk weighted by its share of the data (exactly one for a single chunk)
+            const auto weight = static_cast<double>(chunks[c].size) / N;
+            partial[c][0] = collapse(loss.constant_cf()) * weight;
+            // We make sure all symbols are in so that we get zeros when querying for a variable not in the gdual
+            loss.extend_symbol_set(m_deph_symb);
+            // When the loss does not depend on any ephemeral constant (i.e. they are inactive) its derivatives are
+            // left to zero.
+            if (!(loss.get_order() == 0u)) {
+                for (decltype(coeffs.size()) i = 0u; i < coeffs.size(); ++i) {
+                    partial[c][i + 1u] = collapse(loss.get_derivative(coeffs[i])) * weight;
+                }
+            }
+        };
+        if (chunks.size() > 1u) {
+            tbb::parallel_for(tbb::blocked_range<std::size_t>(0u, chunks.size(), 1u),
+                              [&eval](const tbb::blocked_range<std::size_t> &range) {
+                                  for (auto c = range.begin(); c != range.end(); ++c) {
+                                      eval(c);
+                                  }
+                              });
+        } else {
+            eval(0u);
+        }
+        std::vector<double> retval(std::move(partial[0]));
+        for (decltype(partial.size()) c = 1u; c < partial.size(); ++c) {
+            for (decltype(retval.size()) i = 0u; i < retval.size(); ++i) {
+                retval[i] += partial[c][i];
+            }
+        }
+        return retval;
+    }
+
+    // Builds the vectorized gduals from the data, one per column of each chunk. The data is kept in one chunk,
+    // unless m_parallel_batches is set: then it is split into (at least) as many chunks, of at most
+    // dual_chunk_size points so that the coefficients of a chunk stay in cache. Also checks the sign of the labels.
+    void update_ddata()
+    {
+        const auto N = m_data.size();
+        m_nonneg_loss_terms = true;
+        if (m_loss_e == expression<audi::gdual_v>::loss_type::CE) {
+            for (decltype(m_data.get_m()) i = 0u; i < m_data.get_m(); ++i) {
+                m_nonneg_loss_terms = m_nonneg_loss_terms
+                                      && std::all_of(m_data.label_column(i), m_data.label_column(i) + N,
+                                                     [](double a) { return !(a < 0.); });
+            }
+        }
+        std::size_t n_chunks = 1u;
+        if (m_parallel_batches > 0u) {
+            n_chunks = std::max<std::size_t>(m_parallel_batches, (N + dual_chunk_size - 1u) / dual_chunk_size);
+            n_chunks = std::max<std::size_t>(std::min(n_chunks, N), 1u);
+        }
+        std::vector<dual_chunk> chunks(n_chunks);
+        for (std::size_t c = 0u; c < n_chunks; ++c) {
+            const auto begin = N * c / n_chunks;
+            const auto end = N * (c + 1u) / n_chunks;
+            for (decltype(m_data.get_n()) i = 0u; i < m_data.get_n(); ++i) {
+                chunks[c].points.emplace_back(
+                    std::vector<double>(m_data.point_column(i) + begin, m_data.point_column(i) + end));
+            }
+            for (decltype(m_data.get_m()) i = 0u; i < m_data.get_m(); ++i) {
+                chunks[c].labels.emplace_back(
+                    std::vector<double>(m_data.label_column(i) + begin, m_data.label_column(i) + end));
+            }
+            chunks[c].size = end - begin;
+        }
+        m_dchunks = std::make_shared<const std::vector<dual_chunk>>(std::move(chunks));
+    }
+
+    // The key identifying the phenotype currently encoded in cgp: the active genes with their values, followed
+    // by the bit patterns of the ephemeral constants actually used (see detail::double_bits()).
+    detail::fitness_cache::key_type phenotype_key(const expression<double> &cgp) const
+    {
+        const auto &x = cgp.get();
+        const auto &active_genes = cgp.get_active_genes();
+        detail::fitness_cache::key_type retval;
+        retval.reserve(2u * active_genes.size() + m_n_eph);
+        for (auto idx : active_genes) {
+            retval.push_back(idx);
+            retval.push_back(x[idx]);
+        }
+        const auto n = cgp.get_n() - m_n_eph;
+        for (decltype(m_n_eph) i = 0u; i < m_n_eph; ++i) {
+            if (cgp.is_active_node(n + i)) {
+                retval.push_back(detail::double_bits(cgp.get_eph_val()[i]));
+            }
+        }
+        return retval;
+    }
+
+    // Computes the loss of s.cgp evaluating it over the whole dataset (column by column). When m_parallel_batches
+    // is not zero the data is split into as many (roughly equal) parts evaluated in parallel. When threshold is not
+    // null the data is processed in rounds of race_block_size points per batch instead, and the evaluation stops
+    // (setting aborted) after the first round whose partial loss is NaN or proves the loss larger than *threshold.
+    // The partial loss is then returned.
+    double batch_loss(scratch &s, const double *threshold = nullptr, bool *aborted = nullptr) const
+    {
+        const auto N = m_data.size();
+        auto m = m_data.get_m();
+        s.predictionsT.resize(m);
+        for (auto &col : s.predictionsT) {
+            col.resize(N);
+        }
+        // The eph frontier is used from the second evaluation of the same chromosome on (e.g. in a line search on
+        // the ephemeral constants), so that evaluating many different chromosomes once does not pay for storing it.
+        const bool use_frontier = m_n_eph > 0u && partial_graphs() && frontier_hit(s, s.cgp.get());
+        const bool fill_frontier = use_frontier && !s.frontier_ready;
+        if (fill_frontier) {
+            s.frontier.resize(s.cgp.get_eph_frontier().size());
+            for (auto &col : s.frontier) {
+                col.resize(N);
+            }
+        }
+        // Loss sums of the blocks of points in [begin, end)
+        auto partial_loss = [this, &s, m, use_frontier, fill_frontier](std::size_t begin, std::size_t end,
+                                                                       double *sums) {
+            std::vector<const double *> in(m_data.get_n());
+            std::vector<double *> out(m);
+            for (decltype(in.size()) i = 0u; i < in.size(); ++i) {
+                in[i] = m_data.point_column(i) + begin;
+            }
+            for (decltype(m) j = 0u; j < m; ++j) {
+                out[j] = s.predictionsT[j].data() + begin;
+            }
+            if (use_frontier) {
+                std::vector<double *> frontier(s.frontier.size());
+                for (decltype(frontier.size()) i = 0u; i < frontier.size(); ++i) {
+                    frontier[i] = s.frontier[i].data() + begin;
+                }
+                if (fill_frontier) {
+                    s.cgp.eph_frontier_batch(in, frontier, end - begin);
+                }
+                s.cgp.evaluate_batch(in, std::vector<const double *>(frontier.begin(), frontier.end()), out,
+                                     end - begin);
+            } else {
+                s.cgp.evaluate_batch(in, out, end - begin);
+            }
+            block_loss_sums(std::vector<const double *>(out.begin(), out.end()), begin, end, sums);
+        };
+        bool stopped = false;
+        auto retval = sum_loss(partial_loss, threshold, stopped);
+        if (stopped) {
+            *aborted = true;
+        } else {
+            s.frontier_ready = use_frontier;
+        }
+        return retval;
+    }
+
+    // Computes the loss terms of the points [begin, end), given the prediction columns (from begin on), and writes
+    // in sums their sum over each block of race_block_size points (begin being the first point of a block). Any
+    // split of the data in whole blocks thus gives the same sums.
+    void block_loss_sums(const std::vector<const double *> &predictions, std::size_t begin, std::size_t end,
+                         double *sums) const
+    {
+        const auto m = predictions.size();
+        double block_sum = 0.;
+        std::vector<double> outputs(m);
+        for (auto k = begin; k < end; ++k) {
+            double err = 0.;
+            for (decltype(outputs.size()) j = 0u; j < m; ++j) {
+                outputs[j] = predictions[j][k - begin];
+            }
+            switch (m_loss_e) {
+                // Mean Square Error
+                case expression<audi::gdual_v>::loss_type::MSE: {
+                    for (decltype(outputs.size()) j = 0u; j < m; ++j) {
+                        auto diff = outputs[j] - m_data.label_column(j)[k];
+                        err += diff * diff;
+                    }
+                    err /= static_cast<double>(m);
+                    break;
+                }
+                // Cross Entropy (guarded from numerical instabilities subtracting the max element)
+                case expression<audi::gdual_v>::loss_type::CE: {
+                    auto max = *std::max_element(outputs.begin(), outputs.end());
+                    double cumsum = 0.;
+                    for (auto &a : outputs) {
+                        a = std::exp(a - max);
+                        cumsum += a;
+                    }
+                    for (decltype(outputs.size()) j = 0u; j < m; ++j) {
+                        err -= std::log(outputs[j] / cumsum) * m_data.label_column(j)[k];
+                    }
+                    break;
+                }
+            }
+            block_sum += err;
+            if ((k + 1u) % race_block_size == 0u || k + 1u == end) {
+                *sums++ = block_sum;
+                block_sum = 0.;
+            }
+        }
+    }
+
+    // Sums the loss sums of the blocks of race_block_size points, computed by partial_loss (called as
+    // partial_loss(begin, end, sums) on whole blocks), over the whole dataset and returns the loss, splitting the
+    // data and stopping early as described in batch_loss(). The blocks are summed in order, so that the loss does
+    // not depend on the split (nor on the tiles of batch_fitness()).
+    template <typename F>
+    double sum_loss(const F &partial_loss, const double *threshold, bool &aborted) const
     {
-        std::vector<std::vector<double>> result(points[0].size(), std::vector<double>(points.size()));
-        for (std::vector<double>::size_type i = 0; i < points[0].size(); i++)
-            for (std::vector<int>::size_type j = 0; j < points.size(); j++) {
-                result[i][j] = points[j][i];
+        const auto N = m_data.size();
+        const auto n_blocks = (N + race_block_size - 1u) / race_block_size;
+        std::vector<double> sums(n_blocks);
+        // The blocks processed per round, and per batch in a round
+        std::size_t round = n_blocks;
+        std::size_t chunk = (n_blocks + m_parallel_batches - 1u) / std::max(m_parallel_batches, 1u);
+        if (threshold) {
+            round = std::max(m_parallel_batches, 1u);
+            chunk = 1u;
+        }
+        auto blocks = [&](std::size_t b_begin, std::size_t b_end) {
+            partial_loss(b_begin * race_block_size, std::min(N, b_end * race_block_size), sums.data() + b_begin);
+        };
+        double retval = 0.;
+        for (std::size_t b_begin = 0u; b_begin < n_blocks; b_begin += round) {
+            const auto b_end = std::min(n_blocks, b_begin + round);
+            if (m_parallel_batches > 0u) {
+                tbb::parallel_for(tbb::blocked_range<std::size_t>(b_begin, b_end, chunk),
+                                  [&blocks](const tbb::blocked_range<std::size_t> &range) {
+                                      blocks(range.begin(), range.end());
+                                  });
+            } else {
+                blocks(b_begin, b_end);
+            }
+            for (auto b = b_begin; b < b_end; ++b) {
+                retval += sums[b];
+            }
+            // (a NaN stays such, while an infinite partial loss is only known to be larger than a finite threshold)
+            if (threshold && b_end < n_blocks
+                && (std::isnan(retval) || (m_nonneg_loss_terms && retval / static_cast<double>(N) > *threshold))) {
+                aborted = true;
+                return retval / static_cast<double>(N);
+            }
+        }
+        return retval / static_cast<double>(N);
+    }
+
+    // Computes the loss of s.cgp reusing the node columns of parent (see node_columns), computed and stored in s
+    // if not there already. Only the active nodes changed with respect to parent (see expression::unchanged_nodes())
+    // are evaluated, block by block, and only the columns of the output nodes among them are written. Returns false,
+    // leaving loss untouched, if the columns of parent do not fit in node_columns_budget.
+    bool delta_loss(scratch &s, const pagmo::vector_double &x, const pagmo::vector_double &parent,
+                    const double *threshold, bool &aborted, double &loss) const
+    {
+        const auto N = m_data.size();
+        const auto n_in = m_data.get_n();
+        auto function_nodes = [n = s.cgp.get_n()](const expression<double> &cgp) {
+            std::vector<unsigned> retval;
+            for (auto node_id : cgp.get_active_nodes()) {
+                if (node_id >= n) {
+                    retval.push_back(node_id);
+                }
+            }
+            return retval;
+        };
+        // Runs the compiled evaluation of some nodes over the points in [begin, end), reading the columns of the
+        // known nodes and writing the ones of the output nodes
+        auto evaluate = [this, n_in](const expression<double> &cgp, const expression<double>::nodes_tape &tape,
+                                     const std::vector<const double *> &known_columns,
+                                     const std::vector<double *> &out, std::size_t begin, std::size_t end) {
+            std::vector<const double *> in(n_in), known_b(known_columns);
+            std::vector<double *> out_b(out);
+            for (decltype(in.size()) i = 0u; i < in.size(); ++i) {
+                in[i] = m_data.point_column(i) + begin;
+            }
+            for (auto &ptr : known_b) {
+                ptr += begin;
+            }
+            for (auto &ptr : out_b) {
+                ptr += begin;
+            }
+            cgp.nodes_batch(tape, in, known_b, out_b, end - begin);
+        };
+        if (N * function_nodes(s.cgp).size() > node_columns_budget) {
+            return false;
+        }
+        // 1 - The columns of parent
+        auto it = std::find_if(s.columns.begin(), s.columns.end(),
+                               [&parent](const node_columns &item) { return detail::same_bits(item.x, parent); });
+        if (it == s.columns.end()) {
+            set_cgp(s.cgp, parent);
+            const auto nodes = function_nodes(s.cgp);
+            if (N * nodes.size() > node_columns_budget) {
+                set_cgp(s.cgp, x);
+                return false;
+            }
+            node_columns item{parent, std::vector<std::shared_ptr<const double[]>>(
+                                          s.cgp.get_n() + s.cgp.get_r() * s.cgp.get_c()),
+                              nodes.size()};
+            std::vector<double *> out;
+            for (auto node_id : nodes) {
+                std::shared_ptr<double[]> column(new double[N]);
+                out.push_back(column.get());
+                item.columns[node_id] = std::move(column);
             }
-        return result;
+            const auto tape = s.cgp.compile_nodes({}, nodes, nodes);
+            if (m_parallel_batches > 0u) {
+                tbb::parallel_for(tbb::blocked_range<std::size_t>(0u, N, race_block_size),
+                                  [&](const tbb::blocked_range<std::size_t> &range) {
+                                      evaluate(s.cgp, tape, {}, out, range.begin(), range.end());
+                                  });
+            } else {
+                evaluate(s.cgp, tape, {}, out, 0u, N);
+            }
+            store_columns(s, std::move(item));
+            it = s.columns.end() - 1;
+            set_cgp(s.cgp, x);
+        }
+        // 2 - The nodes of x to be evaluated and the ones read from the columns of parent (which becomes the most
+        // recently used)
+        const auto parent_item = *it;
+        if (it != s.columns.end() - 1) {
+            s.columns.erase(it);
+            s.columns.push_back(parent_item);
+        }
+        std::vector<unsigned> parent_xu(parent.size() - m_n_eph);
+        std::transform(parent.data() + m_n_eph, parent.data() + parent.size(), parent_xu.begin(),
+                       [](double a) { return boost::numeric_cast<unsigned>(a); });
+        const auto unchanged
+            = s.cgp.unchanged_nodes(parent_xu, std::vector<double>(parent.data(), parent.data() + m_n_eph));
+        std::vector<unsigned> known, nodes;
+        std::vector<const double *> known_columns;
+        for (auto node_id : function_nodes(s.cgp)) {
+            if (unchanged[node_id] && parent_item.columns[node_id]) {
+                known.push_back(node_id);
+                known_columns.push_back(parent_item.columns[node_id].get());
+            } else {
+                nodes.push_back(node_id);
+            }
+        }
+        // 3 - The predictions are the columns of the output nodes: the inputs, the ephemeral constants, the known
+        // nodes or the evaluated ones. Only the latter are written in the prediction columns (not kept).
+        const auto &xu = s.cgp.get();
+        const auto m = m_data.get_m();
+        s.predictionsT.resize(m);
+        std::vector<const double *> predictions(m);
+        std::vector<unsigned> evaluated_outputs;
+        std::vector<double *> out;
+        for (decltype(predictions.size()) j = 0u; j < m; ++j) {
+            auto node_id = xu[xu.size() - m + j];
+            auto known_it = std::find(known.begin(), known.end(), node_id);
+            if (node_id < n_in) {
+                predictions[j] = m_data.point_column(node_id);
+            } else if (node_id < s.cgp.get_n() || known_it == known.end()) {
+                s.predictionsT[j].resize(N);
+                if (node_id < s.cgp.get_n()) {
+                    std::fill(s.predictionsT[j].begin(), s.predictionsT[j].end(), s.cgp.get_eph_val()[node_id - n_in]);
+                } else {
+                    evaluated_outputs.push_back(node_id);
+                    out.push_back(s.predictionsT[j].data());
+                }
+                predictions[j] = s.predictionsT[j].data();
+            } else {
+                predictions[j] = known_columns[static_cast<std::size_t>(known_it - known.begin())];
+            }
+        }
+        // Only the evaluated nodes read by the outputs are written, the others stay in the registers of the tape
+        // (compiled once for all the blocks of points)
+        const auto tape = s.cgp.compile_nodes(known, nodes, evaluated_outputs);
+        auto partial_loss = [&](std::size_t begin, std::size_t end, double *sums) {
+            if (!nodes.empty()) {
+                evaluate(s.cgp, tape, known_columns, out, begin, end);
+            }
+            std::vector<const double *> predictions_b(predictions);
+            for (auto &ptr : predictions_b) {
+                ptr += begin;
+            }
+            block_loss_sums(predictions_b, begin, end, sums);
+        };
+        loss = sum_loss(partial_loss, threshold, aborted);
+        return true;
     }
-    // Builds the vectorized gduals from the data
-    static inline std::vector<audi::gdual_v> points_to_gdual_v(const std::vector<std::vector<double>> &points)
+
+    // Plans the evaluation of cgps so that the active subtrees they have in common are evaluated once, by the first
+    // phenotype having them. Subtrees are identified structurally: an input by its index, an ephemeral constant by
+    // its bit pattern (see detail::double_bits()) and a function node by its kernel and the subtrees it reads. Sets
+    // n_shared to the number of subtrees read by more than one phenotype, which get a column.
+    std::vector<subtree_plan> subtree_plans(const std::vector<expression<double>> &cgps, std::size_t &n_shared) const
     {
-        std::vector<audi::gdual_v> retval(points[0].size());
-        auto pointsT = transpose(points);
-        for (decltype(pointsT.size()) i = 0u; i < pointsT.size(); ++i) {
-            retval[i] = audi::gdual_v(pointsT[i]);
+        const auto n_in = m_data.get_n();
+        const auto m = m_data.get_m();
+        const auto none = std::numeric_limits<std::size_t>::max();
+        // The distinct subtrees: the phenotype first having it, its node there and its column (none if not shared)
+        struct subtree {
+            std::size_t owner;
+            unsigned node_id;
+            std::size_t column;
+        };
+        std::vector<subtree> subtrees;
+        using key_type = std::vector<std::uint64_t>;
+        std::unordered_map<key_type, std::size_t, boost::hash<key_type>> ids;
+        // The first element of the keys of inputs and constants, never a kernel index
+        const auto input_tag = std::numeric_limits<std::uint64_t>::max();
+        const auto eph_tag = input_tag - 1u;
+        // The subtree of each active node of each phenotype
+        std::vector<std::vector<std::size_t>> node_subtree(cgps.size());
+        n_shared = 0u;
+        for (decltype(cgps.size()) c = 0u; c < cgps.size(); ++c) {
+            const auto &cgp = cgps[c];
+            const auto &xu = cgp.get();
+            node_subtree[c].assign(cgp.get_n() + cgp.get_r() * cgp.get_c(), none);
+            for (auto node_id : cgp.get_active_nodes()) {
+                key_type key;
+                if (node_id < n_in) {
+                    key = {input_tag, node_id};
+                } else if (node_id < cgp.get_n()) {
+                    key = {eph_tag, detail::double_bits(cgp.get_eph_val()[node_id - n_in])};
+                } else {
+                    const auto idx = cgp.get_gene_idx()[node_id];
+                    key.push_back(xu[idx]);
+                    for (auto j = 1u; j <= cgp.get_arity(node_id); ++j) {
+                        key.push_back(node_subtree[c][xu[idx + j]]);
+                    }
+                }
+                auto res = ids.emplace(std::move(key), subtrees.size());
+                if (res.second) {
+                    subtrees.push_back({c, node_id, none});
+                } else {
+                    auto &item = subtrees[res.first->second];
+                    if (item.owner != c && item.column == none && node_id >= cgp.get_n()) {
+                        item.column = n_shared++;
+                    }
+                }
+                node_subtree[c][node_id] = res.first->second;
+            }
+        }
+        std::vector<subtree_plan> retval(cgps.size());
+        for (decltype(cgps.size()) c = 0u; c < cgps.size(); ++c) {
+            const auto &cgp = cgps[c];
+            const auto &xu = cgp.get();
+            auto &plan = retval[c];
+            // The known nodes are only preloaded when read by an evaluated one
+            std::vector<bool> read(node_subtree[c].size(), false);
+            for (auto node_id : cgp.get_active_nodes()) {
+                const auto &item = subtrees[node_subtree[c][node_id]];
+                if (node_id < cgp.get_n() || item.owner != c) {
+                    continue;
+                }
+                plan.nodes.push_back(node_id);
+                for (auto j = 1u; j <= cgp.get_arity(node_id); ++j) {
+                    read[xu[cgp.get_gene_idx()[node_id] + j]] = true;
+                }
+                if (item.node_id == node_id && item.column != none) {
+                    plan.outs.push_back(node_id);
+                    plan.out_columns.push_back(item.column);
+                }
+            }
+            for (auto node_id : cgp.get_active_nodes()) {
+                const auto &item = subtrees[node_subtree[c][node_id]];
+                if (node_id >= cgp.get_n() && item.owner != c && read[node_id]) {
+                    plan.known.push_back(node_id);
+                    plan.known_columns.push_back(item.column);
+                }
+            }
+            plan.output_columns.assign(m, none);
+            for (decltype(plan.output_columns.size()) j = 0u; j < m; ++j) {
+                const auto node_id = xu[xu.size() - m + j];
+                if (node_id < cgp.get_n()) {
+                    continue;
+                }
+                const auto &item = subtrees[node_subtree[c][node_id]];
+                if (item.owner != c || (item.node_id == node_id && item.column != none)) {
+                    plan.output_columns[j] = item.column;
+                } else {
+                    plan.outs.push_back(node_id);
+                    plan.out_columns.push_back(n_shared + j);
+                    plan.output_columns[j] = n_shared + j;
+                }
+            }
+            if (!plan.nodes.empty()) {
+                plan.tape = cgp.compile_nodes(plan.known, plan.nodes, plan.outs);
+            }
         }
         return retval;
     }
 
+    // Stores in s the node columns of a chromosome, evicting the least recently used ones beyond node_columns_budget
+    void store_columns(scratch &s, node_columns &&item) const
+    {
+        const auto N = m_data.size();
+        while (!s.columns.empty() && (s.columns_size + item.n_columns) * N > node_columns_budget) {
+            s.columns_size -= s.columns.front().n_columns;
+            s.columns.pop_front();
+        }
+        s.columns_size += item.n_columns;
+        s.columns.push_back(std::move(item));
+    }
+
+    // Computes the loss of s.cgp and, by reverse mode differentiation, its gradient with respect to the ephemeral
+    // constants. The data is split in blocks of race_block_size points, whose sums are added in order as in
+    // sum_loss(): the results do not depend on m_parallel_batches and the loss is the one computed by fitness().
+    double reverse_gradient(scratch &s, pagmo::vector_double &grad) const
+    {
+        const auto N = m_data.size();
+        auto m = m_data.get_m();
+        // Loss (and its derivatives w.r.t. the outputs) of a block of points starting at offset, also added point by
+        // point to sum
+        auto block_loss = [this, m](const double *const *y, double *const *dy, std::size_t offset, std::size_t b,
+                                    double &sum) {
+            double retval = 0.;
+            for (decltype(b) k = 0u; k < b; ++k) {
+                double err = 0.;
+                switch (m_loss_e) {
+                    // Mean Square Error
+                    case expression<audi::gdual_v>::loss_type::MSE: {
+                        for (decltype(m) j = 0u; j < m; ++j) {
+                            auto diff = y[j][k] - m_data.label_column(j)[offset + k];
+                            err += diff * diff;
+                            dy[j][k] = 2. * diff / static_cast<double>(m);
+                        }
+                        err /= static_cast<double>(m);
+                        break;
+                    }
+                    // Cross Entropy (guarded from numerical instabilities subtracting the max element)
+                    case expression<audi::gdual_v>::loss_type::CE: {
+                        double max = y[0][k];
+                        for (decltype(m) j = 1u; j < m; ++j) {
+                            max = std::max(max, y[j][k]);
+                        }
+                        double cumsum = 0., labels_sum = 0.;
+                        for (decltype(m) j = 0u; j < m; ++j) {
+                            dy[j][k] = std::exp(y[j][k] - max);
+                            cumsum += dy[j][k];
+                            labels_sum += m_data.label_column(j)[offset + k];
+                        }
+                        for (decltype(m) j = 0u; j < m; ++j) {
+                            const auto label = m_data.label_column(j)[offset + k];
+                            err -= std::log(dy[j][k] / cumsum) * label;
+                            dy[j][k] = dy[j][k] / cumsum * labels_sum - label;
+                        }
+                        break;
+                    }
+                }
+                retval += err;
+                sum += err;
+            }
+            return retval;
+        };
+        // Loss sums and gradients of the blocks of race_block_size points. The loss terms are accumulated point by
+        // point into the sum of their block, as in block_loss_sums(), so that the loss equals the one of fitness().
+        const auto n_blocks = (N + race_block_size - 1u) / race_block_size;
+        std::vector<double> sums(n_blocks);
+        std::vector<pagmo::vector_double> grads(n_blocks);
+        auto blocks = [this, &s, &block_loss, &sums, &grads, N](std::size_t b_begin, std::size_t b_end) {
+            std::vector<const double *> in(m_data.get_n());
+            for (auto b = b_begin; b < b_end; ++b) {
+                const auto begin = b * race_block_size;
+                for (decltype(in.size()) i = 0u; i < in.size(); ++i) {
+                    in[i] = m_data.point_column(i) + begin;
+                }
+                sums[b] = 0.;
+                s.cgp.eph_gradient_batch(
+                    in, std::min(N, begin + race_block_size) - begin,
+                    [&block_loss, &sums, b, begin](const double *const *y, double *const *dy, std::size_t offset,
+                                                   std::size_t n) {
+                        return block_loss(y, dy, begin + offset, n, sums[b]);
+                    },
+                    grads[b]);
+            }
+        };
+        if (m_parallel_batches > 0u) {
+            const std::size_t chunk = (n_blocks + m_parallel_batches - 1u) / m_parallel_batches;
+            tbb::parallel_for(tbb::blocked_range<std::size_t>(0u, n_blocks, chunk),
+                              [&blocks](const tbb::blocked_range<std::size_t> &range) {
+                                  blocks(range.begin(), range.end());
+                              });
+        } else {
+            blocks(0u, n_blocks);
+        }
+        // The blocks are summed in order, so that the results do not depend on the split
+        double retval = 0.;
+        std::fill(grad.begin(), grad.begin() + m_n_eph, 0.);
+        for (std::size_t b = 0u; b < n_blocks; ++b) {
+            retval += sums[b];
+            for (decltype(m_n_eph) i = 0u; i < m_n_eph; ++i) {
+                grad[i] += grads[b][i];
+            }
+        }
+        for (decltype(m_n_eph) i = 0u; i < m_n_eph; ++i) {
+            grad[i] /= static_cast<double>(N);
+        }
+        return retval / static_cast<double>(N);
+    }
+
     void sanity_checks(unsigned &n, unsigned &m) const
     {
-        // 1 - We check that points is not an empty vector.
-        if (m_points.size() == 0) {
+        // We check that the dataset is not empty (its consistency is guaranteed by construction).
+        if (m_data.size() == 0) {
             throw std::invalid_argument("The size of the input data (points) is zero.");
         }
-        n = static_cast<unsigned>(m_points[0].size());
-        m = static_cast<unsigned>(m_labels[0].size());
-        // 2 - We check labels and points have the same (non-empty) size
-        if (m_points.size() != m_labels.size()) {
-            throw std::invalid_argument("The number of input data (points) is " + std::to_string(m_points.size())
-                                        + " while the number of labels is " + std::to_string(m_labels.size())
-                                        + ". They should be equal.");
-        }
-        // 3 - We check that all p in points have the same size
-        if (!std::all_of(m_points.begin(), m_points.end(),
-                         [n](const std::vector<double> &p) { return p.size() == n; })) {
-            throw std::invalid_argument("The input data (points) is inconsistent: all points must have the same "
-                                        "dimension, while I detect differences.");
-        }
-        // 4 - We check that all l in labels have the same size
-        if (!std::all_of(m_labels.begin(), m_labels.end(),
-                         [m](const std::vector<double> &l) { return l.size() == m; })) {
-            throw std::invalid_argument("The labels are inconsistent: all labels must have the same "
-                                        "dimension, while I detect differences.");
-        }
+        n = m_data.get_n();
+        m = m_data.get_m();
         if (m_c == 0) throw std::invalid_argument("Number of columns is 0");
         if (m_r == 0) throw std::invalid_argument("Number of rows is 0");
         if (m_l == 0) throw std::invalid_argument("Number of level-backs is 0");
@@ -602,17 +1838,37 @@ public:
     /**
      * This method will save/load \p this into the archive \p ar.
      *
+     * Archives of version 0 (which store the points and labels, also as gduals, and the last fitness computed) can
+     * still be loaded: the problem then uses the forward mode gradient.
+     *
      * @param ar target archive.
+     * @param version the version of the archive.
      *
+     * @throws std::invalid_argument if the dataset is serialized by reference and it is not registered in the
+     * saving process or, in the loading process, no matching dataset is registered.
      * @throws unspecified any exception thrown by the serialization of the expression and of primitive types.
      */
     template <typename Archive>
-    void serialize(Archive &ar, unsigned)
+    void serialize(Archive &ar, unsigned version)
     {
-        ar &m_points;
-        ar &m_labels;
-        ar &m_dpoints;
-        ar &m_dlabels;
+        if (version == 0u) {
+            serialize_v0(ar);
+            return;
+        }
+        ar &m_data_by_reference;
+        if (m_data_by_reference) {
+            if (Archive::is_saving::value && !dataset::is_registered(m_data)) {
+                throw std::invalid_argument("The dataset of a symbolic regression problem serialized by reference "
+                                            "must be registered first (see dataset::add_to_registry()).");
+            }
+            auto ref = m_data.get_reference();
+            ar &ref;
+            if (Archive::is_loading::value) {
+                m_data = dataset::from_registry(ref);
+            }
+        } else {
+            ar &m_data;
+        }
         ar &m_deph_symb;
         ar &m_symbols;
         ar &m_r;
@@ -625,16 +1881,92 @@ public:
         ar &m_parallel_batches;
         ar &m_loss_s;
         ar &m_loss_e;
+        ar &m_gradient_s;
+        ar &m_reverse_mode;
         ar &m_cgp;
         ar &m_dcgp;
-        ar &m_cache_fitness;
+        ar &m_pc_thread_safety;
+        ar &m_has_pc;
+        // The phenotype cache and the per-thread scratch are not serialized, and a loaded problem starts with empty
+        // ones. The vectorized gduals are rebuilt from the data.
+        if (Archive::is_loading::value) {
+            m_phenotype_cache.clear();
+            m_scratch.clear();
+            update_ddata();
+        }
     }
 
 private:
-    std::vector<std::vector<double>> m_points;
-    std::vector<std::vector<double>> m_labels;
-    std::vector<audi::gdual_v> m_dpoints;
-    std::vector<audi::gdual_v> m_dlabels;
+    // Loads an archive of version 0 (only ever called when loading, as the current version is saved)
+    template <typename Archive>
+    void serialize_v0(Archive &ar)
+    {
+        std::vector<std::vector<double>> points, labels;
+        std::vector<audi::gdual_v> dpoints, dlabels;
+        std::pair<pagmo::vector_double, pagmo::vector_double> cache_fitness;
+        ar &points;
+        ar &labels;
+        ar &dpoints;
+        ar &dlabels;
+        ar &m_deph_symb;
+        ar &m_symbols;
+        ar &m_r;
+        ar &m_c;
+        ar &m_l;
+        ar &m_arity;
+        ar &m_f;
+        ar &m_n_eph;
+        ar &m_multi_objective;
+        ar &m_parallel_batches;
+        ar &m_loss_s;
+        ar &m_loss_e;
+        ar &m_cgp;
+        ar &m_dcgp;
+        ar &cache_fitness;
+        // The default constructed problem has no data
+        m_data = points.empty() ? dataset() : dataset(points, labels);
+        m_data_by_reference = false;
+        m_gradient_s = "forward";
+        m_reverse_mode = false;
+        const auto &pc = m_cgp.get_phenotype_correction();
+        const auto &dpc = m_dcgp.get_phenotype_correction();
+        m_has_pc = pc || dpc;
+        m_pc_thread_safety = pagmo::thread_safety::constant;
+        if (pc) {
+            m_pc_thread_safety = std::min(m_pc_thread_safety, pc->get_thread_safety());
+        }
+        if (dpc) {
+            m_pc_thread_safety = std::min(m_pc_thread_safety, dpc->get_thread_safety());
+        }
+        m_phenotype_cache.clear();
+        m_scratch.clear();
+        update_ddata();
+    }
+
+    // The data (shared by all copies of the problem)
+    dataset m_data;
+    // When true, only a reference to the (registered) dataset is serialized
+    bool m_data_by_reference = false;
+    // A chunk of the data as vectorized gduals, one per column
+    struct dual_chunk {
+        std::vector<audi::gdual_v> points;
+        std::vector<audi::gdual_v> labels;
+        std::size_t size = 0u;
+    };
+    // Maximum number of points in a chunk of vectorized gduals, when the data is split
+    static constexpr std::size_t dual_chunk_size = 1024u;
+    // The data as chunks of vectorized gduals (also shared by all copies of the problem)
+    std::shared_ptr<const std::vector<dual_chunk>> m_dchunks;
+    // Number of points processed per batch between two checks of race_fitness()
+    static constexpr std::size_t race_block_size = 1024u;
+    // Size of the data (inputs, labels and predictions) in a tile of batch_fitness(), about that of an L2 cache
+    static constexpr std::size_t tile_bytes = 1u << 18;
+    // Maximum number of doubles in the node columns stored per thread (see delta_loss()), i.e. 64MB (documented in
+    // the class description)
+    static constexpr std::size_t node_columns_budget = 1u << 23;
+    // True when the loss of each point is non-negative (always for MSE, for CE when no label is negative), so
+    // that partial losses are lower bounds of the loss
+    bool m_nonneg_loss_terms = true;
     std::vector<std::string> m_deph_symb;
     std::vector<std::string> m_symbols;
 
@@ -648,14 +1980,22 @@ private:
     unsigned m_parallel_batches;
     std::string m_loss_s;
     dcgp::expression<audi::gdual_v>::loss_type m_loss_e;
+    std::string m_gradient_s;
+    // True when the gradient is computed in reverse mode
+    bool m_reverse_mode = false;
 
-    // The fact that this is mutable may hamper the performances of the bfe as the thread safetly level
-    // of the UDP in pagmo will force copies of the UDP to be made in all threads. This can in principle be
-    // avoided, but likely resulting in premature optimization. (see https://github.com/darioizzo/dcgp/pull/42)
+    // The thread safety of the phenotype correction (if any)
+    pagmo::thread_safety m_pc_thread_safety = pagmo::thread_safety::constant;
+    bool m_has_pc = false;
+
+    // The prototypes of the expressions copied in the per-thread scratch. The cgp is mutable only to support
+    // set_cgp(), which is used by the UDAs.
     mutable expression<double> m_cgp;
-    mutable expression<audi::gdual_v> m_dcgp;
-    mutable std::pair<pagmo::vector_double, pagmo::vector_double> m_cache_fitness;
-    mutable std::pair<pagmo::vector_double, pagmo::vector_double> m_cache_gradient;
+    expression<audi::gdual_v> m_dcgp;
+    // The fitness of the phenotypes already evaluated (thread safe)
+    mutable detail::fitness_cache m_phenotype_cache;
+    // The working state of the evaluations, one per thread
+    mutable detail::thread_scratch<scratch> m_scratch;
 };
 
 namespace details
@@ -669,6 +2009,21 @@ inline dcgp::function<const dcgp::symbolic_regression *(const pagmo::problem &)>
 } // namespace details
 } // namespace dcgp
 
+namespace boost
+{
+namespace serialization
+{
+// Version 1 stores the dataset (or a reference to it) instead of the points and labels, the gradient mode and the
+// phenotype correction flags, and no longer the last fitness computed.
+template <>
+struct version<dcgp::symbolic_regression> {
+    typedef mpl::int_<1> type;
+    typedef mpl::integral_c_tag tag;
+    BOOST_STATIC_CONSTANT(int, value = version::type::value);
+};
+} // namespace serialization
+} // namespace boost
+
 PAGMO_S11N_PROBLEM_EXPORT_KEY(dcgp::symbolic_regression)
 
 #endif
@@ -4,10 +4,20 @@
 #include <audi/audi.hpp>
 #include <audi/functions.hpp>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
 #include <string>
 #include <type_traits>
 #include <vector>
 
+// The fast batch kernels select their AVX2 version at run time, on x86-64 with gcc and clang
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define DCGP_AVX2_DISPATCH
+#include <immintrin.h>
+#endif
+
 #include <dcgp/config.hpp>
 #include <dcgp/function.hpp>
 #include <dcgp/type_traits.hpp>
@@ -154,14 +164,16 @@ struct my_pdiv_func {
     T operator()(const std::vector<T> &in) const
     {
         T retval(in[0]);
-        T tmpval(in[1]);
 
-        for (auto i = 2u; i < in.size(); ++i) {
-            tmpval *= in[i];
+        // A single input is divided by nothing (i.e. by one)
+        if (in.size() > 1u) {
+            T tmpval(in[1]);
+            for (auto i = 2u; i < in.size(); ++i) {
+                tmpval *= in[i];
+            }
+            retval /= tmpval;
         }
 
-        retval /= tmpval;
-
         if (std::isfinite(retval)) {
             return retval;
         }
@@ -834,6 +846,842 @@ struct print_my_psqrt_func {
 
 inline constexpr auto print_my_psqrt = print_my_psqrt_func{};
 
+/*--------------------------------------------------------------------------
+ *                            KERNEL IDENTIFIERS
+ *------------------------------------------------------------------------**/
+
+// Each of the functions above, paired with its own symbolic representation, is a built-in kernel and is
+// identified by a kernel_id. Built-in kernels are evaluated through a switch on their id rather than through the
+// type erased dcgp::function, which is kept only for user defined kernels (kernel_id::user).
+enum class kernel_id : unsigned char {
+    user = 0,
+    sum,
+    diff,
+    mul,
+    div,
+    pdiv,
+    sig,
+    tanh,
+    relu,
+    elu,
+    isru,
+    sin_nu,
+    cos_nu,
+    gaussian_nu,
+    inv_sum,
+    abs,
+    step,
+    sin,
+    cos,
+    log,
+    exp,
+    gaussian,
+    sqrt,
+    psqrt
+};
+
+/// Identifier of a kernel
+/**
+ * Returns the kernel_id of the kernel defined by \p f and \p pf.
+ *
+ * @param[in] f the kernel function.
+ * @param[in] pf its symbolic representation.
+ *
+ * @return the built-in kernel_id if \p f and \p pf are one of the functions above and its matching
+ * symbolic representation, kernel_id::user otherwise.
+ */
+template <typename T>
+inline kernel_id get_kernel_id(const function<T(const std::vector<T> &)> &f,
+                               const function<std::string(const std::vector<std::string> &)> &pf)
+{
+    if constexpr (std::is_same<T, double>::value || is_gdual<T>::value) {
+        if (f.template is<my_sum_func<T>>() && pf.template is<print_my_sum_func>()) return kernel_id::sum;
+        if (f.template is<my_diff_func<T>>() && pf.template is<print_my_diff_func>()) return kernel_id::diff;
+        if (f.template is<my_mul_func<T>>() && pf.template is<print_my_mul_func>()) return kernel_id::mul;
+        if (f.template is<my_div_func<T>>() && pf.template is<print_my_div_func>()) return kernel_id::div;
+        if (f.template is<my_pdiv_func<T>>() && pf.template is<print_my_pdiv_func>()) return kernel_id::pdiv;
+        if (f.template is<my_sig_func<T>>() && pf.template is<print_my_sig_func>()) return kernel_id::sig;
+        if (f.template is<my_tanh_func<T>>() && pf.template is<print_my_tanh_func>()) return kernel_id::tanh;
+        if (f.template is<my_relu_func<T>>() && pf.template is<print_my_relu_func>()) return kernel_id::relu;
+        if (f.template is<my_elu_func<T>>() && pf.template is<print_my_elu_func>()) return kernel_id::elu;
+        if (f.template is<my_isru_func<T>>() && pf.template is<print_my_isru_func>()) return kernel_id::isru;
+        if (f.template is<my_sin_nu_func<T>>() && pf.template is<print_my_sin_nu_func>()) return kernel_id::sin_nu;
+        if (f.template is<my_cos_nu_func<T>>() && pf.template is<print_my_cos_nu_func>()) return kernel_id::cos_nu;
+        if (f.template is<my_gaussian_nu_func<T>>() && pf.template is<print_my_gaussian_nu_func>())
+            return kernel_id::gaussian_nu;
+        if (f.template is<my_inv_sum_func<T>>() && pf.template is<print_my_inv_sum_func>()) return kernel_id::inv_sum;
+        if (f.template is<my_abs_func<T>>() && pf.template is<print_my_abs_func>()) return kernel_id::abs;
+        if (f.template is<my_step_func<T>>() && pf.template is<print_my_step_func>()) return kernel_id::step;
+        if (f.template is<my_sin_func<T>>() && pf.template is<print_my_sin_func>()) return kernel_id::sin;
+        if (f.template is<my_cos_func<T>>() && pf.template is<print_my_cos_func>()) return kernel_id::cos;
+        if (f.template is<my_log_func<T>>() && pf.template is<print_my_log_func>()) return kernel_id::log;
+        if (f.template is<my_exp_func<T>>() && pf.template is<print_my_exp_func>()) return kernel_id::exp;
+        if (f.template is<my_gaussian_func<T>>() && pf.template is<print_my_gaussian_func>())
+            return kernel_id::gaussian;
+        if (f.template is<my_sqrt_func<T>>() && pf.template is<print_my_sqrt_func>()) return kernel_id::sqrt;
+        if (f.template is<my_psqrt_func<T>>() && pf.template is<print_my_psqrt_func>()) return kernel_id::psqrt;
+    }
+    return kernel_id::user;
+}
+
+/// Evaluates a built-in kernel
+/**
+ * @param[in] id the kernel_id, must not be kernel_id::user.
+ * @param[in] in the evaluation point.
+ *
+ * @return the value of the kernel \p id in \p in.
+ *
+ * @throw std::invalid_argument if \p id is not a built-in kernel for the type T.
+ */
+template <typename T>
+inline T call_kernel(kernel_id id, const std::vector<T> &in)
+{
+    if constexpr (std::is_same<T, double>::value || is_gdual<T>::value) {
+        switch (id) {
+            case kernel_id::sum:
+                return my_sum<T>(in);
+            case kernel_id::diff:
+                return my_diff<T>(in);
+            case kernel_id::mul:
+                return my_mul<T>(in);
+            case kernel_id::div:
+                return my_div<T>(in);
+            case kernel_id::pdiv:
+                return my_pdiv<T>(in);
+            case kernel_id::sig:
+                return my_sig<T>(in);
+            case kernel_id::tanh:
+                return my_tanh<T>(in);
+            case kernel_id::relu:
+                return my_relu<T>(in);
+            case kernel_id::elu:
+                return my_elu<T>(in);
+            case kernel_id::isru:
+                return my_isru<T>(in);
+            case kernel_id::sin_nu:
+                return my_sin_nu<T>(in);
+            case kernel_id::cos_nu:
+                return my_cos_nu<T>(in);
+            case kernel_id::gaussian_nu:
+                return my_gaussian_nu<T>(in);
+            case kernel_id::inv_sum:
+                return my_inv_sum<T>(in);
+            case kernel_id::abs:
+                return my_abs<T>(in);
+            case kernel_id::step:
+                return my_step<T>(in);
+            case kernel_id::sin:
+                return my_sin<T>(in);
+            case kernel_id::cos:
+                return my_cos<T>(in);
+            case kernel_id::log:
+                return my_log<T>(in);
+            case kernel_id::exp:
+                return my_exp<T>(in);
+            case kernel_id::gaussian:
+                return my_gaussian<T>(in);
+            case kernel_id::sqrt:
+                return my_sqrt<T>(in);
+            case kernel_id::psqrt:
+                return my_psqrt<T>(in);
+            case kernel_id::user:
+                break;
+        }
+    }
+    throw std::invalid_argument("The kernel_id does not correspond to a built-in kernel");
+}
+
+/// Symbolic representation of a built-in kernel
+/**
+ * @param[in] id the kernel_id, must not be kernel_id::user.
+ * @param[in] in the symbolic names to be used.
+ *
+ * @return the string representation of the kernel \p id applied to \p in.
+ *
+ * @throw std::invalid_argument if \p id is kernel_id::user.
+ */
+inline std::string print_kernel(kernel_id id, const std::vector<std::string> &in)
+{
+    switch (id) {
+        case kernel_id::sum:
+            return print_my_sum(in);
+        case kernel_id::diff:
+            return print_my_diff(in);
+        case kernel_id::mul:
+            return print_my_mul(in);
+        case kernel_id::div:
+            return print_my_div(in);
+        case kernel_id::pdiv:
+            return print_my_pdiv(in);
+        case kernel_id::sig:
+            return print_my_sig(in);
+        case kernel_id::tanh:
+            return print_my_tanh(in);
+        case kernel_id::relu:
+            return print_my_relu(in);
+        case kernel_id::elu:
+            return print_my_elu(in);
+        case kernel_id::isru:
+            return print_my_isru(in);
+        case kernel_id::sin_nu:
+            return print_my_sin_nu(in);
+        case kernel_id::cos_nu:
+            return print_my_cos_nu(in);
+        case kernel_id::gaussian_nu:
+            return print_my_gaussian_nu(in);
+        case kernel_id::inv_sum:
+            return print_my_inv_sum(in);
+        case kernel_id::abs:
+            return print_my_abs(in);
+        case kernel_id::step:
+            return print_my_step(in);
+        case kernel_id::sin:
+            return print_my_sin(in);
+        case kernel_id::cos:
+            return print_my_cos(in);
+        case kernel_id::log:
+            return print_my_log(in);
+        case kernel_id::exp:
+            return print_my_exp(in);
+        case kernel_id::gaussian:
+            return print_my_gaussian(in);
+        case kernel_id::sqrt:
+            return print_my_sqrt(in);
+        case kernel_id::psqrt:
+            return print_my_psqrt(in);
+        case kernel_id::user:
+            break;
+    }
+    throw std::invalid_argument("The kernel_id does not correspond to a built-in kernel");
+}
+
+/*--------------------------------------------------------------------------
+ *                         BATCH FUNCTIONS (double only)
+ *------------------------------------------------------------------------**/
+
+// The batch version of a kernel evaluates it over n points at once: in[j] points to the n values of the
+// j-th input and out, which must not overlap any of the inputs, receives the n results. They save the per-point
+// dispatch and input copies of the scalar kernels, but otherwise run the scalar code over the columns: the same
+// floating point operations, in the same order, calling the same math functions. Their results are thus bitwise
+// equal to the scalar ones, which the constant folding of expression::set_fp_rules() relies upon. The fast
+// versions (see get_fast_batch_function()), used only with the fast floating point rules, are not.
+template <typename T>
+using batch_fun_ptr = void (*)(const T *const *, unsigned, T *, std::size_t);
+
+namespace detail
+{
+// out = in[0] op in[1] op in[2] ...
+template <typename Op>
+inline void batch_reduce(const double *const *in, unsigned arity, double *out, std::size_t n, Op op)
+{
+    const double *col = in[0];
+    for (std::size_t k = 0u; k < n; ++k) {
+        out[k] = col[k];
+    }
+    for (auto j = 1u; j < arity; ++j) {
+        col = in[j];
+        for (std::size_t k = 0u; k < n; ++k) {
+            out[k] = op(out[k], col[k]);
+        }
+    }
+}
+
+// out = f(in[0] + in[1] + ...)
+template <typename F>
+inline void batch_sum_apply(const double *const *in, unsigned arity, double *out, std::size_t n, F f)
+{
+    batch_reduce(in, arity, out, n, [](double a, double b) { return a + b; });
+    for (std::size_t k = 0u; k < n; ++k) {
+        out[k] = f(out[k]);
+    }
+}
+
+// out = f(in[0])
+template <typename F>
+inline void batch_unary_apply(const double *const *in, double *out, std::size_t n, F f)
+{
+    const double *col = in[0];
+    for (std::size_t k = 0u; k < n; ++k) {
+        out[k] = f(col[k]);
+    }
+}
+
+// Vector math of the fast batch kernels (see get_fast_batch_function()). The argument of the exponential is reduced
+// as x = k ln2 + r, with |r| <= ln2 / 2 (Cody and Waite), and exp(r) - 1 is evaluated by its Taylor polynomial of
+// degree 13: the results are within a few ulps of std::exp, overflow to inf and underflow to zero (or to a
+// subnormal) as std::exp does. On x86-64 the AVX2 versions are selected at run time, when supported by the cpu,
+// and otherwise the portable ones, which perform the same operations one value at a time.
+constexpr double log2e = 1.4426950408889634;
+// ln2 split in a high part with trailing zeros, so that k * ln2_hi is exact, and a low one
+constexpr double ln2_hi = 6.93147180369123816490e-01;
+constexpr double ln2_lo = 1.90821492927058770002e-10;
+// Rounds to an integer (as a double) by adding and subtracting it, and biases the exponents of the powers of two
+constexpr double round_magic = 0x1.8p52;
+constexpr double exponent_bias = 0x1.8p52 + 1023.;
+// 1 / n!, for n = 13 down to 2
+constexpr double expm1_taylor[] = {1.6059043836821613e-10, 2.08767569878681e-09, 2.505210838544172e-08,
+                             2.755731922398589e-07,  2.7557319223985893e-06, 2.48015873015873e-05,
+                             1.984126984126984e-04,  1.388888888888889e-03,  8.333333333333333e-03,
+                             4.1666666666666664e-02, 1.6666666666666666e-01, 0.5};
+
+// exp(r) - 1, for |r| <= ln2 / 2
+inline double expm1_reduced(double r)
+{
+    double q = expm1_taylor[0];
+    for (auto i = 1u; i < sizeof(expm1_taylor) / sizeof(double); ++i) {
+        q = q * r + expm1_taylor[i];
+    }
+    return r + r * r * q;
+}
+
+// 2^k, for an integer k in [-1022, 1023]
+inline double pow2(double k)
+{
+    double retval = k + exponent_bias;
+    std::uint64_t bits;
+    std::memcpy(&bits, &retval, sizeof(double));
+    bits <<= 52;
+    std::memcpy(&retval, &bits, sizeof(double));
+    return retval;
+}
+
+inline double fast_exp(double x)
+{
+    // (NaN fails both comparisons, and propagates)
+    x = x < -746. ? -746. : x;
+    x = x > 710. ? 710. : x;
+    const double k = (x * log2e + round_magic) - round_magic;
+    const double p = expm1_reduced((x - k * ln2_hi) - k * ln2_lo);
+    // 2^k is applied in two steps, as it may not be a normal double
+    const double k1 = std::floor(k * 0.5);
+    return ((1. + p) * pow2(k1)) * pow2(k - k1);
+}
+
+inline double fast_tanh(double x)
+{
+    // tanh(|x|) = -u / (u + 2), with u = exp(-2|x|) - 1 (in [-1, 0], exactly -1 below -50)
+    double a = -2. * std::abs(x);
+    a = a < -50. ? -50. : a;
+    const double k = (a * log2e + round_magic) - round_magic;
+    const double p = expm1_reduced((a - k * ln2_hi) - k * ln2_lo);
+    const double s = pow2(k);
+    const double u = s * p + (s - 1.);
+    return std::copysign(-u / (u + 2.), x);
+}
+
+inline void batch_fast_exp_portable(const double *in, double *out, std::size_t n)
+{
+    for (std::size_t k = 0u; k < n; ++k) {
+        out[k] = fast_exp(in[k]);
+    }
+}
+
+inline void batch_fast_tanh_portable(const double *in, double *out, std::size_t n)
+{
+    for (std::size_t k = 0u; k < n; ++k) {
+        out[k] = fast_tanh(in[k]);
+    }
+}
+
+#if defined(DCGP_AVX2_DISPATCH)
+
+__attribute__((target("avx2"))) inline __m256d expm1_reduced(__m256d r)
+{
+    __m256d q = _mm256_set1_pd(expm1_taylor[0]);
+    for (auto i = 1u; i < sizeof(expm1_taylor) / sizeof(double); ++i) {
+        q = _mm256_add_pd(_mm256_mul_pd(q, r), _mm256_set1_pd(expm1_taylor[i]));
+    }
+    return _mm256_add_pd(r, _mm256_mul_pd(_mm256_mul_pd(r, r), q));
+}
+
+__attribute__((target("avx2"))) inline __m256d pow2(__m256d k)
+{
+    const __m256i bits = _mm256_castpd_si256(_mm256_add_pd(k, _mm256_set1_pd(exponent_bias)));
+    return _mm256_castsi256_pd(_mm256_slli_epi64(bits, 52));
+}
+
+// (x - k ln2_hi) - k ln2_lo, with k the integer nearest to x / ln2
+__attribute__((target("avx2"))) inline __m256d reduce_exp_arg(__m256d x, __m256d &k)
+{
+    const __m256d magic = _mm256_set1_pd(round_magic);
+    k = _mm256_sub_pd(_mm256_add_pd(_mm256_mul_pd(x, _mm256_set1_pd(log2e)), magic), magic);
+    return _mm256_sub_pd(_mm256_sub_pd(x, _mm256_mul_pd(k, _mm256_set1_pd(ln2_hi))),
+                         _mm256_mul_pd(k, _mm256_set1_pd(ln2_lo)));
+}
+
+__attribute__((target("avx2"))) inline void batch_fast_exp_avx2(const double *in, double *out, std::size_t n)
+{
+    std::size_t k = 0u;
+    for (; k + 4u <= n; k += 4u) {
+        // (max and min return their second operand if either is NaN, which thus propagates)
+        __m256d x = _mm256_max_pd(_mm256_set1_pd(-746.), _mm256_loadu_pd(in + k));
+        x = _mm256_min_pd(_mm256_set1_pd(710.), x);
+        __m256d e;
+        const __m256d p = expm1_reduced(reduce_exp_arg(x, e));
+        const __m256d e1 = _mm256_floor_pd(_mm256_mul_pd(e, _mm256_set1_pd(0.5)));
+        const __m256d retval = _mm256_mul_pd(_mm256_mul_pd(_mm256_add_pd(_mm256_set1_pd(1.), p), pow2(e1)),
+                                             pow2(_mm256_sub_pd(e, e1)));
+        _mm256_storeu_pd(out + k, retval);
+    }
+    batch_fast_exp_portable(in + k, out + k, n - k);
+}
+
+__attribute__((target("avx2"))) inline void batch_fast_tanh_avx2(const double *in, double *out, std::size_t n)
+{
+    const __m256d sign = _mm256_set1_pd(-0.);
+    std::size_t k = 0u;
+    for (; k + 4u <= n; k += 4u) {
+        const __m256d x = _mm256_loadu_pd(in + k);
+        const __m256d a
+            = _mm256_max_pd(_mm256_set1_pd(-50.), _mm256_mul_pd(_mm256_set1_pd(-2.), _mm256_andnot_pd(sign, x)));
+        __m256d e;
+        const __m256d p = expm1_reduced(reduce_exp_arg(a, e));
+        const __m256d s = pow2(e);
+        const __m256d u = _mm256_add_pd(_mm256_mul_pd(s, p), _mm256_sub_pd(s, _mm256_set1_pd(1.)));
+        const __m256d t = _mm256_div_pd(_mm256_sub_pd(_mm256_setzero_pd(), u), _mm256_add_pd(u, _mm256_set1_pd(2.)));
+        _mm256_storeu_pd(out + k, _mm256_or_pd(_mm256_andnot_pd(sign, t), _mm256_and_pd(sign, x)));
+    }
+    batch_fast_tanh_portable(in + k, out + k, n - k);
+}
+
+inline bool has_avx2()
+{
+    static const bool retval = __builtin_cpu_supports("avx2");
+    return retval;
+}
+
+#endif
+
+// out = exp(in), in and out may be the same
+inline void batch_fast_exp(const double *in, double *out, std::size_t n)
+{
+#if defined(DCGP_AVX2_DISPATCH)
+    if (has_avx2()) {
+        batch_fast_exp_avx2(in, out, n);
+        return;
+    }
+#endif
+    batch_fast_exp_portable(in, out, n);
+}
+
+// out = tanh(in), in and out may be the same
+inline void batch_fast_tanh(const double *in, double *out, std::size_t n)
+{
+#if defined(DCGP_AVX2_DISPATCH)
+    if (has_avx2()) {
+        batch_fast_tanh_avx2(in, out, n);
+        return;
+    }
+#endif
+    batch_fast_tanh_portable(in, out, n);
+}
+} // namespace detail
+
+inline void my_sum_batch(const double *const *in, unsigned arity, double *out, std::size_t n)
+{
+    detail::batch_reduce(in, arity, out, n, [](double a, double b) { return a + b; });
+}
+
+inline void my_diff_batch(const double *const *in, unsigned arity, double *out, std::size_t n)
+{
+    detail::batch_reduce(in, arity, out, n, [](double a, double b) { return a - b; });
+}
+
+inline void my_mul_batch(const double *const *in, unsigned arity, double *out, std::size_t n)
+{
+    detail::batch_reduce(in, arity, out, n, [](double a, double b) { return a * b; });
+}
+
+inline void my_div_batch(const double *const *in, unsigned arity, double *out, std::size_t n)
+{
+    detail::batch_reduce(in, arity, out, n, [](double a, double b) { return a / b; });
+}
+
+inline void my_pdiv_batch(const double *const *in, unsigned arity, double *out, std::size_t n)
+{
+    const double *col = in[0];
+    // A single input is divided by nothing (i.e. by one)
+    if (arity < 2u) {
+        for (std::size_t k = 0u; k < n; ++k) {
+            out[k] = std::isfinite(col[k]) ? col[k] : 1.;
+        }
+        return;
+    }
+    // out is first used to accumulate the product of the divisors
+    detail::batch_reduce(in + 1, arity - 1u, out, n, [](double a, double b) { return a * b; });
+    for (std::size_t k = 0u; k < n; ++k) {
+        auto retval = col[k] / out[k];
+        out[k] = std::isfinite(retval) ? retval : 1.;
+    }
+}
+
+inline void my_sig_batch(const double *const *in, unsigned arity, double *out, std::size_t n)
+{
+    detail::batch_sum_apply(in, arity, out, n, [](double x) { return 1. / (1. + std::exp(-x)); });
+}
+
+inline void my_tanh_batch(const double *const *in, unsigned arity, double *out, std::size_t n)
+{
+    detail::batch_sum_apply(in, arity, out, n, [](double x) { return std::tanh(x); });
+}
+
+inline void my_relu_batch(const double *const *in, unsigned arity, double *out, std::size_t n)
+{
+    detail::batch_sum_apply(in, arity, out, n, [](double x) { return x < 0 ? 0. : x; });
+}
+
+inline void my_elu_batch(const double *const *in, unsigned arity, double *out, std::size_t n)
+{
+    detail::batch_sum_apply(in, arity, out, n, [](double x) { return x < 0 ? std::exp(x) - 1. : x; });
+}
+
+inline void my_isru_batch(const double *const *in, unsigned arity, double *out, std::size_t n)
+{
+    detail::batch_sum_apply(in, arity, out, n, [](double x) { return x / (std::sqrt(1 + x * x)); });
+}
+
+inline void my_sin_nu_batch(const double *const *in, unsigned arity, double *out, std::size_t n)
+{
+    detail::batch_sum_apply(in, arity, out, n, [](double x) { return std::sin(x); });
+}
+
+inline void my_cos_nu_batch(const double *const *in, unsigned arity, double *out, std::size_t n)
+{
+    detail::batch_sum_apply(in, arity, out, n, [](double x) { return std::cos(x); });
+}
+
+inline void my_gaussian_nu_batch(const double *const *in, unsigned arity, double *out, std::size_t n)
+{
+    detail::batch_sum_apply(in, arity, out, n, [](double x) { return std::exp(-x * x); });
+}
+
+inline void my_inv_sum_batch(const double *const *in, unsigned arity, double *out, std::size_t n)
+{
+    detail::batch_sum_apply(in, arity, out, n, [](double x) { return -x; });
+}
+
+inline void my_abs_batch(const double *const *in, unsigned arity, double *out, std::size_t n)
+{
+    detail::batch_sum_apply(in, arity, out, n, [](double x) { return std::abs(x); });
+}
+
+inline void my_step_batch(const double *const *in, unsigned arity, double *out, std::size_t n)
+{
+    detail::batch_sum_apply(in, arity, out, n, [](double x) { return x < 0. ? 0. : 1.; });
+}
+
+inline void my_sin_batch(const double *const *in, unsigned, double *out, std::size_t n)
+{
+    detail::batch_unary_apply(in, out, n, [](double x) { return std::sin(x); });
+}
+
+inline void my_cos_batch(const double *const *in, unsigned, double *out, std::size_t n)
+{
+    detail::batch_unary_apply(in, out, n, [](double x) { return std::cos(x); });
+}
+
+inline void my_log_batch(const double *const *in, unsigned, double *out, std::size_t n)
+{
+    detail::batch_unary_apply(in, out, n, [](double x) { return std::log(x); });
+}
+
+inline void my_exp_batch(const double *const *in, unsigned, double *out, std::size_t n)
+{
+    detail::batch_unary_apply(in, out, n, [](double x) { return std::exp(x); });
+}
+
+inline void my_gaussian_batch(const double *const *in, unsigned, double *out, std::size_t n)
+{
+    detail::batch_unary_apply(in, out, n, [](double x) { return std::exp(-x * x); });
+}
+
+inline void my_sqrt_batch(const double *const *in, unsigned, double *out, std::size_t n)
+{
+    detail::batch_unary_apply(in, out, n, [](double x) { return std::sqrt(x); });
+}
+
+inline void my_psqrt_batch(const double *const *in, unsigned, double *out, std::size_t n)
+{
+    detail::batch_unary_apply(in, out, n, [](double x) { return std::sqrt(std::abs(x)); });
+}
+
+// The fast batch versions of the kernels calling std::exp or std::tanh (see get_fast_batch_function())
+inline void my_sig_fast_batch(const double *const *in, unsigned arity, double *out, std::size_t n)
+{
+    detail::batch_sum_apply(in, arity, out, n, [](double x) { return -x; });
+    detail::batch_fast_exp(out, out, n);
+    for (std::size_t k = 0u; k < n; ++k) {
+        out[k] = 1. / (1. + out[k]);
+    }
+}
+
+inline void my_tanh_fast_batch(const double *const *in, unsigned arity, double *out, std::size_t n)
+{
+    detail::batch_reduce(in, arity, out, n, [](double a, double b) { return a + b; });
+    detail::batch_fast_tanh(out, out, n);
+}
+
+inline void my_gaussian_nu_fast_batch(const double *const *in, unsigned arity, double *out, std::size_t n)
+{
+    detail::batch_sum_apply(in, arity, out, n, [](double x) { return -x * x; });
+    detail::batch_fast_exp(out, out, n);
+}
+
+inline void my_exp_fast_batch(const double *const *in, unsigned, double *out, std::size_t n)
+{
+    detail::batch_fast_exp(in[0], out, n);
+}
+
+inline void my_gaussian_fast_batch(const double *const *in, unsigned, double *out, std::size_t n)
+{
+    detail::batch_unary_apply(in, out, n, [](double x) { return -x * x; });
+    detail::batch_fast_exp(out, out, n);
+}
+
+/// Batch version of a kernel function
+/**
+ * Returns the batch version of the built-in kernel \p id if T is double, nullptr otherwise.
+ *
+ * @param[in] id the kernel_id.
+ *
+ * @return a pointer to the batch version of the kernel, or nullptr.
+ */
+template <typename T>
+inline batch_fun_ptr<T> get_batch_function(kernel_id id)
+{
+    if constexpr (std::is_same<T, double>::value) {
+        switch (id) {
+            case kernel_id::sum:
+                return my_sum_batch;
+            case kernel_id::diff:
+                return my_diff_batch;
+            case kernel_id::mul:
+                return my_mul_batch;
+            case kernel_id::div:
+                return my_div_batch;
+            case kernel_id::pdiv:
+                return my_pdiv_batch;
+            case kernel_id::sig:
+                return my_sig_batch;
+            case kernel_id::tanh:
+                return my_tanh_batch;
+            case kernel_id::relu:
+                return my_relu_batch;
+            case kernel_id::elu:
+                return my_elu_batch;
+            case kernel_id::isru:
+                return my_isru_batch;
+            case kernel_id::sin_nu:
+                return my_sin_nu_batch;
+            case kernel_id::cos_nu:
+                return my_cos_nu_batch;
+            case kernel_id::gaussian_nu:
+                return my_gaussian_nu_batch;
+            case kernel_id::inv_sum:
+                return my_inv_sum_batch;
+            case kernel_id::abs:
+                return my_abs_batch;
+            case kernel_id::step:
+                return my_step_batch;
+            case kernel_id::sin:
+                return my_sin_batch;
+            case kernel_id::cos:
+                return my_cos_batch;
+            case kernel_id::log:
+                return my_log_batch;
+            case kernel_id::exp:
+                return my_exp_batch;
+            case kernel_id::gaussian:
+                return my_gaussian_batch;
+            case kernel_id::sqrt:
+                return my_sqrt_batch;
+            case kernel_id::psqrt:
+                return my_psqrt_batch;
+            case kernel_id::user:
+                break;
+        }
+    }
+    return nullptr;
+}
+
+/// Fast batch version of a kernel function
+/**
+ * Returns the batch version of the built-in kernel \p id to be used with the fast floating point rules (see
+ * expression::set_fp_rules()) if T is double, nullptr otherwise. The sig, tanh, exp, gaussian and gaussian_nu kernels
+ * then evaluate the exponential with vector instructions (AVX2, if supported by the cpu), so that their results may
+ * differ in the last bits (by a few ulps) from those of the scalar kernels. The other kernels are as returned by
+ * get_batch_function().
+ *
+ * @param[in] id the kernel_id.
+ *
+ * @return a pointer to the fast batch version of the kernel, or nullptr.
+ */
+template <typename T>
+inline batch_fun_ptr<T> get_fast_batch_function(kernel_id id)
+{
+    if constexpr (std::is_same<T, double>::value) {
+        switch (id) {
+            case kernel_id::sig:
+                return my_sig_fast_batch;
+            case kernel_id::tanh:
+                return my_tanh_fast_batch;
+            case kernel_id::gaussian_nu:
+                return my_gaussian_nu_fast_batch;
+            case kernel_id::exp:
+                return my_exp_fast_batch;
+            case kernel_id::gaussian:
+                return my_gaussian_fast_batch;
+            default:
+                break;
+        }
+    }
+    return get_batch_function<T>(id);
+}
+
+/*--------------------------------------------------------------------------
+ *                       PARTIAL DERIVATIVES (double only)
+ *------------------------------------------------------------------------**/
+
+/// Partial derivatives of a built-in kernel
+/**
+ * Computes the partial derivatives of the built-in kernel \p id with respect to each of its inputs, as needed by
+ * reverse mode differentiation. Where a kernel is not differentiable (e.g. relu, abs or psqrt in zero) the
+ * derivative of the branch taken by the gdual version of the kernel is returned. The protected division has zero
+ * derivatives where it returns its protection value.
+ *
+ * @param[in] id the kernel_id, must not be kernel_id::user.
+ * @param[in] in the \p arity inputs of the kernel.
+ * @param[in] arity the number of inputs.
+ * @param[in] value the value of the kernel in \p in.
+ * @param[out] d the \p arity partial derivatives.
+ *
+ * @throw std::invalid_argument if \p id is kernel_id::user.
+ */
+inline void kernel_partials(kernel_id id, const double *in, unsigned arity, double value, double *d)
+{
+    // Kernels applied to the sum of their inputs share the same derivative w.r.t. each input
+    auto fill = [d, arity](double ds) {
+        for (auto j = 0u; j < arity; ++j) {
+            d[j] = ds;
+        }
+    };
+    auto sum = [in, arity]() {
+        double retval = in[0];
+        for (auto j = 1u; j < arity; ++j) {
+            retval += in[j];
+        }
+        return retval;
+    };
+    // Unary kernels discard all inputs except the first one
+    auto unary = [d, arity](double d0) {
+        d[0] = d0;
+        for (auto j = 1u; j < arity; ++j) {
+            d[j] = 0.;
+        }
+    };
+    switch (id) {
+        case kernel_id::sum:
+            fill(1.);
+            return;
+        case kernel_id::diff:
+            fill(-1.);
+            d[0] = 1.;
+            return;
+        case kernel_id::mul:
+            // prefix products first, then multiplied by the suffix ones (no divisions, so that zeros are fine)
+            d[0] = 1.;
+            for (auto j = 1u; j < arity; ++j) {
+                d[j] = d[j - 1u] * in[j - 1u];
+            }
+            {
+                double suffix = 1.;
+                for (auto j = arity; j-- > 0u;) {
+                    d[j] *= suffix;
+                    suffix *= in[j];
+                }
+            }
+            return;
+        case kernel_id::div:
+        case kernel_id::pdiv: {
+            // (a single input is divided by one)
+            double den = 1.;
+            for (auto j = 1u; j < arity; ++j) {
+                den *= in[j];
+            }
+            const double ratio = in[0] / den;
+            if (id == kernel_id::pdiv && !std::isfinite(ratio)) {
+                fill(0.);
+                return;
+            }
+            d[0] = 1. / den;
+            for (auto j = 1u; j < arity; ++j) {
+                d[j] = -ratio / in[j];
+            }
+            return;
+        }
+        case kernel_id::sig:
+            fill(value * (1. - value));
+            return;
+        case kernel_id::tanh:
+            fill(1. - value * value);
+            return;
+        case kernel_id::relu:
+            fill(sum() < 0. ? 0. : 1.);
+            return;
+        case kernel_id::elu:
+            fill(sum() < 0. ? value + 1. : 1.);
+            return;
+        case kernel_id::isru: {
+            const double s = sum();
+            const double tmp = 1. / std::sqrt(1. + s * s);
+            fill(tmp * tmp * tmp);
+            return;
+        }
+        case kernel_id::sin_nu:
+            fill(std::cos(sum()));
+            return;
+        case kernel_id::cos_nu:
+            fill(-std::sin(sum()));
+            return;
+        case kernel_id::gaussian_nu:
+            fill(-2. * sum() * value);
+            return;
+        case kernel_id::inv_sum:
+            fill(-1.);
+            return;
+        case kernel_id::abs:
+            fill(sum() < 0. ? -1. : 1.);
+            return;
+        case kernel_id::step:
+            fill(0.);
+            return;
+        case kernel_id::sin:
+            unary(std::cos(in[0]));
+            return;
+        case kernel_id::cos:
+            unary(-std::sin(in[0]));
+            return;
+        case kernel_id::log:
+            unary(1. / in[0]);
+            return;
+        case kernel_id::exp:
+            unary(value);
+            return;
+        case kernel_id::gaussian:
+            unary(-2. * in[0] * value);
+            return;
+        case kernel_id::sqrt:
+            unary(0.5 / value);
+            return;
+        case kernel_id::psqrt:
+            unary((in[0] < 0. ? -0.5 : 0.5) / value);
+            return;
+        case kernel_id::user:
+            break;
+    }
+    throw std::invalid_argument("The kernel_id does not correspond to a built-in kernel");
+}
+
 } // namespace dcgp
 
 DCGP_S11N_FUNCTION_EXPORT_KEY_MULTI(my_diff)
@@ -0,0 +1,295 @@
+#define BOOST_TEST_MODULE dcgp_dataset_test
+#include <boost/test/included/unit_test.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <pagmo/s11n.hpp>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <dcgp/dataset.hpp>
+
+using namespace dcgp;
+
+BOOST_AUTO_TEST_CASE(construction_test)
+{
+    // Default constructed is empty
+    dataset empty;
+    BOOST_CHECK_EQUAL(empty.size(), 0u);
+    BOOST_CHECK_EQUAL(empty.get_n(), 0u);
+    BOOST_CHECK_EQUAL(empty.get_m(), 0u);
+    // Sanity checks tests (inconsistent points / labels)
+    BOOST_CHECK_THROW(dataset({}, {}), std::invalid_argument);
+    BOOST_CHECK_THROW(dataset({{1., 2.}, {0.3, -0.32}, {0.3, -0.32}}, {{1.5}, {0.02}}), std::invalid_argument);
+    BOOST_CHECK_THROW(dataset({{1., 2.}, {0.3, -0.32, 0.3}}, {{1.5}, {0.02}}), std::invalid_argument);
+    BOOST_CHECK_THROW(dataset({{1., 2.}, {0.3, -0.32}}, {{1.5}, {0.02, 0.3}}), std::invalid_argument);
+
+    std::vector<std::vector<double>> points{{1., 2.}, {3., 4.}, {5., 6.}};
+    std::vector<std::vector<double>> labels{{-1.}, {-2.}, {-3.}};
+    dataset data(points, labels);
+    BOOST_CHECK_EQUAL(data.size(), 3u);
+    BOOST_CHECK_EQUAL(data.get_n(), 2u);
+    BOOST_CHECK_EQUAL(data.get_m(), 1u);
+    BOOST_CHECK(data.get_points() == points);
+    BOOST_CHECK(data.get_labels() == labels);
+}
+
+BOOST_AUTO_TEST_CASE(views_test)
+{
+    std::vector<std::vector<double>> points, labels;
+    for (auto i = 0u; i < 21u; ++i) {
+        points.push_back({1. * i, 2. * i, 3. * i});
+        labels.push_back({-1. * i, -2. * i});
+    }
+    dataset data(points, labels);
+    // Rows
+    for (auto i = 0u; i < data.size(); ++i) {
+        BOOST_CHECK_EQUAL(data.point(i).size(), 3u);
+        BOOST_CHECK_EQUAL(data.label(i).size(), 2u);
+        BOOST_CHECK(std::vector<double>(data.point(i).begin(), data.point(i).end()) == points[i]);
+        BOOST_CHECK(std::vector<double>(data.label(i).begin(), data.label(i).end()) == labels[i]);
+    }
+    // Columns
+    for (auto j = 0u; j < data.get_n(); ++j) {
+        BOOST_CHECK_EQUAL(reinterpret_cast<std::uintptr_t>(data.point_column(j)) % dataset::alignment, 0u);
+        for (auto i = 0u; i < data.size(); ++i) {
+            BOOST_CHECK_EQUAL(data.point_column(j)[i], points[i][j]);
+        }
+    }
+    for (auto j = 0u; j < data.get_m(); ++j) {
+        BOOST_CHECK_EQUAL(reinterpret_cast<std::uintptr_t>(data.label_column(j)) % dataset::alignment, 0u);
+        for (auto i = 0u; i < data.size(); ++i) {
+            BOOST_CHECK_EQUAL(data.label_column(j)[i], labels[i][j]);
+        }
+    }
+    // Iterators (in order and permuted)
+    BOOST_CHECK_EQUAL(data.points_end() - data.points_begin(), 21);
+    BOOST_CHECK_EQUAL((*(data.points_begin() + 4))[2], 12.);
+    std::vector<std::size_t> perm(data.size());
+    for (auto i = 0u; i < perm.size(); ++i) {
+        perm[i] = perm.size() - 1u - i;
+    }
+    BOOST_CHECK_EQUAL((*(data.points_begin(perm.data()) + 4))[2], 48.);
+    BOOST_CHECK_EQUAL((*(data.labels_begin(perm.data()) + 4))[1], -32.);
+}
+
+BOOST_AUTO_TEST_CASE(sharing_test)
+{
+    dataset data({{1., 2.}, {3., 4.}}, {{1.}, {2.}});
+    // Copies share the data
+    auto copy = data;
+    BOOST_CHECK(copy.point_column(0) == data.point_column(0));
+    BOOST_CHECK(copy.point(1).data() == data.point(1).data());
+    // and it survives the original
+    data = dataset();
+    BOOST_CHECK_EQUAL(copy.size(), 2u);
+    BOOST_CHECK_EQUAL(copy.point_column(1)[1], 4.);
+}
+
+BOOST_AUTO_TEST_CASE(s11n_test)
+{
+    std::vector<std::vector<double>> points{{1., 2.}, {3., 4.}, {5., 6.}};
+    std::vector<std::vector<double>> labels{{-1.}, {-2.}, {-3.}};
+    dataset data(points, labels);
+    std::stringstream ss;
+    {
+        boost::archive::binary_oarchive oarchive(ss);
+        oarchive << data;
+    }
+    data = dataset();
+    {
+        boost::archive::binary_iarchive iarchive(ss);
+        iarchive >> data;
+    }
+    BOOST_CHECK(data.get_points() == points);
+    BOOST_CHECK(data.get_labels() == labels);
+    BOOST_CHECK_EQUAL(data.point_column(1)[2], 6.);
+    BOOST_CHECK_EQUAL(data.label_column(0)[1], -2.);
+}
+
+BOOST_AUTO_TEST_CASE(registry_test)
+{
+    dataset data({{1., 2.}, {3., 4.}}, {{1.}, {2.}});
+    // The hash depends on the content only
+    BOOST_CHECK_EQUAL(data.get_hash(), dataset({{1., 2.}, {3., 4.}}, {{1.}, {2.}}).get_hash());
+    BOOST_CHECK(data.get_hash() != dataset({{1., 2.}, {3., 4.}}, {{1.}, {2.1}}).get_hash());
+    BOOST_CHECK(data.get_hash() != dataset({{1., 2., 3., 4.}}, {{1., 2.}}).get_hash());
+    // The hash survives serialization
+    std::stringstream ss;
+    {
+        boost::archive::binary_oarchive oarchive(ss);
+        oarchive << data;
+    }
+    dataset loaded;
+    {
+        boost::archive::binary_iarchive iarchive(ss);
+        iarchive >> loaded;
+    }
+    BOOST_CHECK_EQUAL(loaded.get_hash(), data.get_hash());
+    // Registry
+    auto hash = data.get_hash();
+    BOOST_CHECK_THROW(dataset::from_registry(hash), std::invalid_argument);
+    BOOST_CHECK(!dataset::is_registered(data));
+    dataset::add_to_registry(data);
+    BOOST_CHECK(dataset::is_registered(data));
+    BOOST_CHECK(dataset::is_registered(dataset({{1., 2.}, {3., 4.}}, {{1.}, {2.}})));
+    BOOST_CHECK_NO_THROW(dataset::add_to_registry(data));
+    // The checksum depends on the content only, and the reference is checked on retrieval
+    BOOST_CHECK_EQUAL(data.get_checksum(), loaded.get_checksum());
+    BOOST_CHECK(data.get_checksum() != dataset({{1., 2.}, {3., 4.}}, {{1.}, {2.1}}).get_checksum());
+    auto ref = data.get_reference();
+    BOOST_CHECK(dataset::from_registry(ref).point(0).data() == dataset::from_registry(hash).point(0).data());
+    ref.N = 3u;
+    BOOST_CHECK_THROW(dataset::from_registry(ref), std::invalid_argument);
+    ref = data.get_reference();
+    ref.checksum += 1u;
+    BOOST_CHECK_THROW(dataset::from_registry(ref), std::invalid_argument);
+    data = dataset();
+    auto retrieved = dataset::from_registry(hash);
+    BOOST_CHECK_EQUAL(retrieved.get_hash(), hash);
+    BOOST_CHECK_EQUAL(retrieved.point_column(1)[1], 4.);
+    BOOST_CHECK(retrieved.point(0).data() == dataset::from_registry(hash).point(0).data());
+    dataset::remove_from_registry(hash);
+    BOOST_CHECK_THROW(dataset::from_registry(hash), std::invalid_argument);
+    BOOST_CHECK_NO_THROW(dataset::remove_from_registry(hash));
+}
+
+BOOST_AUTO_TEST_CASE(file_test)
+{
+    std::vector<std::vector<double>> points, labels;
+    for (auto i = 0u; i < 21u; ++i) {
+        points.push_back({1. * i, 2. * i, 0.1 * i});
+        labels.push_back({-1. * i, -0.5 * i});
+    }
+    dataset data(points, labels);
+    data.to_file("dcgp_dataset_test.bin");
+    {
+        auto mapped = dataset::from_file("dcgp_dataset_test.bin");
+        BOOST_CHECK_EQUAL(mapped.size(), 21u);
+        BOOST_CHECK_EQUAL(mapped.get_n(), 3u);
+        BOOST_CHECK_EQUAL(mapped.get_m(), 2u);
+        BOOST_CHECK_EQUAL(mapped.get_hash(), data.get_hash());
+        BOOST_CHECK(mapped.get_points() == points);
+        BOOST_CHECK(mapped.get_labels() == labels);
+        for (auto j = 0u; j < mapped.get_n(); ++j) {
+            BOOST_CHECK_EQUAL(reinterpret_cast<std::uintptr_t>(mapped.point_column(j)) % dataset::alignment, 0u);
+            for (auto i = 0u; i < mapped.size(); ++i) {
+                BOOST_CHECK_EQUAL(mapped.point_column(j)[i], points[i][j]);
+            }
+        }
+        for (auto i = 0u; i < mapped.size(); ++i) {
+            BOOST_CHECK_EQUAL(mapped.label_column(1)[i], labels[i][1]);
+        }
+        // A mapped dataset can be serialized, and the loaded one owns its data
+        std::stringstream ss;
+        {
+            boost::archive::binary_oarchive oarchive(ss);
+            oarchive << mapped;
+        }
+        mapped = dataset();
+        {
+            boost::archive::binary_iarchive iarchive(ss);
+            iarchive >> mapped;
+        }
+        BOOST_CHECK(mapped.get_points() == points);
+        BOOST_CHECK_EQUAL(mapped.get_hash(), data.get_hash());
+    }
+    std::remove("dcgp_dataset_test.bin");
+    // Invalid files
+    BOOST_CHECK_THROW(dataset::from_file("dcgp_dataset_test.bin"), std::invalid_argument);
+    {
+        std::ofstream file("dcgp_dataset_test.bin");
+        file << "not a dataset, but long enough to hold a header. not a dataset, but long enough to hold a header.";
+    }
+    BOOST_CHECK_THROW(dataset::from_file("dcgp_dataset_test.bin"), std::invalid_argument);
+    // Headers with out of range dimensions, or whose block sizes overflow
+    auto corrupt = [&data](std::uint64_t n, std::uint64_t m, std::uint64_t N) {
+        data.to_file("dcgp_dataset_test.bin");
+        std::fstream file("dcgp_dataset_test.bin", std::ios::in | std::ios::out | std::ios::binary);
+        // n, m, N and the stride follow the magic, the version and the type
+        const std::uint64_t dims[4] = {n, m, N, N};
+        file.seekp(24);
+        file.write(reinterpret_cast<const char *>(dims), sizeof(dims));
+    };
+    corrupt(std::uint64_t(1u) << 32, 2u, 24u);
+    BOOST_CHECK_THROW(dataset::from_file("dcgp_dataset_test.bin"), std::invalid_argument);
+    corrupt(4u, 0u, std::uint64_t(1u) << 62);
+    BOOST_CHECK_THROW(dataset::from_file("dcgp_dataset_test.bin"), std::invalid_argument);
+    std::remove("dcgp_dataset_test.bin");
+}
+
+BOOST_AUTO_TEST_CASE(csv_test)
+{
+    {
+        std::ofstream file("dcgp_dataset_test.csv");
+        file << "2, 1, 3,\n1., 2., -1.,\n3., 4.5e-1, -2.,\n5, 6, -3\n";
+    }
+    auto data = dataset::from_csv("dcgp_dataset_test.csv");
+    BOOST_CHECK(data.get_points() == std::vector<std::vector<double>>({{1., 2.}, {3., 0.45}, {5., 6.}}));
+    BOOST_CHECK(data.get_labels() == std::vector<std::vector<double>>({{-1.}, {-2.}, {-3.}}));
+    BOOST_CHECK_EQUAL(data.get_hash(), dataset({{1., 2.}, {3., 0.45}, {5., 6.}}, {{-1.}, {-2.}, {-3.}}).get_hash());
+    // Truncated file
+    {
+        std::ofstream file("dcgp_dataset_test.csv");
+        file << "2, 1, 3,\n1., 2., -1.,\n3., 4.5e-1";
+    }
+    BOOST_CHECK_THROW(dataset::from_csv("dcgp_dataset_test.csv"), std::invalid_argument);
+    // Invalid dimensions
+    for (const auto header : {"2.5, 1, 1,\n", "2, -1, 1,\n", "2, 1, 1e30,\n", "2, 1, 1e12,\n", "5e9, 1, 1,\n"}) {
+        {
+            std::ofstream file("dcgp_dataset_test.csv");
+            file << header << "1., 2., -1.\n";
+        }
+        BOOST_CHECK_THROW(dataset::from_csv("dcgp_dataset_test.csv"), std::invalid_argument);
+    }
+    std::remove("dcgp_dataset_test.csv");
+    BOOST_CHECK_THROW(dataset::from_csv("dcgp_dataset_test.csv"), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(shared_memory_test)
+{
+    std::vector<std::vector<double>> points{{1., 2.}, {3., 4.}, {5., 6.}};
+    std::vector<std::vector<double>> labels{{-1.}, {-2.}, {-3.}};
+    dataset data(points, labels);
+    BOOST_CHECK(data.get_shared_memory_name().empty());
+    dataset::remove_shared_memory("dcgp_dataset_test");
+    auto shared = data.to_shared_memory("dcgp_dataset_test");
+    BOOST_CHECK_EQUAL(shared.get_shared_memory_name(), "dcgp_dataset_test");
+    BOOST_CHECK_EQUAL(shared.get_hash(), data.get_hash());
+    BOOST_CHECK(shared.get_points() == points);
+    BOOST_CHECK(shared.get_labels() == labels);
+    BOOST_CHECK_EQUAL(reinterpret_cast<std::uintptr_t>(shared.point_column(1)) % dataset::alignment, 0u);
+    BOOST_CHECK_EQUAL(shared.point_column(1)[2], 6.);
+    // The shared memory object cannot be created twice, and the failed attempt leaves the existing one in place
+    BOOST_CHECK_THROW(data.to_shared_memory("dcgp_dataset_test"), std::invalid_argument);
+    // A second attachment maps the same data
+    auto attached = dataset::from_shared_memory("dcgp_dataset_test");
+    BOOST_CHECK(attached.get_points() == points);
+    // Serialization only stores the name, and loading attaches to the shared memory object
+    std::stringstream ss;
+    {
+        boost::archive::binary_oarchive oarchive(ss);
+        oarchive << shared;
+    }
+    const auto archive = ss.str();
+    BOOST_CHECK(archive.size() < points.size() * 3u * sizeof(double));
+    dataset loaded;
+    {
+        boost::archive::binary_iarchive iarchive(ss);
+        iarchive >> loaded;
+    }
+    BOOST_CHECK_EQUAL(loaded.get_shared_memory_name(), "dcgp_dataset_test");
+    BOOST_CHECK(loaded.get_labels() == labels);
+    // Once removed, attached datasets stay valid but new attachments fail
+    BOOST_CHECK(dataset::remove_shared_memory("dcgp_dataset_test"));
+    BOOST_CHECK_EQUAL(shared.label_column(0)[2], -3.);
+    BOOST_CHECK_THROW(dataset::from_shared_memory("dcgp_dataset_test"), std::invalid_argument);
+    {
+        std::stringstream ss_in(archive);
+        boost::archive::binary_iarchive iarchive(ss_in);
+        BOOST_CHECK_THROW(iarchive >> loaded, std::invalid_argument);
+    }
+}
@@ -1,6 +1,7 @@
 #define BOOST_TEST_MODULE dcgp_es4cgp_test
 #include <boost/test/included/unit_test.hpp>
 
+#include <algorithm>
 #include <sstream>
 
 #include <pagmo/algorithm.hpp>
@@ -11,6 +12,7 @@
 #include <pagmo/problems/rosenbrock.hpp>
 
 #include <dcgp/algorithms/es4cgp.hpp>
+#include <dcgp/kernel_set.hpp>
 #include <dcgp/problems/symbolic_regression.hpp>
 #include <dcgp/s11n.hpp>
 
@@ -89,6 +91,52 @@ BOOST_AUTO_TEST_CASE(bfe_nonbfe_test)
     BOOST_CHECK(uda_not_bfe.get_log() == uda_bfe.get_log());
 }
 
+BOOST_AUTO_TEST_CASE(neutral_mutants_test)
+{
+    // With many columns most mutants are neutral and their evaluation is skipped
+    pagmo::problem prob{symbolic_regression({{1., 2.}, {0.3, -0.32}}, {{3. / 2.}, {0.02 / 0.32}}, 1u, 50u, 51u)};
+    pagmo::population pop{prob, 5u, 23u};
+    es4cgp uda(20u, 2u, 0., false, 23u);
+    uda.set_verbosity(1u);
+    pop = uda.evolve(pop);
+    const auto &last = uda.get_log().back();
+    BOOST_CHECK(std::get<5>(last) > 0u);
+    // Each of the 20 generations produces 5 mutants, either evaluated or skipped
+    BOOST_CHECK_EQUAL(std::get<1>(last) + std::get<5>(last), 100u);
+}
+
+BOOST_AUTO_TEST_CASE(race_test)
+{
+    // With enough points the evaluation of the mutants worse than their parent stops early (without a bfe): the
+    // evolution and the final population are the same as when all are evaluated fully (with a bfe)
+    std::vector<std::vector<double>> points, labels;
+    for (auto i = 0u; i < 3000u; ++i) {
+        auto x = -1. + 2. * i / 2999.;
+        points.push_back({x});
+        labels.push_back({x * x * x + x + 1.});
+    }
+    pagmo::problem prob{symbolic_regression(points, labels, 1u, 15u, 16u, 2u,
+                                            kernel_set<double>({"sum", "diff", "mul", "pdiv"})(), 1u)};
+    pagmo::population pop1{prob, 5u, 23u};
+    pagmo::population pop2{prob, 5u, 23u};
+    es4cgp uda_bfe(20u, 2u, 0., true, 23u);
+    uda_bfe.set_bfe(pagmo::bfe{});
+    uda_bfe.set_verbosity(1u);
+    es4cgp uda_race(20u, 2u, 0., true, 23u);
+    uda_race.set_verbosity(1u);
+    pop1 = uda_bfe.evolve(pop1);
+    pop2 = uda_race.evolve(pop2);
+    // The mutants stopped early in the last generation and inserted in the population are evaluated again fully
+    const auto &log_bfe = uda_bfe.get_log();
+    const auto &log_race = uda_race.get_log();
+    BOOST_CHECK_EQUAL(log_bfe.size(), log_race.size());
+    BOOST_CHECK(std::equal(log_bfe.begin(), log_bfe.end() - 1, log_race.begin()));
+    BOOST_CHECK(std::get<1>(log_bfe.back()) <= std::get<1>(log_race.back()));
+    BOOST_CHECK(std::get<2>(log_bfe.back()) == std::get<2>(log_race.back()));
+    BOOST_CHECK(pop1.get_x() == pop2.get_x());
+    BOOST_CHECK(pop1.get_f() == pop2.get_f());
+}
+
 BOOST_AUTO_TEST_CASE(trivial_methods_test)
 {
     es4cgp uda{10u, 2u, 1e-4, true, 23u};
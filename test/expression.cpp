@@ -3,6 +3,8 @@
 #include <boost/lexical_cast.hpp>
 
 #include <algorithm>
+#include <cmath>
+#include <limits>
 #include <random>
 #include <sstream>
 #include <string>
@@ -139,6 +141,64 @@ BOOST_AUTO_TEST_CASE(compute)
     CHECK_EQUAL_V(ex2({-1., 1., -1., 1.}), std::vector<double>({1}));
 }
 
+// Straightforward evaluation of the active graph, used as a reference for the tape
+template <typename U>
+std::vector<U> naive_eval(const expression<double> &ex, std::vector<U> point, const std::vector<U> &eph)
+{
+    point.insert(point.end(), eph.begin(), eph.end());
+    std::vector<U> node(ex.get_n() + ex.get_r() * ex.get_c());
+    const auto &x = ex.get();
+    for (auto node_id : ex.get_active_nodes()) {
+        if (node_id < ex.get_n()) {
+            node[node_id] = point[node_id];
+        } else {
+            std::vector<U> function_in;
+            auto idx = ex.get_gene_idx()[node_id];
+            for (auto j = 0u; j < ex.get_arity(node_id); ++j) {
+                function_in.push_back(node[x[idx + j + 1u]]);
+            }
+            node[node_id] = ex.get_f()[x[idx]](function_in);
+        }
+    }
+    std::vector<U> retval;
+    for (auto i = 0u; i < ex.get_m(); ++i) {
+        retval.push_back(node[x[x.size() - ex.get_m() + i]]);
+    }
+    return retval;
+}
+
+BOOST_AUTO_TEST_CASE(tape)
+{
+    kernel_set<double> basic_set({"sum", "diff", "mul", "div", "sig", "sin", "log"});
+    std::mt19937 re(23u);
+    // Random expressions with variable arity, multiple outputs and ephemeral constants
+    expression<double> ex(3, 3, 4, 6, 7, {2, 1, 3, 2, 4, 2}, basic_set(), 2u, 32u);
+    for (auto i = 0u; i < 200u; ++i) {
+        ex.mutate_random(3u);
+        std::vector<double> point(3u);
+        for (auto &v : point) {
+            v = std::uniform_real_distribution<double>(-1, 1)(re);
+        }
+        auto ref = naive_eval(ex, point, ex.get_eph_val());
+        auto res = ex(point);
+        for (auto j = 0u; j < ref.size(); ++j) {
+            BOOST_CHECK((std::isnan(ref[j]) && std::isnan(res[j])) || ref[j] == res[j]);
+        }
+        BOOST_CHECK(ex(std::vector<std::string>{"x", "y", "z"})
+                    == naive_eval(ex, std::vector<std::string>{"x", "y", "z"}, ex.get_eph_symb()));
+    }
+    // Changing the kernel of an active node is reflected in the output
+    expression<double> ex2(2, 4, 2, 3, 4, 2, basic_set(), 0u, 32u);
+    ex2.set({0, 0, 1, 1, 0, 0, 1, 3, 1, 2, 0, 1, 0, 4, 4, 2, 5, 4, 2, 5, 7, 3});
+    CHECK_EQUAL_V(ex2({1., -1.}), std::vector<double>({0, -1, -1, 0}));
+    ex2.set_f_gene(2u, 2u);
+    CHECK_EQUAL_V(ex2({1., -1.}), std::vector<double>({-1, -1, -1, 0}));
+    CHECK_EQUAL_V(ex2({1., -1.}), naive_eval(ex2, std::vector<double>{1., -1.}, {}));
+    // Wrong input sizes are still detected
+    BOOST_CHECK_THROW(ex2({1.}), std::invalid_argument);
+    BOOST_CHECK_THROW(ex2({std::string("x")}), std::invalid_argument);
+}
+
 BOOST_AUTO_TEST_CASE(check_bounds)
 {
     // Random seed
@@ -281,6 +341,40 @@ BOOST_AUTO_TEST_CASE(mutate)
             BOOST_CHECK(idx >= x.size() - ex.get_m());
         }
     }
+
+    // We test that mutations, of one or several genes, update the active graph as a full rebuild would
+    {
+        expression<double> ex(3, 2, 3, 20, 5, 2, basic_set(), 0u, rd());
+        for (auto i = 0u; i < 10u * N; ++i) {
+            switch (i % 3u) {
+                case 0u:
+                    ex.mutate(static_cast<unsigned>(rd() % ex.get().size()));
+                    break;
+                case 1u:
+                    ex.mutate({static_cast<unsigned>(rd() % ex.get().size()),
+                               static_cast<unsigned>(rd() % ex.get().size()),
+                               static_cast<unsigned>(rd() % ex.get().size())});
+                    break;
+                default:
+                    ex.mutate_random(3u);
+            }
+            expression<double> ex2(ex);
+            ex2.set(ex.get());
+            BOOST_CHECK(ex.get_active_nodes() == ex2.get_active_nodes());
+            BOOST_CHECK(ex.get_active_genes() == ex2.get_active_genes());
+            for (auto j = 0u; j < ex.get().size(); ++j) {
+                BOOST_CHECK_EQUAL(ex.is_active_gene(j), ex2.is_active_gene(j));
+            }
+            for (auto node_id = 0u; node_id < ex.get_n() + ex.get_r() * ex.get_c(); ++node_id) {
+                BOOST_CHECK_EQUAL(ex.is_active_node(node_id), ex2.is_active_node(node_id));
+            }
+            auto res = ex({1., 2., 3.});
+            auto res2 = ex2({1., 2., 3.});
+            for (auto j = 0u; j < res.size(); ++j) {
+                BOOST_CHECK((std::isnan(res[j]) && std::isnan(res2[j])) || res[j] == res2[j]);
+            }
+        }
+    }
 }
 
 BOOST_AUTO_TEST_CASE(loss)
@@ -337,6 +431,13 @@ BOOST_AUTO_TEST_CASE(loss)
         });
         BOOST_CHECK_CLOSE(ex.loss(in, out, "MSE", true), ex.loss(in, out, "MSE", false), 1e-8);
         BOOST_CHECK_CLOSE(ex.loss(in, out, "CE", true), ex.loss(in, out, "CE", false), 1e-8);
+        // the number of parts does not need to divide the batch size
+        BOOST_CHECK_CLOSE(ex.loss(in, out, "MSE", 7u), ex.loss(in, out, "MSE", 0u), 1e-8);
+        BOOST_CHECK_CLOSE(ex.loss(in, out, "MSE", 300u), ex.loss(in, out, "MSE", 0u), 1e-8);
+        // the same data as a dataset
+        dataset data(in, out);
+        BOOST_CHECK_CLOSE(ex.loss(data, "MSE"), ex.loss(in, out, "MSE", 0u), 1e-8);
+        BOOST_CHECK_CLOSE(ex.loss(data, "CE", 4u), ex.loss(in, out, "CE", 0u), 1e-8);
     }
 }
 
@@ -515,4 +616,470 @@ BOOST_AUTO_TEST_CASE(s11n_test)
     BOOST_CHECK(before_num == after_num);
     BOOST_CHECK(before_string == boost::lexical_cast<std::string>(ex));
 
+    // The active graph and the tapes are rebuilt on load
+    expression<double> ex_eph(2, 2, 3, 4, 5, 2, basic_set(), 2u, rd());
+    ex_eph.set_eph_val({0., 1.});
+    ex_eph.set_fp_rules(expression<double>::fp_rules::fast);
+    std::stringstream ss_eph;
+    {
+        boost::archive::binary_oarchive oarchive(ss_eph);
+        oarchive << ex_eph;
+    }
+    expression<double> ex_eph2(2, 2, 3, 4, 5, 2, basic_set(), 2u, rd());
+    {
+        boost::archive::binary_iarchive iarchive(ss_eph);
+        iarchive >> ex_eph2;
+    }
+    BOOST_CHECK(ex_eph2.get() == ex_eph.get());
+    BOOST_CHECK(ex_eph2.get_active_nodes() == ex_eph.get_active_nodes());
+    BOOST_CHECK(ex_eph2.get_active_genes() == ex_eph.get_active_genes());
+    BOOST_CHECK(ex_eph2.get_eph_frontier() == ex_eph.get_eph_frontier());
+    BOOST_CHECK(ex_eph2.get_fp_rules() == expression<double>::fp_rules::fast);
+    BOOST_CHECK(ex_eph2({1.2, 3.3}) == ex_eph({1.2, 3.3}));
+}
+
+BOOST_AUTO_TEST_CASE(evaluate_batch)
+{
+    kernel_set<double> basic_set({"sum", "diff", "mul", "div", "sig", "sin"});
+    // A kernel without a batch version
+    basic_set.push_back(
+        kernel<double>([](const std::vector<double> &x) { return x[0] * x[1] + 1.; }, print_my_sum, "user"));
+    std::mt19937 re(23u);
+    expression<double> ex(3, 2, 3, 5, 6, 2, basic_set(), 1u, 32u);
+    // A number of points that is not a multiple of the block size
+    const unsigned N = 1001u;
+    std::vector<std::vector<double>> in(3u, std::vector<double>(N)), out;
+    for (auto &col : in) {
+        for (auto &v : col) {
+            v = std::uniform_real_distribution<double>(-1, 1)(re);
+        }
+    }
+    for (auto i = 0u; i < 20u; ++i) {
+        ex.mutate_active(2u);
+        ex.evaluate_batch(in, out);
+        BOOST_CHECK_EQUAL(out.size(), 2u);
+        for (auto k = 0u; k < N; ++k) {
+            auto res = ex({in[0][k], in[1][k], in[2][k]});
+            for (auto j = 0u; j < 2u; ++j) {
+                BOOST_CHECK((std::isnan(res[j]) && std::isnan(out[j][k])) || res[j] == out[j][k]);
+            }
+        }
+    }
+    // With a phenotype correction
+    ex.set_phenotype_correction(my_pc3());
+    ex.evaluate_batch(in, out);
+    for (auto k = 0u; k < N; k += 100u) {
+        auto res = ex({in[0][k], in[1][k], in[2][k]});
+        BOOST_CHECK(res[0] == out[0][k]);
+    }
+    // Sanity checks
+    std::vector<std::vector<double>> wrong_n(2u, std::vector<double>(N));
+    std::vector<std::vector<double>> wrong_size{std::vector<double>(N), std::vector<double>(N),
+                                                std::vector<double>(1u)};
+    BOOST_CHECK_THROW(ex.evaluate_batch(wrong_n, out), std::invalid_argument);
+    BOOST_CHECK_THROW(ex.evaluate_batch(wrong_size, out), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(eph_gradient_batch)
+{
+    kernel_set<double> basic_set({"sum", "diff", "mul", "pdiv", "sig", "tanh", "sin", "cos", "exp", "gaussian",
+                                  "psqrt", "ISRU", "sin_nu", "gaussian_nu", "inv_sum"});
+    std::mt19937 re(23u);
+    // A number of points that is not a multiple of the block size
+    const unsigned N = 301u;
+    std::vector<std::vector<double>> in(2u, std::vector<double>(N)), out;
+    for (auto &col : in) {
+        for (auto &v : col) {
+            v = std::uniform_real_distribution<double>(-1, 1)(re);
+        }
+    }
+    std::vector<const double *> in_ptrs{in[0].data(), in[1].data()};
+    // Squared distance of the outputs from the point index (scaled)
+    auto loss = [N](const double *const *y, double *const *dy, std::size_t offset, std::size_t b) {
+        double retval = 0.;
+        for (auto j = 0u; j < 2u; ++j) {
+            for (decltype(b) k = 0u; k < b; ++k) {
+                auto diff = y[j][k] - static_cast<double>(offset + k) / N;
+                retval += diff * diff;
+                dy[j][k] = 2. * diff;
+            }
+        }
+        return retval;
+    };
+    auto full_loss = [&](expression<double> &ex, const std::vector<double> &eph) {
+        ex.set_eph_val(eph);
+        ex.evaluate_batch(in, out);
+        double retval = 0.;
+        for (auto j = 0u; j < 2u; ++j) {
+            for (auto k = 0u; k < N; ++k) {
+                retval += (out[j][k] - static_cast<double>(k) / N) * (out[j][k] - static_cast<double>(k) / N);
+            }
+        }
+        return retval;
+    };
+    const std::vector<double> eph{0.7, -1.2, 0.9};
+    // We check the gradient against central finite differences
+    for (auto seed = 0u; seed < 50u; ++seed) {
+        expression<double> ex(2, 2, 2, 6, 7, 3, basic_set(), 3u, seed);
+        ex.set_eph_val(eph);
+        std::vector<double> grad;
+        auto value = ex.eph_gradient_batch(in_ptrs, N, loss, grad);
+        BOOST_CHECK_EQUAL(grad.size(), 3u);
+        BOOST_CHECK_CLOSE(value, full_loss(ex, eph), 1e-8);
+        for (auto i = 0u; i < 3u; ++i) {
+            const double h = 1e-6;
+            auto eph_p = eph, eph_m = eph;
+            eph_p[i] += h;
+            eph_m[i] -= h;
+            auto fd = (full_loss(ex, eph_p) - full_loss(ex, eph_m)) / (2. * h);
+            BOOST_CHECK_SMALL((fd - grad[i]) / (1. + std::abs(fd)), 1e-3);
+        }
+    }
+    // Divisions with a single input (divided by one): c and c / x0, then pdiv(c) and pdiv(c) / x0
+    kernel_set<double> div_set({"div", "pdiv"});
+    for (const auto &xu : {std::vector<unsigned>{0, 2, 1, 3, 0, 3, 4}, std::vector<unsigned>{1, 2, 0, 3, 0, 3, 4}}) {
+        expression<double> ex(2, 2, 1, 2, 2, {1u, 2u}, div_set(), 1u, 32u);
+        ex.set(xu);
+        ex.set_eph_val({0.7});
+        std::vector<double> grad;
+        auto value = ex.eph_gradient_batch(in_ptrs, N, loss, grad);
+        BOOST_CHECK_CLOSE(value, full_loss(ex, {0.7}), 1e-8);
+        const double h = 1e-6;
+        auto fd = (full_loss(ex, {0.7 + h}) - full_loss(ex, {0.7 - h})) / (2. * h);
+        BOOST_CHECK_SMALL((fd - grad[0]) / (1. + std::abs(fd)), 1e-3);
+    }
+    // Sanity checks
+    expression<double> ex(2, 2, 2, 6, 7, 3, basic_set(), 3u, 32u);
+    std::vector<double> grad;
+    BOOST_CHECK_THROW(ex.eph_gradient_batch({in[0].data()}, N, loss, grad), std::invalid_argument);
+    ex.set_phenotype_correction(my_pc3());
+    BOOST_CHECK_THROW(ex.eph_gradient_batch(in_ptrs, N, loss, grad), std::invalid_argument);
+    // User defined kernels have no known derivatives
+    kernel_set<double> user_set;
+    user_set.push_back(
+        kernel<double>([](const std::vector<double> &x) { return x[0] * x[1] + 1.; }, print_my_sum, "user"));
+    expression<double> ex_user(2, 2, 2, 6, 7, 3, user_set(), 3u, 32u);
+    BOOST_CHECK_THROW(ex_user.eph_gradient_batch(in_ptrs, N, loss, grad), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(eph_frontier)
+{
+    kernel_set<double> basic_set({"sum", "diff", "mul", "div", "sig", "sin"});
+    std::mt19937 re(23u);
+    const unsigned N = 301u;
+    std::vector<std::vector<double>> in(2u, std::vector<double>(N)), out;
+    for (auto &col : in) {
+        for (auto &v : col) {
+            v = std::uniform_real_distribution<double>(-1, 1)(re);
+        }
+    }
+    std::vector<const double *> in_ptrs{in[0].data(), in[1].data()};
+    expression<double> ex(2, 2, 3, 6, 7, 2, basic_set(), 2u, 32u);
+    for (auto i = 0u; i < 50u; ++i) {
+        ex.mutate_active(2u);
+        const auto &frontier_nodes = ex.get_eph_frontier();
+        // The eph frontier is made of active nodes not depending on the ephemeral constants
+        for (auto node_id : frontier_nodes) {
+            BOOST_CHECK(node_id >= ex.get_n() && ex.is_active_node(node_id));
+        }
+        // The values of the eph frontier can be reused while the ephemeral constants change
+        auto frontier = ex.eph_frontier({in[0][0], in[1][0]});
+        BOOST_CHECK_EQUAL(frontier.size(), frontier_nodes.size());
+        std::vector<std::vector<double>> frontier_cols(frontier.size(), std::vector<double>(N));
+        std::vector<double *> frontier_out;
+        for (auto &col : frontier_cols) {
+            frontier_out.push_back(col.data());
+        }
+        ex.eph_frontier_batch(in_ptrs, frontier_out, N);
+        std::vector<const double *> frontier_ptrs(frontier_out.begin(), frontier_out.end());
+        for (auto eph : {0.3, -2.1, 7.}) {
+            ex.set_eph_val({eph, 1. / eph});
+            auto res = ex({in[0][0], in[1][0]});
+            auto res_f = ex({in[0][0], in[1][0]}, frontier);
+            for (auto j = 0u; j < 2u; ++j) {
+                BOOST_CHECK((std::isnan(res[j]) && std::isnan(res_f[j])) || res[j] == res_f[j]);
+            }
+            ex.evaluate_batch(in, out);
+            std::vector<std::vector<double>> out_f(2u, std::vector<double>(N));
+            ex.evaluate_batch(in_ptrs, frontier_ptrs, {out_f[0].data(), out_f[1].data()}, N);
+            for (auto j = 0u; j < 2u; ++j) {
+                for (auto k = 0u; k < N; ++k) {
+                    BOOST_CHECK((std::isnan(out[j][k]) && std::isnan(out_f[j][k])) || out[j][k] == out_f[j][k]);
+                }
+            }
+        }
+    }
+    // Sanity checks
+    BOOST_CHECK_THROW(ex({1., 2.}, std::vector<double>(ex.get_eph_frontier().size() + 1u)), std::invalid_argument);
+    BOOST_CHECK_THROW(ex.eph_frontier({1.}), std::invalid_argument);
+    ex.set_phenotype_correction(my_pc3());
+    BOOST_CHECK_THROW(ex({1., 2.}, ex.eph_frontier({1., 2.})), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(unchanged_nodes_and_nodes_batch)
+{
+    kernel_set<double> basic_set({"sum", "diff", "mul", "div", "sig", "sin"});
+    std::mt19937 re(23u);
+    const unsigned N = 301u;
+    std::vector<std::vector<double>> in(2u, std::vector<double>(N)), out;
+    for (auto &col : in) {
+        for (auto &v : col) {
+            v = std::uniform_real_distribution<double>(-1, 1)(re);
+        }
+    }
+    std::vector<const double *> in_ptrs{in[0].data(), in[1].data()};
+    auto function_nodes = [](const expression<double> &ex) {
+        std::vector<unsigned> retval;
+        for (auto node_id : ex.get_active_nodes()) {
+            if (node_id >= ex.get_n()) {
+                retval.push_back(node_id);
+            }
+        }
+        return retval;
+    };
+    expression<double> parent(2, 2, 3, 6, 7, 2, basic_set(), 2u, 32u);
+    parent.set_eph_val({0.3, -1.2});
+    for (auto i = 0u; i < 50u; ++i) {
+        // The columns of all the active function nodes of the parent
+        const auto parent_nodes = function_nodes(parent);
+        std::vector<std::vector<double>> parent_cols(parent.get_n() + parent.get_r() * parent.get_c());
+        std::vector<double *> parent_out;
+        for (auto node_id : parent_nodes) {
+            parent_cols[node_id].resize(N);
+            parent_out.push_back(parent_cols[node_id].data());
+        }
+        parent.nodes_batch(in_ptrs, {}, {}, parent_nodes, parent_nodes, parent_out, N);
+        // A mutant evaluates only its changed nodes, reading the others from the parent
+        auto child = parent;
+        child.mutate_active(2u);
+        if (i % 3u == 0u) {
+            child.set_eph_val({0.3, 0.5 + i});
+        }
+        const auto unchanged = child.unchanged_nodes(parent.get(), parent.get_eph_val());
+        if (child.is_active_node(3u)) {
+            BOOST_CHECK_EQUAL(unchanged[3], i % 3u != 0u);
+        }
+        std::vector<unsigned> known, nodes;
+        std::vector<const double *> known_cols;
+        for (auto node_id : function_nodes(child)) {
+            // (an unchanged node may be inactive in the parent, and thus not computed)
+            if (unchanged[node_id] && !parent_cols[node_id].empty()) {
+                known.push_back(node_id);
+                known_cols.push_back(parent_cols[node_id].data());
+            } else {
+                nodes.push_back(node_id);
+            }
+        }
+        std::vector<std::vector<double>> child_cols(nodes.size(), std::vector<double>(N));
+        std::vector<double *> child_out;
+        for (auto &col : child_cols) {
+            child_out.push_back(col.data());
+        }
+        if (i % 2u == 0u) {
+            child.nodes_batch(in_ptrs, known, known_cols, nodes, nodes, child_out, N);
+        } else {
+            // A compiled evaluation can be run over several batches
+            const auto tape = child.compile_nodes(known, nodes, nodes);
+            const unsigned half = N / 2u;
+            child.nodes_batch(tape, in_ptrs, known_cols, child_out, half);
+            auto shift = [half](auto ptrs) {
+                for (auto &ptr : ptrs) {
+                    ptr += half;
+                }
+                return ptrs;
+            };
+            child.nodes_batch(tape, shift(in_ptrs), shift(known_cols), shift(child_out), N - half);
+        }
+        // The outputs match a full evaluation
+        child.evaluate_batch(in, out);
+        for (auto j = 0u; j < 2u; ++j) {
+            auto node_id = child.get()[child.get().size() - 2u + j];
+            const double *col = nullptr;
+            if (node_id < 2u) {
+                col = in[node_id].data();
+            } else if (node_id < child.get_n()) {
+                continue;
+            } else if (unchanged[node_id] && !parent_cols[node_id].empty()) {
+                col = parent_cols[node_id].data();
+            } else {
+                col = child_cols[static_cast<unsigned>(std::find(nodes.begin(), nodes.end(), node_id) - nodes.begin())]
+                          .data();
+            }
+            for (auto k = 0u; k < N; ++k) {
+                BOOST_CHECK((std::isnan(out[j][k]) && std::isnan(col[k])) || out[j][k] == col[k]);
+            }
+        }
+        parent = child;
+    }
+    // Sanity checks
+    BOOST_CHECK_THROW(parent.unchanged_nodes({1u, 2u}, parent.get_eph_val()), std::invalid_argument);
+    BOOST_CHECK_THROW(parent.unchanged_nodes(parent.get(), {1.}), std::invalid_argument);
+    std::vector<double> col(N);
+    BOOST_CHECK_THROW(parent.nodes_batch({in[0].data()}, {}, {}, {}, {}, {}, N), std::invalid_argument);
+    BOOST_CHECK_THROW(parent.nodes_batch(in_ptrs, {}, {}, {1u}, {1u}, {col.data()}, N), std::invalid_argument);
+    BOOST_CHECK_THROW(parent.nodes_batch(in_ptrs, {}, {}, {}, {5u}, {col.data()}, N), std::invalid_argument);
+    BOOST_CHECK_THROW(parent.compile_nodes({}, {1u}, {1u}), std::invalid_argument);
+    const auto tape = parent.compile_nodes({}, {}, {});
+    BOOST_CHECK_THROW(parent.nodes_batch(tape, {in[0].data()}, {}, {}, N), std::invalid_argument);
+    BOOST_CHECK_THROW(parent.nodes_batch(tape, in_ptrs, {}, {col.data()}, N), std::invalid_argument);
+    parent.set_phenotype_correction(my_pc3());
+    BOOST_CHECK_THROW(parent.nodes_batch(in_ptrs, {}, {}, {}, {}, {}, N), std::invalid_argument);
+    BOOST_CHECK_THROW(parent.compile_nodes({}, {}, {}), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(fp_rules_test)
+{
+    kernel_set<double> basic_set({"sum", "diff", "mul", "div", "pdiv", "sig", "sin"});
+    std::mt19937 re(23u);
+    const unsigned N = 301u;
+    std::vector<std::vector<double>> in(2u, std::vector<double>(N)), out, out_none;
+    for (auto &col : in) {
+        for (auto &v : col) {
+            v = std::uniform_real_distribution<double>(-1, 1)(re);
+        }
+    }
+    auto same = [](double a, double b) { return (std::isnan(a) && std::isnan(b)) || a == b; };
+    // The exact rules do not change the results, neither while the chromosome or the constants change
+    expression<double> ex(2, 2, 3, 6, 7, 3, basic_set(), 2u, 32u);
+    BOOST_CHECK(ex.get_fp_rules() == expression<double>::fp_rules::exact);
+    const std::vector<std::vector<double>> ephs{{0., 1.}, {-0., 0.}, {1., 1.}, {0.3, -2.}};
+    for (auto i = 0u; i < 100u; ++i) {
+        ex.mutate_active(2u);
+        ex.set_eph_val(ephs[i % ephs.size()]);
+        auto ex_none = ex;
+        ex_none.set_fp_rules(expression<double>::fp_rules::none);
+        ex.evaluate_batch(in, out);
+        ex_none.evaluate_batch(in, out_none);
+        for (auto k = 0u; k < N; k += 10u) {
+            auto res = ex({in[0][k], in[1][k]});
+            auto res_none = ex_none({in[0][k], in[1][k]});
+            for (auto j = 0u; j < 2u; ++j) {
+                BOOST_CHECK(same(res[j], res_none[j]));
+                BOOST_CHECK(same(out[j][k], out_none[j][k]));
+                BOOST_CHECK(std::signbit(res[j]) == std::signbit(res_none[j]));
+            }
+        }
+    }
+    // A hand built expression: diff(x, x) * c and pdiv(x, x)
+    expression<double> ex2(1, 2, 1, 3, 3, 2, basic_set(), 1u, 32u);
+    ex2.set({1, 0, 0, 2, 2, 1, 4, 0, 0, 3, 4});
+    ex2.set_eph_val({1.});
+    const auto inf = std::numeric_limits<double>::infinity();
+    auto res = ex2({inf});
+    BOOST_CHECK(std::isnan(res[0]));
+    BOOST_CHECK_EQUAL(res[1], 1.);
+    BOOST_CHECK(ex2({2.}) == std::vector<double>({0., 1.}));
+    // The fast rules assume finite values
+    ex2.set_fp_rules(expression<double>::fp_rules::fast);
+    BOOST_CHECK(ex2({inf}) == std::vector<double>({0., 1.}));
+    BOOST_CHECK(ex2({2.}) == std::vector<double>({0., 1.}));
+    ex2.evaluate_batch({{inf, 2.}}, out);
+    BOOST_CHECK(out == std::vector<std::vector<double>>({{0., 0.}, {1., 1.}}));
+    // The chromosome is not affected
+    BOOST_CHECK(ex2.get() == std::vector<unsigned>({1, 0, 0, 2, 2, 1, 4, 0, 0, 3, 4}));
+    // The fast rules evaluate the exponentials over the batch with vector instructions, close to the scalar kernels
+    expression<double> ex5(2, 2, 3, 6, 7, 2, kernel_set<double>({"sig", "tanh", "exp", "gaussian"})(), 0u, 32u);
+    ex5.set_fp_rules(expression<double>::fp_rules::fast);
+    for (auto i = 0u; i < 20u; ++i) {
+        ex5.mutate_active(2u);
+        ex5.evaluate_batch(in, out);
+        for (auto k = 0u; k < N; k += 10u) {
+            auto res5 = ex5({in[0][k], in[1][k]});
+            for (auto j = 0u; j < 2u; ++j) {
+                BOOST_CHECK(same(res5[j], out[j][k]) || std::abs(res5[j] - out[j][k]) <= 1e-12 * std::abs(res5[j]));
+            }
+        }
+    }
+    // sum(c, c): the constants are compared bit by bit, so -0. after 0. is folded again
+    ex2.set_fp_rules(expression<double>::fp_rules::exact);
+    ex2.set({0, 1, 1, 2, 2, 0, 4, 0, 0, 2, 4});
+    ex2.set_eph_val({0.});
+    BOOST_CHECK(!std::signbit(ex2({2.})[0]));
+    ex2.set_eph_val({-0.});
+    BOOST_CHECK(std::signbit(ex2({2.})[0]));
+    ex2.set_eph_val({std::nan("")});
+    ex2.set_eph_val({std::nan("")});
+    BOOST_CHECK(std::isnan(ex2({2.})[0]));
+    // Setting genes and constants together is the same as setting them one after the other
+    auto ex3 = ex2;
+    ex2.set({1, 0, 0, 2, 2, 1, 4, 0, 0, 3, 4});
+    ex2.set_eph_val({0.5});
+    ex3.set({1, 0, 0, 2, 2, 1, 4, 0, 0, 3, 4}, {0.5});
+    BOOST_CHECK(ex3.get() == ex2.get());
+    BOOST_CHECK(ex3.get_eph_val() == ex2.get_eph_val());
+    BOOST_CHECK(ex3({2.}) == ex2({2.}));
+    BOOST_CHECK_THROW(ex3.set({1, 0, 0, 2, 2, 1, 4, 0, 0, 3, 4}, {0.5, 1.}), std::invalid_argument);
+    // User kernels are not called while folding constants
+    unsigned n_calls = 0u;
+    basic_set.push_back(kernel<double>(
+        [&n_calls](const std::vector<double> &x) {
+            ++n_calls;
+            return x[0] * x[1] + 1.;
+        },
+        print_my_sum, "user"));
+    expression<double> ex4(1, 2, 1, 3, 3, 2, basic_set(), 1u, 32u);
+    ex4.set({7, 1, 1, 0, 2, 0, 4, 0, 0, 3, 4}, {2.});
+    ex4.set_eph_val({3.});
+    BOOST_CHECK_EQUAL(n_calls, 0u);
+    BOOST_CHECK_EQUAL(ex4({1.})[0], 11.);
+    BOOST_CHECK(n_calls > 0u);
+}
+
+BOOST_AUTO_TEST_CASE(random_offspring)
+{
+    kernel_set<double> basic_set({"sum", "diff", "mul", "div"});
+    expression<double> ex(2, 2, 3, 6, 7, 2, basic_set(), 1u, 32u);
+    const auto parent = ex.get();
+    const auto dim = parent.size() + 1u;
+    detail::random_engine_type e(23u);
+    // The children are written after a leading element, as in a decision vector with one constant
+    const std::size_t k = 200u;
+    std::vector<double> dvs(k * dim, -1.);
+    auto neutral = ex.random_offspring(dvs.data() + 1u, dim, k, 3u, e);
+    BOOST_CHECK_EQUAL(neutral.size(), k);
+    // The expression is not modified
+    BOOST_CHECK(ex.get() == parent);
+    unsigned n_neutral = 0u;
+    for (auto i = 0u; i < k; ++i) {
+        BOOST_CHECK_EQUAL(dvs[i * dim], -1.);
+        std::vector<unsigned> child(dvs.begin() + static_cast<long>(i * dim + 1u),
+                                    dvs.begin() + static_cast<long>((i + 1u) * dim));
+        unsigned n_diff = 0u;
+        bool active_diff = false;
+        for (auto j = 0u; j < parent.size(); ++j) {
+            BOOST_CHECK(child[j] >= ex.get_lb()[j] && child[j] <= ex.get_ub()[j]);
+            if (child[j] != parent[j]) {
+                ++n_diff;
+                active_diff = active_diff || ex.is_active_gene(j);
+            }
+        }
+        BOOST_CHECK(n_diff <= 3u);
+        // Neutral children express the same phenotype
+        BOOST_CHECK_EQUAL(neutral[i], !active_diff);
+        if (neutral[i]) {
+            ++n_neutral;
+            auto ex_child = ex;
+            ex_child.set(child);
+            BOOST_CHECK(ex_child.get_active_genes() == ex.get_active_genes());
+        }
+    }
+    BOOST_CHECK(n_neutral > 0u && n_neutral < k);
+    // Sanity checks
+    BOOST_CHECK_THROW(ex.random_offspring(dvs.data(), dim, 1u, 0u, e), std::invalid_argument);
+    BOOST_CHECK_THROW(ex.random_offspring(dvs.data(), parent.size() - 1u, 1u, 3u, e), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(same_eph_phenotype)
+{
+    kernel_set<double> basic_set({"sum", "diff", "mul", "div"});
+    // Inputs x, c1, c2: the first output is c1 * x, the second x
+    expression<double> ex(1, 2, 1, 3, 3, 2, basic_set(), 2u, 32u);
+    ex.set({2, 0, 1, 0, 0, 0, 0, 0, 0, 3, 0});
+    const std::vector<double> eph{1., 2.};
+    BOOST_CHECK(ex.same_eph_phenotype(eph.data(), eph.data()));
+    // Changing the inactive constant keeps the phenotype, changing the active one does not
+    BOOST_CHECK(ex.same_eph_phenotype(eph.data(), std::vector<double>{1., 5.}.data()));
+    BOOST_CHECK(!ex.same_eph_phenotype(eph.data(), std::vector<double>{3., 2.}.data()));
+    // The values are compared bit by bit
+    BOOST_CHECK(!ex.same_eph_phenotype(std::vector<double>{0., 2.}.data(), std::vector<double>{-0., 2.}.data()));
 }
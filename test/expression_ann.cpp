@@ -2,6 +2,7 @@
 #include <boost/test/included/unit_test.hpp>
 
 #include <algorithm>
+#include <cmath>
 #include <audi/back_compatibility.hpp>
 #include <audi/io.hpp>
 #include <pagmo/s11n.hpp>
@@ -263,6 +264,16 @@ BOOST_AUTO_TEST_CASE(sgd)
     }
     // NOTE: this can rarely fail, let's disable it.
     // BOOST_CHECK(tmp_end <= tmp_start);
+
+    // The same on a (shared, immutable) dataset
+    dataset shared_data(data, label);
+    for (auto j = 0u; j < 5; ++j) {
+        auto loss = ex.sgd(shared_data, 0.001, 32, "MSE");
+        BOOST_CHECK(std::isfinite(loss));
+    }
+    BOOST_CHECK(shared_data.get_points() == data);
+    BOOST_CHECK_THROW(ex.sgd(shared_data, -0.001, 32, "MSE"), std::invalid_argument);
+    BOOST_CHECK_THROW(ex.sgd(shared_data, 0.001, 32, "MSA"), std::invalid_argument);
 }
 
 BOOST_AUTO_TEST_CASE(d_loss)
@@ -303,6 +314,44 @@ BOOST_AUTO_TEST_CASE(d_loss)
     // Checks on corner case arity (1)
     test_against_numerical_derivatives(5, 1, 5, 5, 2, {2, 1, 3, 1, 7}, random_seed(gen), loss_t::MSE);
     test_against_numerical_derivatives(5, 1, 6, 6, 2, {1, 1, 1, 1, 1, 1}, random_seed(gen), loss_t::CE);
+
+    audi::print("Testing the batched gradient against the single point one\n");
+    for (auto loss_e : {loss_t::MSE, loss_t::CE}) {
+        kernel_set<double> ann_set({"sig", "tanh", "ReLu", "ELU", "ISRU", "sum", "sin_nu", "cos_nu", "gaussian_nu",
+                                    "inv_sum", "abs", "step"});
+        expression_ann ex(3, 2, 4, 4, 2, 3u, ann_set(), random_seed(gen));
+        ex.randomise_weights(0, 1., random_seed(gen));
+        ex.randomise_biases(0, 1., random_seed(gen));
+        // more points than those processed at once by the batched passes
+        std::vector<std::vector<double>> points(600, std::vector<double>(3)), labels(600, std::vector<double>(2));
+        for (auto i = 0u; i < points.size(); ++i) {
+            std::generate(points[i].begin(), points[i].end(), [&]() { return norm(gen); });
+            std::generate(labels[i].begin(), labels[i].end(), [&]() { return std::abs(norm(gen)); });
+        }
+        // Cumulating the single point gradients (the buffers used are reused across points)
+        double value = 0.;
+        std::vector<double> gweights(ex.get_weights().size(), 0.);
+        std::vector<double> gbiases(ex.get_biases().size(), 0.);
+        for (auto i = 0u; i < points.size(); ++i) {
+            ex.d_loss(value, gweights, gbiases, points[i], labels[i], loss_e);
+        }
+        dataset data(points, labels);
+        for (auto parallel : {0u, 1u, 4u, 7u}) {
+            auto res = ex.d_loss(points, labels, loss_e, parallel);
+            auto res_data = ex.d_loss(data, loss_e, parallel);
+            BOOST_CHECK_CLOSE(std::get<0>(res_data), std::get<0>(res), 1e-8);
+            for (auto i = 0u; i < gweights.size(); ++i) {
+                BOOST_CHECK_CLOSE(std::get<1>(res_data)[i], std::get<1>(res)[i], 1e-8);
+            }
+            BOOST_CHECK_CLOSE(std::get<0>(res) * 600., value, 1e-8);
+            for (auto i = 0u; i < gweights.size(); ++i) {
+                BOOST_CHECK_CLOSE(std::get<1>(res)[i] * 600., gweights[i], 1e-8);
+            }
+            for (auto i = 0u; i < gbiases.size(); ++i) {
+                BOOST_CHECK_CLOSE(std::get<2>(res)[i] * 600., gbiases[i], 1e-8);
+            }
+        }
+    }
 }
 
 BOOST_AUTO_TEST_CASE(n_active_weights)
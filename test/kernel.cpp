@@ -1,8 +1,13 @@
 #define BOOST_TEST_MODULE dcgp_kernel_test
 #include <boost/test/included/unit_test.hpp>
 
+#include <cmath>
 #include <initializer_list>
+#include <limits>
+#include <random>
 #include <sstream>
+#include <string>
+#include <vector>
 
 #include <dcgp/kernel.hpp>
 #include <dcgp/kernel_set.hpp>
@@ -34,6 +39,147 @@ BOOST_CHECK_NO_THROW(kernel<double>(my_elu<double>, print_my_elu, "w"));
 BOOST_CHECK_NO_THROW(kernel<double>(my_isru<double>, print_my_isru, "w"));
 }
 
+BOOST_AUTO_TEST_CASE(batch_test)
+{
+    std::mt19937 re(23u);
+    const std::size_t n = 37u;
+    std::vector<std::vector<double>> cols(3u, std::vector<double>(n));
+    for (auto &col : cols) {
+        for (auto &v : col) {
+            v = std::uniform_real_distribution<double>(-2, 2)(re);
+        }
+    }
+    cols[1][3] = 0.; // to trigger the protected division
+    std::vector<const double *> in{cols[0].data(), cols[1].data(), cols[2].data()};
+    std::vector<double> out(n);
+    kernel_set<double> ks({"sum", "diff", "mul", "div", "pdiv", "sig", "tanh", "ReLu", "ELU", "ISRU", "sin", "cos",
+                           "log", "exp", "gaussian", "sqrt", "psqrt", "sin_nu", "cos_nu", "gaussian_nu", "inv_sum",
+                           "abs", "step"});
+    // All shipped kernels have a batch version giving the same results as the scalar one
+    for (const auto &k : ks()) {
+        BOOST_CHECK(k.has_batch());
+        for (auto arity = 2u; arity <= 3u; ++arity) {
+            k.batch(in.data(), arity, out.data(), n);
+            for (auto i = 0u; i < n; ++i) {
+                std::vector<double> point(arity);
+                for (auto j = 0u; j < arity; ++j) {
+                    point[j] = cols[j][i];
+                }
+                auto ref = k(point);
+                BOOST_CHECK((std::isnan(ref) && std::isnan(out[i])) || ref == out[i]);
+            }
+        }
+    }
+    // The fast batch versions are within a few ulps of the scalar ones
+    auto close = [](double ref, double v) {
+        return (std::isnan(ref) && std::isnan(v)) || ref == v || std::abs(ref - v) <= 4e-15 * std::abs(ref) + 1e-320;
+    };
+    for (const auto &k : ks()) {
+        for (auto arity = 2u; arity <= 3u; ++arity) {
+            k.fast_batch(in.data(), arity, out.data(), n);
+            for (auto i = 0u; i < n; ++i) {
+                std::vector<double> point(arity);
+                for (auto j = 0u; j < arity; ++j) {
+                    point[j] = cols[j][i];
+                }
+                BOOST_CHECK(close(k(point), out[i]));
+            }
+        }
+    }
+    // Also at the limits of the exponential
+    const auto inf = std::numeric_limits<double>::infinity();
+    std::vector<double> x{0., -0., 1e-300, -1e-300, 709.7, 710., -708., -740., -746., inf, -inf, std::nan(""), 1.};
+    std::vector<double> res(x.size());
+    const double *px = x.data();
+    for (auto name : {"exp", "tanh"}) {
+        kernel_set<double> single({name});
+        single()[0].fast_batch(&px, 1u, res.data(), x.size());
+        for (auto i = 0u; i < x.size(); ++i) {
+            auto ref = single()[0]({x[i]});
+            BOOST_CHECK(close(ref, res[i]));
+            BOOST_CHECK(std::isnan(ref) || std::signbit(ref) == std::signbit(res[i]));
+        }
+    }
+    // A protected division with a single input is the input itself
+    kernel<double> pdiv(my_pdiv<double>, print_my_pdiv, "pdiv");
+    pdiv.batch(in.data(), 1u, out.data(), n);
+    for (auto i = 0u; i < n; ++i) {
+        BOOST_CHECK_EQUAL(out[i], cols[0][i]);
+        BOOST_CHECK_EQUAL(pdiv({cols[0][i]}), cols[0][i]);
+    }
+    // Kernels built from other functions do not
+    kernel<double> user([](const std::vector<double> &x) { return x[0]; }, print_my_sum, "user");
+    BOOST_CHECK(!user.has_batch());
+    BOOST_CHECK_THROW(user.batch(in.data(), 1u, out.data(), n), std::invalid_argument);
+    // The batch version survives serialization
+    kernel<double> k1(my_sig<double>, print_my_sig, "sig");
+    std::stringstream ss;
+    {
+        boost::archive::binary_oarchive oarchive(ss);
+        oarchive << k1;
+    }
+    k1 = user;
+    {
+        boost::archive::binary_iarchive iarchive(ss);
+        iarchive >> k1;
+    }
+    BOOST_CHECK(k1.has_batch());
+}
+
+BOOST_AUTO_TEST_CASE(kernel_id_test)
+{
+    // Shipped functions paired with their own symbolic representation are built-in kernels
+    BOOST_CHECK(kernel<double>(my_sum<double>, print_my_sum, "w").get_id() == kernel_id::sum);
+    BOOST_CHECK(kernel<double>(my_psqrt<double>, print_my_psqrt, "w").get_id() == kernel_id::psqrt);
+    BOOST_CHECK(kernel<audi::gdual_d>(my_sig<audi::gdual_d>, print_my_sig, "w").get_id() == kernel_id::sig);
+    BOOST_CHECK(kernel_set<audi::gdual_v>({"ELU"})()[0].get_id() == kernel_id::elu);
+    // Anything else is a user defined kernel
+    kernel<double> mixed(my_mul<double>, print_my_sum, "mixed");
+    BOOST_CHECK(mixed.get_id() == kernel_id::user);
+    kernel<double> user([](const std::vector<double> &x) { return x[0] * x[1]; },
+                        [](const std::vector<std::string> &x) { return x[0] + "*" + x[1]; }, "user");
+    BOOST_CHECK(user.get_id() == kernel_id::user);
+    // Built-in kernels are pure functions, user defined ones take the thread safety of their functions
+    BOOST_CHECK(kernel<double>(my_sum<double>, print_my_sum, "w").get_thread_safety()
+                == pagmo::thread_safety::constant);
+    BOOST_CHECK(mixed.get_thread_safety() == pagmo::thread_safety::basic);
+    BOOST_CHECK(user.get_thread_safety() == pagmo::thread_safety::basic);
+    // Both evaluate as before and survive copies and serialization
+    kernel<double> builtin(my_div<double>, print_my_div, "div");
+    for (auto k : {builtin, mixed}) {
+        kernel<double> k2(k);
+        BOOST_CHECK_EQUAL(k2({3., 2.}), k({3., 2.}));
+        BOOST_CHECK_EQUAL(k2(std::vector<std::string>{"x", "y"}), k(std::vector<std::string>{"x", "y"}));
+        std::stringstream ss;
+        {
+            boost::archive::binary_oarchive oarchive(ss);
+            oarchive << k;
+        }
+        k2 = kernel<double>(my_sum<double>, print_my_sum, "sum");
+        {
+            boost::archive::binary_iarchive iarchive(ss);
+            iarchive >> k2;
+        }
+        BOOST_CHECK(k2.get_id() == k.get_id());
+        BOOST_CHECK(k2.get_thread_safety() == k.get_thread_safety());
+        BOOST_CHECK_EQUAL(k2.get_name(), k.get_name());
+        BOOST_CHECK_EQUAL(k2({3., 2.}), k({3., 2.}));
+    }
+    BOOST_CHECK_EQUAL(builtin({3., 2.}), 1.5);
+    BOOST_CHECK_EQUAL(mixed({3., 2.}), 6.);
+    BOOST_CHECK_EQUAL(mixed(std::vector<std::string>{"x", "y"}), "(x+y)");
+    BOOST_CHECK_EQUAL(kernel<double>(user)({3., 2.}), 6.);
+    BOOST_CHECK_EQUAL(builtin(std::vector<std::string>{"x", "y"}), "(x/y)");
+    BOOST_CHECK_EQUAL(user(std::vector<std::string>{"x", "y"}), "x*y");
+    // A moved-from kernel throws rather than crashing, and can be assigned to
+    kernel<double> moved(std::move(user));
+    BOOST_CHECK_EQUAL(moved({3., 2.}), 6.);
+    BOOST_CHECK_THROW(user({3., 2.}), std::invalid_argument);
+    BOOST_CHECK_THROW(user(std::vector<std::string>{"x", "y"}), std::invalid_argument);
+    user = builtin;
+    BOOST_CHECK_EQUAL(user({3., 2.}), 1.5);
+}
+
 BOOST_AUTO_TEST_CASE(s11n_test)
 {
     {
@@ -94,6 +94,9 @@ BOOST_AUTO_TEST_CASE(bfe_nonbfe_test)
     uda_not_bfe.set_verbosity(1u);
     pop2 = uda_not_bfe.evolve(pop2);
     BOOST_CHECK(uda_not_bfe.get_log() == uda_bfe.get_log());
+    // Each of the 10 generations produces 5 mutants, either evaluated or skipped as neutral
+    const auto &last = uda_bfe.get_log().back();
+    BOOST_CHECK_EQUAL(std::get<1>(last) + std::get<5>(last), 50u);
 }
 
 BOOST_AUTO_TEST_CASE(trivial_methods_test)
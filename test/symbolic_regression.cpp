@@ -1,14 +1,23 @@
 #define BOOST_TEST_MODULE dcgp_symbolic_regression_test
 #include <boost/test/included/unit_test.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
 #include <sstream>
+#include <tuple>
 
 #include <pagmo/algorithm.hpp>
 #include <pagmo/algorithms/gaco.hpp>
 #include <pagmo/algorithms/sga.hpp>
+#include <pagmo/batch_evaluators/member_bfe.hpp>
+#include <pagmo/batch_evaluators/thread_bfe.hpp>
 #include <pagmo/io.hpp>
 #include <pagmo/population.hpp>
 #include <pagmo/problem.hpp>
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
 
 #include <dcgp/gym.hpp>
 #include <dcgp/problems/symbolic_regression.hpp>
@@ -105,6 +114,95 @@ BOOST_AUTO_TEST_CASE(fitness_test_single_obj)
         BOOST_CHECK_EQUAL(udp.fitness(test_xeph)[0], 2.5);
     }
 }
+BOOST_AUTO_TEST_CASE(fitness_test_parallel)
+{
+    kernel_set<double> basic_set({"sum", "diff", "mul", "div", "sig"});
+    std::vector<std::vector<double>> points, labels;
+    gym::generate_uball5d(points, labels);
+    for (auto loss_s : {"MSE", "CE"}) {
+        symbolic_regression udp{points, labels, 2, 10, 11, 2, basic_set(), 2u, false, 0u, loss_s};
+        pagmo::population pop(udp, 10u, 32u);
+        // The batches need not divide the data size
+        for (auto parallel : {1u, 3u, 7u}) {
+            symbolic_regression udp_p{points, labels, 2, 10, 11, 2, basic_set(), 2u, false, parallel, loss_s};
+            for (decltype(pop.size()) i = 0u; i < pop.size(); ++i) {
+                auto f = udp.fitness(pop.get_x()[i])[0];
+                auto f_p = udp_p.fitness(pop.get_x()[i])[0];
+                BOOST_CHECK((std::isnan(f) && std::isnan(f_p)) || std::abs(f - f_p) <= 1e-12 * std::abs(f));
+            }
+        }
+        // The batch evaluation agrees with the expression loss
+        for (decltype(pop.size()) i = 0u; i < pop.size(); ++i) {
+            udp.set_cgp(pop.get_x()[i]);
+            auto f = udp.get_cgp().loss(points, labels, loss_s);
+            BOOST_CHECK((std::isnan(f) && std::isnan(pop.get_f()[i][0])) || f == pop.get_f()[i][0]);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(gradient_hessians_test_parallel)
+{
+    kernel_set<double> basic_set({"sum", "diff", "mul", "sin"});
+    std::vector<std::vector<double>> points, labels;
+    // More points than a chunk of vectorized gduals
+    gym::generate_koza_quintic(points, labels);
+    while (points.size() < 3000u) {
+        points.insert(points.end(), points.begin(), points.begin() + 10);
+        labels.insert(labels.end(), labels.begin(), labels.begin() + 10);
+    }
+    symbolic_regression udp{points, labels, 2, 10, 11, 2, basic_set(), 3u, false, 0u};
+    pagmo::population pop(udp, 10u, 32u);
+    for (auto parallel : {1u, 3u, 7u}) {
+        symbolic_regression udp_p{points, labels, 2, 10, 11, 2, basic_set(), 3u, false, parallel};
+        for (const auto &x : pop.get_x()) {
+            auto lgh = udp.loss_gradient_hessian(x);
+            auto lgh_p = udp_p.loss_gradient_hessian(x);
+            BOOST_CHECK_CLOSE(std::get<0>(lgh), std::get<0>(lgh_p), 1e-10);
+            const auto &g = std::get<1>(lgh), &g_p = std::get<1>(lgh_p);
+            const auto &h = std::get<2>(lgh), &h_p = std::get<2>(lgh_p);
+            for (auto i = 0u; i < 3u; ++i) {
+                BOOST_CHECK_SMALL(g[i] - g_p[i], 1e-10 * (1. + std::abs(g[i])));
+            }
+            for (auto i = 0u; i < 6u; ++i) {
+                BOOST_CHECK_SMALL(h[i] - h_p[i], 1e-10 * (1. + std::abs(h[i])));
+            }
+            auto x2 = x;
+            x2[0] += 0.5;
+            auto g2 = udp.gradient(x2);
+            auto g2_p = udp_p.gradient(x2);
+            for (auto i = 0u; i < 3u; ++i) {
+                BOOST_CHECK_SMALL(g2[i] - g2_p[i], 1e-10 * (1. + std::abs(g2[i])));
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(dataset_test)
+{
+    kernel_set<double> basic_set({"sum", "diff", "mul", "div"});
+    std::vector<std::vector<double>> points, labels;
+    gym::generate_koza_quintic(points, labels);
+    dataset data(points, labels);
+    symbolic_regression udp(points, labels, 2, 10, 11, 2, basic_set(), 2u);
+    symbolic_regression udp_data(data, 2, 10, 11, 2, basic_set(), 2u);
+    // The problem constructed from the dataset shares its data, and so do its copies
+    BOOST_CHECK(udp_data.get_data().point_column(0) == data.point_column(0));
+    auto udp_copy = udp_data;
+    BOOST_CHECK(udp_copy.get_data().point_column(0) == data.point_column(0));
+    pagmo::problem prob(udp_data);
+    BOOST_CHECK(prob.extract<symbolic_regression>()->get_data().point_column(0) == data.point_column(0));
+    // and computes the same fitness, gradient and hessians of the one constructed from the vectors
+    pagmo::population pop(udp, 10u);
+    for (decltype(pop.size()) i = 0u; i < pop.size(); ++i) {
+        auto x = pop.get_x()[i];
+        BOOST_CHECK_EQUAL(udp_data.fitness(x)[0], udp.fitness(x)[0]);
+        BOOST_CHECK(udp_data.gradient(x) == udp.gradient(x));
+        BOOST_CHECK(udp_data.hessians(x) == udp.hessians(x));
+    }
+    // An empty dataset is not allowed
+    BOOST_CHECK_THROW(symbolic_regression(dataset{}), std::invalid_argument);
+}
+
 BOOST_AUTO_TEST_CASE(fitness_test_two_obj)
 {
     kernel_set<double> basic_set({"sum", "diff", "mul", "div"});
@@ -153,6 +251,74 @@ BOOST_AUTO_TEST_CASE(phenotype_correction_test)
 }
 
 
+BOOST_AUTO_TEST_CASE(thread_safety_test)
+{
+    kernel_set<double> basic_set({"sum", "diff", "mul", "sin"});
+    std::vector<std::vector<double>> points, labels;
+    gym::generate_koza_quintic(points, labels);
+    symbolic_regression udp(points, labels, 2, 10, 11, 2, basic_set(), 2u, true, 2u);
+    // With built-in kernels a single problem can be shared by all threads
+    BOOST_CHECK(udp.get_thread_safety() == pagmo::thread_safety::constant);
+    pagmo::problem prob(udp);
+    BOOST_CHECK(prob.get_thread_safety() == pagmo::thread_safety::constant);
+    pagmo::population pop(prob, 64u);
+    // Serial results, from a copy of the problem
+    auto udp_serial = udp;
+    std::vector<pagmo::vector_double> f, g;
+    std::vector<std::vector<pagmo::vector_double>> h;
+    std::vector<std::string> p;
+    for (const auto &x : pop.get_x()) {
+        f.push_back(udp_serial.fitness(x));
+    }
+    for (const auto &x : pop.get_x()) {
+        g.push_back(udp_serial.gradient(x));
+        h.push_back(udp_serial.hessians(x));
+        p.push_back(udp_serial.pretty(x));
+    }
+    // Concurrent results, all threads using the same problem. The fitness is computed first, as gradient() and
+    // hessians() cache the fitness computed via gduals.
+    for (auto rep = 0u; rep < 3u; ++rep) {
+        auto udp_shared = udp;
+        std::vector<pagmo::vector_double> f_par(f.size()), g_par(g.size());
+        std::vector<std::vector<pagmo::vector_double>> h_par(h.size());
+        std::vector<std::string> p_par(p.size());
+        tbb::parallel_for(std::size_t(0u), f.size(),
+                          [&](std::size_t i) { f_par[i] = udp_shared.fitness(pop.get_x()[i]); });
+        tbb::parallel_for(std::size_t(0u), 3u * f.size(), [&](std::size_t k) {
+            const auto i = k % f.size();
+            const auto &x = pop.get_x()[i];
+            switch (k / f.size()) {
+                case 0u:
+                    g_par[i] = udp_shared.gradient(x);
+                    break;
+                case 1u:
+                    h_par[i] = udp_shared.hessians(x);
+                    break;
+                default:
+                    p_par[i] = udp_shared.pretty(x);
+            }
+        });
+        BOOST_CHECK(f_par == f);
+        BOOST_CHECK(g_par == g);
+        BOOST_CHECK(h_par == h);
+        BOOST_CHECK(p_par == p);
+    }
+    // and through pagmo's thread_bfe
+    pagmo::vector_double dvs;
+    for (const auto &x : pop.get_x()) {
+        dvs.insert(dvs.end(), x.begin(), x.end());
+    }
+    auto fvs = pagmo::thread_bfe{}(prob, dvs);
+    for (decltype(f.size()) i = 0u; i < f.size(); ++i) {
+        BOOST_CHECK(pagmo::vector_double(fvs.begin() + 2 * i, fvs.begin() + 2 * i + 2) == f[i]);
+    }
+    // The phenotype correction lowers the thread safety to its own
+    udp.set_phenotype_correction(pc<double>, pc<audi::gdual_v>);
+    BOOST_CHECK(udp.get_thread_safety() == pagmo::thread_safety::basic);
+    udp.unset_phenotype_correction();
+    BOOST_CHECK(udp.get_thread_safety() == pagmo::thread_safety::constant);
+}
+
 BOOST_AUTO_TEST_CASE(get_bounds_test)
 {
     kernel_set<double> basic_set({"sum", "diff", "mul", "div"});
@@ -200,6 +366,79 @@ BOOST_AUTO_TEST_CASE(gradient_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(reverse_gradient_test)
+{
+    kernel_set<double> basic_set({"sum", "diff", "mul", "sin", "tanh"});
+    std::vector<std::vector<double>> points, labels;
+    gym::generate_koza_quintic(points, labels);
+    // The reverse mode gradient is the same as the forward mode one (MSE and CE, serial and parallel)
+    for (auto loss : {"MSE", "CE"}) {
+        for (auto parallel_batches : {0u, 3u}) {
+            symbolic_regression udp_f(points, labels, 2, 10, 11, 2, basic_set(), 4u, false, parallel_batches, loss,
+                                      32u);
+            symbolic_regression udp_r(points, labels, 2, 10, 11, 2, basic_set(), 4u, false, parallel_batches, loss,
+                                      32u, "reverse");
+            pagmo::population pop(udp_f, 20u, 123u);
+            for (const auto &x : pop.get_x()) {
+                auto g_f = udp_f.gradient(x);
+                auto g_r = udp_r.gradient(x);
+                BOOST_CHECK_EQUAL(g_r.size(), 4u);
+                for (decltype(g_f.size()) i = 0u; i < g_f.size(); ++i) {
+                    BOOST_CHECK_SMALL(g_r[i] - g_f[i], 1e-10 * (1. + std::abs(g_f[i])));
+                }
+                // the loss computed as a by-product is the fitness
+                BOOST_CHECK_CLOSE(udp_r.fitness(x)[0], udp_f.fitness(x)[0], 1e-10);
+            }
+        }
+    }
+    // Over more than a block of points, the results do not depend on the parallel batches and the loss cached by
+    // the gradient is the one computed by the fitness
+    {
+        std::mt19937 re(23u);
+        std::vector<std::vector<double>> big_points(2500u, std::vector<double>(1u)), big_labels;
+        for (auto &p : big_points) {
+            p[0] = std::uniform_real_distribution<double>(-1, 1)(re);
+            big_labels.push_back({p[0] * p[0] * p[0] - p[0]});
+        }
+        symbolic_regression udp_s(big_points, big_labels, 2, 10, 11, 2, basic_set(), 4u, false, 0u, "MSE", 32u,
+                                  "reverse");
+        symbolic_regression udp_p(big_points, big_labels, 2, 10, 11, 2, basic_set(), 4u, false, 3u, "MSE", 32u,
+                                  "reverse");
+        pagmo::population pop(udp_s, 10u, 123u);
+        for (const auto &x : pop.get_x()) {
+            auto f = udp_p.fitness(x);
+            symbolic_regression udp_c(udp_p);
+            auto g_s = udp_s.gradient(x);
+            BOOST_CHECK(udp_p.gradient(x) == g_s);
+            BOOST_CHECK(udp_c.gradient(x) == g_s);
+            BOOST_CHECK(udp_c.fitness(x) == f);
+        }
+    }
+    // With a phenotype correction the forward mode is used
+    pagmo::vector_double test_xeph
+        = {1.23, 2.34, 0, 0, 2, 1, 0, 1, 1, 2, 3, 0, 3, 1, 1, 6, 0, 0, 4, 1, 2, 1, 1, 1, 9, 5, 2, 3, 3, 0, 5, 0, 8, 11};
+    kernel_set<double> div_set({"sum", "diff", "mul", "div"});
+    symbolic_regression udp_f({{1., 0.}}, {{0., 3.}}, 1, 10, 11, 2, div_set(), 2u, false, 0u, "MSE", 32u);
+    symbolic_regression udp_r({{1., 0.}}, {{0., 3.}}, 1, 10, 11, 2, div_set(), 2u, false, 0u, "MSE", 32u, "reverse");
+    BOOST_CHECK_CLOSE(udp_r.gradient(test_xeph)[0], udp_f.gradient(test_xeph)[0], 1e-10);
+    BOOST_CHECK_CLOSE(udp_r.gradient(test_xeph)[1], udp_f.gradient(test_xeph)[1], 1e-10);
+    udp_f.set_phenotype_correction(pc<double>, pc<audi::gdual_v>);
+    udp_r.set_phenotype_correction(pc<double>, pc<audi::gdual_v>);
+    BOOST_CHECK(udp_r.gradient(test_xeph) == udp_f.gradient(test_xeph));
+    // Sanity checks
+    BOOST_CHECK_THROW(symbolic_regression(points, labels, 2, 10, 11, 2, basic_set(), 4u, false, 0u, "MSE", 32u,
+                                          "backward"),
+                      std::invalid_argument);
+    kernel_set<double> user_set({"sum"});
+    user_set.push_back(
+        kernel<double>([](const std::vector<double> &x) { return x[0] * x[1] + 1.; }, print_my_sum, "user"));
+    BOOST_CHECK_THROW(
+        symbolic_regression(points, labels, 2, 10, 11, 2, user_set(), 4u, false, 0u, "MSE", 32u, "reverse"),
+        std::invalid_argument);
+    BOOST_CHECK_NO_THROW(
+        symbolic_regression(points, labels, 2, 10, 11, 2, user_set(), 4u, false, 0u, "MSE", 32u, "forward"));
+}
+
 BOOST_AUTO_TEST_CASE(hessians_test)
 {
     kernel_set<double> basic_set({"sum", "diff", "mul", "div"});
@@ -237,6 +476,283 @@ BOOST_AUTO_TEST_CASE(hessians_test)
     BOOST_CHECK(udp.hessians(test_xeph) == std::vector<pagmo::vector_double>(1, pagmo::vector_double{104, -4, 4}));
 }
 
+BOOST_AUTO_TEST_CASE(loss_gradient_hessian_test)
+{
+    kernel_set<double> basic_set({"sum", "diff", "mul", "div"});
+    // c1-c2-x, c1+2y
+    pagmo::vector_double test_xeph
+        = {1.23, 2.34, 0, 0, 2, 1, 0, 1, 1, 2, 3, 0, 3, 1, 1, 6, 0, 0, 4, 1, 2, 1, 1, 1, 9, 5, 2, 3, 3, 0, 5, 0, 8, 11};
+    symbolic_regression udp({{1., 0.}}, {{0., 3.}}, 1, 10, 11, 2, basic_set(), 2u, false);
+    auto lgh = udp.loss_gradient_hessian(test_xeph);
+    // The fused pass returns what the separate calls (on a fresh copy, so that no cached values are used) return
+    auto udp_copy = udp;
+    BOOST_CHECK_EQUAL(std::get<0>(lgh), udp_copy.fitness(test_xeph)[0]);
+    BOOST_CHECK(std::get<1>(lgh) == udp_copy.gradient(test_xeph));
+    BOOST_CHECK(std::get<2>(lgh) == pagmo::vector_double({2, -1, 1}));
+    // and the values cached by it are consistent
+    BOOST_CHECK_EQUAL(udp.fitness(test_xeph)[0], std::get<0>(lgh));
+    BOOST_CHECK(udp.gradient(test_xeph) == std::get<1>(lgh));
+    // On a larger problem
+    std::vector<std::vector<double>> points, labels;
+    gym::generate_koza_quintic(points, labels);
+    symbolic_regression udp2(points, labels, 2, 10, 11, 2, kernel_set<double>({"sum", "diff", "mul", "sin"})(), 3u);
+    pagmo::population pop(udp2, 10u);
+    for (const auto &x : pop.get_x()) {
+        auto udp_fresh = udp2;
+        auto res = udp2.loss_gradient_hessian(x);
+        BOOST_CHECK_CLOSE(std::get<0>(res), udp_fresh.fitness(x)[0], 1e-10);
+        auto g = udp_fresh.gradient(x);
+        for (decltype(g.size()) i = 0u; i < g.size(); ++i) {
+            BOOST_CHECK_CLOSE(std::get<1>(res)[i], g[i], 1e-10);
+        }
+        BOOST_CHECK(std::get<2>(res) == udp_fresh.hessians(x)[0]);
+        // A different decision vector does not use the cached values
+        auto x2 = x;
+        x2[0] += 1.;
+        BOOST_CHECK(udp2.gradient(x2) == udp_fresh.gradient(x2));
+    }
+    // A default constructed problem has no data, and all is zero
+    symbolic_regression udp_default;
+    auto res = udp_default.loss_gradient_hessian(udp_default.get_bounds().first);
+    BOOST_CHECK_EQUAL(std::get<0>(res), 0.);
+    BOOST_CHECK(std::get<1>(res).empty());
+    BOOST_CHECK(std::get<2>(res).empty());
+}
+
+BOOST_AUTO_TEST_CASE(eph_frontier_test)
+{
+    kernel_set<double> basic_set({"sum", "diff", "mul", "sin"});
+    std::vector<std::vector<double>> points, labels;
+    gym::generate_koza_quintic(points, labels);
+    for (auto parallel : {0u, 3u}) {
+        symbolic_regression udp(points, labels, 2, 10, 11, 2, basic_set(), 3u, false, parallel);
+        pagmo::population pop(udp, 10u, 32u);
+        for (auto x : pop.get_x()) {
+            // Only the ephemeral constants change: from the second call on the eph frontier is reused, and the
+            // results are the same as the ones computed from scratch by a fresh copy
+            for (auto i = 0u; i < 4u; ++i) {
+                x[0] += 0.25;
+                x[2] -= 0.5;
+                auto udp_fresh = udp;
+                auto f = udp.fitness(x)[0];
+                auto f_fresh = udp_fresh.fitness(x)[0];
+                BOOST_CHECK((std::isnan(f) && std::isnan(f_fresh)) || f == f_fresh);
+                x[1] += 0.125;
+                auto lgh = udp.loss_gradient_hessian(x);
+                auto lgh_fresh = symbolic_regression(udp).loss_gradient_hessian(x);
+                BOOST_CHECK(std::get<0>(lgh) == std::get<0>(lgh_fresh));
+                BOOST_CHECK(std::get<1>(lgh) == std::get<1>(lgh_fresh));
+                BOOST_CHECK(std::get<2>(lgh) == std::get<2>(lgh_fresh));
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(race_fitness_test)
+{
+    kernel_set<double> basic_set({"sum", "diff", "mul", "pdiv"});
+    // Enough points for the evaluation to be stopped early
+    std::vector<std::vector<double>> points, labels, labels_ce;
+    std::mt19937 r_engine(32u);
+    for (auto i = 0u; i < 5000u; ++i) {
+        auto x = std::uniform_real_distribution<double>(-1., 1.)(r_engine);
+        points.push_back({x});
+        labels.push_back({x * x * x + x + 1.});
+        labels_ce.push_back({(x > 0.) ? 1. : 0., (x > 0.) ? 0. : 1.});
+    }
+    for (auto parallel : {0u, 3u}) {
+        symbolic_regression udp(points, labels, 1, 15, 16, 2, basic_set(), 1u, false, parallel);
+        symbolic_regression udp_ce(points, labels_ce, 1, 15, 16, 2, basic_set(), 1u, false, parallel, "CE");
+        for (const auto &prob : {udp, udp_ce}) {
+            pagmo::population pop(prob, 20u, 32u);
+            unsigned aborted = 0u;
+            for (decltype(pop.size()) i = 0u; i < pop.size(); ++i) {
+                const auto &x = pop.get_x()[i];
+                auto f = pop.get_f()[i][0];
+                if (!std::isfinite(f)) {
+                    continue;
+                }
+                for (auto threshold : {0., 0.1, 1., 1e300}) {
+                    // A fresh copy, so that no cache is hit
+                    symbolic_regression racer(prob);
+                    auto f_race = racer.race_fitness(x, threshold)[0];
+                    // (the parallel sums are equal only up to round-off)
+                    if (std::abs(f_race - f) > 1e-12 * std::abs(f)) {
+                        // When stopped early, a lower bound of the loss above the threshold is returned
+                        BOOST_CHECK(f_race > threshold);
+                        BOOST_CHECK(f_race <= f || !std::isfinite(f_race));
+                        ++aborted;
+                    }
+                    // Partial losses are not cached
+                    BOOST_CHECK_CLOSE(racer.fitness(x)[0], f, 1e-10);
+                }
+            }
+            BOOST_CHECK(aborted > 0u);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(delta_fitness_test)
+{
+    kernel_set<double> basic_set({"sum", "diff", "mul", "pdiv", "sin"});
+    std::vector<std::vector<double>> points, labels;
+    std::mt19937 r_engine(32u);
+    for (auto i = 0u; i < 3000u; ++i) {
+        auto x = std::uniform_real_distribution<double>(-1., 1.)(r_engine);
+        points.push_back({x});
+        labels.push_back({x * x * x + x + 1.});
+    }
+    for (auto parallel : {0u, 3u}) {
+        symbolic_regression udp(points, labels, 1, 15, 16, 2, basic_set(), 2u, false, parallel);
+        symbolic_regression fresh(udp);
+        pagmo::population pop(udp, 1u, 32u);
+        auto parent = pop.get_x()[0];
+        expression<double> ex(1, 1, 1, 15, 16, 2, basic_set(), 2u, 32u);
+        for (auto i = 0u; i < 100u; ++i) {
+            // A mutant of the last parent, either in the genes or in the ephemeral constants
+            std::vector<unsigned> xu(parent.size() - 2u);
+            std::transform(parent.begin() + 2, parent.end(), xu.begin(),
+                           [](double a) { return static_cast<unsigned>(a); });
+            ex.set(xu);
+            auto x = parent;
+            if (i % 4u == 0u) {
+                x[1] += 0.5;
+            } else {
+                ex.mutate_active(2u);
+                std::copy(ex.get().begin(), ex.get().end(), x.begin() + 2);
+            }
+            auto f = fresh.fitness(x)[0];
+            auto f_delta = udp.race_fitness(x, std::numeric_limits<double>::infinity(), parent)[0];
+            BOOST_CHECK((std::isnan(f) && std::isnan(f_delta)) || std::abs(f_delta - f) <= 1e-12 * std::abs(f));
+            // The chain of mutants goes on from the ones not worse than their parent
+            if (f_delta <= udp.fitness(parent)[0]) {
+                parent = x;
+            }
+        }
+        // Sanity checks
+        BOOST_CHECK_THROW(udp.race_fitness(parent, 0., {1.}), std::invalid_argument);
+    }
+    // A constant changed from -0. to 0. is a mutation: here sig(2 * x0 / c1) goes from 0 to 1
+    kernel_set<double> sig_set({"sum", "diff", "mul", "div", "sig"});
+    symbolic_regression udp({{0.5}, {0.7}}, {{0.}, {0.}}, 1, 2, 3, 2, sig_set(), 1u, 0u);
+    const pagmo::vector_double x_neg{-0., 3, 0, 1, 4, 2, 2, 3};
+    const pagmo::vector_double x_pos{0., 3, 0, 1, 4, 2, 2, 3};
+    const auto inf = std::numeric_limits<double>::infinity();
+    BOOST_CHECK_EQUAL(udp.race_fitness(x_neg, inf)[0], 0.);
+    BOOST_CHECK_EQUAL(udp.race_fitness(x_pos, inf, x_neg)[0], 1.);
+    BOOST_CHECK_EQUAL(udp.race_fitness(x_neg, inf, x_pos)[0], 0.);
+}
+
+BOOST_AUTO_TEST_CASE(batch_fitness_test)
+{
+    kernel_set<double> basic_set({"sum", "diff", "mul", "pdiv", "sin"});
+    // Enough points for more than one tile
+    std::vector<std::vector<double>> points, labels;
+    std::mt19937 r_engine(32u);
+    for (auto i = 0u; i < 30000u; ++i) {
+        auto x = std::uniform_real_distribution<double>(-1., 1.)(r_engine);
+        auto y = std::uniform_real_distribution<double>(-1., 1.)(r_engine);
+        points.push_back({x, y});
+        labels.push_back({x * x * y + x + 1.});
+    }
+    for (auto multi_objective : {false, true}) {
+        symbolic_regression udp(points, labels, 1, 15, 16, 2, basic_set(), 2u, multi_objective, 0u);
+        pagmo::problem prob(udp);
+        BOOST_CHECK(prob.has_batch_fitness());
+        // Random individuals, then mutants of the first one (sharing most of its subtrees) and a repeated one
+        pagmo::population pop(udp, 10u, 32u);
+        const auto parent = pop.get_x()[0];
+        std::vector<unsigned> xu(parent.size() - 2u);
+        std::transform(parent.begin() + 2, parent.end(), xu.begin(), [](double a) { return static_cast<unsigned>(a); });
+        expression<double> ex(2, 1, 1, 15, 16, 2, basic_set(), 2u, 32u);
+        for (auto i = 0u; i < 20u; ++i) {
+            auto x = parent;
+            ex.set(xu);
+            ex.mutate_active(2u);
+            std::copy(ex.get().begin(), ex.get().end(), x.begin() + 2);
+            if (i % 5u == 0u) {
+                x[0] += 1.;
+            }
+            pop.push_back(x);
+        }
+        pop.push_back(pop.get_x()[3]);
+        pagmo::vector_double dvs;
+        for (const auto &x : pop.get_x()) {
+            dvs.insert(dvs.end(), x.begin(), x.end());
+        }
+        // A fresh copy, so that no cache is hit, and the copy in prob (through pagmo::member_bfe). Fresh copies are
+        // also evaluated with few threads (sharing the subtrees among the phenotypes) and with more threads than
+        // tiles (evaluating phenotypes and tiles in parallel).
+        std::vector<pagmo::vector_double> batches{symbolic_regression(udp).batch_fitness(dvs),
+                                                  pagmo::member_bfe{}(prob, dvs)};
+        for (auto n_threads : {2, 64}) {
+            tbb::task_arena arena(n_threads);
+            arena.execute([&]() { batches.push_back(symbolic_regression(udp).batch_fitness(dvs)); });
+        }
+        for (const auto &fvs : batches) {
+            BOOST_CHECK_EQUAL(fvs.size(), pop.size() * udp.get_nobj());
+            for (decltype(pop.size()) i = 0u; i < pop.size(); ++i) {
+                const auto &f = pop.get_f()[i];
+                for (decltype(f.size()) j = 0u; j < f.size(); ++j) {
+                    auto fb = fvs[i * f.size() + j];
+                    // (the losses are summed in the same blocks whatever the tiles)
+                    if (std::isnan(f[j])) {
+                        BOOST_CHECK(std::isnan(fb));
+                    } else {
+                        BOOST_CHECK_EQUAL(fb, f[j]);
+                    }
+                }
+            }
+        }
+        // The same holds for the parallel batches of fitness()
+        symbolic_regression udp_pb(points, labels, 1, 15, 16, 2, basic_set(), 2u, multi_objective, 3u);
+        for (decltype(pop.size()) i = 0u; i < pop.size(); ++i) {
+            const auto f = udp_pb.fitness(pop.get_x()[i]);
+            if (std::isnan(f[0])) {
+                BOOST_CHECK(std::isnan(pop.get_f()[i][0]));
+            } else {
+                BOOST_CHECK_EQUAL(f[0], pop.get_f()[i][0]);
+            }
+        }
+        BOOST_CHECK_THROW(udp.batch_fitness({1.}), std::invalid_argument);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(fp_rules_test)
+{
+    kernel_set<double> basic_set({"sum", "diff", "mul", "div"});
+    const auto inf = std::numeric_limits<double>::infinity();
+    symbolic_regression udp({{1.}, {inf}, {2.}}, {{1.}, {1.}, {1.}}, 1, 3, 4, 2, basic_set(), 0u, false, 0u);
+    BOOST_CHECK(udp.get_fp_rules() == expression<double>::fp_rules::exact);
+    // diff(x, x) and, as the parent, sum(diff(x, x), diff(x, x))
+    const pagmo::vector_double x = {1, 0, 0, 0, 1, 1, 2, 2, 0, 1};
+    const pagmo::vector_double parent = {1, 0, 0, 0, 1, 1, 2, 2, 0, 2};
+    BOOST_CHECK(std::isnan(udp.fitness(x)[0]));
+    BOOST_CHECK(std::isnan(udp.race_fitness(x, inf, parent)[0]));
+    // The fast rules use x - x = 0 in all the evaluations of the loss, and the cached losses are discarded
+    udp.set_fp_rules(expression<double>::fp_rules::fast);
+    BOOST_CHECK(udp.get_fp_rules() == expression<double>::fp_rules::fast);
+    BOOST_CHECK(udp.get_cgp().get_fp_rules() == expression<double>::fp_rules::fast);
+    BOOST_CHECK_EQUAL(udp.fitness(x)[0], 1.);
+    BOOST_CHECK_EQUAL(symbolic_regression(udp).race_fitness(x, inf, parent)[0], 1.);
+    pagmo::vector_double dvs(x);
+    dvs.insert(dvs.end(), parent.begin(), parent.end());
+    BOOST_CHECK(symbolic_regression(udp).batch_fitness(dvs) == pagmo::vector_double({1., 1.}));
+    // The rules are serialized with the problem
+    std::stringstream ss;
+    {
+        boost::archive::binary_oarchive oarchive(ss);
+        oarchive << udp;
+    }
+    symbolic_regression udp2;
+    {
+        boost::archive::binary_iarchive iarchive(ss);
+        iarchive >> udp2;
+    }
+    BOOST_CHECK(udp2.get_fp_rules() == expression<double>::fp_rules::fast);
+    BOOST_CHECK_EQUAL(udp2.fitness(x)[0], 1.);
+}
+
 BOOST_AUTO_TEST_CASE(cache_test)
 {
     // NOTE: this is not testing whether the cache is hit, but assuming it is
@@ -263,6 +779,51 @@ BOOST_AUTO_TEST_CASE(cache_test)
         BOOST_CHECK_CLOSE(f1[0], f2[0], 1e-12);
         BOOST_CHECK(g1 == g2);
     }
+    // case 3: phenotype cache hit by chromosomes differing only in inactive genes
+    {
+        symbolic_regression udp2(points, labels, 2, 10, 11, 2, basic_set(), 0u, 0u);
+        pagmo::population pop2(udp2, 1u, 32u);
+        auto x = pop2.get_x()[0];
+        auto f1 = udp2.fitness(x);
+        BOOST_CHECK(udp2.get_extra_info().find("Fitness cache hits: 0") != std::string::npos);
+        BOOST_CHECK(udp2.get_extra_info().find("Fitness cache misses: 1") != std::string::npos);
+        const auto &cgp = udp2.get_cgp();
+        const auto ub = cgp.get_ub();
+        for (auto i = 0u; i < cgp.get().size(); ++i) {
+            if (!cgp.is_active_gene(i) && ub[i] > 0u) {
+                x[i] = (x[i] == 0.) ? 1. : 0.;
+                break;
+            }
+        }
+        auto f2 = udp2.fitness(x);
+        BOOST_CHECK_EQUAL(f1[0], f2[0]);
+        BOOST_CHECK(udp2.get_extra_info().find("Fitness cache hits: 1") != std::string::npos);
+        // The phenotype correction (here of the single output) invalidates the cache
+        auto pc_1 = [](const auto &y, auto g) {
+            auto retval = g(y);
+            retval[0] = retval[0] * 2.;
+            return retval;
+        };
+        udp2.set_phenotype_correction(pc_1, pc_1);
+        udp2.fitness(x);
+        BOOST_CHECK(udp2.get_extra_info().find("Fitness cache hits: 0") != std::string::npos);
+    }
+    // case 4: constants equal but not identical (-0. and 0.) are different phenotypes, here of sig(2 * x0 / c1)
+    {
+        kernel_set<double> sig_set({"sum", "diff", "mul", "div", "sig"});
+        symbolic_regression udp3({{0.5}, {0.7}}, {{0.}, {0.}}, 1, 2, 3, 2, sig_set(), 1u, 0u);
+        const pagmo::vector_double x_pos{0., 3, 0, 1, 4, 2, 2, 3};
+        const pagmo::vector_double x_neg{-0., 3, 0, 1, 4, 2, 2, 3};
+        BOOST_CHECK_EQUAL(udp3.fitness(x_pos)[0], 1.);
+        BOOST_CHECK_EQUAL(udp3.fitness(x_neg)[0], 0.);
+        BOOST_CHECK(udp3.batch_fitness(x_pos) == pagmo::vector_double{1.});
+        BOOST_CHECK(udp3.batch_fitness(x_neg) == pagmo::vector_double{0.});
+        // nor do they share their subtrees in a batch
+        pagmo::vector_double dvs(x_pos);
+        dvs.insert(dvs.end(), x_neg.begin(), x_neg.end());
+        symbolic_regression udp4({{0.5}, {0.7}}, {{0.}, {0.}}, 1, 2, 3, 2, sig_set(), 1u, 0u);
+        BOOST_CHECK(udp4.batch_fitness(dvs) == pagmo::vector_double({1., 0.}));
+    }
 }
 
 BOOST_AUTO_TEST_CASE(s11n_test)
@@ -287,3 +848,158 @@ BOOST_AUTO_TEST_CASE(s11n_test)
 
     BOOST_CHECK(orig == udp.get_extra_info());
 }
+
+// The layout of the archives of symbolic_regression of version 0
+struct legacy_symbolic_regression {
+    template <typename Archive>
+    void serialize(Archive &ar, unsigned)
+    {
+        ar &points;
+        ar &labels;
+        ar &dpoints;
+        ar &dlabels;
+        ar &deph_symb;
+        ar &symbols;
+        ar &r;
+        ar &c;
+        ar &l;
+        ar &arity;
+        ar &f;
+        ar &n_eph;
+        ar &multi_objective;
+        ar &parallel_batches;
+        ar &loss_s;
+        ar &loss_e;
+        ar &cgp;
+        ar &dcgp;
+        ar &cache_fitness;
+    }
+    std::vector<std::vector<double>> points;
+    std::vector<std::vector<double>> labels;
+    std::vector<audi::gdual_v> dpoints;
+    std::vector<audi::gdual_v> dlabels;
+    std::vector<std::string> deph_symb;
+    std::vector<std::string> symbols;
+    unsigned r;
+    unsigned c;
+    unsigned l;
+    unsigned arity;
+    std::vector<kernel<double>> f;
+    unsigned n_eph;
+    bool multi_objective;
+    unsigned parallel_batches;
+    std::string loss_s;
+    expression<audi::gdual_v>::loss_type loss_e;
+    expression<double> cgp;
+    expression<audi::gdual_v> dcgp;
+    std::pair<pagmo::vector_double, pagmo::vector_double> cache_fitness;
+};
+
+BOOST_AUTO_TEST_CASE(s11n_legacy_test)
+{
+    kernel_set<double> basic_set({"sum", "diff", "mul", "div"});
+    std::vector<std::vector<double>> points, labels;
+    gym::generate_koza_quintic(points, labels);
+    symbolic_regression udp(points, labels, 2, 2, 3, 2, basic_set(), 2u, 0u, 0u, "MSE", 23u);
+    legacy_symbolic_regression legacy;
+    legacy.points = points;
+    legacy.labels = labels;
+    legacy.deph_symb = {"dc1", "dc2"};
+    legacy.symbols = {"x0"};
+    legacy.r = 2u;
+    legacy.c = 2u;
+    legacy.l = 3u;
+    legacy.arity = 2u;
+    legacy.f = basic_set();
+    legacy.n_eph = 2u;
+    legacy.multi_objective = false;
+    legacy.parallel_batches = 0u;
+    legacy.loss_s = "MSE";
+    legacy.loss_e = expression<audi::gdual_v>::loss_type::MSE;
+    legacy.cgp = expression<double>(1, 1, 2, 2, 3, 2, basic_set(), 2u, 23u);
+    kernel_set<audi::gdual_v> basic_set_d({"sum", "diff", "mul", "div"});
+    legacy.dcgp = expression<audi::gdual_v>(1, 1, 2, 2, 3, 2, basic_set_d(), 2u, 23u);
+    std::stringstream ss;
+    {
+        boost::archive::binary_oarchive oarchive(ss);
+        oarchive << legacy;
+    }
+    symbolic_regression loaded(points, labels, 1, 3, 4, 2, kernel_set<double>({"sum", "diff"})(), 1u, 0u, 0u, "CE",
+                               32u, "reverse");
+    {
+        boost::archive::binary_iarchive iarchive(ss);
+        iarchive >> loaded;
+    }
+    BOOST_CHECK(loaded.get_extra_info() == udp.get_extra_info());
+    BOOST_CHECK(!loaded.get_data_by_reference());
+    BOOST_CHECK(loaded.get_bounds() == udp.get_bounds());
+    pagmo::problem prob(udp);
+    pagmo::population pop(prob, 10u, 32u);
+    for (const auto &x : pop.get_x()) {
+        BOOST_CHECK(loaded.fitness(x) == udp.fitness(x));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(s11n_by_reference_test)
+{
+    kernel_set<double> basic_set({"sum", "diff", "mul", "div"});
+    std::vector<std::vector<double>> points, labels;
+    gym::generate_koza_quintic(points, labels);
+    symbolic_regression udp(points, labels, 2, 2, 3, 2, basic_set(), 5u, 0u);
+    BOOST_CHECK(!udp.get_data_by_reference());
+    udp.set_data_by_reference(true);
+    BOOST_CHECK(udp.get_data_by_reference());
+    const auto orig = udp.get_extra_info();
+    const auto hash = udp.get_data().get_hash();
+    const auto column = udp.get_data().point_column(0);
+    // Saving fails if the dataset is not registered
+    {
+        std::stringstream ss;
+        boost::archive::binary_oarchive oarchive(ss);
+        BOOST_CHECK_THROW(oarchive << udp, std::invalid_argument);
+    }
+    dataset::add_to_registry(udp.get_data());
+
+    std::stringstream ss;
+    {
+        boost::archive::binary_oarchive oarchive(ss);
+        oarchive << udp;
+    }
+    const auto archive = ss.str();
+    // The archive does not carry the data
+    std::stringstream ss_full;
+    {
+        udp.set_data_by_reference(false);
+        boost::archive::binary_oarchive oarchive(ss_full);
+        oarchive << udp;
+    }
+    BOOST_CHECK(archive.size() + points.size() * sizeof(double) < ss_full.str().size());
+    // Loading resolves the dataset against the registry and shares its data
+    udp = symbolic_regression(points, labels, 2, 2, 3, 2, kernel_set<double>({"sum", "diff"})(), 5u, 0u);
+    {
+        std::stringstream ss_in(archive);
+        boost::archive::binary_iarchive iarchive(ss_in);
+        iarchive >> udp;
+    }
+    BOOST_CHECK(orig == udp.get_extra_info());
+    BOOST_CHECK(udp.get_data_by_reference());
+    BOOST_CHECK(udp.get_data().point_column(0) == column);
+    // Loading fails if the dataset is not registered
+    dataset::remove_from_registry(hash);
+    {
+        std::stringstream ss_in(archive);
+        boost::archive::binary_iarchive iarchive(ss_in);
+        BOOST_CHECK_THROW(iarchive >> udp, std::invalid_argument);
+    }
+    // ... or if the registered one does not match the reference
+    points[3][0] += 1.;
+    dataset tampered(points, labels);
+    dataset::reference ref = tampered.get_reference();
+    ref.hash = hash;
+    BOOST_CHECK_THROW(dataset::from_registry(ref), std::invalid_argument);
+    dataset::add_to_registry(tampered);
+    ref = tampered.get_reference();
+    ref.checksum += 1u;
+    BOOST_CHECK_THROW(dataset::from_registry(ref), std::invalid_argument);
+    dataset::remove_from_registry(tampered.get_hash());
+}